@@ -0,0 +1,100 @@
+#ifndef CGIPROCESS_HPP
+# define CGIPROCESS_HPP
+
+# include <string>
+# include <vector>
+# include <stdint.h>
+# include <sys/types.h>
+
+class	Context;
+
+/// @brief Resource limits set on every script of a location, `cgi_rlimit`;
+/// 0 leaves a limit as the server's.
+struct CgiRlimits
+{
+	size_t	cpu;		// RLIMIT_CPU, seconds
+	size_t	memory;		// RLIMIT_AS, bytes
+	size_t	files;		// RLIMIT_NOFILE
+};
+
+/// @brief Counters of the CGI requests of an event loop, see `cgi_status`.
+struct CgiStats
+{
+	size_t	spawned;	// scripts and CGI workers started
+	size_t	timedOut;	// answered 504 after `cgi_timeout`
+	size_t	queued;		// waited for a `cgi_max_concurrency` slot
+	size_t	rejected;	// answered 503, the queue being full
+	size_t	running;	// holding a slot now
+	size_t	waiting;	// in a queue now
+	size_t	cacheHits;		// answered from `cgi_cache`
+	size_t	cacheMisses;	// run to fill it
+	size_t	cacheCoalesced;	// waited for a request filling it
+	size_t	cacheBytes;		// held by it now
+	size_t	cacheDiskHits;	// of `cacheHits`, answered from `cgi_cache_path`
+	size_t	cacheRevalidated;	// stale on disk, found unchanged by a conditional request
+	size_t	cacheDiskBytes;	// held by `cgi_cache_path` now, all workers
+	size_t	cacheStale;		// answered from an expired entry, see `cgi_cache_stale_*`
+	size_t	cacheRefreshes;	// background requests refreshing such an entry
+};
+
+/// @brief A CGI script run for one request, driven by the event loop.
+///
+/// The script's stdin and stdout are non-blocking pipes the `Server` polls next
+/// to its sockets: the request body is written as the pipe takes it and the
+/// output read as it comes, so a slow script only holds up its own client.
+/// The object outlives its pipes until the child is reaped, through a pidfd
+/// where there is one.
+class	CgiProcess
+{
+	public:
+		CgiProcess(int clientFd, unsigned int clientGeneration);
+		~CgiProcess();
+
+		static std::vector<std::string>	buildEnvironment(const Context& context, const std::string& scriptPath,
+											const std::string& pathInfo, size_t contentLength, uint32_t remoteAddr);
+		static std::string	requestBody(const std::string& requestData, bool chunked);
+
+		bool				start(const std::string& interpreter, const std::string& scriptPath,
+								const std::vector<std::string>& env, const std::string& body);
+		bool				startWorker(int socketFd);
+		void				setRlimits(const CgiRlimits& limits);
+		ssize_t				writeInput();
+		bool				inputDone() const;
+		int					readOutput();
+		size_t				outputAvailable() const;
+		ssize_t				spliceOutput(int socket, size_t length);
+
+		bool				reap(bool block);
+		void				kill();
+		int					openPidFd();
+
+		void				closeInput();
+		void				closeOutput();
+		void				closePidFd();
+		void				detach();
+
+		int					getClientFd() const;
+		unsigned int		getClientGeneration() const;
+		int					getStdinFd() const;
+		int					getStdoutFd() const;
+		int					getPidFd() const;
+		void				takeOutput(std::string& output);
+
+	private:
+		int					_clientFd;			// -1 once the client let go of it
+		unsigned int		_clientGeneration;
+		pid_t				_pid;				// -1 once reaped
+		int					_stdinFd;
+		int					_stdoutFd;
+		int					_pidFd;
+		std::string			_input;				// request body, written from `_inputOffset`
+		size_t				_inputOffset;
+		std::string			_output;
+		CgiRlimits			_rlimits;
+		bool				_group;				// leads a process group, killed whole
+
+		CgiProcess(const CgiProcess& other);
+		CgiProcess& operator=(const CgiProcess& other);
+};
+
+#endif
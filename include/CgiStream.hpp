@@ -0,0 +1,79 @@
+#ifndef CGISTREAM_HPP
+# define CGISTREAM_HPP
+
+# include <string>
+# include <sys/types.h>
+
+class	HttpResponse;
+class	OutputQueue;
+
+/// Longest CGI header block accepted
+# define CGI_MAX_HEADER			65536
+
+/// @brief How the body of a relayed CGI response is delimited.
+enum e_cgi_framing
+{
+	CGI_FRAME_LENGTH,	// `Content-Length` from the script
+	CGI_FRAME_CHUNKED,	// chunked, for HTTP/1.1 clients
+	CGI_FRAME_CLOSE,	// closing the connection, for HTTP/1.0 clients
+	CGI_FRAME_NONE		// no body, e.g. 204 or 304
+};
+
+/// @brief The output of a CGI script or FastCGI application, relayed to the
+/// client as it comes rather than once complete.
+///
+/// The CGI header block is parsed as it arrives (`Status:` as the status
+/// line, `Location:` alone meaning a redirect); the body then goes straight
+/// to the connection's output, framed as the script announced it or chunked.
+/// Bytes that need no framing of their own may instead be spliced by the
+/// caller straight from the script's pipe (see `beginSplice`).
+/// Plain value type so it can live in the connection table.
+class	CgiStream
+{
+	public:
+		CgiStream();
+
+		void			reset(bool chunkedAllowed, bool headRequest);
+		int				parseHeader(std::string& data, HttpResponse& response);
+		void			start(HttpResponse& response, bool& keepAlive);
+		void			relay(std::string& data, OutputQueue& output);
+		bool			finish(OutputQueue& output);
+
+		bool			canSplice() const;
+		size_t			beginSplice(size_t available, OutputQueue& output);
+		void			spliced(size_t length, OutputQueue& output);
+		void			disableSplice();
+
+		void			capture(size_t limit);
+		bool			takeCaptured(std::string& body);
+		void			captureToFile(int fd, size_t limit);
+		bool			takeCapturedFile();
+
+		bool			isStarted() const;
+		bool			isPaused() const;
+		void			setPaused(bool paused);
+
+	private:
+		std::string		_header;			// header block received so far
+		bool			_chunkedAllowed;	// the client speaks HTTP/1.1
+		bool			_headRequest;		// no body is sent
+		bool			_started;			// response header queued
+		bool			_paused;			// output not read while the client is behind
+		ssize_t			_contentLength;		// from the script, -1 if none
+		e_cgi_framing	_framing;
+		size_t			_remaining;			// body bytes still expected, CGI_FRAME_LENGTH
+		size_t			_chunkLeft;			// bytes of the open chunk not yet relayed
+		bool			_spliceable;		// false once `splice()` failed
+		bool			_capturing;			// a copy of the body is kept, see `capture`
+		size_t			_captureLimit;
+		std::string		_captured;
+		int				_captureFd;			// the body is also appended to it, -1 if not
+		size_t			_captureFileLimit;
+		size_t			_captureFileBytes;
+
+		bool			_parseHeaderBlock(const std::string& block, HttpResponse& response);
+		void			_keep(const std::string& data);
+		void			_keepInFile(const std::string& data);
+};
+
+#endif
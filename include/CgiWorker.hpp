@@ -0,0 +1,63 @@
+#ifndef CGIWORKER_HPP
+# define CGIWORKER_HPP
+
+# include <string>
+# include <vector>
+# include "CgiProcess.hpp"
+
+/// Argument the server starts its CGI workers with, `webserv-cgi --cgi-worker`
+# define CGI_WORKER_FLAG		"--cgi-worker"
+/// Name of the worker processes, their argv[0] and (on Linux) their comm
+# define CGI_WORKER_NAME		"webserv-cgi"
+/// Parameter carrying the interpreter of the script to a worker
+# define CGI_WORKER_INTERPRETER	"WEBSERV_CGI_INTERPRETER"
+/// Parameter carrying the `cgi_rlimit` of the location, "cpu memory files"
+# define CGI_WORKER_RLIMITS		"WEBSERV_CGI_RLIMITS"
+
+/// @brief A pre-forked process running CGI scripts for the `Server`, one
+/// request at a time, for locations with `cgi_workers`. Each event loop
+/// starts the workers of its pools with itself and keeps them running.
+///
+/// The worker is the server binary started again with `CGI_WORKER_FLAG` and a
+/// socketpair on its stdin, over which it takes FastCGI requests as a
+/// responder: each runs as a `CgiProcess` spawned from this small process
+/// rather than from the event loop, and its output goes back as STDOUT as
+/// it comes.
+///
+/// This is no faster than a script spawned by the server, which
+/// `posix_spawn()` does without copying its page tables: the interpreter
+/// is started for each request either way, plus a relay through the worker.
+/// A pool bounds the scripts of a location running at once, its size, and
+/// keeps their process creation and resource limits out of the event loop.
+/// Applications that stay warm are for `fastcgi_pass`.
+/// The worker exits when the server closes the socket.
+class	CgiWorker
+{
+	public:
+		CgiWorker(int socketFd);
+		~CgiWorker();
+
+		int							run();
+
+	private:
+		int							_socketFd;
+		int							_requestId;
+		std::vector<std::string>	_env;
+		std::string					_interpreter;
+		std::string					_scriptPath;
+		std::string					_body;
+		CgiRlimits					_rlimits;
+
+		bool						_readRecord(int& type, int& requestId, std::string& content);
+		bool						_readRequest();
+		void						_parseParams(const std::string& params);
+		bool						_runScript();
+		bool						_writeStdout(const std::string& data);
+		bool						_endRequest();
+		bool						_write(const std::string& data);
+
+		CgiWorker(const CgiWorker& other);
+		CgiWorker& operator=(const CgiWorker& other);
+};
+
+#endif
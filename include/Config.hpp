@@ -16,10 +16,15 @@
 # include <string>
 # include <vector>
 # include <map>
+# include <sstream>
 # include "Location.hpp"
+# include "CgiProcess.hpp"
 
 class Location;
 
+/// Default of `proxy_timeout`, ms
+# define DEFAULT_PROXY_TIMEOUT	60000
+
 struct LocationConfig 
 {
 	std::string path;
@@ -27,18 +32,51 @@ struct LocationConfig
     std::vector<std::string> allowed_methods;
 	std::string upload_dir;
     bool lsdir;
-    std::string cgi_ext;
+    std::map<std::string, std::string> cgi_ext;	// extension -> interpreter, empty to execute the script
+	std::string fastcgi_pass;	// `unix:/path` or `host:port` of a FastCGI application
+	size_t cgi_workers;			// CGI workers running the scripts, one each; 0 to spawn them from the server
+	size_t cgi_worker_requests;	// requests per worker before it is replaced, 0 for no limit
+	std::vector<std::string> cgi_params;	// `NAME=value` added to the environment of scripts
+	size_t cgi_timeout;			// ms to the CGI header, then between outputs, 0 for none
+	size_t cgi_max_concurrency;	// CGI requests running at once, 0 for no limit
+	size_t cgi_queue;			// requests waiting for one of those
+	CgiRlimits cgi_rlimits;
+	bool cgi_status;			// answer with the CGI counters of the event loop
+	size_t cgi_cache;			// ms GET responses are cached for by default, 0 for none
+	std::vector<std::string> cgi_cache_key;	// request headers added to the cache key
+	size_t cgi_cache_stale_while_revalidate;	// ms a stale response is served while refreshed
+	size_t cgi_cache_stale_if_error;	// ms a stale response is served when the CGI request fails
+	std::string proxy_pass;		// `http://host:port` requests are forwarded to
+	std::string proxy_uri;		// replaces the location path in the URI, kept as is if empty
+	size_t proxy_timeout;		// ms to the response header, then between reads, 0 for none
+	bool precompressed;			// serve `.br`/`.gz` sidecars of static files to clients accepting them
     std::string redirection;
     std::string default_file;
 };
 
+/// @brief Socket options of a `listen` directive, e.g.
+/// `listen 0.0.0.0:8080 backlog=511 deferred fastopen=256 rcvbuf=64k sndbuf=64k;`
+/// 0 leaves the system default.
+struct ListenOptions
+{
+	int		backlog;		// SOMAXCONN if 0
+	int		deferAccept;	// TCP_DEFER_ACCEPT, seconds
+	int		fastOpen;		// TCP_FASTOPEN queue length
+	int		rcvbuf;			// SO_RCVBUF
+	int		sndbuf;			// SO_SNDBUF
+	bool	noDelay;		// TCP_NODELAY on accepted sockets, `tcp_nodelay`
+};
+
 struct ServerConfig 
 {
     std::string server_name;
     std::string listen;
 	std::string host;
 	int port;
+	ListenOptions listen_options;
     size_t max_body_size;
+	size_t max_connect;		// client connections per worker, 0 for no limit
+	size_t max_header;		// bytes of request line and headers
     std::string root;
     std::string default_file;
     std::string upload_dir;
@@ -48,6 +86,28 @@ struct ServerConfig
 	std::map<std::string, Location*> map_locationObjs;
 };
 
+/// @brief One `server` of an `upstream` block, e.g.
+/// `server 10.0.0.1:8080 weight=2 max_fails=3 fail_timeout=10s;`
+struct UpstreamServerConfig
+{
+	std::string	address;		// `host:port`
+	size_t		weight;
+	size_t		maxFails;		// failures in `failTimeout` that take it out, 0 never
+	size_t		failTimeout;	// ms, also how long it is out the first time
+};
+
+/// @brief An `upstream name { ... }` block: the servers `proxy_pass http://name`
+/// spreads its requests over, how, and how they are checked.
+struct UpstreamConfig
+{
+	std::string							name;
+	std::string							balance;		// round_robin, least_conn, hash_uri, hash_ip
+	std::vector<UpstreamServerConfig>	servers;
+	size_t								healthInterval;	// ms between active checks, 0 for none
+	size_t								healthTimeout;
+	std::string							healthUri;		// GET and expect 2xx/3xx, empty to only connect
+};
+
 LocationConfig*	new_locationConfig();
 ServerConfig*	new_serverConfig();
 
@@ -72,6 +132,7 @@ class	Config
 		std::vector<ServerConfig*>			getServers() const;
 		std::map<std::string, std::string>	getMimeTypeMap() const;
 		std::map<std::string, std::string>	getConfigMap() const;
+		const std::map<std::string, UpstreamConfig>&	getUpstreams() const;
 
 		// TODO: Implement
 		void			setServer(ServerConfig* server, std::string line);
@@ -83,10 +144,15 @@ class	Config
 		~Config();
 
 		void			_parseConfigFile(const std::string& filename);
+		static void		_parseListenOption(ListenOptions& options, const std::string& option);
+		static void		_parseCgiRlimit(CgiRlimits& limits, const std::string& option);
+		static void		_parseProxyPass(LocationConfig* location, const std::string& url);
+		static void		_parseUpstream(UpstreamConfig& upstream, const std::string& key, std::istringstream& iss);
 
 		std::vector<ServerConfig*>			_servers;
 		std::map<std::string, std::string>	_mimeTypeMap;
 		std::map<std::string, std::string>	_configMap;
+		std::map<std::string, UpstreamConfig>	_upstreams;
 };
 
 #endif
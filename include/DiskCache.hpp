@@ -0,0 +1,93 @@
+#ifndef DISKCACHE_HPP
+# define DISKCACHE_HPP
+
+# include <string>
+# include <map>
+# include <sys/types.h>
+# include <stdint.h>
+# include "ResponseCache.hpp"
+
+/// @brief What `DiskCache::lookup` found.
+enum e_disk_lookup
+{
+	DISK_MISS,
+	DISK_HIT,		// fresh or within a stale window, its file opened
+	DISK_STALE		// past them, with validators to revalidate it
+};
+
+/// @brief A response found in the `DiskCache`: its status and headers, and
+/// its body as a region of the opened file, sent with `sendfile()`.
+struct DiskCacheEntry
+{
+	CachedResponse	response;		// without `body`; times in wall-clock ms
+	int				fd;				// the caller's to close, -1 if not opened
+	off_t			offset;			// of the body in the file
+	size_t			length;
+	std::string		etag;			// validators, to revalidate it
+	std::string		lastModified;
+
+	DiskCacheEntry();
+};
+
+/// @brief The disk tier of `cgi_cache`, under `cgi_cache_path`.
+///
+/// Each response is a file holding its key, status line and headers, then
+/// its body. The `index` file, mapped into memory, is a fixed-size open
+/// addressing hash table from key to file size, expiry and stale windows,
+/// validators and last use. Every event loop and worker process maps the same index, under
+/// `flock()`, and it survives restarts: the cache is warm from the first
+/// request. Changing `cgi_cache_keys` starts it over.
+///
+/// A response is written to `tmp/` as it is relayed, then renamed into place,
+/// so the index only names complete files. Over the `cgi_cache_disk_size`
+/// budget, or with every key in use, the least recently used files go.
+class	DiskCache
+{
+	public:
+		DiskCache();
+		~DiskCache();
+
+		bool				open(const std::string& path);
+		bool				isOpen() const;
+		e_disk_lookup		lookup(const std::string& key, uint64_t now, DiskCacheEntry& entry);
+		int					create(const std::string& key, const CachedResponse& response);
+		void				commit(const std::string& key, int fd, const CachedResponse& response);
+		void				discard(int fd);
+		bool				refresh(const std::string& key, const CachedResponse& response);
+
+		void				setBudget(size_t bytes);
+		void				setKeys(size_t keys);
+		size_t				getBudget() const;
+		size_t				getBytes() const;
+
+		static uint64_t		now();
+
+	private:
+		struct Header;
+		struct Slot;
+
+		std::string					_path;
+		size_t						_budget;
+		size_t						_keys;
+		int							_indexFd;
+		void*						_map;
+		size_t						_mapSize;
+		Header*						_header;
+		Slot*						_slots;
+		std::map<int, std::string>	_pending;	// temporary file of each fd from `create`
+
+		long				_find(uint64_t hash) const;
+		long				_place(uint64_t hash);
+		void				_remove(size_t slot);
+		void				_evict(size_t keep);
+		void				_rehash();
+		bool				_readHead(const std::string& key, DiskCacheEntry& entry);
+		std::string			_filePath(uint64_t hash) const;
+		void				_sweepTemporary();
+		static uint64_t		_hash(const std::string& key);
+
+		DiskCache(const DiskCache& other);
+		DiskCache& operator=(const DiskCache& other);
+};
+
+#endif
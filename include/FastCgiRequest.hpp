@@ -0,0 +1,51 @@
+#ifndef FASTCGIREQUEST_HPP
+# define FASTCGIREQUEST_HPP
+
+# include <string>
+# include <vector>
+# include <sys/types.h>
+# include "UpstreamRequest.hpp"
+
+/// Record types and flags of the FastCGI 1.0 specification
+# define FCGI_VERSION_1			1
+# define FCGI_BEGIN_REQUEST		1
+# define FCGI_END_REQUEST		3
+# define FCGI_PARAMS			4
+# define FCGI_STDIN				5
+# define FCGI_STDOUT			6
+# define FCGI_STDERR			7
+# define FCGI_RESPONDER			1
+# define FCGI_KEEP_CONN			1
+# define FCGI_REQUEST_COMPLETE	0
+# define FCGI_HEADER_LEN		8
+/// Content of one record at most; streams are sent in records of this size
+# define FCGI_MAX_CONTENT		65535
+/// A connection carries one request at a time, always with this id
+# define FCGI_SERVER_REQUEST_ID	1
+
+/// @brief A request sent to a FastCGI application for one client.
+///
+/// The request is encoded up front as FastCGI records (BEGIN_REQUEST with
+/// FCGI_KEEP_CONN, PARAMS, STDIN); the STDOUT records coming back are the
+/// CGI output.
+class	FastCgiRequest : public UpstreamRequest
+{
+	public:
+		FastCgiRequest(int clientFd, unsigned int clientGeneration, const std::string& upstream);
+		~FastCgiRequest();
+
+		static void			appendRecord(std::string& out, int type, int requestId,
+								const char* content, size_t length);
+		static void			appendStream(std::string& out, int type, int requestId, const std::string& data);
+
+		void				encode(const std::vector<std::string>& env, const std::string& body);
+		void				rewind();
+		int					receive();
+		bool				isReusable() const;
+
+	private:
+		bool				_ended;				// END_REQUEST received
+		bool				_complete;			// and FCGI_REQUEST_COMPLETE
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef FILECACHE_HPP
+# define FILECACHE_HPP
+
+# include <string>
+# include <vector>
+# include <map>
+# include <list>
+# include <ctime>
+# include <sys/types.h>
+# include "IOThreadPool.hpp"
+
+/// @brief Everything the static file handler needs to know about a path,
+/// gathered by `FileCache::load()` with blocking syscalls (`stat`, `open`,
+/// `read`, `opendir`/`readdir`).
+struct FileInfo
+{
+	enum e_kind
+	{
+		MISSING,
+		REGULAR,
+		DIRECTORY,
+		OTHER
+	};
+
+	e_kind										kind;
+	int											error;		// errno of a failed stat/open/read
+	off_t										size;
+	time_t										mtime;
+	ino_t										inode;
+	bool										hasBody;
+	std::string									body;		// regular files up to the body limit
+	bool										hasListing;
+	std::vector<std::pair<std::string, bool> >	listing;	// directory entries, `true` for directories
+
+	FileInfo();
+	bool	isFile() const;
+	bool	isDir() const;
+};
+
+/// @brief Per event loop cache of `FileInfo`, keyed by filesystem path.
+///
+/// Only the owning event loop touches it, so it takes no locks. Entries are
+/// trusted for `file_cache_valid` seconds, after which they count as a miss and
+/// are reloaded (through the I/O pool when one is configured). Bodies are kept
+/// under a `file_cache_size` byte budget with LRU eviction.
+class	FileCache
+{
+	public:
+		FileCache();
+		~FileCache();
+
+		const FileInfo*		lookup(const std::string& path, bool needListing);
+		void				insert(const std::string& path, const FileInfo& info);
+
+		void				setValidity(time_t seconds);
+		void				setBudget(size_t bytes);
+		void				setBodyLimit(size_t bytes);
+		size_t				getBodyLimit() const;
+
+		static FileInfo		load(const std::string& path, size_t bodyLimit, bool withListing);
+
+	private:
+		struct Entry
+		{
+			FileInfo							info;
+			time_t								validUntil;
+			std::list<std::string>::iterator	lru;
+		};
+
+		std::map<std::string, Entry>	_entries;
+		std::list<std::string>			_lru;		// most recently used first
+		size_t							_bytes;
+		size_t							_budget;
+		size_t							_bodyLimit;
+		time_t							_validity;
+
+		void				_evict(const std::string& keep);
+		static size_t		_footprint(const FileInfo& info);
+};
+
+/// @brief Runs `FileCache::load()` on an `IOThreadPool` thread.
+class	FileLoadJob : public IOJob
+{
+	public:
+		FileLoadJob(const std::string& path, size_t bodyLimit, bool withListing);
+		~FileLoadJob();
+
+		void				execute();
+
+		std::string			path;
+		size_t				bodyLimit;
+		bool				withListing;
+		FileInfo			result;
+};
+
+#endif
@@ -15,6 +15,7 @@
 
 # include <string>
 # include <map>
+# include <vector>
 
 # include "Config.hpp"
 # include "Util.hpp"
@@ -39,6 +40,14 @@ enum e_status {
 	STATUS_ERROR
 };
 
+/// @brief A region of a file sent as (part of) a body, see `setFileRanges`.
+struct FileRange
+{
+	off_t			offset;
+	size_t			length;
+	std::string		head;		// sent before it, e.g. a multipart part header
+};
+
 bool	isFile(const std::string path);
 bool	isDir(const std::string path);
 // std::string		generateHtmlBody(int code, const std::string& message);
@@ -55,6 +64,7 @@ class	HttpResponse
 		void					setStatusCode(int code);
 		void					setStatusCode(int code, const std::string statusMessage);
 		void					setHeader(const std::string key, const std::string value);
+		void					setConnectionHeaders(bool keepAlive);
 		void					setBody(const std::string bodyContent);
 		void					setDefaultHeaders();
 		static void				setDefaultHeaders(HttpResponse& resp);
@@ -63,9 +73,39 @@ class	HttpResponse
 		size_t					getBodyLength();
 		std::string				getResponseLine() const;
 		std::string				generateResponseToString() const;
+		std::string				generateHeaderString() const;
+		void					takeBody(std::string& body);
 		int						getStatusCode() const;
 		std::string				getStatusMessage() const;
+		const std::map<std::string, std::string>&	getHeaders() const;
 		void					initializefromFile(const Context& context, const std::string& filePath);
+		void					initializeFromContent(const std::string& content);
+
+		static HttpResponse		deferred(const Context& context, const std::string& path, bool listing);
+		bool					isDeferred() const;
+		const std::string&		getDeferredPath() const;
+		bool					isDeferredListing() const;
+
+		static HttpResponse		cgi(const Context& context, const std::string& script,
+									const std::string& interpreter, const std::string& pathInfo,
+									const std::string& pass = "");
+		bool					isCgi() const;
+		const std::string&		getCgiScript() const;
+		const std::string&		getCgiInterpreter() const;
+		const std::string&		getCgiPathInfo() const;
+		const std::string&		getCgiPass() const;
+
+		static HttpResponse		proxy(const Context& context, const std::string& pass, const std::string& uri);
+		bool					isProxy() const;
+		const std::string&		getProxyUri() const;
+
+		void					setFileBody(const std::string& path, off_t size);
+		void					setFileRanges(const std::string& path, const std::vector<FileRange>& ranges,
+									const std::string& tail);
+		bool					hasFileBody() const;
+		const std::string&		getFilePath() const;
+		const std::vector<FileRange>&	getFileRanges() const;
+		const std::string&		getFileTail() const;
 
 		static HttpResponse		createErrorResponse(int code, const Context& context);
 		static HttpResponse		badRequest_400(const Context& context);
@@ -75,8 +115,13 @@ class	HttpResponse
 		static HttpResponse		requestTimeout_408(const Context& context);
 		static HttpResponse		requestEntityTooLarge_413(const Context& context);
 		static HttpResponse		imaTeapot_418(const Context& context);
+		static HttpResponse		rangeNotSatisfiable_416(const Context& context);
+		static HttpResponse		requestHeaderFieldsTooLarge_431(const Context& context);
 		static HttpResponse		internalServerError_500(const Context& context);
 		static HttpResponse		notImplemented_501(const Context& context);
+		static HttpResponse		badGateway_502(const Context& context);
+		static HttpResponse		serviceUnavailable_503(const Context& context);
+		static HttpResponse		gatewayTimeout_504(const Context& context);
 		static HttpResponse		success_200(const Context& context);
 
 
@@ -88,6 +133,20 @@ class	HttpResponse
 		std::string							_body;
 		std::map<std::string, std::string>	_headers;
 		size_t								_bodyLength;
+		bool								_isDeferred;
+		std::string							_deferredPath;
+		bool								_deferredListing;
+		bool								_hasFileBody;		// body sent from `_filePath`
+		std::string							_filePath;
+		std::vector<FileRange>				_fileRanges;		// of `_filePath`, the whole file if empty
+		std::string							_fileTail;			// sent after them
+		bool								_isCgi;				// run `_cgiScript` to answer
+		std::string							_cgiScript;
+		std::string							_cgiInterpreter;
+		std::string							_cgiPathInfo;
+		std::string							_cgiPass;			// FastCGI application or proxied server, if not run here
+		bool								_isProxy;			// forward to `_cgiPass` over HTTP
+		std::string							_proxyUri;
 
 		std::string							_getStatusLine() const;
 		std::string							_getHeadersString() const;
@@ -96,6 +155,7 @@ class	HttpResponse
 		void								_setDefaultHeadersImpl();
 
 		static const std::map<int, std::string>&	_staticInitStatusMap();
+		static std::map<int, std::string>			_buildStatusMap();
 
 	protected:
 		Context&							_context;
@@ -0,0 +1,59 @@
+#ifndef IOTHREADPOOL_HPP
+# define IOTHREADPOOL_HPP
+
+# include <deque>
+# include <vector>
+# include <pthread.h>
+
+/// @brief A unit of blocking work run on an `IOThreadPool` thread.
+/// `execute()` must not touch state owned by the event loop; results are
+/// stored in the job itself and picked up by the loop after completion.
+class	IOJob
+{
+	public:
+		IOJob();
+		virtual ~IOJob();
+
+		virtual void	execute() = 0;
+
+		IOJob*			next;		// link in the completion stack
+};
+
+/// @brief Bounded pool of threads running blocking filesystem work for one event loop.
+///
+/// Jobs are handed over through a bounded queue (a full queue rejects the job,
+/// and the caller runs it inline). Finished jobs are pushed onto a lock-free
+/// stack, and the loop is woken through an eventfd (a pipe where eventfd does
+/// not exist) that it polls next to its sockets.
+class	IOThreadPool
+{
+	public:
+		IOThreadPool(int threadCount, size_t queueCapacity);
+		~IOThreadPool();
+
+		bool					submit(IOJob* job);
+		IOJob*					takeCompleted();
+		int						getEventFd() const;
+		void					drainEventFd();
+		size_t					pending() const;
+
+	private:
+		pthread_mutex_t			_mutex;
+		pthread_cond_t			_cond;
+		std::deque<IOJob*>		_queue;
+		size_t					_capacity;
+		bool					_stopping;
+		size_t					_inFlight;	// queued or running, touched by the loop only
+		IOJob* volatile			_completed;
+		int						_eventFds[2];
+		std::vector<pthread_t>	_threads;
+
+		IOThreadPool(const IOThreadPool& other);
+		IOThreadPool& operator=(const IOThreadPool& other);
+
+		void					_complete(IOJob* job);
+		void					_workerLoop();
+		static void*			_workerMain(void* arg);
+};
+
+#endif
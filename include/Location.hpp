@@ -15,6 +15,7 @@
 
 # include "webserv.hpp"
 # include "Server.hpp"
+# include "CgiProcess.hpp"
 
 class	Server;
 
@@ -41,7 +42,24 @@ class	Location
 		std::string							getRedirectPath() const;
 		bool								isRedirect() const;
 		std::string							getRedirectCode() const;
-		std::map<std::string, std::string>	getCgi() const;
+		const std::map<std::string, std::string>&	getCgi() const;
+		const std::string&					getFastCgiPass() const;
+		size_t								getCgiWorkers() const;
+		size_t								getCgiWorkerRequests() const;
+		const std::vector<std::string>&		getCgiEnvironment() const;
+		size_t								getCgiTimeout() const;
+		size_t								getCgiMaxConcurrency() const;
+		size_t								getCgiQueue() const;
+		const CgiRlimits&					getCgiRlimits() const;
+		bool								isCgiStatus() const;
+		size_t								getCgiCache() const;
+		const std::vector<std::string>&		getCgiCacheKey() const;
+		size_t								getCgiCacheStaleWhileRevalidate() const;
+		size_t								getCgiCacheStaleIfError() const;
+		const std::string&					getProxyPass() const;
+		const std::string&					getProxyUri() const;
+		size_t								getProxyTimeout() const;
+		bool								isPrecompressed() const;
 		// Setters
 		void								setServer(ServerConfig* server);
 		void								setPath(std::string path);
@@ -52,6 +70,7 @@ class	Location
 		void								setAllowedMethods(std::vector<std::string> allowedMethods);
 		void								setRedirect(std::string redirectPath);
 		void								setCgi(std::string cgi);
+		void								buildCgiEnvironment();
 
 	private:
 		ServerConfig*						_server;
@@ -65,6 +84,24 @@ class	Location
 		bool								_isRedirect;
 		std::string							_redirectCode;
 		std::map<std::string, std::string>	_cgi;
+		std::string							_fastCgiPass;
+		size_t								_cgiWorkers;
+		size_t								_cgiWorkerRequests;
+		std::vector<std::string>			_cgiParams;
+		std::vector<std::string>			_cgiEnvironment;	// template, see `buildCgiEnvironment`
+		size_t								_cgiTimeout;
+		size_t								_cgiMaxConcurrency;
+		size_t								_cgiQueue;
+		CgiRlimits							_cgiRlimits;
+		bool								_cgiStatus;
+		size_t								_cgiCache;
+		std::vector<std::string>			_cgiCacheKey;
+		size_t								_cgiCacheStaleWhileRevalidate;
+		size_t								_cgiCacheStaleIfError;
+		std::string							_proxyPass;
+		std::string							_proxyUri;
+		size_t								_proxyTimeout;
+		bool								_precompressed;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,41 @@
+#ifndef MASTER_HPP
+# define MASTER_HPP
+
+# include <vector>
+# include <ctime>
+# include <sys/types.h>
+
+class	Config;
+
+/// @brief Supervisor process for the multi-process worker model.
+/// The master forks `worker_processes` workers, each of them running its own
+/// `Server` with `SO_REUSEPORT` listeners, so the kernel spreads new connections
+/// over all workers. Crashed workers are restarted, and termination signals
+/// received by the master are forwarded to every worker.
+class	Master
+{
+	public:
+		Master(Config& config, int workerCount);
+		~Master();
+
+		void				run();
+
+		static int			resolveWorkerCount(const Config& config);
+
+	private:
+		Config&				_config;
+		int					_workerCount;
+		std::vector<pid_t>	_workers;
+		std::vector<time_t>	_spawnedAt;
+		int					_rapidFailures;
+
+		void				_installSignalHandlers();
+		pid_t				_spawnWorker(size_t slot);
+		void				_runWorker();
+		void				_forwardSignal(int sig);
+		void				_handleExit(pid_t pid, int status, bool shuttingDown);
+		int					_findSlot(pid_t pid) const;
+		size_t				_aliveCount() const;
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef OUTPUTQUEUE_HPP
+# define OUTPUTQUEUE_HPP
+
+# include <deque>
+# include <string>
+# include <sys/types.h>
+
+/// @brief A piece of a response: bytes held in memory, or a region of an open file.
+struct OutputSegment
+{
+	std::string	data;		// memory segment, empty for a file region
+	int			fd;			// file region, -1 for a memory segment
+	off_t		offset;		// next byte to send, in `data` or in the file
+	size_t		remaining;
+	bool		owned;		// the file is closed with the segment
+};
+
+/// @brief The output of one connection, sent without concatenating segments:
+/// runs of memory segments leave in a single `sendmsg()` (writev), files with
+/// `sendfile()`. Headers followed by a file are sent with `MSG_MORE`, so they
+/// share the first packet with the file data.
+///
+/// Plain value type so it can live in the connection table: file descriptors
+/// are only closed by `clear()` (or once fully sent), never by a destructor.
+class	OutputQueue
+{
+	public:
+		OutputQueue();
+
+		void			pushMemory(std::string& data);
+		void			pushFile(int fd, off_t offset, size_t length, bool owned = true);
+		bool			empty() const;
+		size_t			pending() const;
+		ssize_t			send(int socket);
+		void			clear();
+
+	private:
+		std::deque<OutputSegment>	_segments;
+
+		ssize_t			_sendMemory(int socket);
+		ssize_t			_sendFile(int socket);
+		void			_popFront();
+};
+
+#endif
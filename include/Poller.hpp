@@ -0,0 +1,98 @@
+#ifndef POLLER_HPP
+# define POLLER_HPP
+
+# include <string>
+# include <vector>
+# include <poll.h>
+# include <sys/socket.h>
+
+/// Interest of a client only watched for going away while its request runs:
+/// besides errors and hang-ups, the peer closing its side, where the system
+/// can tell
+# ifdef POLLRDHUP
+#  define POLL_PEER_CLOSED	POLLRDHUP
+# else
+#  define POLL_PEER_CLOSED	0
+# endif
+
+/// @brief A readiness event returned by `Poller::wait()`, with `poll()` flags.
+struct PollEvent
+{
+	int		fd;
+	short	revents;
+};
+
+/// @brief Readiness notification backend of the `Server` event loop.
+///
+/// Interest is expressed with `poll()` flags (`POLLIN`, `POLLOUT`,
+/// `POLL_PEER_CLOSED`) and is level
+/// triggered on every backend: an fd stays reported while it is ready. An fd
+/// registered with no events is only reported for errors and hang-ups (where
+/// the backend can). `remove()` must be called before the fd is closed.
+///
+/// Listening sockets are added with `addListener()` and reported readable
+/// while a connection is waiting; `accept()` then takes it, from the kernel
+/// or from the connections the backend already accepted on its own.
+///
+/// The backend is chosen by the `event_backend` directive, see `create()`.
+class	Poller
+{
+	public:
+		virtual ~Poller();
+
+		virtual const char*	name() const = 0;
+		virtual bool		add(int fd, short events) = 0;
+		virtual bool		modify(int fd, short events) = 0;
+		virtual void		remove(int fd) = 0;
+		virtual int			wait(std::vector<PollEvent>& ready, int timeoutMs) = 0;
+		virtual bool		addListener(int fd);
+		virtual int			accept(int fd, sockaddr* addr, socklen_t* addrLen);
+
+		static Poller*		create(const std::string& backend);
+};
+
+/// @brief `poll()` over a dense `pollfd` array; removal swaps the last entry in.
+class	PollPoller : public Poller
+{
+	public:
+		PollPoller();
+		~PollPoller();
+
+		const char*			name() const;
+		bool				add(int fd, short events);
+		bool				modify(int fd, short events);
+		void				remove(int fd);
+		int					wait(std::vector<PollEvent>& ready, int timeoutMs);
+
+	private:
+		std::vector<pollfd>	_pollfds;
+		std::vector<int>	_indexes;		// position in `_pollfds` by fd, -1 if absent
+};
+
+# ifdef __linux__
+#  include <sys/epoll.h>
+
+/// @brief Level-triggered `epoll`: the kernel keeps the interest list, so a
+/// wait costs nothing per idle connection.
+class	EpollPoller : public Poller
+{
+	public:
+		EpollPoller();
+		~EpollPoller();
+
+		const char*			name() const;
+		bool				add(int fd, short events);
+		bool				modify(int fd, short events);
+		void				remove(int fd);
+		int					wait(std::vector<PollEvent>& ready, int timeoutMs);
+
+	private:
+		int					_epollFd;
+		std::vector<epoll_event>	_buffer;
+
+		bool				_control(int op, int fd, short events);
+};
+
+# endif
+
+#endif
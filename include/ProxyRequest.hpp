@@ -0,0 +1,53 @@
+#ifndef PROXYREQUEST_HPP
+# define PROXYREQUEST_HPP
+
+# include <string>
+# include <stdint.h>
+# include "UpstreamRequest.hpp"
+
+class	HttpRequest;
+
+/// @brief A request forwarded to an HTTP/1.1 server for one client,
+/// `proxy_pass`.
+///
+/// The request goes out with its hop-by-hop headers replaced and its body
+/// de-chunked; the response comes back as CGI output: its status line as a
+/// `Status:` header, its end-to-end headers, then its body, decoded from
+/// whatever framing the server chose. The connection is kept for the next
+/// request unless the server says otherwise.
+class	ProxyRequest : public UpstreamRequest
+{
+	public:
+		ProxyRequest(int clientFd, unsigned int clientGeneration, const std::string& upstream);
+		~ProxyRequest();
+
+		void				encode(const HttpRequest& request, const std::string& uri,
+								const std::string& body, uint32_t clientAddr);
+		void				rewind();
+		int					receive();
+		bool				isReusable() const;
+
+	private:
+		/// @brief Where the parsing of the response is.
+		enum e_state
+		{
+			STATE_HEADER,		// status line and headers
+			STATE_LENGTH,		// body of `Content-Length` bytes
+			STATE_CHUNK_SIZE,
+			STATE_CHUNK_DATA,
+			STATE_CHUNK_END,	// CRLF after the data of a chunk
+			STATE_TRAILER,
+			STATE_CLOSE,		// body up to the end of the connection
+			STATE_DONE
+		};
+
+		bool				_headRequest;		// the response has no body
+		e_state				_state;
+		size_t				_remaining;			// of the body or of the chunk
+		bool				_keepAlive;			// the server keeps the connection
+
+		int					_parse();
+		int					_parseHeader(size_t end, size_t separator);
+};
+
+#endif
@@ -17,6 +17,8 @@ class HttpResponse;
 class HttpRequest;
 class Location;
 class Context;
+class FileCache;
+struct CgiStats;
 
 # include <algorithm>
 # include "StaticFileHandler.hpp"
@@ -30,9 +32,12 @@ class	RequestHandler
 
 		// HttpResponse		handleRequest(const HttpRequest& request);
 		HttpResponse		handleRequest(const Context& context);
+		void				setFileCache(FileCache* fileCache);
+		void				setCgiStats(const CgiStats* cgiStats);
 
 	private:
 		StaticFileHandler	_staticFileHandler;
+		const CgiStats*		_cgiStats;
 
 		HttpResponse		_processStandardMethods(const Context& context);
 	
@@ -43,5 +48,7 @@ class	RequestHandler
 
 		bool				_isCGIReqeust(const Context& context) const;
 		HttpResponse		_handleCGIRequest(const Context& context);
+		HttpResponse		_handleCgiStatus(const Context& context) const;
+		HttpResponse		_handleProxyRequest(const Context& context) const;
 };
 #endif
\ No newline at end of file
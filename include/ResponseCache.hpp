@@ -0,0 +1,78 @@
+#ifndef RESPONSECACHE_HPP
+# define RESPONSECACHE_HPP
+
+# include <string>
+# include <vector>
+# include <map>
+# include <list>
+# include <stdint.h>
+
+class	Context;
+class	HttpRequest;
+class	HttpResponse;
+
+/// @brief A response kept by the `ResponseCache`: status and headers without
+/// framing or connection headers, and the whole body.
+struct CachedResponse
+{
+	int									status;
+	std::string							message;
+	std::map<std::string, std::string>	headers;
+	std::string							body;
+	uint64_t							storedAt;	// ms, `TimerWheel::now()`
+	uint64_t							expires;		// fresh until then
+	uint64_t							staleUntil;		// served while refreshed until then
+	uint64_t							errorUntil;		// served on a failure until then
+	bool								pass;		// not cacheable: run the request
+
+	CachedResponse();
+};
+
+/// @brief Per event loop cache of dynamic responses, e.g. `cgi_cache`.
+///
+/// Like the `FileCache`, only the owning event loop touches it, so it takes
+/// no locks. Entries are kept until they expire and their stale windows
+/// close, under a `cgi_cache_size` byte budget with LRU eviction. A key found not cacheable is remembered as
+/// a pass entry for a while, so its requests run at once instead of waiting
+/// on one another to find out again.
+class	ResponseCache
+{
+	public:
+		ResponseCache();
+		~ResponseCache();
+
+		const CachedResponse*	lookup(const std::string& key, uint64_t now);
+		void					insert(const std::string& key, const CachedResponse& response);
+		void					insertPass(const std::string& key, uint64_t expires);
+
+		void					setBudget(size_t bytes);
+		void					setMaxEntry(size_t bytes);
+		size_t					getMaxEntry() const;
+		size_t					getBytes() const;
+
+		static bool				acceptsRequest(const HttpRequest& request);
+		static std::string		buildKey(const Context& context, const std::vector<std::string>& headers);
+		static std::string		normalizeUri(const std::string& uri);
+		static size_t			freshness(const HttpResponse& response, size_t defaultTtl);
+		static size_t			staleness(const HttpResponse& response, const std::string& directive,
+									size_t defaultWindow);
+
+	private:
+		struct Entry
+		{
+			CachedResponse						response;
+			std::list<std::string>::iterator	lru;
+		};
+
+		std::map<std::string, Entry>	_entries;
+		std::list<std::string>			_lru;		// most recently used first
+		size_t							_bytes;
+		size_t							_budget;
+		size_t							_maxEntry;
+
+		void					_erase(std::map<std::string, Entry>::iterator it);
+		void					_evict(const std::string& keep);
+		static size_t			_footprint(const std::string& key, const CachedResponse& response);
+};
+
+#endif
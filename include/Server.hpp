@@ -15,17 +15,33 @@
 
 // # include "webserv.hpp"
 # include <vector>
+# include <deque>
 # include "Config.hpp"
 # include "Location.hpp"
 # include "RequestHandler.hpp"
 # include "HttpRequest.hpp"
 # include "HttpResponse.hpp"
+# include "FileCache.hpp"
+# include "IOThreadPool.hpp"
+# include "TimerWheel.hpp"
+# include "OutputQueue.hpp"
+# include "Poller.hpp"
+# include "CgiProcess.hpp"
+# include "FastCgiRequest.hpp"
+# include "ProxyRequest.hpp"
+# include "CgiStream.hpp"
+# include "ResponseCache.hpp"
+# include "DiskCache.hpp"
+# include "Upstream.hpp"
+# include "UpstreamGroup.hpp"
 
 class	Config;
 class	Location;
+class	Context;
 // class	RequestHandler;
 
 struct	ServerConfig;
+struct	ListenOptions;
 
 struct ListenInfo
 {
@@ -33,6 +49,128 @@ struct ListenInfo
 	std::string	host;
 	int			port;
 	int			fd;
+	size_t		clients;	// open client connections accepted here
+};
+
+/// @brief What an fd in the connection table is used for.
+enum e_fd_type
+{
+	FD_FREE,
+	FD_LISTENER,
+	FD_CLIENT,
+	FD_INTERNAL,	// wakeup pipe, I/O pool eventfd
+	FD_CGI,			// pipe or pidfd of a CGI script
+	FD_UPSTREAM,	// connection to a FastCGI application or proxied server, busy or pooled
+	FD_HEALTH,		// active health check of a server of an `upstream` block
+	FD_SINK			// discards the response to a background `cgi_cache` refresh
+};
+
+/// @brief Where a client connection is in its request/response cycle.
+enum e_conn_phase
+{
+	PHASE_HEADER,	// reading the request line and headers
+	PHASE_BODY,		// reading the request body
+	PHASE_PARKED,	// waiting for a file load or a CGI slot
+	PHASE_CGI,		// waiting for a CGI script or FastCGI application
+	PHASE_SENDING,	// writing the response, or relaying CGI output
+	PHASE_IDLE		// kept alive, waiting for the next request
+};
+
+/// @brief A connection waiting on some asynchronous work.
+struct ConnectionRef
+{
+	int				fd;
+	unsigned int	generation;
+};
+
+/// @brief The CGI requests of a location running against its
+/// `cgi_max_concurrency`, and those waiting for a slot, parked.
+struct CgiLimit
+{
+	size_t						maxRunning;		// 0 for no limit
+	size_t						maxWaiting;
+	size_t						timeout;		// `cgi_timeout`, 0 for none
+	size_t						running;
+	std::deque<ConnectionRef>	waiting;
+};
+
+/// @brief One slot of the connection table, indexed by fd.
+/// `generation` changes every time the fd is reused, so an event or a
+/// completion carrying an older generation is known to be stale.
+struct Connection
+{
+	e_fd_type		type;
+	unsigned int	generation;
+	size_t			listenIndex;	// in `_listenInfos`, for listeners and clients
+	ServerConfig*	serverConfig;
+	uint32_t		clientAddr;		// IPv4 address of the peer, network byte order
+	e_conn_phase	phase;
+	std::string		inBuffer;		// bytes read and not yet handled
+	size_t			requestLength;	// of the request at the front of `inBuffer`, 0 until known
+	size_t			chunkOffset;	// next chunk-size line of its chunked body, 0 if not chunked
+	size_t			chunkedBody;	// chunk data framed so far
+	std::string		parkedRequest;	// request waiting for a file load
+	OutputQueue		output;
+	bool			keepAlive;
+	CgiProcess*		cgi;			// script run for the client, or whose pipe this is
+	UpstreamRequest*	upstream;	// FastCGI or proxied request of the client, or over this connection
+	CgiLimit*		cgiLimit;		// of the CGI request holding or waiting for a slot
+	CgiStream		stream;			// output of the CGI request, relayed as it comes
+	std::string		cacheKey;		// of the `cgi_cache` entry the CGI request fills
+	bool			background;		// refreshes a stale entry, see `_openRefresh`
+};
+
+/// @brief A readiness event, tagged with the generation of its fd when it was
+/// returned by the poller, so handlers can close and reuse fds safely.
+struct ReadyEvent
+{
+	int				fd;
+	unsigned int	generation;
+	short			revents;
+};
+
+/// @brief The `cgi_workers` of a location, and the requests waiting for one.
+struct CgiWorkerPool
+{
+	size_t						size;
+	size_t						maxRequests;	// per worker, 0 for no limit
+	size_t						running;
+	std::deque<UpstreamRequest*>	waiting;
+};
+
+/// @brief A `cgi_cache` miss being run, and the requests for the same key
+/// waiting for its response, parked.
+struct CacheFill
+{
+	size_t						ttl;		// `cgi_cache` of the location
+	size_t						staleWhileRevalidate;	// its stale windows, ms
+	size_t						staleIfError;
+	CachedResponse				response;	// status and headers, once known
+	std::vector<ConnectionRef>	waiting;
+	int							diskFd;		// file of the `DiskCache` being written, -1 if none
+	bool						revalidate;	// a stale disk entry, asked for conditionally
+	std::string					etag;		// its validators
+	std::string					lastModified;
+	bool						failed;		// the request failed: waiters get the stale entry
+};
+
+/// @brief An active health check in flight, by the fd of its connection.
+struct HealthProbe
+{
+	UpstreamGroup*	group;
+	size_t			peer;
+	bool			connecting;
+	std::string		request;	// empty to only connect
+	size_t			offset;
+	std::string		response;	// received so far, up to the status line
+};
+
+/// @brief A worker process, by the fd of its socket.
+struct CgiWorkerProcess
+{
+	CgiProcess*		process;
+	std::string		pool;
+	size_t			requests;
 };
 
 class	Server
@@ -45,21 +183,165 @@ class	Server
 		void						stop();
 
 		bool						isRunning() const;
+		void						setReusePort(bool reusePort);
+		int							getWakeupFd() const;
+		void						wakeup();
 
 	private:
 		bool						_running;
+		bool						_reusePort;
+		int							_wakeFds[2];
+		int							_reserveFd;
+		int							_acceptBudget;
 		std::vector<ListenInfo>		_listenInfos;
-		std::map<int, ListenInfo> 	_clients;
-		std::vector<pollfd>			_pollfds;
+		std::vector<Connection>		_connections;
+		Poller*						_poller;
+		std::vector<PollEvent>		_events;
+		std::vector<ReadyEvent>		_ready;
 		RequestHandler				_requestHandler;
+		FileCache					_fileCache;
+		IOThreadPool*				_ioPool;
+		TimerWheel					_timers;		// one per client fd
+		unsigned int				_headerTimeout;
+		unsigned int				_bodyTimeout;
+		unsigned int				_keepaliveTimeout;
+		unsigned int				_sendTimeout;
+
+		// Admission control, see `_setupLimits`
+		size_t						_clientCount;
+		size_t						_maxConnections;
+		size_t						_maxConnectionsPerIp;
+		std::map<uint32_t, size_t>	_clientsPerIp;
+		unsigned int				_shedLoopLag;
+		size_t						_shedQueueDepth;
+		unsigned int				_retryAfter;
+		uint64_t					_loopLag;		// ms spent on the last batch of events
+		std::map<ServerConfig*, std::string>	_overloadResponses;
 
-		int							_setupListeningSocket(const std::string host, int port);
+		// Connections waiting per file load
+		std::map<std::pair<std::string, bool>, std::vector<ConnectionRef> >	_pendingLoads;
+		// Exited CGI scripts to reap, where there is no pidfd to wait on
+		std::vector<CgiProcess*>	_cgiOrphans;
+		// FastCGI applications by `fastcgi_pass` and HTTP servers by
+		// `proxy_pass`, and their idle connections
+		std::map<std::string, UpstreamAddress>		_upstreams;
+		// `upstream` blocks by `http://name`, and their health checks
+		std::map<std::string, UpstreamGroup>		_upstreamGroups;
+		std::map<int, HealthProbe>					_healthProbes;
+		uint64_t									_nextHealthCheck;	// ms, 0 if none
+		std::map<std::string, std::vector<int> >	_upstreamIdle;
+		size_t						_fastcgiKeepalive;
+		size_t						_proxyKeepalive;
+		// Pre-forked CGI workers: pools by name, processes by socket
+		std::map<std::string, CgiWorkerPool>	_cgiWorkerPools;
+		std::map<int, CgiWorkerProcess>			_cgiWorkers;
+		// CGI concurrency per location, by listen address and path
+		std::map<std::string, CgiLimit>			_cgiLimits;
+		CgiStats					_cgiStats;
+		// Cached CGI responses, and the misses being run by key
+		ResponseCache				_cgiCache;
+		DiskCache					_diskCache;		// shared, under `cgi_cache_path`
+		std::map<std::string, CacheFill>		_cacheFills;
+
+		int							_setupListeningSocket(const std::string host, int port, const ListenOptions& options);
+		void						_applyListenOptions(int listenfd, const ListenOptions& options);
 
 		ServerConfig&				_fetchConfig(int target);
 		int							_setupListenInfos();
 		int							_setupListenSockets();
+		void						_dispatchEvent(const ReadyEvent& event);
 		int							_acceptNewConnection(int target);
-		int							_handleClientData(int target, size_t i);
+		void						_shedWithReserveFd(int target);
+		int							_handleClientData(int target);
+		void						_parseBufferedRequest(int target);
+		size_t						_measureRequest(int target, int& status);
+		size_t						_measureChunks(Connection& conn, size_t maxBody, size_t maxTrailer, int& status);
+		int							_processRequest(int target, std::string requestData, int attempt);
+		void						_sendResponse(int target, HttpResponse& response, bool keepAlive);
+		void						_queueResponse(int target, HttpResponse& response, int fileFd,
+										off_t offset, bool keepAlive);
+		void						_respondWithError(int target, int code);
+		void						_flushOutput(int target);
+		void						_handleTimeout(int target);
+		int							_deferRequest(int target, const std::string& requestData,
+										const HttpResponse& response, int attempt);
+		void						_handleIOCompletions();
+		void						_setupFileCache();
+		void						_setupIOPool();
+		void						_setupTimeouts();
+		void						_setupLimits();
+		void						_setupCgiCache();
+
+		bool						_admitConnection(size_t listenIndex, uint32_t clientAddr) const;
+		bool						_isOverloaded() const;
+		const std::string&			_overloadResponse(ServerConfig* serverConfig);
+		void						_shedRequest(int target);
+
+		void						_startCgi(int target, const Context& context, const HttpResponse& response,
+										const std::string& requestData, bool keepAlive);
+		void						_handleCgiEvent(int fd);
+		void						_relayCgiOutput(int target, std::string& data, int status);
+		bool						_spliceCgiOutput(CgiProcess* cgi);
+		bool						_startCgiResponse(int target, std::string& data, int status);
+		void						_endCgi(int target, bool abort);
+		void						_failCgi(int target);
+		void						_pauseCgiOutput(int target, bool pause);
+		void						_releaseCgi(int target, bool abort);
+		void						_reapCgi(CgiProcess* cgi);
+		void						_reapCgiOrphans();
+		bool						_admitCgi(int target, const Context& context, const std::string& requestData);
+		void						_leaveCgiLimit(int target);
+		void						_timeoutCgi(int target);
+		void						_stopCgi();
+		bool						_serveCgiCache(int target, const Context& context,
+										const std::string& requestData, bool keepAlive);
+		void						_sendCachedResponse(int target, const Context& context,
+										const CachedResponse& cached, bool keepAlive, bool stale);
+		void						_sendDiskCached(int target, const Context& context,
+										DiskCacheEntry& entry, bool keepAlive, bool stale);
+		int							_openRefresh(int target, const std::string& key);
+		void						_drainRefresh(int fd);
+		bool						_findStaleOnError(const std::string& key, CachedResponse& cached,
+										DiskCacheEntry& entry);
+		void						_sendStaleOnError(int target, const CachedResponse& cached,
+										DiskCacheEntry& entry, bool keepAlive);
+		bool						_failCacheFill(int target, CachedResponse& cached, DiskCacheEntry& entry);
+		void						_addCacheValidators(int target, HttpRequest& request);
+		bool						_keepCgiResponse(int target, const Context& context,
+										HttpResponse& response, int status);
+		bool						_revalidateCgiCache(int target, const Context& context,
+										HttpResponse& response, int status);
+		void						_endCacheFill(int target, bool complete);
+		void						_dropCacheFills();
+		void						_startFastCgi(int target, const Context& context, const HttpResponse& response,
+										const std::string& requestData, bool keepAlive);
+		bool						_connectUpstream(UpstreamRequest* request);
+		void						_handleUpstreamEvent(int fd, short revents);
+		void						_retryUpstream(UpstreamRequest* request);
+		void						_releaseUpstream(int target, bool abort);
+		bool						_keepUpstreamConnection(int fd, const std::string& name);
+		void						_closeUpstreamConnection(int fd);
+		std::string					_cgiWorkerPool(const ServerConfig& server, const Location& location);
+		void						_setupCgiWorkers();
+		bool						_spawnCgiWorker(const std::string& name, UpstreamRequest* request);
+		void						_startProxy(int target, const Context& context, const HttpResponse& response,
+										const std::string& requestData, bool keepAlive);
+		const UpstreamAddress*		_resolveUpstream(const std::string& name) const;
+		void						_setupUpstreamGroups();
+		void						_setupUpstreams();
+		bool						_connectPeer(UpstreamRequest* request, int avoid);
+		void						_failPeer(UpstreamRequest* request);
+		void						_runHealthChecks();
+		void						_startHealthProbe(UpstreamGroup& group, size_t peer);
+		void						_handleHealthEvent(int fd, short revents);
+		void						_endHealthProbe(int fd, bool healthy);
+
+		Connection&					_registerFd(int fd, e_fd_type type, short events);
+		void						_unregisterFd(int fd);
+		bool						_isCurrent(int fd, unsigned int generation) const;
+		void						_setPollEvents(int fd, short events);
+		void						_closeClient(int fd);
+		void						_drainWakeup();
 
 		Config&						_config;
 		std::vector<ServerConfig*>	_serverConfigs;
@@ -17,10 +17,15 @@
 # include <sys/stat.h>
 # include <dirent.h>
 # include <map>
+# include <ctime>
+# include <vector>
 class HttpResponse;
 class HttpRequest;
 class Location;
 class Context;
+class FileCache;
+struct FileInfo;
+struct FileRange;
 
 # define LOCATION_PATH	"./www/static"
 # define INDEX_HTML		"index.html"
@@ -38,12 +43,14 @@ class	StaticFileHandler
 		HttpResponse	handlepost(const Context& context);
 
 
-		std::string		getFullPath() const;
 		std::string		resolveMimeType(const std::string path) const;
+		void			setFileCache(FileCache* fileCache);
 
 	private:
-		std::string							_handledPath;
+		// Read-only once constructed: the resolved path of a request is passed
+		// along explicitly, so a handler never carries per-request state.
 		std::map<std::string, std::string>	_mimeTypes;
+		FileCache*							_fileCache;	// owned by the event loop
 
 
 		void			_initMimeTypes();
@@ -55,24 +62,32 @@ class	StaticFileHandler
 		bool			_hasTargetHeader(const std::string& target, const std::map<std::string, std::string>& headers) const;
 
 
-		HttpResponse	_handleDirListing(const Context& context);
-		HttpResponse	_handleDirRequest(const Context& context);
-		HttpResponse	_handleFileRequest(const Context& context);
+		const FileInfo*	_lookup(const std::string& path, bool listing) const;
 
+		HttpResponse	_handleGet(const Context& context);
+		HttpResponse	_handleDirListing(const Context& context, const std::string& path, const FileInfo& info);
+		HttpResponse	_handleDirRequest(const Context& context, const std::string& path);
+		HttpResponse	_handleFileRequest(const Context& context, const std::string& path, const FileInfo& info);
 
-		HttpResponse	_createResponseForFile(const Context& context) const;
 
-		HttpResponse	_createDirListingResponse(const Context& context) const;
-		std::string		_genDirListingHtml(const std::string& path) const;
-		std::string		_genListing(const std::string& path) const;
+		HttpResponse	_createResponseForFile(const Context& context, const std::string& path, const FileInfo& info) const;
+		bool			_isNotModified(const Context& context, const std::string& etag, time_t mtime) const;
+		int				_selectRanges(const Context& context, const FileInfo& info, const std::string& etag,
+							std::vector<FileRange>& ranges) const;
+		HttpResponse	_createRangeResponse(const Context& context, const std::string& path, const std::string& type,
+							const FileInfo& info, std::vector<FileRange>& ranges) const;
+		bool			_selectSidecar(const Context& context, const std::string& path, const FileInfo& info,
+							std::string& variantPath, const FileInfo*& variant, std::string& encoding) const;
+
+		HttpResponse	_createDirListingResponse(const Context& context, const std::string& path, const FileInfo& info) const;
+		std::string		_genDirListingHtml(const std::string& path, const FileInfo& info) const;
+		std::string		_genListing(const FileInfo& info) const;
 		HttpResponse	_handleRoot(const Context& context);
 		HttpResponse	_handleNotFound(const Context& context);
 
 		std::string		_buildPathWithUri(const Context& context) const;
 		std::string		_buildAbsolutePathWithRoot(const Context& context) const;
-		std::string		_buildAbsolutePathWithIndex(const Context& context) const;
-
-		void			_setHandledPath(const std::string& fullPath);
+		std::string		_buildAbsolutePathWithIndex(const Context& context, const std::string& dirPath) const;
 };
 
 #endif
@@ -0,0 +1,36 @@
+#ifndef THREADGROUP_HPP
+# define THREADGROUP_HPP
+
+# include <vector>
+# include <pthread.h>
+
+class	Config;
+class	Server;
+
+# define MAX_WORKER_THREADS	256
+
+/// @brief Threaded alternative to the forked workers: one event loop per thread.
+/// Each thread runs its own `Server`, which owns its listeners (`SO_REUSEPORT`),
+/// connections, request handlers and caches. Nothing on the request path is
+/// shared between threads, so no locks are taken while serving.
+class	ThreadGroup
+{
+	public:
+		ThreadGroup(Config& config, int threadCount);
+		~ThreadGroup();
+
+		void					run();
+
+		static int				resolveThreadCount(const Config& config);
+
+	private:
+		Config&					_config;
+		int						_threadCount;
+		std::vector<Server*>	_servers;
+		std::vector<pthread_t>	_threads;
+
+		void					_installSignalHandlers();
+		static void*			_threadMain(void* arg);
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef TIMERWHEEL_HPP
+# define TIMERWHEEL_HPP
+
+# include <vector>
+# include <cstddef>
+# include <stdint.h>
+
+/// Resolution and size of the wheel: one revolution covers 51.2 seconds,
+/// longer timeouts wait for extra revolutions
+# define TIMER_WHEEL_TICK_MS	100
+# define TIMER_WHEEL_SLOTS		512
+
+/// @brief Hashed timing wheel holding at most one timer per id (an fd).
+///
+/// A timer lives in the slot it expires in, linked through per-id nodes, so
+/// arming, re-arming and cancelling are O(1), and each tick only looks at one
+/// slot. Timers that are more than one revolution away carry a round count.
+class	TimerWheel
+{
+	public:
+		TimerWheel(unsigned int tickMs = TIMER_WHEEL_TICK_MS, size_t slots = TIMER_WHEEL_SLOTS);
+		~TimerWheel();
+
+		void				arm(int id, unsigned int timeoutMs);
+		void				cancel(int id);
+		bool				isArmed(int id) const;
+
+		int					pollTimeout() const;
+		void				expire(std::vector<int>& expired);
+
+		static uint64_t		now();
+
+	private:
+		struct Node
+		{
+			int				prev;
+			int				next;
+			int				slot;		// -1 when not armed
+			unsigned int	rounds;
+		};
+
+		std::vector<Node>	_nodes;		// indexed by id
+		std::vector<int>	_heads;		// first id of each slot, -1 if empty
+		size_t				_current;
+		uint64_t			_lastTick;
+		unsigned int		_tickMs;
+		size_t				_armed;
+
+		void				_link(int id, size_t slot);
+		void				_unlink(int id);
+};
+
+#endif
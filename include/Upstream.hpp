@@ -0,0 +1,20 @@
+#ifndef UPSTREAM_HPP
+# define UPSTREAM_HPP
+
+# include <string>
+# include <sys/socket.h>
+
+/// @brief Address of a backend the server connects to, from its name in the
+/// configuration: `unix:/path/to/socket` or `host:port`.
+struct UpstreamAddress
+{
+	std::string				name;
+	struct sockaddr_storage	addr;
+	socklen_t				length;
+};
+
+bool	resolveUpstream(const std::string& name, UpstreamAddress& address);
+int		connectUpstream(const UpstreamAddress& address);
+bool	finishConnect(int fd);
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef UPSTREAMGROUP_HPP
+# define UPSTREAMGROUP_HPP
+
+# include <string>
+# include <vector>
+# include <stdint.h>
+
+struct	UpstreamConfig;
+
+/// @brief How an `upstream` block picks the server of a request.
+enum e_balance
+{
+	BALANCE_ROUND_ROBIN,	// smooth weighted round-robin
+	BALANCE_LEAST_CONN,		// fewest outstanding requests per weight
+	BALANCE_HASH_URI,		// consistent hashing on the request URI
+	BALANCE_HASH_IP			// consistent hashing on the client address
+};
+
+/// @brief The servers of an `upstream` block, as one event loop sees them:
+/// which one the next request goes to, how many requests each has
+/// outstanding, and which are out of rotation.
+///
+/// A server is out while its last active health check failed, and for a
+/// while after `max_fails` failures within `fail_timeout` (passive
+/// detection). That while starts at `fail_timeout` and doubles each time the
+/// server fails again right after coming back, up to `UPSTREAM_MAX_BACKOFF`;
+/// a success resets it. When every server is out, the one due back first is
+/// tried anyway rather than failing the request outright.
+class	UpstreamGroup
+{
+	public:
+		UpstreamGroup();
+		explicit UpstreamGroup(const UpstreamConfig& config);
+		~UpstreamGroup();
+
+		std::string			balanceKey(const std::string& uri, uint32_t clientAddr) const;
+		int					select(const std::string& key, uint64_t now, int avoid);
+		void				release(size_t peer);
+		void				succeed(size_t peer);
+		void				fail(size_t peer, uint64_t now);
+		bool				setHealthy(size_t peer, bool healthy);
+		bool				isHealthCheckDue(uint64_t now);
+
+		size_t				size() const;
+		const std::string&	getName() const;
+		const std::string&	getPool(size_t peer) const;
+		uint64_t			getNextHealthCheck() const;
+		size_t				getHealthInterval() const;
+		size_t				getHealthTimeout() const;
+		const std::string&	getHealthUri() const;
+
+	private:
+		struct Peer
+		{
+			std::string		pool;			// `http://host:port`, its connection pool
+			size_t			weight;
+			size_t			maxFails;
+			size_t			failTimeout;
+			long			currentWeight;	// smooth round-robin state
+			size_t			active;			// requests outstanding
+			size_t			fails;			// recent failures
+			uint64_t		lastFail;
+			uint64_t		downUntil;		// out of rotation until then, ms
+			size_t			backoff;		// how long it was last taken out, 0 if not
+			bool			healthy;		// last active health check passed
+		};
+
+		std::string							_name;
+		e_balance							_balance;
+		std::vector<Peer>					_peers;
+		std::vector<std::pair<uint32_t, size_t> >	_ring;	// hash points of the peers, sorted
+		size_t								_next;			// where least_conn ties start
+		size_t								_healthInterval;
+		size_t								_healthTimeout;
+		std::string							_healthUri;
+		uint64_t							_nextHealthCheck;
+
+		bool				_isAvailable(size_t peer, uint64_t now, int avoid) const;
+		int					_selectRoundRobin(uint64_t now, int avoid);
+		int					_selectLeastConn(uint64_t now, int avoid);
+		int					_selectHash(const std::string& key, uint64_t now, int avoid) const;
+		int					_selectAnyway(int avoid) const;
+		static uint32_t		_hash(const std::string& value);
+};
+
+#endif
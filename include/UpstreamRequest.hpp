@@ -0,0 +1,67 @@
+#ifndef UPSTREAMREQUEST_HPP
+# define UPSTREAMREQUEST_HPP
+
+# include <string>
+# include <sys/types.h>
+
+class	UpstreamGroup;
+
+/// @brief A request sent to a backend for one client, driven by the event
+/// loop: to a FastCGI application (`FastCgiRequest`) or to a proxied HTTP
+/// server (`ProxyRequest`).
+///
+/// The request is encoded up front and written to a socket the `Server` owns
+/// and pools per upstream; what comes back is turned into CGI output (a CGI
+/// header block, then the body), relayed to the client as it comes.
+/// A connection carries one request at a time.
+class	UpstreamRequest
+{
+	public:
+		UpstreamRequest(int clientFd, unsigned int clientGeneration, const std::string& upstream);
+		virtual ~UpstreamRequest();
+
+		void				attach(int socketFd, bool reused);
+		void				detach();
+		virtual void		rewind();
+
+		void				balance(UpstreamGroup* group, const std::string& key);
+		void				setPeer(int peer);
+
+		int					send();
+		bool				hasStarted() const;
+		bool				isSent() const;
+		virtual int			receive() = 0;
+		bool				canRetry() const;
+		virtual bool		isReusable() const = 0;
+
+		int					getClientFd() const;
+		unsigned int		getClientGeneration() const;
+		const std::string&	getUpstream() const;
+		int					getSocketFd() const;
+		UpstreamGroup*		getGroup() const;
+		const std::string&	getBalanceKey() const;
+		int					getPeer() const;
+		void				takeOutput(std::string& output);
+
+	protected:
+		int					_clientFd;
+		unsigned int		_clientGeneration;
+		std::string			_upstream;			// name of its connection pool
+		int					_socketFd;			// -1 until attached
+		bool				_reused;			// taken from the pool, may be stale
+		bool				_connecting;
+		std::string			_request;			// whole request, written from `_requestOffset`
+		size_t				_requestOffset;
+		std::string			_input;				// received, not yet parsed
+		size_t				_received;
+		std::string			_output;			// CGI output, until taken
+		UpstreamGroup*		_group;				// balanced over, NULL for a single server
+		std::string			_balanceKey;
+		int					_peer;				// server of `_group` it went to, -1 if none
+
+	private:
+		UpstreamRequest(const UpstreamRequest& other);
+		UpstreamRequest& operator=(const UpstreamRequest& other);
+};
+
+#endif
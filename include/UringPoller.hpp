@@ -0,0 +1,94 @@
+#ifndef URINGPOLLER_HPP
+# define URINGPOLLER_HPP
+
+# include "Poller.hpp"
+
+# ifdef __linux__
+#  include <stdint.h>
+#  include <map>
+#  include <deque>
+#  include <linux/io_uring.h>
+
+/// @brief `io_uring` backend, driven through raw syscalls (no liburing).
+///
+/// Readiness is requested with one-shot `IORING_OP_POLL_ADD`s, re-armed for
+/// every fd still interested after its event was handled. Re-arms, interest
+/// changes and the wait itself are batched into a single `io_uring_enter()`
+/// per loop iteration, so the poll set costs no syscalls of its own. An fd
+/// with no events is still polled, for errors and hang-ups.
+///
+/// One-shot polls keep the level-triggered contract of `Poller`: a fast-path
+/// multishot poll only fires on new wakeups, and would lose the data and
+/// connections a handler leaves for the next iteration.
+///
+/// Listeners instead carry a multishot `IORING_OP_ACCEPT` (Linux 5.19): the
+/// kernel accepts connections as they come, and `accept()` hands them out
+/// from a queue without a syscall. The queue holding what was not taken yet,
+/// nothing is lost. On older kernels listeners fall back to polls.
+///
+/// The constructor throws when the kernel lacks `io_uring` or refuses it (e.g.
+/// seccomp, `kernel.io_uring_disabled`); `Poller::create()` then falls back.
+class	UringPoller : public Poller
+{
+	public:
+		UringPoller();
+		~UringPoller();
+
+		const char*			name() const;
+		bool				add(int fd, short events);
+		bool				modify(int fd, short events);
+		void				remove(int fd);
+		int					wait(std::vector<PollEvent>& ready, int timeoutMs);
+		bool				addListener(int fd);
+		int					accept(int fd, sockaddr* addr, socklen_t* addrLen);
+
+	private:
+		struct FdState
+		{
+			bool			registered;
+			bool			armed;		// a POLL_ADD or ACCEPT is in flight
+			bool			queued;		// listed in `_rearm`
+			bool			listener;	// added with `addListener()`
+			bool			accepting;	// what is in flight is a multishot ACCEPT
+			short			events;
+			uint32_t		token;		// changes whenever the request in flight is dropped
+		};
+
+		int					_ringFd;
+		void*				_sqRing;
+		size_t				_sqRingSize;
+		void*				_cqRing;
+		size_t				_cqRingSize;
+		io_uring_sqe*		_sqes;
+		size_t				_sqesSize;
+
+		unsigned*			_sqHead;
+		unsigned*			_sqTail;
+		unsigned*			_sqMask;
+		unsigned*			_sqArray;
+		unsigned			_sqEntries;
+		unsigned*			_cqHead;
+		unsigned*			_cqTail;
+		unsigned*			_cqMask;
+		io_uring_cqe*		_cqes;
+		unsigned			_pending;	// SQEs queued and not yet submitted
+
+		std::vector<FdState>	_fds;
+		std::vector<int>		_rearm;	// fds that may need a new POLL_ADD
+		// Connections accepted by listener, or a negative errno to report
+		std::map<int, std::deque<int> >	_accepted;
+		bool					_multishotAccept;	// cleared if the kernel refuses it
+
+		FdState&			_state(int fd);
+		bool				_armAccept(int fd);
+		void				_completeAccept(const io_uring_cqe& cqe);
+		void				_queueArm(int fd);
+		void				_cancel(int fd);
+		bool				_pushSqe(const io_uring_sqe& sqe);
+		int					_enter(unsigned toSubmit, unsigned minComplete, int timeoutMs);
+		void				_unmap();
+};
+
+# endif
+
+#endif
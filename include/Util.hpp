@@ -14,5 +14,7 @@ std::string		toString(const ssize_t value);
 std::string		toString(const std::vector<std::string>& values);
 
 size_t			toSizeT(const std::string& value);
+size_t			parseSize(const std::string& value);
+size_t			parseDuration(const std::string& value);
 
 #endif
\ No newline at end of file
@@ -14,6 +14,12 @@
 #include "Config.hpp"
 // #include "util/Logger.hpp"
 #include "Server.hpp"
+#include "Master.hpp"
+#include "ThreadGroup.hpp"
+#include "CgiWorker.hpp"
+#ifdef __linux__
+# include <sys/prctl.h>
+#endif
 
 volatile bool	g_sigint = false;
 
@@ -37,9 +43,19 @@ static void	ft_sigint_handler(int sig)
 /// 
 /// The program expects one command line argument: the path to the configuration file.
 /// If the argument is missing, the program prints the usage message and exits with status 1.
-/// Otherwise, it runs the server on the specified port.
+/// Otherwise, it runs the server on the specified port, either in this process or,
+/// when `worker_processes` resolves to more than one, in workers forked by a `Master`.
+/// `worker_threads` runs several event loops inside each (worker) process.
 int main(int argc, char *argv[])
 {
+	// Started by a server for its `cgi_workers`, see `CgiWorker`
+	if (argc == 2 && std::string(argv[1]) == CGI_WORKER_FLAG)
+	{
+#ifdef __linux__
+		prctl(PR_SET_NAME, CGI_WORKER_NAME, 0, 0, 0);
+#endif
+		return (CgiWorker(STDIN_FILENO).run());
+	}
 	// Check if the correct number of arguments is provided
 	if (argc != 2)
 	{
@@ -52,6 +68,7 @@ int main(int argc, char *argv[])
 	signal(SIGPIPE, SIG_IGN);
 	// Set the signal handler for SIGINT signal
 	signal(SIGINT, ft_sigint_handler);
+	signal(SIGTERM, ft_sigint_handler);
 
 	// try-catch block for error handling
 	// Create a Config object with the provided configuration file
@@ -59,6 +76,22 @@ int main(int argc, char *argv[])
 	config.load(argv[1]);
 	// Create a Logger object with the Config object
 	// Logger logger(config);
+	// With more than one worker, a master process supervises forked workers
+	int workers = Master::resolveWorkerCount(config);
+	if (workers > 1)
+	{
+		Master master(config, workers);
+		master.run();
+		return (0);
+	}
+	// Or one event loop per thread, sharing nothing on the request path
+	int threads = ThreadGroup::resolveThreadCount(config);
+	if (threads > 1)
+	{
+		ThreadGroup group(config, threads);
+		group.run();
+		return (0);
+	}
 	// Create a Server object with the Config object
 	Server server(config);
 	// Server server(8080);
@@ -0,0 +1,98 @@
+#ifdef __linux__
+
+#include "Poller.hpp"
+#include <stdexcept>
+#include <cerrno>
+#include <unistd.h>
+
+/// Events returned by one `epoll_wait()`; more are picked up by the next one
+#define EPOLL_MAX_EVENTS	256
+
+////////////////////////////////////////////////////////////////////////////////
+/// Constructor & Destructor
+////////////////////////////////////////////////////////////////////////////////
+
+EpollPoller::EpollPoller()
+	: _buffer(EPOLL_MAX_EVENTS)
+{
+	_epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (_epollFd == -1)
+		throw std::runtime_error("Failed to create epoll instance");
+}
+
+EpollPoller::~EpollPoller()
+{
+	close(_epollFd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Public Methods
+////////////////////////////////////////////////////////////////////////////////
+
+const char*	EpollPoller::name() const
+{
+	return ("epoll");
+}
+
+bool	EpollPoller::add(int fd, short events)
+{
+	if (_control(EPOLL_CTL_ADD, fd, events))
+		return (true);
+	return (errno == EEXIST && _control(EPOLL_CTL_MOD, fd, events));
+}
+
+bool	EpollPoller::modify(int fd, short events)
+{
+	return (_control(EPOLL_CTL_MOD, fd, events));
+}
+
+void	EpollPoller::remove(int fd)
+{
+	_control(EPOLL_CTL_DEL, fd, 0);
+}
+
+int	EpollPoller::wait(std::vector<PollEvent>& ready, int timeoutMs)
+{
+	ready.clear();
+	int count = epoll_wait(_epollFd, _buffer.data(), _buffer.size(), timeoutMs);
+	for (int i = 0; i < count; i++)
+	{
+		uint32_t	flags = _buffer[i].events;
+		PollEvent	event = {_buffer[i].data.fd, 0};
+
+		if (flags & EPOLLIN)
+			event.revents |= POLLIN;
+		if (flags & EPOLLOUT)
+			event.revents |= POLLOUT;
+		if (flags & EPOLLERR)
+			event.revents |= POLLERR;
+		if (flags & EPOLLHUP)
+			event.revents |= POLLHUP;
+		if (flags & EPOLLRDHUP)
+			event.revents |= POLLRDHUP;
+		ready.push_back(event);
+	}
+	return (count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Private Methods
+////////////////////////////////////////////////////////////////////////////////
+
+bool	EpollPoller::_control(int op, int fd, short events)
+{
+	struct epoll_event	event;
+
+	event.events = 0;
+	if (events & POLLIN)
+		event.events |= EPOLLIN;
+	if (events & POLLOUT)
+		event.events |= EPOLLOUT;
+	if (events & POLLRDHUP)
+		event.events |= EPOLLRDHUP;
+	event.data.u64 = 0;
+	event.data.fd = fd;
+	return (epoll_ctl(_epollFd, op, fd, &event) == 0);
+}
+
+#endif
@@ -0,0 +1,207 @@
+#include "OutputQueue.hpp"
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#ifdef __linux__
+# include <sys/sendfile.h>
+#endif
+
+/// Memory segments gathered into one `sendmsg()`
+#define OUTPUT_MAX_IOV			16
+/// Chunk size of the `pread()` fallback where `sendfile()` is unavailable
+#define OUTPUT_FILE_CHUNK		65536
+
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL			0
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+/// Constructor
+////////////////////////////////////////////////////////////////////////////////
+
+OutputQueue::OutputQueue()
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Public Methods
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Appends `data`, taking its content (`data` is left empty).
+void	OutputQueue::pushMemory(std::string& data)
+{
+	OutputSegment	segment;
+
+	if (data.empty())
+		return ;
+	segment.owned = false;
+	_segments.push_back(segment);
+	_segments.back().data.swap(data);
+	_segments.back().fd = -1;
+	_segments.back().offset = 0;
+	_segments.back().remaining = _segments.back().data.size();
+}
+
+/// @brief Appends `length` bytes of `fd` from `offset`, taking ownership of
+/// `fd` if `owned`. Several regions of one file share it: only the last one
+/// queued owns it, as it goes last.
+void	OutputQueue::pushFile(int fd, off_t offset, size_t length, bool owned)
+{
+	OutputSegment	segment;
+
+	if (length == 0)
+	{
+		if (owned)
+			close(fd);
+		return ;
+	}
+	segment.fd = fd;
+	segment.offset = offset;
+	segment.remaining = length;
+	segment.owned = owned;
+	_segments.push_back(segment);
+}
+
+bool	OutputQueue::empty() const
+{
+	return (_segments.empty());
+}
+
+/// @brief Bytes still to send.
+size_t	OutputQueue::pending() const
+{
+	size_t	total = 0;
+
+	for (size_t i = 0; i < _segments.size(); i++)
+		total += _segments[i].remaining;
+	return (total);
+}
+
+/// @brief Sends as much as the socket takes.
+/// @return the number of bytes sent, possibly 0 when the socket is full, or -1
+/// on error with `errno` set.
+ssize_t	OutputQueue::send(int socket)
+{
+	ssize_t	total = 0;
+
+	while (!_segments.empty())
+	{
+		bool	isFile = (_segments.front().fd != -1);
+		size_t	before = _segments.size();
+		ssize_t	sent = isFile ? _sendFile(socket) : _sendMemory(socket);
+
+		if (sent < 0)
+		{
+			if (errno == EINTR)
+				continue ;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return (total);
+			return (-1);
+		}
+		total += sent;
+		// A segment left unfinished means the socket buffer is full
+		if (!_segments.empty() && _segments.size() == before)
+			return (total);
+	}
+	return (total);
+}
+
+/// @brief Drops everything still queued and closes the files.
+void	OutputQueue::clear()
+{
+	while (!_segments.empty())
+		_popFront();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Private Methods
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Sends the memory segments at the front with one `sendmsg()`.
+ssize_t	OutputQueue::_sendMemory(int socket)
+{
+	struct iovec	iov[OUTPUT_MAX_IOV];
+	struct msghdr	msg;
+	int				count = 0;
+	int				flags = MSG_NOSIGNAL;
+	size_t			i = 0;
+
+	for (; i < _segments.size() && count < OUTPUT_MAX_IOV && _segments[i].fd == -1; i++)
+	{
+		iov[count].iov_base = const_cast<char*>(_segments[i].data.data()) + _segments[i].offset;
+		iov[count].iov_len = _segments[i].remaining;
+		count++;
+	}
+#ifdef MSG_MORE
+	// More data follows from a file: let the kernel fill the packet with it
+	if (i < _segments.size() && _segments[i].fd != -1)
+		flags |= MSG_MORE;
+#endif
+	msg.msg_name = NULL;
+	msg.msg_namelen = 0;
+	msg.msg_iov = iov;
+	msg.msg_iovlen = count;
+	msg.msg_control = NULL;
+	msg.msg_controllen = 0;
+	msg.msg_flags = 0;
+	ssize_t	sent = sendmsg(socket, &msg, flags);
+	if (sent <= 0)
+		return (sent);
+
+	size_t	left = sent;
+	while (left > 0 && left >= _segments.front().remaining)
+	{
+		left -= _segments.front().remaining;
+		_popFront();
+	}
+	if (left > 0)
+	{
+		_segments.front().offset += left;
+		_segments.front().remaining -= left;
+	}
+	return (sent);
+}
+
+/// @brief Sends from the file region at the front, without copying it through
+/// user space where `sendfile()` exists.
+ssize_t	OutputQueue::_sendFile(int socket)
+{
+	OutputSegment&	segment = _segments.front();
+	ssize_t			sent;
+
+#ifdef __linux__
+	sent = sendfile(socket, segment.fd, &segment.offset, segment.remaining);
+	if (sent < 0)
+		return (-1);
+#else
+	char	buffer[OUTPUT_FILE_CHUNK];
+	size_t	chunk = segment.remaining < sizeof(buffer) ? segment.remaining : sizeof(buffer);
+	ssize_t	count = pread(segment.fd, buffer, chunk, segment.offset);
+	if (count <= 0)
+	{
+		errno = (count == 0) ? EIO : errno;
+		return (-1);
+	}
+	sent = ::send(socket, buffer, count, MSG_NOSIGNAL);
+	if (sent < 0)
+		return (-1);
+	segment.offset += sent;
+#endif
+	// The file shrank since its size was announced
+	if (sent == 0)
+	{
+		errno = EIO;
+		return (-1);
+	}
+	segment.remaining -= sent;
+	if (segment.remaining == 0)
+		_popFront();
+	return (sent);
+}
+
+void	OutputQueue::_popFront()
+{
+	if (_segments.front().owned)
+		close(_segments.front().fd);
+	_segments.pop_front();
+}
@@ -0,0 +1,144 @@
+#include "Poller.hpp"
+#include "UringPoller.hpp"
+#include <iostream>
+#include <stdexcept>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+////////////////////////////////////////////////////////////////////////////////
+/// Poller
+////////////////////////////////////////////////////////////////////////////////
+
+Poller::~Poller()
+{}
+
+/// @brief Creates the backend named by `event_backend`: `poll` (the default),
+/// `epoll`, `io_uring`, or `auto` for the best one available. A backend the
+/// system does not support falls back to the next one: io_uring, epoll, poll.
+Poller*	Poller::create(const std::string& backend)
+{
+	std::string	name = backend.empty() ? "poll" : backend;
+
+	if (name != "poll" && name != "epoll" && name != "io_uring" && name != "auto")
+		throw std::runtime_error("Unknown event_backend: " + backend);
+#ifdef __linux__
+	if (name == "io_uring" || name == "auto")
+	{
+		try
+		{
+			return (new UringPoller());
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << "Error: " << e.what() << ", falling back to epoll" << std::endl;
+		}
+	}
+	if (name != "poll")
+	{
+		try
+		{
+			return (new EpollPoller());
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << "Error: " << e.what() << ", falling back to poll" << std::endl;
+		}
+	}
+#endif
+	return (new PollPoller());
+}
+
+bool	Poller::addListener(int fd)
+{
+	return (add(fd, POLLIN));
+}
+
+/// @brief `accept()` returning a non-blocking, close-on-exec socket, in one
+/// syscall where `accept4()` is available.
+/// @return the socket, or -1 with `errno` set.
+int	Poller::accept(int fd, sockaddr* addr, socklen_t* addrLen)
+{
+#ifdef __linux__
+	return (accept4(fd, addr, addrLen, SOCK_NONBLOCK | SOCK_CLOEXEC));
+#else
+	int client_socket = ::accept(fd, addr, addrLen);
+	if (client_socket < 0)
+		return (-1);
+	int flags = fcntl(client_socket, F_GETFL, 0);
+	if (flags == -1 || fcntl(client_socket, F_SETFL, flags | O_NONBLOCK) == -1
+		|| fcntl(client_socket, F_SETFD, FD_CLOEXEC) == -1)
+	{
+		int saved = errno;
+		close(client_socket);
+		errno = saved;
+		return (-1);
+	}
+	return (client_socket);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// PollPoller
+////////////////////////////////////////////////////////////////////////////////
+
+PollPoller::PollPoller()
+{}
+
+PollPoller::~PollPoller()
+{}
+
+const char*	PollPoller::name() const
+{
+	return ("poll");
+}
+
+bool	PollPoller::add(int fd, short events)
+{
+	if ((size_t)fd >= _indexes.size())
+		_indexes.resize(fd + 1, -1);
+	if (_indexes[fd] != -1)
+		return (modify(fd, events));
+	_indexes[fd] = _pollfds.size();
+	_pollfds.push_back((struct pollfd){fd, events, 0});
+	return (true);
+}
+
+bool	PollPoller::modify(int fd, short events)
+{
+	if ((size_t)fd >= _indexes.size() || _indexes[fd] == -1)
+		return (false);
+	_pollfds[_indexes[fd]].events = events;
+	return (true);
+}
+
+/// @brief O(1): the last entry moves into the freed position.
+void	PollPoller::remove(int fd)
+{
+	if ((size_t)fd >= _indexes.size() || _indexes[fd] == -1)
+		return ;
+	int	index = _indexes[fd];
+	int	last = _pollfds.back().fd;
+
+	_pollfds[index] = _pollfds.back();
+	_pollfds.pop_back();
+	if (last != fd)
+		_indexes[last] = index;
+	_indexes[fd] = -1;
+}
+
+int	PollPoller::wait(std::vector<PollEvent>& ready, int timeoutMs)
+{
+	ready.clear();
+	int count = poll(_pollfds.data(), _pollfds.size(), timeoutMs);
+	if (count <= 0)
+		return (count);
+	for (size_t i = 0; i < _pollfds.size() && (int)ready.size() < count; i++)
+	{
+		if (_pollfds[i].revents == 0)
+			continue ;
+		PollEvent	event = {_pollfds[i].fd, _pollfds[i].revents};
+		ready.push_back(event);
+	}
+	return (ready.size());
+}
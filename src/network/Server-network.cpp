@@ -12,6 +12,7 @@
 
 #include "webserv.hpp"
 #include "Server.hpp"
+#include <netinet/tcp.h>
 
 static unsigned int	ft_inet_addr(const std::string& ipAddr)
 {
@@ -33,7 +34,7 @@ static unsigned int	ft_inet_addr(const std::string& ipAddr)
 	return (htonl(result));
 }
 
-int	Server::_setupListeningSocket(const std::string host, int port)
+int	Server::_setupListeningSocket(const std::string host, int port, const ListenOptions& options)
 {
 	// Create socket
 	int listenfd = socket(AF_INET, SOCK_STREAM, 0);
@@ -49,6 +50,14 @@ int	Server::_setupListeningSocket(const std::string host, int port)
 		close(listenfd);
 		throw std::runtime_error("Failed to set socket options");
 	}
+	// Every worker binds its own listener, the kernel balances accepts between them
+	if (_reusePort && setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) == -1)
+	{
+		close(listenfd);
+		throw std::runtime_error("Failed to set SO_REUSEPORT");
+	}
+
+	_applyListenOptions(listenfd, options);
 
 	// Bind socket
 	struct sockaddr_in addr;
@@ -68,7 +77,7 @@ int	Server::_setupListeningSocket(const std::string host, int port)
 	}
 
 	// Listen
-	if (listen(listenfd, SOMAXCONN) < 0)
+	if (listen(listenfd, options.backlog > 0 ? options.backlog : SOMAXCONN) < 0)
 	{
 		throw std::runtime_error("Failed to listen");
 	}
@@ -87,3 +96,28 @@ int	Server::_setupListeningSocket(const std::string host, int port)
 
 	return (listenfd);
 }
+
+/// @brief Applies the socket options of a `listen` directive. They are tuning
+/// only, so one the system refuses is reported and skipped.
+/// Accepted sockets inherit the buffer sizes.
+void	Server::_applyListenOptions(int listenfd, const ListenOptions& options)
+{
+	if (options.rcvbuf > 0
+		&& setsockopt(listenfd, SOL_SOCKET, SO_RCVBUF, &options.rcvbuf, sizeof(options.rcvbuf)) == -1)
+		std::cerr << "Error: failed to set SO_RCVBUF" << std::endl;
+	if (options.sndbuf > 0
+		&& setsockopt(listenfd, SOL_SOCKET, SO_SNDBUF, &options.sndbuf, sizeof(options.sndbuf)) == -1)
+		std::cerr << "Error: failed to set SO_SNDBUF" << std::endl;
+#ifdef TCP_DEFER_ACCEPT
+	// Only wake up for a connection once its first data has arrived
+	if (options.deferAccept > 0
+		&& setsockopt(listenfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &options.deferAccept, sizeof(options.deferAccept)) == -1)
+		std::cerr << "Error: failed to set TCP_DEFER_ACCEPT" << std::endl;
+#endif
+#ifdef TCP_FASTOPEN
+	// Accept data in the SYN from clients holding a Fast Open cookie
+	if (options.fastOpen > 0
+		&& setsockopt(listenfd, IPPROTO_TCP, TCP_FASTOPEN, &options.fastOpen, sizeof(options.fastOpen)) == -1)
+		std::cerr << "Error: failed to set TCP_FASTOPEN" << std::endl;
+#endif
+}
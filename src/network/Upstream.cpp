@@ -0,0 +1,94 @@
+#include "Upstream.hpp"
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/// @brief Resolves a backend name. Host names are looked up here, blocking, so
+/// callers resolve once and keep the result.
+/// @return false if the name is malformed or does not resolve.
+bool	resolveUpstream(const std::string& name, UpstreamAddress& address)
+{
+	std::memset(&address.addr, 0, sizeof(address.addr));
+	address.name = name;
+	if (name.compare(0, 5, "unix:") == 0)
+	{
+		struct sockaddr_un*	un = reinterpret_cast<struct sockaddr_un*>(&address.addr);
+		std::string			path = name.substr(5);
+
+		if (path.empty() || path.size() >= sizeof(un->sun_path))
+			return (false);
+		un->sun_family = AF_UNIX;
+		std::memcpy(un->sun_path, path.c_str(), path.size() + 1);
+		address.length = sizeof(struct sockaddr_un);
+		return (true);
+	}
+
+	size_t				colon = name.rfind(':');
+	struct addrinfo		hints;
+	struct addrinfo*	result;
+
+	if (colon == std::string::npos || colon == 0 || colon + 1 == name.size())
+		return (false);
+	std::memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(name.substr(0, colon).c_str(), name.substr(colon + 1).c_str(), &hints, &result) != 0)
+		return (false);
+	std::memcpy(&address.addr, result->ai_addr, result->ai_addrlen);
+	address.length = result->ai_addrlen;
+	freeaddrinfo(result);
+	return (true);
+}
+
+/// @brief Starts a non-blocking connection to a backend. Completion is
+/// signalled by the socket becoming writable, see `finishConnect`.
+/// @return the socket, or -1 with `errno` set.
+int	connectUpstream(const UpstreamAddress& address)
+{
+	int	family = address.addr.ss_family;
+#ifdef __linux__
+	int	fd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+#else
+	int	fd = socket(family, SOCK_STREAM, 0);
+	if (fd != -1)
+	{
+		fcntl(fd, F_SETFL, O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+#endif
+	if (fd == -1)
+		return (-1);
+	if (family == AF_INET)
+	{
+		int	optval = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+	}
+	if (connect(fd, reinterpret_cast<const struct sockaddr*>(&address.addr), address.length) == -1
+		&& errno != EINPROGRESS)
+	{
+		int	saved = errno;
+		close(fd);
+		errno = saved;
+		return (-1);
+	}
+	return (fd);
+}
+
+/// @brief Whether the connection started by `connectUpstream` succeeded,
+/// once its socket is writable.
+bool	finishConnect(int fd)
+{
+	int			error = 0;
+	socklen_t	length = sizeof(error);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1)
+		return (false);
+	errno = error;
+	return (error == 0);
+}
@@ -0,0 +1,421 @@
+#ifdef __linux__
+
+#include "UringPoller.hpp"
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+
+/// Submission queue size; the completion queue is larger, since every
+/// connection can have a poll in flight
+#define URING_SQ_ENTRIES	1024
+#define URING_CQ_ENTRIES	8192
+/// `user_data` of `POLL_REMOVE`s and cancels, whose completions are ignored
+#define URING_REMOVE_TAG	(~static_cast<uint64_t>(0))
+/// Set in the `user_data` of multishot accepts, next to the fd
+#define URING_ACCEPT_TAG	(static_cast<uint64_t>(1) << 31)
+/// Accepted connections queued per listener beyond which it is not re-armed
+#define URING_ACCEPT_QUEUE	1024
+
+static uint64_t	ft_uring_user_data(int fd, uint32_t token)
+{
+	return ((static_cast<uint64_t>(token) << 32) | static_cast<uint32_t>(fd));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Constructor & Destructor
+////////////////////////////////////////////////////////////////////////////////
+
+UringPoller::UringPoller()
+	: _sqRing(MAP_FAILED), _cqRing(MAP_FAILED), _sqes(static_cast<io_uring_sqe*>(MAP_FAILED)), _pending(0),
+	_multishotAccept(true)
+{
+	struct io_uring_params	params;
+
+	std::memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = URING_CQ_ENTRIES;
+	_ringFd = syscall(__NR_io_uring_setup, URING_SQ_ENTRIES, &params);
+	if (_ringFd < 0)
+		throw std::runtime_error(std::string("io_uring is not available: ") + strerror(errno));
+	// Waiting with a timeout, and never losing a completion, are required
+	if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP))
+	{
+		close(_ringFd);
+		throw std::runtime_error("io_uring is too old");
+	}
+
+	_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		_sqRingSize = _cqRingSize = std::max(_sqRingSize, _cqRingSize);
+	_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+	_sqRing = mmap(NULL, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQ_RING);
+	if (_sqRing != MAP_FAILED && (params.features & IORING_FEAT_SINGLE_MMAP))
+		_cqRing = _sqRing;
+	else if (_sqRing != MAP_FAILED)
+		_cqRing = mmap(NULL, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_CQ_RING);
+	if (_cqRing != MAP_FAILED)
+		_sqes = static_cast<io_uring_sqe*>(mmap(NULL, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQES));
+	if (_sqes == MAP_FAILED)
+	{
+		_unmap();
+		close(_ringFd);
+		throw std::runtime_error("Failed to map io_uring rings");
+	}
+
+	char*	sq = static_cast<char*>(_sqRing);
+	char*	cq = static_cast<char*>(_cqRing);
+	_sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+	_sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+	_sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+	_sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+	_sqEntries = params.sq_entries;
+	_cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+	_cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+	_cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+	_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+}
+
+UringPoller::~UringPoller()
+{
+	_unmap();
+	close(_ringFd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Public Methods
+////////////////////////////////////////////////////////////////////////////////
+
+const char*	UringPoller::name() const
+{
+	return ("io_uring");
+}
+
+bool	UringPoller::add(int fd, short events)
+{
+	FdState&	state = _state(fd);
+
+	if (state.registered)
+		return (modify(fd, events));
+	state.registered = true;
+	state.listener = false;
+	state.accepting = false;
+	state.events = events;
+	_queueArm(fd);
+	return (true);
+}
+
+bool	UringPoller::modify(int fd, short events)
+{
+	FdState&	state = _state(fd);
+
+	if (!state.registered)
+		return (false);
+	if (state.events == events)
+		return (true);
+	if (state.armed)
+		_cancel(fd);
+	state.events = events;
+	_queueArm(fd);
+	return (true);
+}
+
+void	UringPoller::remove(int fd)
+{
+	FdState&	state = _state(fd);
+
+	if (!state.registered)
+		return ;
+	if (state.armed)
+		_cancel(fd);
+	state.registered = false;
+	if (!state.listener)
+		return ;
+	std::deque<int>&	queue = _accepted[fd];
+	for (size_t i = 0; i < queue.size(); i++)
+	{
+		if (queue[i] >= 0)
+			close(queue[i]);
+	}
+	_accepted.erase(fd);
+	state.listener = false;
+}
+
+bool	UringPoller::addListener(int fd)
+{
+	if (!add(fd, POLLIN))
+		return (false);
+	_fds[fd].listener = true;
+	_accepted[fd];
+	return (true);
+}
+
+/// @brief Takes a connection the listener's multishot accept queued, and
+/// finds its address; listeners without one accept from the kernel.
+int	UringPoller::accept(int fd, sockaddr* addr, socklen_t* addrLen)
+{
+	std::map<int, std::deque<int> >::iterator	it = _accepted.find(fd);
+
+	if (it == _accepted.end() || it->second.empty())
+	{
+		if (it != _accepted.end() && _fds[fd].accepting)
+		{
+			errno = EAGAIN;
+			return (-1);
+		}
+		return (Poller::accept(fd, addr, addrLen));
+	}
+	int	result = it->second.front();
+
+	it->second.pop_front();
+	if (!_fds[fd].armed)
+		_queueArm(fd);
+	if (result < 0)
+	{
+		errno = -result;
+		return (-1);
+	}
+	// Multishot accepts share no address buffer; reset already, it is aborted
+	if (addr != NULL && getpeername(result, addr, addrLen) == -1)
+	{
+		close(result);
+		errno = ECONNABORTED;
+		return (-1);
+	}
+	return (result);
+}
+
+/// @brief Arms the polls asked for since the last call, submits everything
+/// queued and waits for completions, all in one `io_uring_enter()`.
+int	UringPoller::wait(std::vector<PollEvent>& ready, int timeoutMs)
+{
+	ready.clear();
+	for (size_t i = 0; i < _rearm.size(); i++)
+	{
+		int			fd = _rearm[i];
+		FdState&	state = _fds[fd];
+
+		state.queued = false;
+		if (!state.registered || state.armed)
+			continue ;
+		if (state.listener && _multishotAccept)
+		{
+			if (!_armAccept(fd))
+				return (-1);
+			continue ;
+		}
+		io_uring_sqe	sqe;
+		std::memset(&sqe, 0, sizeof(sqe));
+		sqe.opcode = IORING_OP_POLL_ADD;
+		sqe.fd = fd;
+		sqe.poll_events = state.events | POLLERR | POLLHUP;
+		sqe.user_data = ft_uring_user_data(fd, state.token);
+		if (!_pushSqe(sqe))
+			return (-1);
+		state.armed = true;
+		state.accepting = false;
+	}
+	_rearm.clear();
+
+	// Connections still queued are reported again without waiting
+	bool	queued = false;
+	for (std::map<int, std::deque<int> >::iterator it = _accepted.begin(); it != _accepted.end(); ++it)
+		queued = queued || !it->second.empty();
+	int submitted = _enter(_pending, queued ? 0 : 1, timeoutMs);
+	if (submitted >= 0)
+		_pending -= submitted;
+	else if (errno != ETIME && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+		return (-1);
+
+	unsigned	head = *_cqHead;
+	unsigned	tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++)
+	{
+		const io_uring_cqe&	cqe = _cqes[head & *_cqMask];
+		if (cqe.user_data == URING_REMOVE_TAG)
+			continue ;
+		if (cqe.user_data & URING_ACCEPT_TAG)
+		{
+			_completeAccept(cqe);
+			continue ;
+		}
+		int			fd = static_cast<int>(cqe.user_data & 0xffffffff);
+		uint32_t	token = static_cast<uint32_t>(cqe.user_data >> 32);
+		if ((size_t)fd >= _fds.size() || !_fds[fd].registered || _fds[fd].token != token)
+			continue ;
+		// One-shot: the poll is gone, re-armed on the next wait if still wanted
+		_fds[fd].armed = false;
+		_queueArm(fd);
+		if (cqe.res > 0)
+		{
+			PollEvent	event = {fd, static_cast<short>(cqe.res)};
+			ready.push_back(event);
+		}
+	}
+	__atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+	for (std::map<int, std::deque<int> >::iterator it = _accepted.begin(); it != _accepted.end(); ++it)
+	{
+		if (!it->second.empty())
+		{
+			PollEvent	event = {it->first, POLLIN};
+			ready.push_back(event);
+		}
+	}
+	return (ready.size());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Private Methods
+////////////////////////////////////////////////////////////////////////////////
+
+UringPoller::FdState&	UringPoller::_state(int fd)
+{
+	if ((size_t)fd >= _fds.size())
+	{
+		FdState	unused = {false, false, false, false, false, 0, 0};
+		_fds.resize(fd + 1, unused);
+	}
+	return (_fds[fd]);
+}
+
+void	UringPoller::_queueArm(int fd)
+{
+	if (_fds[fd].queued)
+		return ;
+	_fds[fd].queued = true;
+	_rearm.push_back(fd);
+}
+
+/// @brief Submits a multishot accept on listener `fd`, unless enough of its
+/// connections are queued already: `accept()` re-arms it as they are taken.
+bool	UringPoller::_armAccept(int fd)
+{
+	FdState&		state = _fds[fd];
+	io_uring_sqe	sqe;
+
+	if (_accepted[fd].size() >= URING_ACCEPT_QUEUE)
+		return (true);
+	std::memset(&sqe, 0, sizeof(sqe));
+	sqe.opcode = IORING_OP_ACCEPT;
+	sqe.fd = fd;
+	sqe.accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	sqe.ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe.user_data = ft_uring_user_data(fd, state.token) | URING_ACCEPT_TAG;
+	if (!_pushSqe(sqe))
+		return (false);
+	state.armed = true;
+	state.accepting = true;
+	return (true);
+}
+
+/// @brief Queues the connection (or error) a multishot accept completed with.
+/// One accepted after its accept was dropped still goes to the listener, or
+/// is closed if the listener is gone. The accept is re-armed once it ends.
+void	UringPoller::_completeAccept(const io_uring_cqe& cqe)
+{
+	int			fd = static_cast<int>(cqe.user_data & (URING_ACCEPT_TAG - 1));
+	uint32_t	token = static_cast<uint32_t>(cqe.user_data >> 32);
+
+	if ((size_t)fd >= _fds.size() || !_fds[fd].registered || !_fds[fd].listener)
+	{
+		if (cqe.res >= 0)
+			close(cqe.res);
+		return ;
+	}
+	FdState&	state = _fds[fd];
+	bool		current = (state.token == token);
+
+	if (current && !(cqe.flags & IORING_CQE_F_MORE))
+	{
+		state.armed = false;
+		_queueArm(fd);
+	}
+	if (current && cqe.res == -EINVAL)
+	{
+		// Before Linux 5.19, accepts are single shot: poll listeners instead
+		_multishotAccept = false;
+		state.accepting = false;
+		return ;
+	}
+	if (cqe.res < 0 && (!current || cqe.res == -ECANCELED))
+		return ;
+	_accepted[fd].push_back(cqe.res);
+}
+
+/// @brief Drops the request in flight for `fd`. Its completion, if any, no
+/// longer matches the token and is ignored.
+void	UringPoller::_cancel(int fd)
+{
+	FdState&		state = _fds[fd];
+	io_uring_sqe	sqe;
+
+	std::memset(&sqe, 0, sizeof(sqe));
+	sqe.opcode = state.accepting ? IORING_OP_ASYNC_CANCEL : IORING_OP_POLL_REMOVE;
+	sqe.fd = -1;
+	sqe.addr = ft_uring_user_data(fd, state.token) | (state.accepting ? URING_ACCEPT_TAG : 0);
+	sqe.user_data = URING_REMOVE_TAG;
+	_pushSqe(sqe);
+	state.token++;
+	state.armed = false;
+	state.accepting = false;
+}
+
+/// @brief Copies `sqe` into the submission ring, submitting what is queued
+/// first if the ring is full.
+bool	UringPoller::_pushSqe(const io_uring_sqe& sqe)
+{
+	unsigned	tail = *_sqTail;
+
+	if (tail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE) >= _sqEntries)
+	{
+		int submitted = _enter(_pending, 0, -1);
+		if (submitted > 0)
+			_pending -= submitted;
+		if (tail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE) >= _sqEntries)
+			return (false);
+	}
+	unsigned	index = tail & *_sqMask;
+	_sqes[index] = sqe;
+	_sqArray[index] = index;
+	__atomic_store_n(_sqTail, tail + 1, __ATOMIC_RELEASE);
+	_pending++;
+	return (true);
+}
+
+/// @brief Submits `toSubmit` entries and, with `minComplete`, waits for
+/// completions for at most `timeoutMs` (forever if negative).
+/// @return the number of entries submitted, or -1 with `errno` set.
+int	UringPoller::_enter(unsigned toSubmit, unsigned minComplete, int timeoutMs)
+{
+	unsigned						flags = IORING_ENTER_EXT_ARG;
+	struct io_uring_getevents_arg	arg;
+	struct __kernel_timespec		ts;
+
+	std::memset(&arg, 0, sizeof(arg));
+	if (minComplete > 0)
+		flags |= IORING_ENTER_GETEVENTS;
+	if (minComplete > 0 && timeoutMs >= 0)
+	{
+		ts.tv_sec = timeoutMs / 1000;
+		ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+		arg.ts = reinterpret_cast<uint64_t>(&ts);
+	}
+	return (syscall(__NR_io_uring_enter, _ringFd, toSubmit, minComplete, flags, &arg, sizeof(arg)));
+}
+
+void	UringPoller::_unmap()
+{
+	if (_sqes != MAP_FAILED)
+		munmap(_sqes, _sqesSize);
+	if (_cqRing != MAP_FAILED && _cqRing != _sqRing)
+		munmap(_cqRing, _cqRingSize);
+	if (_sqRing != MAP_FAILED)
+		munmap(_sqRing, _sqRingSize);
+}
+
+#endif
@@ -0,0 +1,504 @@
+#include "CgiProcess.hpp"
+#include "CgiWorker.hpp"
+#include "Context.hpp"
+#include "HttpResponse.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <arpa/inet.h>
+
+/// Bytes read from a script's stdout per read, and reads per readiness event
+#define CGI_READ_BUFFER_SIZE	16384
+#define CGI_READS_PER_EVENT		4
+
+/// `posix_spawn()` can change the child's directory from glibc 2.29 on
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+# define CGI_SPAWN_CHDIR
+#endif
+
+/// @brief Sets one resource limit of `pid`, 0 for the calling process.
+/// `Resource` is the type of the `RLIMIT_*` constants, an enum with glibc.
+template <typename Resource>
+static void	ft_rlimit(pid_t pid, Resource resource, size_t soft, size_t hard)
+{
+	struct rlimit	limit;
+
+	limit.rlim_cur = soft;
+	limit.rlim_max = hard;
+#ifdef __linux__
+	if (pid != 0)
+	{
+		prlimit(pid, resource, &limit, NULL);
+		return ;
+	}
+#endif
+	(void)pid;
+	setrlimit(resource, &limit);
+}
+
+/// @brief Applies the `cgi_rlimit` of a location to a script. The CPU limit
+/// sends SIGXCPU, then SIGKILL a second later.
+static void	ft_apply_rlimits(pid_t pid, const CgiRlimits& limits)
+{
+	if (limits.cpu != 0)
+		ft_rlimit(pid, RLIMIT_CPU, limits.cpu, limits.cpu + 1);
+	if (limits.memory != 0)
+		ft_rlimit(pid, RLIMIT_AS, limits.memory, limits.memory);
+	if (limits.files != 0)
+		ft_rlimit(pid, RLIMIT_NOFILE, limits.files, limits.files);
+}
+
+/// @brief Starts `path` with `argv`, and `stdinFd` and `stdoutFd` (if not -1) as its
+/// stdin and stdout, in `directory` (if not NULL), with default SIGPIPE and
+/// no blocked signals. Where it can, `posix_spawn()` does this without
+/// copying the page tables of the server, so spawning takes the same time
+/// whatever the size of the caches; it also reports a failed exec().
+/// `limits` are then set with `prlimit()`, as the script starts, or by the
+/// forked child before exec().
+/// With `group`, the child leads a new process group, which its own children
+/// join: killing the group stops them all.
+/// @return the pid, or -1 with `errno` set.
+static pid_t	ft_spawn(const char* path, char* const argv[], char* const envp[], int stdinFd, int stdoutFd,
+					const char* directory, const CgiRlimits& limits, bool group)
+{
+	pid_t	pid = -1;
+#ifdef CGI_SPAWN_CHDIR
+	posix_spawn_file_actions_t	actions;
+	posix_spawnattr_t			attr;
+	sigset_t					none;
+	sigset_t					defaults;
+	int							error;
+
+	sigemptyset(&none);
+	sigemptyset(&defaults);
+	sigaddset(&defaults, SIGPIPE);
+	posix_spawn_file_actions_init(&actions);
+	posix_spawnattr_init(&attr);
+	// The pipes are close-on-exec, only the dup2() copies are inherited
+	error = posix_spawn_file_actions_adddup2(&actions, stdinFd, STDIN_FILENO);
+	if (error == 0 && stdoutFd != -1)
+		error = posix_spawn_file_actions_adddup2(&actions, stdoutFd, STDOUT_FILENO);
+	if (error == 0 && directory != NULL)
+		error = posix_spawn_file_actions_addchdir_np(&actions, directory);
+	if (error == 0)
+		error = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF
+			| (group ? POSIX_SPAWN_SETPGROUP : 0));
+	if (error == 0 && group)
+		error = posix_spawnattr_setpgroup(&attr, 0);
+	if (error == 0)
+		error = posix_spawnattr_setsigmask(&attr, &none);
+	if (error == 0)
+		error = posix_spawnattr_setsigdefault(&attr, &defaults);
+	if (error == 0)
+		error = posix_spawn(&pid, path, &actions, &attr, argv, envp);
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+	if (error != 0)
+	{
+		errno = error;
+		return (-1);
+	}
+	ft_apply_rlimits(pid, limits);
+#else
+	pid = fork();
+	if (pid == 0)
+	{
+		struct sigaction	dfl;
+		sigset_t			none;
+
+		// Between fork() and exec() a multithreaded process may only make
+		// async-signal-safe calls. Ignored signals and the event loop's
+		// blocked mask survive exec()
+		std::memset(&dfl, 0, sizeof(dfl));
+		dfl.sa_handler = SIG_DFL;
+		sigaction(SIGPIPE, &dfl, NULL);
+		sigemptyset(&none);
+		sigprocmask(SIG_SETMASK, &none, NULL);
+		if (dup2(stdinFd, STDIN_FILENO) == -1
+			|| (stdoutFd != -1 && dup2(stdoutFd, STDOUT_FILENO) == -1)
+			|| (directory != NULL && chdir(directory) == -1)
+			|| (group && setpgid(0, 0) == -1))
+			_exit(1);
+		ft_apply_rlimits(0, limits);
+		execve(path, argv, envp);
+		_exit(1);
+	}
+	// Either side may run first, the group must exist before it is killed
+	if (pid > 0 && group)
+		setpgid(pid, pid);
+#endif
+	return (pid);
+}
+
+/// @brief A pipe whose ends are close-on-exec, so concurrent spawns by other
+/// event loops do not inherit them; the parent end is also non-blocking.
+static int	ft_cgi_pipe(int fds[2], int parentEnd)
+{
+#ifdef __linux__
+	if (pipe2(fds, O_CLOEXEC) == -1)
+		return (-1);
+#else
+	if (pipe(fds) == -1)
+		return (-1);
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+	fcntl(fds[parentEnd], F_SETFL, O_NONBLOCK);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Constructor & Destructor
+////////////////////////////////////////////////////////////////////////////////
+
+CgiProcess::CgiProcess(int clientFd, unsigned int clientGeneration)
+	: _clientFd(clientFd), _clientGeneration(clientGeneration), _pid(-1),
+	_stdinFd(-1), _stdoutFd(-1), _pidFd(-1), _inputOffset(0), _group(false)
+{
+	std::memset(&_rlimits, 0, sizeof(_rlimits));
+}
+
+/// @brief Closes what is still open. The server unregisters the fds first, and
+/// reaps the child before deleting.
+CgiProcess::~CgiProcess()
+{
+	closeInput();
+	closeOutput();
+	closePidFd();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Public Methods: setup
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief The CGI/1.1 meta-variables of a request (RFC 3875, section 4.1),
+/// with every request header as `HTTP_*`: the location's template (see
+/// `Location::buildCgiEnvironment`), filled in with what is request-specific.
+std::vector<std::string>	CgiProcess::buildEnvironment(const Context& context, const std::string& scriptPath,
+								const std::string& pathInfo, size_t contentLength, uint32_t remoteAddr)
+{
+	const HttpRequest&					request = context.getRequest();
+	std::map<std::string, std::string>	headers = request.getHeaders();
+	std::vector<std::string>			env(context.getLocation().getCgiEnvironment());
+	std::string							uri = request.getUri();
+	size_t								query = uri.find('?');
+	std::string							path = uri.substr(0, query);
+	char								address[INET_ADDRSTRLEN] = "";
+
+	inet_ntop(AF_INET, &remoteAddr, address, sizeof(address));
+	env.reserve(env.size() + 11 + headers.size());
+	env.push_back("SERVER_PROTOCOL=" + request.getVersion());
+	env.push_back("REQUEST_METHOD=" + request.getMethod());
+	env.push_back("REQUEST_URI=" + uri);
+	env.push_back("QUERY_STRING=" + (query == std::string::npos ? "" : uri.substr(query + 1)));
+	env.push_back("SCRIPT_NAME=" + path.substr(0, path.size() - pathInfo.size()));
+	env.push_back("SCRIPT_FILENAME=" + scriptPath);
+	env.push_back("PATH_INFO=" + pathInfo);
+	env.push_back("CONTENT_LENGTH=" + toString(contentLength));
+	env.push_back("REMOTE_ADDR=" + std::string(address));
+	for (std::map<std::string, std::string>::const_iterator it = headers.begin(); it != headers.end(); ++it)
+	{
+		std::string	name = it->first;
+		for (size_t i = 0; i < name.size(); i++)
+			name[i] = (name[i] == '-') ? '_' : std::toupper(name[i]);
+		if (name == "CONTENT_TYPE")
+			env.push_back("CONTENT_TYPE=" + it->second);
+		else if (name == "CONTENT_LENGTH" || name == "TRANSFER_ENCODING")
+			continue ;
+		// `Proxy:` would land in HTTP_PROXY, which many clients honour (httpoxy)
+		else if (name != "PROXY")
+			env.push_back("HTTP_" + name + "=" + it->second);
+	}
+	return (env);
+}
+
+/// @brief The body of a complete request, with the chunked framing removed:
+/// CGI announces the body length in `CONTENT_LENGTH`.
+std::string	CgiProcess::requestBody(const std::string& requestData, bool chunked)
+{
+	size_t		start = requestData.find("\r\n\r\n");
+	std::string	body;
+
+	if (start == std::string::npos)
+		return ("");
+	start += 4;
+	if (!chunked)
+		return (requestData.substr(start));
+	while (start < requestData.size())
+	{
+		size_t	lineEnd = requestData.find("\r\n", start);
+		if (lineEnd == std::string::npos)
+			break ;
+		size_t	size = std::strtoul(requestData.substr(start, lineEnd - start).c_str(), NULL, 16);
+		if (size == 0)
+			break ;
+		body.append(requestData, lineEnd + 2, size);
+		start = lineEnd + 2 + size + 2;
+	}
+	return (body);
+}
+
+/// @brief Starts the script with its stdin and stdout on pipes, in its own
+/// directory as RFC 3875 suggests. `interpreter` runs the script when set,
+/// otherwise the script is executed itself (e.g. through its `#!` line).
+/// @param scriptPath absolute path of the script.
+/// @return false if the pipes or the process could not be created.
+bool	CgiProcess::start(const std::string& interpreter, const std::string& scriptPath,
+			const std::vector<std::string>& env, const std::string& body)
+{
+	int						in[2];
+	int						out[2];
+	std::string				directory = scriptPath.substr(0, scriptPath.find_last_of('/') + 1);
+	std::vector<char*>		argv;
+	std::vector<char*>		envp;
+
+	// Everything the child needs is prepared here, see `ft_spawn`
+	if (!interpreter.empty())
+		argv.push_back(const_cast<char*>(interpreter.c_str()));
+	argv.push_back(const_cast<char*>(scriptPath.c_str()));
+	argv.push_back(NULL);
+	for (size_t i = 0; i < env.size(); i++)
+		envp.push_back(const_cast<char*>(env[i].c_str()));
+	envp.push_back(NULL);
+
+	if (ft_cgi_pipe(in, 1) == -1)
+		return (false);
+	if (ft_cgi_pipe(out, 0) == -1)
+	{
+		close(in[0]);
+		close(in[1]);
+		return (false);
+	}
+	_pid = ft_spawn(argv[0], &argv[0], &envp[0], in[0], out[1], directory.c_str(), _rlimits, false);
+	int	saved = errno;
+	close(in[0]);
+	close(out[1]);
+	if (_pid < 0)
+	{
+		close(in[1]);
+		close(out[0]);
+		errno = saved;
+		return (false);
+	}
+	_stdinFd = in[1];
+	_stdoutFd = out[0];
+	_input = body;
+	if (_input.empty())
+		closeInput();
+	return (true);
+}
+
+/// @brief Starts a `CgiWorker`: the server binary again, in worker mode, with
+/// `socketFd` as its stdin. The new image does not share the event loop's
+/// memory, so the scripts it starts later do not copy it. It is named
+/// `CGI_WORKER_NAME`, for `ps` and `pgrep`. It leads its own process group,
+/// which the scripts it starts join, so `kill()` stops a running script
+/// with it.
+/// @return false if the process could not be created.
+bool	CgiProcess::startWorker(int socketFd)
+{
+	const char*	argv[] = {CGI_WORKER_NAME, CGI_WORKER_FLAG, NULL};
+	const char*	envp[] = {NULL};
+	CgiRlimits	none = {0, 0, 0};
+
+	// Limits are for scripts, the worker sets them on those it starts
+	_pid = ft_spawn("/proc/self/exe", const_cast<char**>(argv), const_cast<char**>(envp), socketFd, -1, NULL, none, true);
+	_group = (_pid > 0);
+	return (_pid > 0);
+}
+
+/// @brief The resource limits of the script `start()` runs.
+void	CgiProcess::setRlimits(const CgiRlimits& limits)
+{
+	_rlimits = limits;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Public Methods: I/O
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Writes as much of the request body as the pipe takes.
+/// @return the bytes written, 0 if the pipe is full, -1 if the script stopped
+/// reading (`EPIPE`), which is not an error of the request.
+ssize_t	CgiProcess::writeInput()
+{
+	ssize_t	written = write(_stdinFd, _input.data() + _inputOffset, _input.size() - _inputOffset);
+
+	if (written < 0)
+		return ((errno == EAGAIN || errno == EINTR) ? 0 : -1);
+	_inputOffset += written;
+	if (inputDone())
+		std::string().swap(_input);
+	return (written);
+}
+
+bool	CgiProcess::inputDone() const
+{
+	return (_inputOffset >= _input.size());
+}
+
+/// @brief Reads what the script wrote, a bounded amount per call so a chatty
+/// script does not starve the other connections.
+/// @return 1 while more may come, 0 at end of output, -1 on error.
+int	CgiProcess::readOutput()
+{
+	char	buffer[CGI_READ_BUFFER_SIZE];
+
+	for (int i = 0; i < CGI_READS_PER_EVENT; i++)
+	{
+		ssize_t	count = read(_stdoutFd, buffer, sizeof(buffer));
+		if (count == 0)
+			return (0);
+		if (count < 0)
+			return ((errno == EAGAIN || errno == EINTR) ? 1 : -1);
+		_output.append(buffer, count);
+	}
+	return (1);
+}
+
+/// @brief Bytes of output waiting in the pipe; 0 at its end too.
+size_t	CgiProcess::outputAvailable() const
+{
+	int	available = 0;
+
+	if (_stdoutFd == -1 || ioctl(_stdoutFd, FIONREAD, &available) == -1 || available < 0)
+		return (0);
+	return (available);
+}
+
+/// @brief Moves up to `length` bytes of output from the pipe to `socket`
+/// without copying them through user space, where `splice()` exists.
+/// @return bytes moved, 0 if the socket is full, -1 on error (`ENOSYS`
+/// without `splice()`).
+ssize_t	CgiProcess::spliceOutput(int socket, size_t length)
+{
+#ifdef __linux__
+	ssize_t	moved = splice(_stdoutFd, NULL, socket, NULL, length, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+	if (moved < 0 && (errno == EAGAIN || errno == EINTR))
+		return (0);
+	return (moved);
+#else
+	(void)socket;
+	(void)length;
+	errno = ENOSYS;
+	return (-1);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Public Methods: process
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Collects the exit status of the child, waiting for it with `block`.
+/// @return true once the child is gone.
+bool	CgiProcess::reap(bool block)
+{
+	int	status;
+
+	if (_pid < 0)
+		return (true);
+	pid_t	result = waitpid(_pid, &status, block ? 0 : WNOHANG);
+	if (result == 0 || (result < 0 && errno == EINTR))
+		return (false);
+	_pid = -1;
+	return (true);
+}
+
+/// @brief Kills a script whose output is no longer wanted; a worker, with the
+/// script it runs.
+void	CgiProcess::kill()
+{
+	if (_pid > 0)
+		::kill(_group ? -_pid : _pid, SIGKILL);
+}
+
+/// @brief A descriptor that becomes readable when the child exits, on kernels
+/// with `pidfd_open()`.
+/// @return the descriptor, or -1 if there is none.
+int	CgiProcess::openPidFd()
+{
+#ifdef SYS_pidfd_open
+	if (_pidFd == -1 && _pid > 0)
+	{
+		_pidFd = syscall(SYS_pidfd_open, _pid, 0);
+		if (_pidFd >= 0)
+			fcntl(_pidFd, F_SETFD, FD_CLOEXEC);
+	}
+#endif
+	return (_pidFd);
+}
+
+void	CgiProcess::closeInput()
+{
+	if (_stdinFd != -1)
+		close(_stdinFd);
+	_stdinFd = -1;
+	std::string().swap(_input);
+}
+
+void	CgiProcess::closeOutput()
+{
+	if (_stdoutFd != -1)
+		close(_stdoutFd);
+	_stdoutFd = -1;
+}
+
+void	CgiProcess::closePidFd()
+{
+	if (_pidFd != -1)
+		close(_pidFd);
+	_pidFd = -1;
+}
+
+/// @brief The client is done with the script, which is only waited for now.
+void	CgiProcess::detach()
+{
+	_clientFd = -1;
+	std::string().swap(_output);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Getters
+////////////////////////////////////////////////////////////////////////////////
+
+int	CgiProcess::getClientFd() const
+{
+	return (_clientFd);
+}
+
+unsigned int	CgiProcess::getClientGeneration() const
+{
+	return (_clientGeneration);
+}
+
+int	CgiProcess::getStdinFd() const
+{
+	return (_stdinFd);
+}
+
+int	CgiProcess::getStdoutFd() const
+{
+	return (_stdoutFd);
+}
+
+int	CgiProcess::getPidFd() const
+{
+	return (_pidFd);
+}
+
+/// @brief Moves out what was read from the script so far.
+void	CgiProcess::takeOutput(std::string& output)
+{
+	output.clear();
+	output.swap(_output);
+}
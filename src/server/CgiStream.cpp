@@ -0,0 +1,395 @@
+#include "CgiStream.hpp"
+#include "HttpResponse.hpp"
+#include "OutputQueue.hpp"
+#include "Util.hpp"
+#include <cstdlib>
+#include <cctype>
+#include <cerrno>
+#include <sstream>
+#include <algorithm>
+#include <unistd.h>
+
+static std::string	ft_trim(const std::string& value)
+{
+	size_t	start = value.find_first_not_of(" \t\r");
+	size_t	end = value.find_last_not_of(" \t\r");
+
+	if (start == std::string::npos)
+		return ("");
+	return (value.substr(start, end - start + 1));
+}
+
+static std::string	ft_to_lower(std::string value)
+{
+	for (size_t i = 0; i < value.size(); i++)
+		value[i] = std::tolower(value[i]);
+	return (value);
+}
+
+static bool	ft_write_all(int fd, const std::string& data)
+{
+	for (size_t written = 0; written < data.size(); )
+	{
+		ssize_t	count = write(fd, data.data() + written, data.size() - written);
+		if (count < 0 && errno == EINTR)
+			continue ;
+		if (count <= 0)
+			return (false);
+		written += count;
+	}
+	return (true);
+}
+
+/// @brief The size line of a chunk, `length` in hex.
+static std::string	ft_chunk_size(size_t length)
+{
+	std::ostringstream	line;
+
+	line << std::hex << length << "\r\n";
+	return (line.str());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Constructor
+////////////////////////////////////////////////////////////////////////////////
+
+CgiStream::CgiStream()
+{
+	reset(false, false);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Public Methods
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Gets ready for the output of a new request.
+/// @param chunkedAllowed whether the client speaks HTTP/1.1.
+/// @param headRequest whether the request is a HEAD: the body is dropped.
+void	CgiStream::reset(bool chunkedAllowed, bool headRequest)
+{
+	std::string().swap(_header);
+	_chunkedAllowed = chunkedAllowed;
+	_headRequest = headRequest;
+	_started = false;
+	_paused = false;
+	_contentLength = -1;
+	_framing = CGI_FRAME_CLOSE;
+	_remaining = 0;
+	_chunkLeft = 0;
+	_spliceable = true;
+	_capturing = false;
+	_captureLimit = 0;
+	std::string().swap(_captured);
+	_captureFd = -1;
+	_captureFileLimit = 0;
+	_captureFileBytes = 0;
+}
+
+/// @brief Takes output until the header block is complete, and turns it into
+/// `response`. Both `\r\n` and bare `\n` line ends are accepted.
+/// @param data output of the script; left holding the body bytes that came
+/// with the end of the header block.
+/// @return 1 once the header is parsed, 0 while incomplete, -1 if invalid.
+int	CgiStream::parseHeader(std::string& data, HttpResponse& response)
+{
+	size_t	from = _header.size() < 3 ? 0 : _header.size() - 3;
+
+	_header.append(data);
+	data.clear();
+	size_t	end = _header.find("\r\n\r\n", from);
+	size_t	separator = 4;
+	size_t	bareEnd = _header.find("\n\n", from);
+	if (bareEnd < end)
+	{
+		end = bareEnd;
+		separator = 2;
+	}
+	if (end == std::string::npos)
+		return (_header.size() > CGI_MAX_HEADER ? -1 : 0);
+	data.assign(_header, end + separator, std::string::npos);
+	_header.erase(end);
+	bool	valid = _parseHeaderBlock(_header, response);
+	std::string().swap(_header);
+	return (valid ? 1 : -1);
+}
+
+/// @brief Sets the framing headers of `response` for a body relayed as it
+/// comes: the script's `Content-Length` if it gave one, else chunked for an
+/// HTTP/1.1 client, else the end of the body is the end of the connection.
+/// @param keepAlive turned off when the body is delimited by closing.
+void	CgiStream::start(HttpResponse& response, bool& keepAlive)
+{
+	int	code = response.getStatusCode();
+
+	_started = true;
+	if (code < 200 || code == 204 || code == 304)
+		_framing = CGI_FRAME_NONE;
+	else if (_headRequest)
+	{
+		// The length of the body a GET would have had, if known
+		_framing = CGI_FRAME_NONE;
+		if (_contentLength >= 0)
+			response.setHeader("Content-Length", toString(_contentLength));
+	}
+	else if (_contentLength >= 0)
+	{
+		_framing = CGI_FRAME_LENGTH;
+		_remaining = _contentLength;
+		response.setHeader("Content-Length", toString(_contentLength));
+	}
+	else if (_chunkedAllowed)
+	{
+		_framing = CGI_FRAME_CHUNKED;
+		response.setHeader("Transfer-Encoding", "chunked");
+	}
+	else
+	{
+		_framing = CGI_FRAME_CLOSE;
+		keepAlive = false;
+	}
+	response.setHeader("Connection", keepAlive ? "keep-alive" : "close");
+}
+
+/// @brief Queues body bytes on `output`, taking `data`: as one chunk when
+/// chunked, cut to the announced length otherwise.
+void	CgiStream::relay(std::string& data, OutputQueue& output)
+{
+	if (data.empty())
+		return ;
+	if (_framing == CGI_FRAME_NONE)
+	{
+		data.clear();
+		return ;
+	}
+	if (_framing == CGI_FRAME_LENGTH)
+	{
+		if (data.size() > _remaining)
+			data.resize(_remaining);
+		_remaining -= data.size();
+		_keep(data);
+		output.pushMemory(data);
+		return ;
+	}
+	if (_framing == CGI_FRAME_CHUNKED && _chunkLeft > 0)
+	{
+		// The rest of a chunk opened for `splice()`
+		std::string	rest(data, 0, std::min(data.size(), _chunkLeft));
+
+		data.erase(0, rest.size());
+		output.pushMemory(rest);
+		spliced(rest.size(), output);
+		relay(data, output);
+		return ;
+	}
+	if (_framing == CGI_FRAME_CHUNKED)
+	{
+		std::string	size = ft_chunk_size(data.size());
+		std::string	end = "\r\n";
+
+		_keep(data);
+		output.pushMemory(size);
+		output.pushMemory(data);
+		output.pushMemory(end);
+		return ;
+	}
+	_keep(data);
+	output.pushMemory(data);
+}
+
+/// @brief The output ended: queues the last chunk when chunked.
+/// @return false if the body is shorter than announced, in which case the
+/// connection must be closed for the client to notice.
+bool	CgiStream::finish(OutputQueue& output)
+{
+	if (_framing == CGI_FRAME_CHUNKED && _chunkLeft > 0)
+		return (false);
+	if (_framing == CGI_FRAME_CHUNKED)
+	{
+		std::string	last = "0\r\n\r\n";
+		output.pushMemory(last);
+	}
+	return (_framing != CGI_FRAME_LENGTH || _remaining == 0);
+}
+
+/// @brief Whether body bytes may now go from the script's pipe to the client
+/// as they are, without passing through `relay`.
+bool	CgiStream::canSplice() const
+{
+	if (!_started || !_spliceable || _capturing || _captureFd != -1)
+		return (false);
+	if (_framing == CGI_FRAME_LENGTH)
+		return (_remaining > 0);
+	return (_framing == CGI_FRAME_CHUNKED || _framing == CGI_FRAME_CLOSE);
+}
+
+/// @brief Prepares to splice body bytes, `available` of them waiting in the
+/// pipe. When chunked, opens a chunk of that size, queuing its size line on
+/// `output`, which must be sent before the bytes.
+/// @return how many bytes may be spliced.
+size_t	CgiStream::beginSplice(size_t available, OutputQueue& output)
+{
+	if (_framing == CGI_FRAME_LENGTH)
+		return (std::min(available, _remaining));
+	if (_framing != CGI_FRAME_CHUNKED)
+		return (available);
+	if (_chunkLeft == 0)
+	{
+		std::string	size = ft_chunk_size(available);
+
+		output.pushMemory(size);
+		_chunkLeft = available;
+	}
+	return (_chunkLeft);
+}
+
+/// @brief Accounts for `length` body bytes sent, queuing the end of the chunk
+/// on `output` once it is complete.
+void	CgiStream::spliced(size_t length, OutputQueue& output)
+{
+	if (_framing == CGI_FRAME_LENGTH)
+		_remaining -= std::min(length, _remaining);
+	if (_framing != CGI_FRAME_CHUNKED || _chunkLeft == 0)
+		return ;
+	_chunkLeft -= std::min(length, _chunkLeft);
+	if (_chunkLeft == 0)
+	{
+		std::string	end = "\r\n";
+		output.pushMemory(end);
+	}
+}
+
+/// @brief `splice()` is not available for this connection: the rest of the
+/// body is relayed by copying.
+void	CgiStream::disableSplice()
+{
+	_spliceable = false;
+}
+
+bool	CgiStream::isStarted() const
+{
+	return (_started);
+}
+
+/// @brief Whether reading the output is paused until the client catches up.
+bool	CgiStream::isPaused() const
+{
+	return (_paused);
+}
+
+void	CgiStream::setPaused(bool paused)
+{
+	_paused = paused;
+}
+
+/// @brief Keeps a copy of the body relayed from now on, e.g. to cache it,
+/// up to `limit` bytes. Bytes are then never spliced.
+void	CgiStream::capture(size_t limit)
+{
+	_capturing = true;
+	_captureLimit = limit;
+}
+
+/// @brief Moves the copy of the body into `body`.
+/// @return false if none was kept, or it outgrew its limit.
+bool	CgiStream::takeCaptured(std::string& body)
+{
+	bool	kept = _capturing;
+
+	body.clear();
+	body.swap(_captured);
+	_capturing = false;
+	return (kept);
+}
+
+/// @brief Also appends the body relayed from now on to `fd`, up to `limit`
+/// bytes, e.g. to cache it on disk. The fd stays the caller's.
+void	CgiStream::captureToFile(int fd, size_t limit)
+{
+	_captureFd = fd;
+	_captureFileLimit = limit;
+	_captureFileBytes = 0;
+}
+
+/// @brief Stops appending the body to the file of `captureToFile`.
+/// @return false if there was none, it outgrew its limit, or a write failed.
+bool	CgiStream::takeCapturedFile()
+{
+	bool	kept = (_captureFd != -1);
+
+	_captureFd = -1;
+	return (kept);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Private Methods
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Turns a CGI header block into `response`. Framing headers are the
+/// server's, except the script's `Content-Length`, which is kept aside.
+/// @return false if the block is not a valid CGI header.
+bool	CgiStream::_parseHeaderBlock(const std::string& block, HttpResponse& response)
+{
+	std::istringstream	lines(block);
+	std::string			line;
+	bool				hasStatus = false;
+	bool				hasLocation = false;
+
+	while (std::getline(lines, line))
+	{
+		size_t	colon = line.find(':');
+		if (colon == std::string::npos || colon == 0)
+			return (false);
+		std::string	name = ft_trim(line.substr(0, colon));
+		std::string	value = ft_trim(line.substr(colon + 1));
+		std::string	key = ft_to_lower(name);
+		if (key == "status")
+		{
+			int	code = std::atoi(value.c_str());
+			if (code < 100 || code > 999)
+				return (false);
+			size_t	space = value.find(' ');
+			response.setStatusCode(code, space == std::string::npos ? "" : ft_trim(value.substr(space)));
+			hasStatus = true;
+		}
+		else if (key == "content-length")
+		{
+			if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos)
+				return (false);
+			_contentLength = static_cast<ssize_t>(toSizeT(value));
+		}
+		else if (key == "transfer-encoding" || key == "connection")
+			continue ;
+		else
+		{
+			hasLocation = hasLocation || key == "location";
+			response.setHeader(name, value);
+		}
+	}
+	if (hasLocation && !hasStatus)
+		response.setStatusCode(302, "Found");
+	return (true);
+}
+
+void	CgiStream::_keep(const std::string& data)
+{
+	if (_captureFd != -1)
+		_keepInFile(data);
+	if (!_capturing)
+		return ;
+	if (_captured.size() + data.size() > _captureLimit)
+	{
+		// Too large to keep: stop copying, but go on relaying
+		_capturing = false;
+		std::string().swap(_captured);
+		return ;
+	}
+	_captured.append(data);
+}
+
+void	CgiStream::_keepInFile(const std::string& data)
+{
+	_captureFileBytes += data.size();
+	// Too large, or the disk is full: stop copying, but go on relaying
+	if (_captureFileBytes > _captureFileLimit || !ft_write_all(_captureFd, data))
+		_captureFd = -1;
+}
@@ -0,0 +1,255 @@
+#include "CgiWorker.hpp"
+#include "CgiProcess.hpp"
+#include "FastCgiRequest.hpp"
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <unistd.h>
+#include <poll.h>
+#include <algorithm>
+
+/// @brief Reads exactly `length` bytes from the blocking socket.
+static bool	ft_read_full(int fd, char* buffer, size_t length)
+{
+	while (length > 0)
+	{
+		ssize_t	count = read(fd, buffer, length);
+		if (count < 0 && errno == EINTR)
+			continue ;
+		if (count <= 0)
+			return (false);
+		buffer += count;
+		length -= count;
+	}
+	return (true);
+}
+
+/// @brief A name or value length of a PARAMS stream, see `FastCgiRequest`.
+static size_t	ft_read_length(const std::string& params, size_t& offset)
+{
+	const unsigned char*	data = (const unsigned char*)params.data() + offset;
+
+	if (offset >= params.size())
+		return (0);
+	if (data[0] < 128)
+	{
+		offset += 1;
+		return (data[0]);
+	}
+	if (offset + 4 > params.size())
+	{
+		offset = params.size();
+		return (0);
+	}
+	offset += 4;
+	return (((size_t)(data[0] & 0x7f) << 24) | (data[1] << 16) | (data[2] << 8) | data[3]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Constructor & Destructor
+////////////////////////////////////////////////////////////////////////////////
+
+CgiWorker::CgiWorker(int socketFd)
+	: _socketFd(socketFd), _requestId(0)
+{
+	std::memset(&_rlimits, 0, sizeof(_rlimits));
+}
+
+CgiWorker::~CgiWorker()
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Public Methods
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Serves requests until the server closes the socket.
+/// @return the exit status of the worker.
+int	CgiWorker::run()
+{
+	while (_readRequest())
+	{
+		if (!_runScript())
+			return (1);
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Private Methods
+////////////////////////////////////////////////////////////////////////////////
+
+bool	CgiWorker::_readRecord(int& type, int& requestId, std::string& content)
+{
+	unsigned char	header[FCGI_HEADER_LEN];
+	char			padding[256];
+
+	if (!ft_read_full(_socketFd, (char*)header, sizeof(header)) || header[0] != FCGI_VERSION_1)
+		return (false);
+	type = header[1];
+	requestId = (header[2] << 8) | header[3];
+	content.resize((header[4] << 8) | header[5]);
+	if (!content.empty() && !ft_read_full(_socketFd, &content[0], content.size()))
+		return (false);
+	return (ft_read_full(_socketFd, padding, header[6]));
+}
+
+/// @brief Reads the next request: BEGIN_REQUEST, then the PARAMS and STDIN
+/// streams up to their empty records.
+/// @return false once the socket is closed.
+bool	CgiWorker::_readRequest()
+{
+	int			type;
+	int			requestId;
+	std::string	content;
+	std::string	params;
+	bool		paramsDone = false;
+
+	_requestId = 0;
+	_body.clear();
+	while (_readRecord(type, requestId, content))
+	{
+		if (type == FCGI_BEGIN_REQUEST)
+		{
+			_requestId = requestId;
+			params.clear();
+			_body.clear();
+			paramsDone = false;
+		}
+		else if (requestId != _requestId || _requestId == 0)
+			continue ;
+		else if (type == FCGI_PARAMS && content.empty())
+			paramsDone = true;
+		else if (type == FCGI_PARAMS)
+			params += content;
+		else if (type == FCGI_STDIN && !content.empty())
+			_body += content;
+		else if (type == FCGI_STDIN && paramsDone)
+		{
+			_parseParams(params);
+			return (true);
+		}
+	}
+	return (false);
+}
+
+/// @brief Turns the PARAMS stream into the script's environment, taking out
+/// the interpreter and resource limits the server added.
+void	CgiWorker::_parseParams(const std::string& params)
+{
+	size_t	offset = 0;
+
+	_env.clear();
+	_interpreter.clear();
+	_scriptPath.clear();
+	std::memset(&_rlimits, 0, sizeof(_rlimits));
+	while (offset < params.size())
+	{
+		size_t	nameLength = ft_read_length(params, offset);
+		size_t	valueLength = ft_read_length(params, offset);
+		if (offset + nameLength + valueLength > params.size())
+			break ;
+		std::string	name = params.substr(offset, nameLength);
+		std::string	value = params.substr(offset + nameLength, valueLength);
+		offset += nameLength + valueLength;
+		if (name == CGI_WORKER_INTERPRETER)
+			_interpreter = value;
+		else if (name == CGI_WORKER_RLIMITS)
+		{
+			std::istringstream	limits(value);
+			limits >> _rlimits.cpu >> _rlimits.memory >> _rlimits.files;
+		}
+		else
+		{
+			if (name == "SCRIPT_FILENAME")
+				_scriptPath = value;
+			_env.push_back(name + "=" + value);
+		}
+	}
+}
+
+/// @brief Runs the script of the request, sending its output back as STDOUT
+/// as it comes, then ends the request. Writes block: a client that reads
+/// slowly holds up the script rather than filling the worker's memory.
+/// @return false if the server closed the socket.
+bool	CgiWorker::_runScript()
+{
+	CgiProcess	script(-1, 0);
+	std::string	output;
+	bool		connected = true;
+	int			status = 1;
+
+	script.setRlimits(_rlimits);
+	// Without output, the server answers 502
+	if (_scriptPath.empty() || !script.start(_interpreter, _scriptPath, _env, _body))
+		return (_endRequest());
+	std::string().swap(_body);
+	while (status > 0 && connected)
+	{
+		struct pollfd	fds[2];
+		nfds_t			count = 0;
+
+		fds[count++] = (struct pollfd){script.getStdoutFd(), POLLIN, 0};
+		if (script.getStdinFd() != -1)
+			fds[count++] = (struct pollfd){script.getStdinFd(), POLLOUT, 0};
+		if (poll(fds, count, -1) == -1)
+		{
+			if (errno == EINTR)
+				continue ;
+			break ;
+		}
+		// A script may not read its whole body; that is not an error
+		if (count > 1 && fds[1].revents != 0
+			&& (script.writeInput() < 0 || script.inputDone()))
+			script.closeInput();
+		if (fds[0].revents != 0)
+		{
+			status = script.readOutput();
+			script.takeOutput(output);
+			connected = _writeStdout(output);
+		}
+	}
+	if (!connected)
+		script.kill();
+	script.closeInput();
+	script.closeOutput();
+	script.reap(true);
+	return (connected && _endRequest());
+}
+
+/// @brief Sends `data` as STDOUT records.
+bool	CgiWorker::_writeStdout(const std::string& data)
+{
+	std::string	records;
+
+	for (size_t offset = 0; offset < data.size(); offset += FCGI_MAX_CONTENT)
+	{
+		size_t	length = std::min(data.size() - offset, (size_t)FCGI_MAX_CONTENT);
+		FastCgiRequest::appendRecord(records, FCGI_STDOUT, _requestId, data.data() + offset, length);
+	}
+	return (_write(records));
+}
+
+/// @brief Ends the STDOUT stream and the request.
+bool	CgiWorker::_endRequest()
+{
+	const char	end[8] = {0, 0, 0, 0, FCGI_REQUEST_COMPLETE, 0, 0, 0};
+	std::string	records;
+
+	FastCgiRequest::appendRecord(records, FCGI_STDOUT, _requestId, "", 0);
+	FastCgiRequest::appendRecord(records, FCGI_END_REQUEST, _requestId, end, sizeof(end));
+	return (_write(records));
+}
+
+bool	CgiWorker::_write(const std::string& data)
+{
+	for (size_t offset = 0; offset < data.size(); )
+	{
+		ssize_t	written = write(_socketFd, data.data() + offset, data.size() - offset);
+		if (written < 0 && errno == EINTR)
+			continue ;
+		if (written <= 0)
+			return (false);
+		offset += written;
+	}
+	return (true);
+}
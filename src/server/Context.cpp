@@ -160,7 +160,6 @@ std::string	getParentPath(const std::string& path)
 
 	if (trimmedPath.length() > 1 && trimmedPath[trimmedPath.length() - 1] == '/') // while? if?
 		trimmedPath.erase(trimmedPath.length() - 1);
-	std::cout << "trimmedPath: " << trimmedPath << std::endl;
 	
 	std::string::size_type lastSlashPos = trimmedPath.find_last_of('/');
 	if (lastSlashPos == std::string::npos)
@@ -0,0 +1,581 @@
+#include "DiskCache.hpp"
+#include "Util.hpp"
+#include <algorithm>
+#include <vector>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <ctime>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+/// Defaults, overridden by the `cgi_cache_disk_size` and `cgi_cache_keys` directives
+#define DISK_CACHE_DEFAULT_BUDGET	(256 * 1024 * 1024)
+#define DISK_CACHE_DEFAULT_KEYS		16384
+/// Version of the index and file layout; another one starts the cache over
+#define DISK_CACHE_MAGIC			"WSCACHE2"
+/// Largest header of a cache file: key, status line and headers
+#define DISK_CACHE_MAX_HEAD			(128 * 1024)
+/// Temporary files older than this were left by a crash, seconds
+#define DISK_CACHE_TMP_MAX_AGE		3600
+
+/// @brief State of a slot of the index.
+enum e_slot_state
+{
+	SLOT_EMPTY,
+	SLOT_USED,
+	SLOT_DELETED	// left by a removal, so probes go on past it
+};
+
+/// @brief The start of the index file.
+struct DiskCache::Header
+{
+	char		magic[8];
+	uint64_t	slots;
+	uint64_t	used;
+	uint64_t	deleted;
+	uint64_t	bytes;			// of the files indexed
+	uint64_t	clock;			// counts uses, for LRU
+};
+
+/// @brief An entry of the index, found by the hash of its key.
+struct DiskCache::Slot
+{
+	uint64_t	hash;
+	uint64_t	size;			// of the file, header included
+	uint64_t	storedAt;		// wall-clock ms
+	uint64_t	expires;
+	uint64_t	staleUntil;		// see `CachedResponse`
+	uint64_t	errorUntil;
+	uint64_t	lastUse;		// `Header::clock` then
+	uint32_t	state;
+	uint32_t	reserved;
+	char		etag[64];		// empty if none, or too long to keep
+	char		lastModified[32];
+};
+
+static std::string	ft_to_lower(std::string value)
+{
+	for (size_t i = 0; i < value.size(); i++)
+		value[i] = std::tolower(value[i]);
+	return (value);
+}
+
+/// @brief The value of header `name` of a response, whatever its case.
+static std::string	ft_header(const std::map<std::string, std::string>& headers, const std::string& name)
+{
+	for (std::map<std::string, std::string>::const_iterator it = headers.begin(); it != headers.end(); ++it)
+	{
+		if (ft_to_lower(it->first) == name)
+			return (it->second);
+	}
+	return ("");
+}
+
+/// @brief Copies `value` into a fixed field of the index, or leaves it empty
+/// if it does not fit.
+static void	ft_set_field(char* field, size_t size, const std::string& value)
+{
+	std::memset(field, 0, size);
+	if (value.size() < size)
+		std::memcpy(field, value.data(), value.size());
+}
+
+static bool	ft_write_all(int fd, const std::string& data)
+{
+	for (size_t written = 0; written < data.size(); )
+	{
+		ssize_t	count = write(fd, data.data() + written, data.size() - written);
+		if (count < 0 && errno == EINTR)
+			continue ;
+		if (count <= 0)
+			return (false);
+		written += count;
+	}
+	return (true);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// DiskCacheEntry
+////////////////////////////////////////////////////////////////////////////////
+
+DiskCacheEntry::DiskCacheEntry()
+	: fd(-1), offset(0), length(0)
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Constructor & Destructor
+////////////////////////////////////////////////////////////////////////////////
+
+DiskCache::DiskCache()
+	: _budget(DISK_CACHE_DEFAULT_BUDGET), _keys(DISK_CACHE_DEFAULT_KEYS), _indexFd(-1),
+	_map(NULL), _mapSize(0), _header(NULL), _slots(NULL)
+{}
+
+/// @brief Drops the files still being written; the cache itself stays.
+DiskCache::~DiskCache()
+{
+	while (!_pending.empty())
+		discard(_pending.begin()->first);
+	if (_map != NULL)
+		munmap(_map, _mapSize);
+	if (_indexFd != -1)
+		close(_indexFd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Public Methods
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Opens the cache in directory `path`, creating it, and maps its
+/// index. An index of another layout or size is started over.
+/// @return false if the cache cannot be used; it then stays closed.
+bool	DiskCache::open(const std::string& path)
+{
+	struct stat	st;
+
+	_path = path;
+	while (_path.size() > 1 && _path[_path.size() - 1] == '/')
+		_path.erase(_path.size() - 1);
+	if ((mkdir(_path.c_str(), 0700) != 0 && errno != EEXIST)
+		|| (mkdir((_path + "/tmp").c_str(), 0700) != 0 && errno != EEXIST))
+	{
+		std::cerr << "Error: cgi_cache_path " << _path << ": " << strerror(errno) << std::endl;
+		return (false);
+	}
+	_indexFd = ::open((_path + "/index").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (_indexFd == -1)
+	{
+		std::cerr << "Error: cgi_cache_path " << _path << ": " << strerror(errno) << std::endl;
+		return (false);
+	}
+	_mapSize = sizeof(Header) + _keys * sizeof(Slot);
+	flock(_indexFd, LOCK_EX);
+	bool	fresh = (fstat(_indexFd, &st) != 0 || static_cast<size_t>(st.st_size) != _mapSize);
+	if (fresh && (ftruncate(_indexFd, 0) != 0 || ftruncate(_indexFd, _mapSize) != 0))
+	{
+		std::cerr << "Error: cgi_cache_path " << _path << ": " << strerror(errno) << std::endl;
+		flock(_indexFd, LOCK_UN);
+		close(_indexFd);
+		_indexFd = -1;
+		return (false);
+	}
+	_map = mmap(NULL, _mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, _indexFd, 0);
+	if (_map == MAP_FAILED)
+	{
+		std::cerr << "Error: cgi_cache_path " << _path << ": " << strerror(errno) << std::endl;
+		_map = NULL;
+		flock(_indexFd, LOCK_UN);
+		close(_indexFd);
+		_indexFd = -1;
+		return (false);
+	}
+	_header = static_cast<Header*>(_map);
+	_slots = reinterpret_cast<Slot*>(static_cast<char*>(_map) + sizeof(Header));
+	if (std::memcmp(_header->magic, DISK_CACHE_MAGIC, sizeof(_header->magic)) != 0 || _header->slots != _keys)
+	{
+		// The files it named stay behind, outside the budget
+		std::memset(_map, 0, _mapSize);
+		std::memcpy(_header->magic, DISK_CACHE_MAGIC, sizeof(_header->magic));
+		_header->slots = _keys;
+	}
+	_sweepTemporary();
+	flock(_indexFd, LOCK_UN);
+	return (true);
+}
+
+bool	DiskCache::isOpen() const
+{
+	return (_header != NULL);
+}
+
+/// @brief Looks `key` up. An entry fresh or within a stale window has its
+/// file opened and its header read into `entry`; one past them only has its
+/// times and validators set.
+/// @param now wall-clock ms, see `now()`.
+/// @return `DISK_STALE` only for an entry that can be revalidated: one with
+/// neither `ETag` nor `Last-Modified` is a miss.
+e_disk_lookup	DiskCache::lookup(const std::string& key, uint64_t now, DiskCacheEntry& entry)
+{
+	uint64_t	hash = _hash(key);
+	Slot		slot;
+
+	if (!isOpen())
+		return (DISK_MISS);
+	flock(_indexFd, LOCK_SH);
+	long		index = _find(hash);
+	uint64_t	kept = 0;
+	if (index != -1)
+	{
+		slot = _slots[index];
+		kept = std::max(slot.expires, std::max(slot.staleUntil, slot.errorUntil));
+		// Racing another reader only makes the order a little less exact
+		if (now < kept)
+			_slots[index].lastUse = ++_header->clock;
+	}
+	flock(_indexFd, LOCK_UN);
+	if (index == -1)
+		return (DISK_MISS);
+	entry.response.storedAt = slot.storedAt;
+	entry.response.expires = slot.expires;
+	entry.response.staleUntil = slot.staleUntil;
+	entry.response.errorUntil = slot.errorUntil;
+	entry.etag = std::string(slot.etag, strnlen(slot.etag, sizeof(slot.etag)));
+	entry.lastModified = std::string(slot.lastModified, strnlen(slot.lastModified, sizeof(slot.lastModified)));
+	if (now >= kept)
+		return (entry.etag.empty() && entry.lastModified.empty() ? DISK_MISS : DISK_STALE);
+	if (!_readHead(key, entry))
+	{
+		// Removed by hand, or another key of the same hash
+		flock(_indexFd, LOCK_EX);
+		index = _find(hash);
+		if (index != -1 && _slots[index].storedAt == slot.storedAt)
+			_remove(index);
+		flock(_indexFd, LOCK_UN);
+		return (DISK_MISS);
+	}
+	return (DISK_HIT);
+}
+
+/// @brief Starts the file of a response for `key`: writes its header to a
+/// temporary file, to which the body is then appended.
+/// @return the fd of the file, -1 if it cannot be written.
+int	DiskCache::create(const std::string& key, const CachedResponse& response)
+{
+	std::string	head;
+
+	if (!isOpen())
+		return (-1);
+	head = DISK_CACHE_MAGIC " " + toString(key.size()) + "\n" + key + "\n"
+		+ toString(response.status) + " " + response.message + "\r\n";
+	for (std::map<std::string, std::string>::const_iterator it = response.headers.begin();
+		it != response.headers.end(); ++it)
+		head += it->first + ": " + it->second + "\r\n";
+	head += "\r\n";
+	if (head.size() > DISK_CACHE_MAX_HEAD)
+		return (-1);
+	std::string			path = _path + "/tmp/XXXXXX";
+	std::vector<char>	name(path.begin(), path.end());
+	name.push_back('\0');
+	int	fd = mkstemp(&name[0]);
+	if (fd == -1)
+	{
+		std::cerr << "Error: cgi_cache_path " << _path << ": " << strerror(errno) << std::endl;
+		return (-1);
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	_pending[fd] = &name[0];
+	if (!ft_write_all(fd, head))
+	{
+		discard(fd);
+		return (-1);
+	}
+	return (fd);
+}
+
+/// @brief The body of the file from `create` is complete: moves it into
+/// place and indexes it under `key`, replacing any older one, then evicts
+/// down to the budget. `response` gives its expiry and validators.
+void	DiskCache::commit(const std::string& key, int fd, const CachedResponse& response)
+{
+	std::map<int, std::string>::iterator it = _pending.find(fd);
+	uint64_t	hash = _hash(key);
+	std::string	path = _filePath(hash);
+	struct stat	st;
+
+	if (it == _pending.end())
+		return ;
+	std::string	temporary = it->second;
+	_pending.erase(it);
+	bool	written = (fstat(fd, &st) == 0);
+	close(fd);
+	flock(_indexFd, LOCK_EX);
+	if (written)
+	{
+		mkdir(path.substr(0, path.rfind('/')).c_str(), 0700);
+		written = (rename(temporary.c_str(), path.c_str()) == 0);
+	}
+	if (!written)
+	{
+		unlink(temporary.c_str());
+		flock(_indexFd, LOCK_UN);
+		return ;
+	}
+	long	index = _find(hash);
+	if (index != -1)
+		_header->bytes -= _slots[index].size;
+	else
+	{
+		// Keep a quarter of the slots empty, so probes stay short
+		if ((_header->used + 1) * 4 > _header->slots * 3)
+			_evict(_header->slots);
+		if ((_header->used + _header->deleted + 1) * 4 > _header->slots * 3)
+			_rehash();
+		index = _place(hash);
+	}
+	Slot&	slot = _slots[index];
+	slot.hash = hash;
+	slot.size = st.st_size;
+	slot.storedAt = response.storedAt;
+	slot.expires = response.expires;
+	slot.staleUntil = response.staleUntil;
+	slot.errorUntil = response.errorUntil;
+	slot.lastUse = ++_header->clock;
+	slot.state = SLOT_USED;
+	ft_set_field(slot.etag, sizeof(slot.etag), ft_header(response.headers, "etag"));
+	ft_set_field(slot.lastModified, sizeof(slot.lastModified), ft_header(response.headers, "last-modified"));
+	_header->bytes += slot.size;
+	if (_header->bytes > _budget)
+		_evict(index);
+	flock(_indexFd, LOCK_UN);
+}
+
+/// @brief Drops the file from `create`, e.g. for a response cut short.
+void	DiskCache::discard(int fd)
+{
+	std::map<int, std::string>::iterator it = _pending.find(fd);
+
+	if (it == _pending.end())
+		return ;
+	unlink(it->second.c_str());
+	close(fd);
+	_pending.erase(it);
+}
+
+/// @brief The entry of `key` was revalidated: it takes the times of
+/// `response`, stored again at `storedAt`.
+/// @return false if it is gone.
+bool	DiskCache::refresh(const std::string& key, const CachedResponse& response)
+{
+	if (!isOpen())
+		return (false);
+	flock(_indexFd, LOCK_EX);
+	long	index = _find(_hash(key));
+	if (index != -1)
+	{
+		_slots[index].storedAt = response.storedAt;
+		_slots[index].expires = response.expires;
+		_slots[index].staleUntil = response.staleUntil;
+		_slots[index].errorUntil = response.errorUntil;
+		_slots[index].lastUse = ++_header->clock;
+	}
+	flock(_indexFd, LOCK_UN);
+	return (index != -1);
+}
+
+/// @brief Bytes of files kept before the least recently used go.
+void	DiskCache::setBudget(size_t bytes)
+{
+	_budget = bytes;
+}
+
+/// @brief Slots of the index, set before `open()`: at most three quarters
+/// of them hold entries.
+void	DiskCache::setKeys(size_t keys)
+{
+	_keys = std::max(keys, static_cast<size_t>(16));
+}
+
+size_t	DiskCache::getBudget() const
+{
+	return (_budget);
+}
+
+size_t	DiskCache::getBytes() const
+{
+	return (isOpen() ? _header->bytes : 0);
+}
+
+/// @brief Wall-clock ms: entries outlive the process, and its monotonic clock.
+uint64_t	DiskCache::now()
+{
+	struct timeval	tv;
+
+	gettimeofday(&tv, NULL);
+	return (static_cast<uint64_t>(tv.tv_sec) * 1000 + tv.tv_usec / 1000);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Private Methods
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief The slot of `hash`, -1 if none. Under the lock.
+long	DiskCache::_find(uint64_t hash) const
+{
+	for (size_t n = 0, i = hash % _header->slots; n < _header->slots; n++, i = (i + 1) % _header->slots)
+	{
+		if (_slots[i].state == SLOT_EMPTY)
+			return (-1);
+		if (_slots[i].state == SLOT_USED && _slots[i].hash == hash)
+			return (i);
+	}
+	return (-1);
+}
+
+/// @brief Takes the first free slot on the probe of `hash`. Under the lock,
+/// with a slot known to be empty.
+long	DiskCache::_place(uint64_t hash)
+{
+	size_t	i = hash % _header->slots;
+
+	while (_slots[i].state == SLOT_USED)
+		i = (i + 1) % _header->slots;
+	if (_slots[i].state == SLOT_DELETED)
+		_header->deleted--;
+	_header->used++;
+	_slots[i].state = SLOT_USED;
+	return (i);
+}
+
+/// @brief Removes an entry and its file. Under the exclusive lock.
+void	DiskCache::_remove(size_t slot)
+{
+	unlink(_filePath(_slots[slot].hash).c_str());
+	_header->bytes -= std::min(_header->bytes, _slots[slot].size);
+	_header->used--;
+	_header->deleted++;
+	_slots[slot].state = SLOT_DELETED;
+}
+
+/// @brief Removes the least recently used entries but `keep` until the files
+/// take 90% of the budget and, when the index is full, a tenth of its
+/// entries: each pass makes room for many more. Under the exclusive lock.
+void	DiskCache::_evict(size_t keep)
+{
+	std::vector<std::pair<uint64_t, size_t> >	byUse;
+	uint64_t									target = _budget / 10 * 9;
+	size_t										count = 0;
+
+	if ((_header->used + 1) * 4 > _header->slots * 3)
+		count = _header->used / 10 + 1;
+	for (size_t i = 0; i < _header->slots; i++)
+	{
+		if (_slots[i].state == SLOT_USED && i != keep)
+			byUse.push_back(std::make_pair(_slots[i].lastUse, i));
+	}
+	std::sort(byUse.begin(), byUse.end());
+	for (size_t i = 0; i < byUse.size() && (_header->bytes > target || count > 0); i++)
+	{
+		_remove(byUse[i].second);
+		if (count > 0)
+			count--;
+	}
+}
+
+/// @brief Places the entries again, without the slots of removed ones.
+/// Under the exclusive lock.
+void	DiskCache::_rehash()
+{
+	std::vector<Slot>	used;
+
+	for (size_t i = 0; i < _header->slots; i++)
+	{
+		if (_slots[i].state == SLOT_USED)
+			used.push_back(_slots[i]);
+	}
+	std::memset(_slots, 0, _header->slots * sizeof(Slot));
+	_header->used = 0;
+	_header->deleted = 0;
+	for (size_t i = 0; i < used.size(); i++)
+		_slots[_place(used[i].hash)] = used[i];
+}
+
+/// @brief Opens the file of `key` and parses its header into `entry`.
+/// @return false if it is gone, or is the file of another key.
+bool	DiskCache::_readHead(const std::string& key, DiskCacheEntry& entry)
+{
+	int			fd = ::open(_filePath(_hash(key)).c_str(), O_RDONLY | O_CLOEXEC);
+	struct stat	st;
+	std::string	head;
+	std::string	prefix = DISK_CACHE_MAGIC " " + toString(key.size()) + "\n" + key + "\n";
+
+	if (fd == -1)
+		return (false);
+	if (fstat(fd, &st) == 0)
+	{
+		head.resize(std::min(static_cast<size_t>(st.st_size), prefix.size() + DISK_CACHE_MAX_HEAD));
+		ssize_t	count = head.empty() ? 0 : pread(fd, &head[0], head.size(), 0);
+		head.resize(count < 0 ? 0 : count);
+	}
+	size_t	end = head.find("\r\n\r\n", prefix.size());
+	if (head.compare(0, prefix.size(), prefix) != 0 || end == std::string::npos)
+	{
+		close(fd);
+		return (false);
+	}
+	size_t	lineEnd = head.find("\r\n", prefix.size());
+	std::string	status = head.substr(prefix.size(), lineEnd - prefix.size());
+	size_t	space = status.find(' ');
+	entry.response.status = std::atoi(status.c_str());
+	entry.response.message = (space == std::string::npos) ? "" : status.substr(space + 1);
+	entry.response.headers.clear();
+	while (lineEnd < end)
+	{
+		size_t		start = lineEnd + 2;
+		lineEnd = head.find("\r\n", start);
+		std::string	line = head.substr(start, lineEnd - start);
+		size_t		colon = line.find(": ");
+		if (colon != std::string::npos)
+			entry.response.headers[line.substr(0, colon)] = line.substr(colon + 2);
+	}
+	entry.fd = fd;
+	entry.offset = end + 4;
+	entry.length = st.st_size - entry.offset;
+	return (true);
+}
+
+/// @brief `<path>/ab/abcdef0123456789`: 256 directories keep each one small.
+std::string	DiskCache::_filePath(uint64_t hash) const
+{
+	static const char*	digits = "0123456789abcdef";
+	char				name[17];
+
+	for (int i = 15; i >= 0; i--, hash >>= 4)
+		name[i] = digits[hash & 0xf];
+	name[16] = '\0';
+	return (_path + "/" + std::string(name, 2) + "/" + name);
+}
+
+/// @brief Removes the temporary files a crash left behind. Those of other
+/// workers still writing are recent, and kept.
+void	DiskCache::_sweepTemporary()
+{
+	DIR*			dir = opendir((_path + "/tmp").c_str());
+	struct dirent*	file;
+	struct stat		st;
+	time_t			now = time(NULL);
+
+	if (dir == NULL)
+		return ;
+	while ((file = readdir(dir)) != NULL)
+	{
+		std::string	path = _path + "/tmp/" + file->d_name;
+
+		if (file->d_name[0] != '.' && stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)
+			&& now - st.st_mtime > DISK_CACHE_TMP_MAX_AGE)
+			unlink(path.c_str());
+	}
+	closedir(dir);
+}
+
+/// @brief 64-bit FNV-1a: collisions are rare enough that the key kept in
+/// each file settles them.
+uint64_t	DiskCache::_hash(const std::string& key)
+{
+	uint64_t	hash = 14695981039346656037ULL;
+
+	for (size_t i = 0; i < key.size(); i++)
+	{
+		hash ^= static_cast<unsigned char>(key[i]);
+		hash *= 1099511628211ULL;
+	}
+	return (hash);
+}
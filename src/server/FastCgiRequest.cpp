@@ -0,0 +1,154 @@
+#include "FastCgiRequest.hpp"
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+
+/// Bytes read from the application per read, and reads per readiness event
+#define FASTCGI_READ_BUFFER_SIZE	16384
+#define FASTCGI_READS_PER_EVENT		4
+
+/// @brief Name and value lengths: one byte below 128, else four with the
+/// high bit set.
+static void	ft_append_length(std::string& out, size_t length)
+{
+	if (length < 128)
+	{
+		out += (char)length;
+		return ;
+	}
+	out += (char)(((length >> 24) & 0x7f) | 0x80);
+	out += (char)((length >> 16) & 0xff);
+	out += (char)((length >> 8) & 0xff);
+	out += (char)(length & 0xff);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Constructor & Destructor
+////////////////////////////////////////////////////////////////////////////////
+
+FastCgiRequest::FastCgiRequest(int clientFd, unsigned int clientGeneration, const std::string& upstream)
+	: UpstreamRequest(clientFd, clientGeneration, upstream), _ended(false), _complete(false)
+{}
+
+FastCgiRequest::~FastCgiRequest()
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Public Methods
+////////////////////////////////////////////////////////////////////////////////
+
+void	FastCgiRequest::appendRecord(std::string& out, int type, int requestId, const char* content, size_t length)
+{
+	char	header[FCGI_HEADER_LEN] = {
+		FCGI_VERSION_1, (char)type,
+		(char)(requestId >> 8), (char)(requestId & 0xff),
+		(char)(length >> 8), (char)(length & 0xff),
+		0, 0
+	};
+
+	out.append(header, FCGI_HEADER_LEN);
+	out.append(content, length);
+}
+
+/// @brief Appends a stream (PARAMS, STDIN, STDOUT) as records, ended by an
+/// empty one.
+void	FastCgiRequest::appendStream(std::string& out, int type, int requestId, const std::string& data)
+{
+	for (size_t offset = 0; offset < data.size(); offset += FCGI_MAX_CONTENT)
+	{
+		size_t	length = std::min(data.size() - offset, (size_t)FCGI_MAX_CONTENT);
+		appendRecord(out, type, requestId, data.data() + offset, length);
+	}
+	appendRecord(out, type, requestId, "", 0);
+}
+
+/// @brief Encodes the whole request: the CGI environment `env` as PARAMS,
+/// then `body` as STDIN.
+void	FastCgiRequest::encode(const std::vector<std::string>& env, const std::string& body)
+{
+	const char	begin[8] = {0, FCGI_RESPONDER, FCGI_KEEP_CONN, 0, 0, 0, 0, 0};
+	std::string	params;
+
+	for (size_t i = 0; i < env.size(); i++)
+	{
+		size_t	equal = env[i].find('=');
+		if (equal == std::string::npos)
+			continue ;
+		ft_append_length(params, equal);
+		ft_append_length(params, env[i].size() - equal - 1);
+		params.append(env[i], 0, equal);
+		params.append(env[i], equal + 1, std::string::npos);
+	}
+	_request.clear();
+	_request.reserve(FCGI_HEADER_LEN * 6 + sizeof(begin) + params.size() + body.size());
+	appendRecord(_request, FCGI_BEGIN_REQUEST, FCGI_SERVER_REQUEST_ID, begin, sizeof(begin));
+	appendStream(_request, FCGI_PARAMS, FCGI_SERVER_REQUEST_ID, params);
+	appendStream(_request, FCGI_STDIN, FCGI_SERVER_REQUEST_ID, body);
+}
+
+void	FastCgiRequest::rewind()
+{
+	UpstreamRequest::rewind();
+	_ended = false;
+	_complete = false;
+}
+
+/// @brief Reads and parses what the application sent, a bounded amount per
+/// call. STDERR records are logged; records of other requests (management
+/// records) are skipped.
+/// @return 1 while more may come, 0 once the request ended, -1 on error or
+/// if the connection closed first.
+int	FastCgiRequest::receive()
+{
+	char	buffer[FASTCGI_READ_BUFFER_SIZE];
+
+	for (int i = 0; i < FASTCGI_READS_PER_EVENT && !_ended; i++)
+	{
+		ssize_t	count = read(_socketFd, buffer, sizeof(buffer));
+		if (count == 0)
+			return (-1);
+		if (count < 0)
+			return ((errno == EAGAIN || errno == EINTR) ? 1 : -1);
+		_received += count;
+		_input.append(buffer, count);
+
+		size_t	offset = 0;
+		while (!_ended && _input.size() - offset >= FCGI_HEADER_LEN)
+		{
+			const unsigned char*	header = (const unsigned char*)_input.data() + offset;
+			size_t					length = (header[4] << 8) | header[5];
+			size_t					total = FCGI_HEADER_LEN + length + header[6];
+			const char*				content = _input.data() + offset + FCGI_HEADER_LEN;
+
+			if (header[0] != FCGI_VERSION_1)
+				return (-1);
+			if (_input.size() - offset < total)
+				break ;
+			if (((header[2] << 8) | header[3]) == FCGI_SERVER_REQUEST_ID)
+			{
+				if (header[1] == FCGI_STDOUT)
+					_output.append(content, length);
+				else if (header[1] == FCGI_STDERR && length > 0)
+					std::cerr << "FastCGI " << _upstream << ": " << std::string(content, length) << std::endl;
+				else if (header[1] == FCGI_END_REQUEST && length >= 8)
+				{
+					_ended = true;
+					_complete = (content[4] == FCGI_REQUEST_COMPLETE);
+				}
+			}
+			offset += total;
+		}
+		_input.erase(0, offset);
+	}
+	if (_ended)
+		return (_complete ? 0 : -1);
+	return (1);
+}
+
+/// @brief Whether the connection can carry another request: this one ended
+/// cleanly and nothing follows it.
+bool	FastCgiRequest::isReusable() const
+{
+	return (_complete && _input.empty());
+}
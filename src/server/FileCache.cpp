@@ -0,0 +1,220 @@
+#include "FileCache.hpp"
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+
+/// Defaults, overridden by the `file_cache_*` directives
+#define FILE_CACHE_DEFAULT_VALID	5
+#define FILE_CACHE_DEFAULT_BUDGET	(16 * 1024 * 1024)
+
+////////////////////////////////////////////////////////////////////////////////
+/// FileInfo
+////////////////////////////////////////////////////////////////////////////////
+
+FileInfo::FileInfo()
+	: kind(MISSING), error(0), size(0), mtime(0), inode(0), hasBody(false), hasListing(false)
+{}
+
+bool	FileInfo::isFile() const
+{
+	return (kind == REGULAR);
+}
+
+bool	FileInfo::isDir() const
+{
+	return (kind == DIRECTORY);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Constructor & Destructor
+////////////////////////////////////////////////////////////////////////////////
+
+FileCache::FileCache()
+	: _bytes(0), _budget(FILE_CACHE_DEFAULT_BUDGET), _bodyLimit(0), _validity(FILE_CACHE_DEFAULT_VALID)
+{}
+
+FileCache::~FileCache()
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Public Methods
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Returns the cached information of `path` if it is still trusted.
+/// @param needListing a directory cached without its entries counts as a miss.
+/// @return `NULL` on a miss; the pointer stays valid until the next `insert()`.
+const FileInfo*	FileCache::lookup(const std::string& path, bool needListing)
+{
+	std::map<std::string, Entry>::iterator it = _entries.find(path);
+
+	if (it == _entries.end())
+		return (NULL);
+	if (time(NULL) > it->second.validUntil)
+		return (NULL);
+	if (needListing && it->second.info.isDir() && !it->second.info.hasListing)
+		return (NULL);
+	_lru.splice(_lru.begin(), _lru, it->second.lru);
+	return (&it->second.info);
+}
+
+/// @brief Stores (or replaces) the information of `path`, then evicts least
+/// recently used entries until the budget fits again. The entry just inserted
+/// is never evicted, so the request that asked for it can always use it.
+void	FileCache::insert(const std::string& path, const FileInfo& info)
+{
+	std::map<std::string, Entry>::iterator it = _entries.find(path);
+
+	if (it != _entries.end())
+	{
+		_bytes -= _footprint(it->second.info);
+		_lru.erase(it->second.lru);
+		_entries.erase(it);
+	}
+	_lru.push_front(path);
+	Entry&	entry = _entries[path];
+	entry.info = info;
+	entry.validUntil = time(NULL) + _validity;
+	entry.lru = _lru.begin();
+	_bytes += _footprint(info);
+	_evict(path);
+}
+
+void	FileCache::setValidity(time_t seconds)
+{
+	_validity = seconds;
+}
+
+void	FileCache::setBudget(size_t bytes)
+{
+	_budget = bytes;
+}
+
+/// @brief Regular files up to this size are loaded with their content.
+void	FileCache::setBodyLimit(size_t bytes)
+{
+	_bodyLimit = bytes;
+}
+
+size_t	FileCache::getBodyLimit() const
+{
+	return (_bodyLimit);
+}
+
+/// @brief Gathers the information of `path` with blocking syscalls.
+/// Safe to call from any thread: it touches no shared state.
+/// @param bodyLimit regular files up to this size are read into `body`.
+/// @param withListing directories get their entries read into `listing`.
+FileInfo	FileCache::load(const std::string& path, size_t bodyLimit, bool withListing)
+{
+	FileInfo	info;
+	struct stat	st;
+
+	if (stat(path.c_str(), &st) != 0)
+	{
+		info.error = errno;
+		return (info);
+	}
+	info.size = st.st_size;
+	info.mtime = st.st_mtime;
+	info.inode = st.st_ino;
+	if (S_ISREG(st.st_mode))
+	{
+		info.kind = FileInfo::REGULAR;
+		if (static_cast<size_t>(st.st_size) > bodyLimit)
+			return (info);
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			info.error = errno;
+			return (info);
+		}
+		info.body.resize(st.st_size);
+		size_t	total = 0;
+		while (total < info.body.size())
+		{
+			ssize_t count = read(fd, &info.body[total], info.body.size() - total);
+			if (count < 0 && errno == EINTR)
+				continue ;
+			if (count <= 0)
+				break ;
+			total += count;
+		}
+		if (total != info.body.size())
+		{
+			info.error = EIO;
+			info.body.clear();
+		}
+		else
+			info.hasBody = true;
+		close(fd);
+	}
+	else if (S_ISDIR(st.st_mode))
+	{
+		info.kind = FileInfo::DIRECTORY;
+		if (!withListing)
+			return (info);
+		DIR*	dir = opendir(path.c_str());
+		if (dir == NULL)
+		{
+			info.error = errno;
+			return (info);
+		}
+		struct dirent*	entry;
+		while ((entry = readdir(dir)) != NULL)
+		{
+			std::string name = entry->d_name;
+			if (name != "." && name != "..")
+				info.listing.push_back(std::make_pair(name, entry->d_type == DT_DIR));
+		}
+		closedir(dir);
+		info.hasListing = true;
+	}
+	else
+		info.kind = FileInfo::OTHER;
+	return (info);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Private Methods
+////////////////////////////////////////////////////////////////////////////////
+
+void	FileCache::_evict(const std::string& keep)
+{
+	while (_bytes > _budget && !_lru.empty())
+	{
+		std::string victim = _lru.back();
+		if (victim == keep)
+			break ;
+		std::map<std::string, Entry>::iterator it = _entries.find(victim);
+		_bytes -= _footprint(it->second.info);
+		_lru.pop_back();
+		_entries.erase(it);
+	}
+}
+
+size_t	FileCache::_footprint(const FileInfo& info)
+{
+	size_t	bytes = info.body.size();
+
+	for (size_t i = 0; i < info.listing.size(); i++)
+		bytes += info.listing[i].first.size();
+	return (bytes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// FileLoadJob
+////////////////////////////////////////////////////////////////////////////////
+
+FileLoadJob::FileLoadJob(const std::string& path, size_t bodyLimit, bool withListing)
+	: path(path), bodyLimit(bodyLimit), withListing(withListing)
+{}
+
+FileLoadJob::~FileLoadJob()
+{}
+
+void	FileLoadJob::execute()
+{
+	result = FileCache::load(path, bodyLimit, withListing);
+}
@@ -12,6 +12,7 @@
 
 #include "webserv.hpp"
 #include "HttpRequest.hpp"
+#include <iterator>
 
 HttpRequest::HttpRequest()
 	: _body(""), _type(NONE), _content(false, NOT_SET)
@@ -22,10 +23,7 @@ HttpRequest::HttpRequest(std::string& data)
 	: _body(""), _type(NONE), _content(false, NOT_SET)
 {
 	/// FIXME: check logic
-	if (parse(data))
-		std::cout << "TEST | HttpRequest | parse success" << std::endl;
-	else
-		std::cout << "TEST | HttpRequest | parse failed" << std::endl;
+	parse(data);
 }
 
 HttpRequest::~HttpRequest()
@@ -142,15 +140,11 @@ std::vector<std	::string> HttpRequest::_convertPartToHeaders(std::istringstream&
 	return (res);
 }
 
+/// @brief The rest of the request, byte for byte: a body need not be text,
+/// nor end with a newline.
 std::string HttpRequest::_convertPartToBodyLines(std::istringstream& iss)
 {
-	std::string					readline;
-	// std::vector<std::string>	drafts;
-	std::string					drafts;
-
-	while (std::getline(iss, readline))
-		drafts += readline + "\n";
-	return (drafts);
+	return (std::string(std::istreambuf_iterator<char>(iss), std::istreambuf_iterator<char>()));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
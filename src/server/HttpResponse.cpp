@@ -24,12 +24,16 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 HttpResponse::HttpResponse(const Context& context)
-	: _statusCode(200), _statusMessage("OK"), _context(const_cast<Context&>(context))
+	: _statusCode(200), _statusMessage("OK"), _bodyLength(0),
+	_isDeferred(false), _deferredListing(false), _hasFileBody(false), _isCgi(false), _isProxy(false),
+	_context(const_cast<Context&>(context))
 {
 }
 
 HttpResponse::HttpResponse(const Context& context, const std::string& filePath)
-	: _statusCode(200), _statusMessage("OK"), _context(const_cast<Context&>(context))
+	: _statusCode(200), _statusMessage("OK"), _bodyLength(0),
+	_isDeferred(false), _deferredListing(false), _hasFileBody(false), _isCgi(false), _isProxy(false),
+	_context(const_cast<Context&>(context))
 {
 	initializefromFile(context, filePath);
 }
@@ -43,6 +47,21 @@ HttpResponse::HttpResponse(const HttpResponse& other)
 	_statusMessage = other._statusMessage;
 	_headers = other._headers;
 	_body = other._body;
+	_bodyLength = other._bodyLength;
+	_isDeferred = other._isDeferred;
+	_deferredPath = other._deferredPath;
+	_deferredListing = other._deferredListing;
+	_hasFileBody = other._hasFileBody;
+	_filePath = other._filePath;
+	_fileRanges = other._fileRanges;
+	_fileTail = other._fileTail;
+	_isCgi = other._isCgi;
+	_cgiScript = other._cgiScript;
+	_cgiInterpreter = other._cgiInterpreter;
+	_cgiPathInfo = other._cgiPathInfo;
+	_cgiPass = other._cgiPass;
+	_isProxy = other._isProxy;
+	_proxyUri = other._proxyUri;
 }
 
 HttpResponse& HttpResponse::operator=(const HttpResponse& other)
@@ -54,6 +73,20 @@ HttpResponse& HttpResponse::operator=(const HttpResponse& other)
 		_headers = other._headers;
 		_body = other._body;
 		_bodyLength = other._bodyLength;
+		_isDeferred = other._isDeferred;
+		_deferredPath = other._deferredPath;
+		_deferredListing = other._deferredListing;
+		_hasFileBody = other._hasFileBody;
+		_filePath = other._filePath;
+		_fileRanges = other._fileRanges;
+		_fileTail = other._fileTail;
+		_isCgi = other._isCgi;
+		_cgiScript = other._cgiScript;
+		_cgiInterpreter = other._cgiInterpreter;
+		_cgiPathInfo = other._cgiPathInfo;
+		_cgiPass = other._cgiPass;
+		_isProxy = other._isProxy;
+		_proxyUri = other._proxyUri;
 		_context = other._context;
 	}
 	return (*this);
@@ -70,7 +103,22 @@ HttpResponse::~HttpResponse()
 
 std::string	HttpResponse::generateResponseToString() const
 {
-	return (getResponseLine() + _getHeadersString() + "\r\n\r\n" + _body);
+	// Every header line ends in CRLF already, one more ends the header block
+	return (getResponseLine() + _getHeadersString() + "\r\n" + _body);
+}
+
+/// @brief The status line and headers, up to the empty line; the body is sent
+/// separately (see `takeBody`, `hasFileBody`).
+std::string	HttpResponse::generateHeaderString() const
+{
+	return (getResponseLine() + _getHeadersString() + "\r\n");
+}
+
+/// @brief Moves the in-memory body into `body` without copying it.
+void	HttpResponse::takeBody(std::string& body)
+{
+	body.swap(_body);
+	_body.clear();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -111,6 +159,53 @@ void	HttpResponse::_setDefaultHeadersImpl()
 ////////////////////////////////////////////////////////////////////////////////
 /// Public member functions: initializefromFile
 ////////////////////////////////////////////////////////////////////////////////
+/// @brief Makes the body `size` bytes of the file at `path`, sent straight
+/// from the file by the server instead of being read into memory.
+void	HttpResponse::setFileBody(const std::string& path, off_t size)
+{
+	_body.clear();
+	_hasFileBody = true;
+	_filePath = path;
+	_fileRanges.clear();
+	_fileTail.clear();
+	_bodyLength = static_cast<size_t>(size);
+}
+
+/// @brief Makes the body regions of the file at `path`, each after its
+/// `head`, then `tail`: the parts of a 206, sent straight from the file too.
+void	HttpResponse::setFileRanges(const std::string& path, const std::vector<FileRange>& ranges,
+			const std::string& tail)
+{
+	_body.clear();
+	_hasFileBody = true;
+	_filePath = path;
+	_fileRanges = ranges;
+	_fileTail = tail;
+	_bodyLength = tail.size();
+	for (size_t i = 0; i < ranges.size(); i++)
+		_bodyLength += ranges[i].head.size() + ranges[i].length;
+}
+
+bool	HttpResponse::hasFileBody() const
+{
+	return (_hasFileBody);
+}
+
+const std::string&	HttpResponse::getFilePath() const
+{
+	return (_filePath);
+}
+
+const std::vector<FileRange>&	HttpResponse::getFileRanges() const
+{
+	return (_fileRanges);
+}
+
+const std::string&	HttpResponse::getFileTail() const
+{
+	return (_fileTail);
+}
+
 /// @brief Creates an Static HttpResponse object by reading the contents of a file.
 /// @param filePath The path to the file to be read.
 /// @return HttpResponse The created HttpResponse object.
@@ -124,6 +219,119 @@ void	HttpResponse::initializefromFile(const Context& context, const std::string&
 		setDefaultHeaders();
 }
 
+/// @brief Same as `initializefromFile`, for a file content that was already read
+/// (e.g. from the `FileCache`).
+/// @param content The content of the file.
+void	HttpResponse::initializeFromContent(const std::string& content)
+{
+	setBody(content);
+	if (_body.empty())
+		return ;
+	if (_statusCode == 200)
+		setDefaultHeaders();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Public member functions: deferred and CGI responses
+////////////////////////////////////////////////////////////////////////////////
+/// @brief A placeholder returned when the handler needs `path` loaded into the
+/// `FileCache` first. The server loads it (on the I/O pool if there is one)
+/// and runs the request again; a deferred response is never sent.
+/// @param path The filesystem path to load.
+/// @param listing Whether the directory entries of `path` are needed.
+HttpResponse	HttpResponse::deferred(const Context& context, const std::string& path, bool listing)
+{
+	HttpResponse resp(context);
+	resp._isDeferred = true;
+	resp._deferredPath = path;
+	resp._deferredListing = listing;
+	return (resp);
+}
+
+bool	HttpResponse::isDeferred() const
+{
+	return (_isDeferred);
+}
+
+const std::string&	HttpResponse::getDeferredPath() const
+{
+	return (_deferredPath);
+}
+
+bool	HttpResponse::isDeferredListing() const
+{
+	return (_deferredListing);
+}
+
+/// @brief A placeholder returned for a CGI request: the server runs `script`
+/// in its event loop and answers with its output; a CGI response is never sent.
+/// @param script The filesystem path of the script, absolute.
+/// @param interpreter The program running the script, empty to execute it.
+/// @param pathInfo The part of the URI path after the script name.
+/// @param pass The `fastcgi_pass` address the request is sent to instead of
+/// running the script, empty to run it.
+HttpResponse	HttpResponse::cgi(const Context& context, const std::string& script,
+					const std::string& interpreter, const std::string& pathInfo, const std::string& pass)
+{
+	HttpResponse resp(context);
+	resp._isCgi = true;
+	resp._cgiScript = script;
+	resp._cgiInterpreter = interpreter;
+	resp._cgiPathInfo = pathInfo;
+	resp._cgiPass = pass;
+	return (resp);
+}
+
+bool	HttpResponse::isCgi() const
+{
+	return (_isCgi);
+}
+
+const std::string&	HttpResponse::getCgiScript() const
+{
+	return (_cgiScript);
+}
+
+const std::string&	HttpResponse::getCgiInterpreter() const
+{
+	return (_cgiInterpreter);
+}
+
+const std::string&	HttpResponse::getCgiPathInfo() const
+{
+	return (_cgiPathInfo);
+}
+
+const std::string&	HttpResponse::getCgiPass() const
+{
+	return (_cgiPass);
+}
+
+/// @brief A placeholder returned for a request of a `proxy_pass` location:
+/// the server forwards it to `pass` and relays the answer as it does the
+/// output of a CGI request, so it is a CGI response too.
+/// @param pass The server, `http://host:port`.
+/// @param uri The URI the request is sent with.
+HttpResponse	HttpResponse::proxy(const Context& context, const std::string& pass, const std::string& uri)
+{
+	HttpResponse resp(context);
+	resp._isCgi = true;
+	resp._isProxy = true;
+	resp._cgiPass = pass;
+	resp._proxyUri = uri;
+	return (resp);
+}
+
+bool	HttpResponse::isProxy() const
+{
+	return (_isProxy);
+}
+
+const std::string&	HttpResponse::getProxyUri() const
+{
+	return (_proxyUri);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// Private member functions
 ////////////////////////////////////////////////////////////////////////////////
@@ -194,29 +402,42 @@ std::string HttpResponse::_getStatusLine() const
 ////////////////////////////////////////////////////////////////////////////////
 /// @brief Initializes the map of HTTP status codes to status messages.
 /// @var `statusMap` Static, The map of status codes to status messages.
+/// It is built inside the (guarded) initialization of the static, so several
+/// event-loop threads may ask for it concurrently.
 /// @return Return the map of status codes and status messages.
 const std::map<int, std::string>& HttpResponse::_staticInitStatusMap()
 {
-	static std::map<int, std::string> statusMap;
+	static const std::map<int, std::string> statusMap = _buildStatusMap();
 
-	if (statusMap.empty())
-	{
-		statusMap[200] = "OK";
-		statusMap[201] = "Created";
-		statusMap[204] = "No Content";
-		statusMap[301] = "Moved Permanently";
-		statusMap[302] = "Found";
-		statusMap[400] = "Bad Request";
-		statusMap[401] = "Unauthorized";
-		statusMap[403] = "Forbidden";
-		statusMap[404] = "Not Found";
-		statusMap[405] = "Method Not Allowed";
-		statusMap[408] = "Request Timeout";
-		statusMap[413] = "Request Entity Too Large";
-		statusMap[418] = "I'm a Teapot";
-		statusMap[500] = "Internal Server Error";
-		statusMap[501] = "Not Implemented";
-	}
+	return (statusMap);
+}
+
+std::map<int, std::string>	HttpResponse::_buildStatusMap()
+{
+	std::map<int, std::string> statusMap;
+
+	statusMap[200] = "OK";
+	statusMap[201] = "Created";
+	statusMap[204] = "No Content";
+	statusMap[206] = "Partial Content";
+	statusMap[301] = "Moved Permanently";
+	statusMap[302] = "Found";
+	statusMap[304] = "Not Modified";
+	statusMap[400] = "Bad Request";
+	statusMap[401] = "Unauthorized";
+	statusMap[403] = "Forbidden";
+	statusMap[404] = "Not Found";
+	statusMap[405] = "Method Not Allowed";
+	statusMap[408] = "Request Timeout";
+	statusMap[413] = "Request Entity Too Large";
+	statusMap[416] = "Range Not Satisfiable";
+	statusMap[418] = "I'm a Teapot";
+	statusMap[431] = "Request Header Fields Too Large";
+	statusMap[500] = "Internal Server Error";
+	statusMap[501] = "Not Implemented";
+	statusMap[502] = "Bad Gateway";
+	statusMap[503] = "Service Unavailable";
+	statusMap[504] = "Gateway Timeout";
 	return (statusMap);
 }
 
@@ -349,11 +570,21 @@ HttpResponse	HttpResponse::requestEntityTooLarge_413(const Context& context)
 	return (createErrorResponse(413, context));
 }
 
+HttpResponse	HttpResponse::rangeNotSatisfiable_416(const Context& context)
+{
+	return (createErrorResponse(416, context));
+}
+
 HttpResponse	HttpResponse::imaTeapot_418(const Context& context)
 {
 	return (createErrorResponse(418, context));
 }
 
+HttpResponse	HttpResponse::requestHeaderFieldsTooLarge_431(const Context& context)
+{
+	return (createErrorResponse(431, context));
+}
+
 HttpResponse	HttpResponse::internalServerError_500(const Context& context)
 {
 	return (createErrorResponse(500, context));
@@ -364,6 +595,21 @@ HttpResponse	HttpResponse::notImplemented_501(const Context& context)
 	return (createErrorResponse(501, context));
 }
 
+HttpResponse	HttpResponse::badGateway_502(const Context& context)
+{
+	return (createErrorResponse(502, context));
+}
+
+HttpResponse	HttpResponse::serviceUnavailable_503(const Context& context)
+{
+	return (createErrorResponse(503, context));
+}
+
+HttpResponse	HttpResponse::gatewayTimeout_504(const Context& context)
+{
+	return (createErrorResponse(504, context));
+}
+
 /// @brief Creates a successful HTTP response with status code 200.
 /// @details All `Response` object constructors initialize the status code to 200 and the status message to "OK".
 /// @return Return the generated HTML response.
@@ -406,7 +652,19 @@ void	HttpResponse::setStatusCode(int code, const std::string statusMessage)
 
 void	HttpResponse::setHeader(const std::string key, const std::string value)
 {
-	_headers.insert(std::pair<std::string, std::string>(key, value));
+	_headers[key] = value;
+}
+
+/// @brief Sets the headers the connection relies on for framing: the length
+/// of the body actually sent, and whether the connection stays open after it.
+/// A 304 has no body, and no length: it would be that of the one it stands for.
+void	HttpResponse::setConnectionHeaders(bool keepAlive)
+{
+	if (_statusCode == 304)
+		_headers.erase("Content-Length");
+	else
+		setHeader("Content-Length", toString(_hasFileBody ? _bodyLength : _body.size()));
+	setHeader("Connection", keepAlive ? "keep-alive" : "close");
 }
 
 void	HttpResponse::setBody(const std::string bodyContent)
@@ -439,6 +697,11 @@ std::string HttpResponse::getStatusMessage() const
 	return (_statusMessage);
 }
 
+const std::map<std::string, std::string>&	HttpResponse::getHeaders() const
+{
+	return (_headers);
+}
+
 std::string HttpResponse::getResponseLine() const
 {
 	std::ostringstream oss;
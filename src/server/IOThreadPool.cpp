@@ -0,0 +1,197 @@
+#include "IOThreadPool.hpp"
+#include <stdexcept>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <signal.h>
+#ifdef __linux__
+# include <sys/eventfd.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+/// IOJob
+////////////////////////////////////////////////////////////////////////////////
+
+IOJob::IOJob()
+	: next(NULL)
+{}
+
+IOJob::~IOJob()
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Constructor & Destructor
+////////////////////////////////////////////////////////////////////////////////
+
+IOThreadPool::IOThreadPool(int threadCount, size_t queueCapacity)
+	: _capacity(queueCapacity), _stopping(false), _inFlight(0), _completed(NULL)
+{
+#ifdef __linux__
+	_eventFds[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (_eventFds[0] == -1)
+		throw std::runtime_error("Failed to create I/O pool eventfd");
+	_eventFds[1] = _eventFds[0];
+#else
+	if (pipe(_eventFds) == -1)
+		throw std::runtime_error("Failed to create I/O pool pipe");
+	for (int i = 0; i < 2; i++)
+	{
+		fcntl(_eventFds[i], F_SETFL, O_NONBLOCK);
+		fcntl(_eventFds[i], F_SETFD, FD_CLOEXEC);
+	}
+#endif
+	pthread_mutex_init(&_mutex, NULL);
+	pthread_cond_init(&_cond, NULL);
+	for (int i = 0; i < threadCount; i++)
+	{
+		pthread_t	thread;
+		if (pthread_create(&thread, NULL, _workerMain, this) != 0)
+			break ;
+		_threads.push_back(thread);
+	}
+	if (_threads.empty())
+	{
+		pthread_cond_destroy(&_cond);
+		pthread_mutex_destroy(&_mutex);
+		close(_eventFds[0]);
+		if (_eventFds[1] != _eventFds[0])
+			close(_eventFds[1]);
+		throw std::runtime_error("Failed to start I/O pool threads");
+	}
+}
+
+IOThreadPool::~IOThreadPool()
+{
+	pthread_mutex_lock(&_mutex);
+	_stopping = true;
+	pthread_cond_broadcast(&_cond);
+	pthread_mutex_unlock(&_mutex);
+	for (size_t i = 0; i < _threads.size(); i++)
+		pthread_join(_threads[i], NULL);
+
+	for (size_t i = 0; i < _queue.size(); i++)
+		delete _queue[i];
+	IOJob* job = takeCompleted();
+	while (job != NULL)
+	{
+		IOJob* next = job->next;
+		delete job;
+		job = next;
+	}
+	pthread_cond_destroy(&_cond);
+	pthread_mutex_destroy(&_mutex);
+	close(_eventFds[0]);
+	if (_eventFds[1] != _eventFds[0])
+		close(_eventFds[1]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Public Methods (event loop side)
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Queues a job for the pool threads.
+/// @return `false` if the queue is full; the caller keeps ownership of the job.
+bool	IOThreadPool::submit(IOJob* job)
+{
+	pthread_mutex_lock(&_mutex);
+	if (_queue.size() >= _capacity)
+	{
+		pthread_mutex_unlock(&_mutex);
+		return (false);
+	}
+	_queue.push_back(job);
+	pthread_cond_signal(&_cond);
+	pthread_mutex_unlock(&_mutex);
+	_inFlight++;
+	return (true);
+}
+
+/// @brief Detaches every finished job, oldest first, linked through `next`.
+/// The caller owns (and deletes) the returned jobs.
+IOJob*	IOThreadPool::takeCompleted()
+{
+	IOJob*	stack = __sync_lock_test_and_set(&_completed, static_cast<IOJob*>(NULL));
+	IOJob*	ordered = NULL;
+
+	while (stack != NULL)
+	{
+		IOJob* next = stack->next;
+		stack->next = ordered;
+		ordered = stack;
+		stack = next;
+		if (_inFlight > 0)
+			_inFlight--;
+	}
+	return (ordered);
+}
+
+int	IOThreadPool::getEventFd() const
+{
+	return (_eventFds[0]);
+}
+
+void	IOThreadPool::drainEventFd()
+{
+	char	buffer[64];
+
+	while (read(_eventFds[0], buffer, sizeof(buffer)) > 0)
+		;
+}
+
+/// @brief Number of jobs queued or running, i.e. submitted but not yet taken back.
+size_t	IOThreadPool::pending() const
+{
+	return (_inFlight);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Private Methods (pool thread side)
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Lock-free push onto the completion stack, then wakes the event loop.
+void	IOThreadPool::_complete(IOJob* job)
+{
+	IOJob*		head;
+	uint64_t	one = 1;
+
+	do
+	{
+		head = _completed;
+		job->next = head;
+	}
+	while (!__sync_bool_compare_and_swap(&_completed, head, job));
+	if (write(_eventFds[1], &one, sizeof(one)) < 0)
+		return ;
+}
+
+void	IOThreadPool::_workerLoop()
+{
+	while (true)
+	{
+		pthread_mutex_lock(&_mutex);
+		while (_queue.empty() && !_stopping)
+			pthread_cond_wait(&_cond, &_mutex);
+		if (_stopping)
+		{
+			pthread_mutex_unlock(&_mutex);
+			return ;
+		}
+		IOJob* job = _queue.front();
+		_queue.pop_front();
+		pthread_mutex_unlock(&_mutex);
+
+		job->execute();
+		_complete(job);
+	}
+}
+
+void*	IOThreadPool::_workerMain(void* arg)
+{
+	sigset_t	blocked;
+
+	// Signals belong to the event loop threads
+	sigfillset(&blocked);
+	pthread_sigmask(SIG_BLOCK, &blocked, NULL);
+	static_cast<IOThreadPool*>(arg)->_workerLoop();
+	return (NULL);
+}
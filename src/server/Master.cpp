@@ -0,0 +1,246 @@
+#include "webserv.hpp"
+#include "Master.hpp"
+#include "Config.hpp"
+#include "Server.hpp"
+#include "ThreadGroup.hpp"
+#include <cerrno>
+#include <cstring>
+#ifdef __linux__
+# include <sys/prctl.h>
+#endif
+
+/// Number of consecutive workers allowed to die right after spawning
+/// before the master gives up (e.g. the port can not be bound).
+#define WORKER_RAPID_FAILURE_LIMIT	10
+
+static volatile sig_atomic_t	s_pendingSignal = 0;
+
+/// @brief Shared by the master and (inherited by) the workers.
+/// Both stop their loop through `g_sigint`; the master additionally
+/// remembers which signal to forward to the workers.
+static void	ft_master_signal_handler(int sig)
+{
+	s_pendingSignal = sig;
+	g_sigint = true;
+}
+
+static void	ft_sigchld_handler(int sig)
+{
+	(void)sig;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Constructor & Destructor
+////////////////////////////////////////////////////////////////////////////////
+
+Master::Master(Config& config, int workerCount)
+	: _config(config), _workerCount(workerCount), _rapidFailures(0)
+{
+	if (_workerCount < 1)
+		_workerCount = 1;
+	_workers.assign(_workerCount, -1);
+	_spawnedAt.assign(_workerCount, 0);
+}
+
+Master::~Master()
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Public Methods
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Reads `worker_processes` from the top level of the config file.
+/// @return `auto` or an absent directive resolves to the number of online CPUs.
+int	Master::resolveWorkerCount(const Config& config)
+{
+	std::string	value = config.get("worker_processes");
+	long		count;
+
+	if (value.empty() || value == "auto")
+		count = sysconf(_SC_NPROCESSORS_ONLN);
+	else
+		count = atol(value.c_str());
+	if (count < 1)
+		count = 1;
+	return (static_cast<int>(count));
+}
+
+/// @brief Spawns the workers and supervises them until a termination signal.
+///
+/// Signals are blocked outside of `sigsuspend()`, so a signal arriving between
+/// the reap pass and the wait can not be lost. Workers that exit while the master
+/// is still running are restarted; on shutdown the received signal is forwarded
+/// and the master waits for every worker to exit.
+void	Master::run()
+{
+	sigset_t	blocked;
+	sigset_t	waitMask;
+	int			status;
+	pid_t		pid;
+
+	_installSignalHandlers();
+	sigemptyset(&blocked);
+	sigaddset(&blocked, SIGINT);
+	sigaddset(&blocked, SIGTERM);
+	sigaddset(&blocked, SIGQUIT);
+	sigaddset(&blocked, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &blocked, &waitMask);
+
+	for (size_t slot = 0; slot < _workers.size(); slot++)
+		_spawnWorker(slot);
+	std::cout << "Master " << getpid() << " started " << _workerCount << " workers" << std::endl;
+
+	while (g_sigint == false)
+	{
+		while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+			_handleExit(pid, status, false);
+		if (g_sigint == true)
+			break ;
+		sigsuspend(&waitMask);
+	}
+
+	_forwardSignal(s_pendingSignal ? static_cast<int>(s_pendingSignal) : SIGTERM);
+	while (_aliveCount() > 0)
+	{
+		pid = waitpid(-1, &status, 0);
+		if (pid < 0)
+		{
+			if (errno == EINTR)
+				continue ;
+			break ;
+		}
+		_handleExit(pid, status, true);
+	}
+	sigprocmask(SIG_SETMASK, &waitMask, NULL);
+	std::cout << "\rMaster stopped" << std::endl;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Private Methods
+////////////////////////////////////////////////////////////////////////////////
+
+void	Master::_installSignalHandlers()
+{
+	struct sigaction	sa;
+
+	std::memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	sa.sa_handler = ft_master_signal_handler;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGQUIT, &sa, NULL);
+	sa.sa_handler = ft_sigchld_handler;
+	sa.sa_flags = SA_NOCLDSTOP;
+	sigaction(SIGCHLD, &sa, NULL);
+}
+
+/// @brief Forks a worker for the given slot.
+/// The child restores the default signal mask and never returns.
+pid_t	Master::_spawnWorker(size_t slot)
+{
+	std::cout.flush();
+	std::cerr.flush();
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		std::cerr << "Error: failed to fork worker: " << std::strerror(errno) << std::endl;
+		return (-1);
+	}
+	if (pid == 0)
+		_runWorker();
+	_workers[slot] = pid;
+	_spawnedAt[slot] = time(NULL);
+	return (pid);
+}
+
+void	Master::_runWorker()
+{
+	sigset_t			empty;
+	struct sigaction	sa;
+
+	std::memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	sa.sa_handler = SIG_DFL;
+	sigaction(SIGCHLD, &sa, NULL);
+	sigemptyset(&empty);
+	sigprocmask(SIG_SETMASK, &empty, NULL);
+#ifdef __linux__
+	// Do not outlive the master
+	prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+
+	int threads = ThreadGroup::resolveThreadCount(_config);
+	if (threads > 1)
+	{
+		ThreadGroup group(_config, threads);
+		group.run();
+		exit(g_sigint == true ? 0 : 1);
+	}
+	Server server(_config);
+	server.setReusePort(true);
+	server.start();
+	exit(g_sigint == true ? 0 : 1);
+}
+
+void	Master::_forwardSignal(int sig)
+{
+	for (size_t slot = 0; slot < _workers.size(); slot++)
+	{
+		if (_workers[slot] > 0)
+			kill(_workers[slot], sig);
+	}
+}
+
+/// @brief Bookkeeping for an exited worker, restarting it unless shutting down.
+/// Workers dying within a second of being spawned are counted, and after
+/// `WORKER_RAPID_FAILURE_LIMIT` of them in a row the master shuts down instead
+/// of spinning on a worker that can never start.
+void	Master::_handleExit(pid_t pid, int status, bool shuttingDown)
+{
+	int	slot = _findSlot(pid);
+	if (slot < 0)
+		return ;
+	_workers[slot] = -1;
+
+	if (WIFSIGNALED(status))
+		std::cerr << "Worker " << pid << " killed by signal " << WTERMSIG(status) << std::endl;
+	else if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+		std::cerr << "Worker " << pid << " exited with status " << WEXITSTATUS(status) << std::endl;
+	if (shuttingDown || g_sigint == true)
+		return ;
+
+	if (time(NULL) - _spawnedAt[slot] <= 1)
+		_rapidFailures++;
+	else
+		_rapidFailures = 0;
+	if (_rapidFailures >= WORKER_RAPID_FAILURE_LIMIT)
+	{
+		std::cerr << "Error: workers keep failing on startup, shutting down" << std::endl;
+		g_sigint = true;
+		return ;
+	}
+	std::cout << "Restarting worker " << slot << std::endl;
+	_spawnWorker(slot);
+}
+
+int	Master::_findSlot(pid_t pid) const
+{
+	for (size_t slot = 0; slot < _workers.size(); slot++)
+	{
+		if (_workers[slot] == pid)
+			return (static_cast<int>(slot));
+	}
+	return (-1);
+}
+
+size_t	Master::_aliveCount() const
+{
+	size_t	count = 0;
+
+	for (size_t slot = 0; slot < _workers.size(); slot++)
+	{
+		if (_workers[slot] > 0)
+			count++;
+	}
+	return (count);
+}
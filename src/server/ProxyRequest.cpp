@@ -0,0 +1,338 @@
+#include "ProxyRequest.hpp"
+#include "HttpRequest.hpp"
+#include "CgiStream.hpp"
+#include "Util.hpp"
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cctype>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+/// Bytes read from the server per read, and reads per readiness event
+#define PROXY_READ_BUFFER_SIZE		16384
+#define PROXY_READS_PER_EVENT		4
+/// Longest chunk size or trailer line accepted
+#define PROXY_MAX_LINE				4096
+
+static std::string	ft_to_lower(std::string value)
+{
+	for (size_t i = 0; i < value.size(); i++)
+		value[i] = std::tolower(value[i]);
+	return (value);
+}
+
+static std::string	ft_trim(const std::string& value)
+{
+	size_t	start = value.find_first_not_of(" \t");
+	size_t	end = value.find_last_not_of(" \t\r");
+
+	if (start == std::string::npos)
+		return ("");
+	return (value.substr(start, end - start + 1));
+}
+
+/// @brief Whether the comma separated `list` (lowercase) has `token`.
+static bool	ft_has_token(const std::string& list, const std::string& token)
+{
+	for (size_t start = 0; start < list.size(); )
+	{
+		size_t	end = list.find(',', start);
+		if (end == std::string::npos)
+			end = list.size();
+		if (ft_trim(list.substr(start, end - start)) == token)
+			return (true);
+		start = end + 1;
+	}
+	return (false);
+}
+
+/// @brief Whether `name` (lowercase) is a hop-by-hop header: one of RFC 9110,
+/// or one listed by the message's own `Connection` header.
+static bool	ft_is_hop_by_hop(const std::string& name, const std::string& connection)
+{
+	static const char*	headers[] = {"connection", "keep-alive", "proxy-connection", "te",
+		"trailer", "transfer-encoding", "upgrade", "proxy-authorization", "proxy-authenticate", NULL};
+
+	for (size_t i = 0; headers[i] != NULL; i++)
+	{
+		if (name == headers[i])
+			return (true);
+	}
+	return (ft_has_token(connection, name));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Constructor & Destructor
+////////////////////////////////////////////////////////////////////////////////
+
+ProxyRequest::ProxyRequest(int clientFd, unsigned int clientGeneration, const std::string& upstream)
+	: UpstreamRequest(clientFd, clientGeneration, upstream), _headRequest(false),
+	_state(STATE_HEADER), _remaining(0), _keepAlive(true)
+{}
+
+ProxyRequest::~ProxyRequest()
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Public Methods
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Encodes the whole request for `uri`: the client's end-to-end
+/// headers, `X-Forwarded-For` and `X-Forwarded-Proto`, then `body` with its
+/// length. The connection is asked to stay open.
+void	ProxyRequest::encode(const HttpRequest& request, const std::string& uri,
+			const std::string& body, uint32_t clientAddr)
+{
+	std::map<std::string, std::string>	headers = request.getHeaders();
+	std::string							connection;
+	std::string							forwarded;
+	bool								hasHost = false;
+	bool								hasBody = !body.empty();
+	char								address[INET_ADDRSTRLEN] = "";
+
+	std::map<std::string, std::string>::const_iterator it;
+	for (it = headers.begin(); it != headers.end(); ++it)
+	{
+		if (ft_to_lower(it->first) == "connection")
+			connection = ft_to_lower(it->second);
+	}
+	inet_ntop(AF_INET, &clientAddr, address, sizeof(address));
+	_request = request.getMethod() + " " + uri + " HTTP/1.1\r\n";
+	for (it = headers.begin(); it != headers.end(); ++it)
+	{
+		std::string	name = ft_to_lower(it->first);
+
+		if (name == "content-length" || name == "transfer-encoding")
+			hasBody = true;
+		if (name == "host")
+			hasHost = true;
+		if (name == "x-forwarded-for")
+			forwarded = it->second + ", ";
+		if (name == "content-length" || name == "x-forwarded-for" || name == "x-forwarded-proto"
+			|| ft_is_hop_by_hop(name, connection))
+			continue ;
+		_request += it->first + ": " + it->second + "\r\n";
+	}
+	if (!hasHost)
+		_request += "Host: " + _upstream.substr(_upstream.find("://") + 3) + "\r\n";
+	_request += "X-Forwarded-For: " + forwarded + address + "\r\n";
+	_request += "X-Forwarded-Proto: http\r\n";
+	if (hasBody)
+		_request += "Content-Length: " + toString(body.size()) + "\r\n";
+	_request += "Connection: keep-alive\r\n\r\n";
+	_request += body;
+	_headRequest = (request.getMethod() == "HEAD");
+}
+
+void	ProxyRequest::rewind()
+{
+	UpstreamRequest::rewind();
+	_state = STATE_HEADER;
+	_remaining = 0;
+	_keepAlive = true;
+}
+
+/// @brief Reads and parses what the server sent, a bounded amount per call.
+/// @return 1 while more may come, 0 once the response is complete, -1 on
+/// error or if the connection closed before the end of the response.
+int	ProxyRequest::receive()
+{
+	char	buffer[PROXY_READ_BUFFER_SIZE];
+
+	for (int i = 0; i < PROXY_READS_PER_EVENT && _state != STATE_DONE; i++)
+	{
+		ssize_t	count = read(_socketFd, buffer, sizeof(buffer));
+		if (count == 0)
+		{
+			if (_state != STATE_CLOSE)
+				return (-1);
+			_state = STATE_DONE;
+			break ;
+		}
+		if (count < 0)
+			return ((errno == EAGAIN || errno == EINTR) ? 1 : -1);
+		_received += count;
+		_input.append(buffer, count);
+		if (_parse() < 0)
+			return (-1);
+	}
+	return (_state == STATE_DONE ? 0 : 1);
+}
+
+/// @brief Whether the connection can carry another request: the response
+/// ended on its own framing, nothing follows it, and the server keeps the
+/// connection open.
+bool	ProxyRequest::isReusable() const
+{
+	return (_state == STATE_DONE && _keepAlive && _input.empty());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Private Methods
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Moves what `_input` holds of the response to `_output`: the header
+/// block once complete, then the body without its framing.
+/// @return -1 if the response is malformed, 0 otherwise.
+int	ProxyRequest::_parse()
+{
+	while (true)
+	{
+		if (_state == STATE_HEADER)
+		{
+			size_t	end = _input.find("\r\n\r\n");
+			size_t	separator = 4;
+			size_t	bare = _input.find("\n\n");
+
+			if (bare != std::string::npos && bare < end)
+			{
+				end = bare;
+				separator = 2;
+			}
+			if (end == std::string::npos)
+				return (_input.size() > CGI_MAX_HEADER ? -1 : 0);
+			if (_parseHeader(end, separator) < 0)
+				return (-1);
+			continue ;
+		}
+		if (_state == STATE_LENGTH || _state == STATE_CHUNK_DATA)
+		{
+			size_t	length = std::min(_remaining, _input.size());
+
+			_output.append(_input, 0, length);
+			_input.erase(0, length);
+			_remaining -= length;
+			if (_remaining > 0)
+				return (0);
+			_state = (_state == STATE_LENGTH) ? STATE_DONE : STATE_CHUNK_END;
+			continue ;
+		}
+		if (_state == STATE_CLOSE)
+		{
+			_output += _input;
+			_input.clear();
+			return (0);
+		}
+		if (_state == STATE_DONE)
+			return (0);
+
+		// Line based: chunk size, end of chunk data, trailer
+		size_t	newline = _input.find('\n');
+		if (newline == std::string::npos)
+			return (_input.size() > PROXY_MAX_LINE ? -1 : 0);
+		std::string	line = ft_trim(_input.substr(0, newline));
+		_input.erase(0, newline + 1);
+		if (_state == STATE_CHUNK_SIZE)
+		{
+			char*	end;
+
+			if (line.empty() || !std::isxdigit(line[0]))
+				return (-1);
+			_remaining = std::strtoul(line.c_str(), &end, 16);
+			if (*end != '\0' && *end != ';' && *end != ' ' && *end != '\t')
+				return (-1);
+			_state = (_remaining == 0) ? STATE_TRAILER : STATE_CHUNK_DATA;
+		}
+		else if (_state == STATE_CHUNK_END)
+		{
+			if (!line.empty())
+				return (-1);
+			_state = STATE_CHUNK_SIZE;
+		}
+		else if (line.empty())
+			_state = STATE_DONE;
+	}
+}
+
+/// @brief Parses the status line and headers ending at `end`, and starts the
+/// body. Interim (1xx) responses are skipped. The status line becomes a CGI
+/// `Status:` header and hop-by-hop headers are dropped; `Content-Length` is
+/// kept, so the client's framing can follow the server's.
+/// @return -1 if the header block is malformed, 0 otherwise.
+int	ProxyRequest::_parseHeader(size_t end, size_t separator)
+{
+	std::string											block = _input.substr(0, end);
+	std::vector<std::pair<std::string, std::string> >	fields;
+	std::string											connection;
+	std::string											line;
+	size_t												lineEnd;
+	long												length = -1;
+	bool												chunked = false;
+
+	_input.erase(0, end + separator);
+	lineEnd = block.find('\n');
+	line = ft_trim(block.substr(0, lineEnd));
+	if (line.compare(0, 7, "HTTP/1.") != 0 || line.size() < 12 || line[8] != ' '
+		|| !std::isdigit(line[9]) || !std::isdigit(line[10]) || !std::isdigit(line[11]))
+		return (-1);
+	int			code = std::atoi(line.c_str() + 9);
+	std::string	reason = line.size() > 13 ? line.substr(13) : "";
+
+	if (code == 101 || code < 100)
+		return (-1);
+	if (code < 200)
+		return (0);
+	while (lineEnd != std::string::npos)
+	{
+		size_t	start = lineEnd + 1;
+
+		lineEnd = block.find('\n', start);
+		line = block.substr(start, lineEnd == std::string::npos ? std::string::npos : lineEnd - start);
+		size_t	colon = line.find(':');
+		if (colon == std::string::npos || colon == 0)
+		{
+			if (ft_trim(line).empty())
+				continue ;
+			return (-1);
+		}
+		std::string	name = line.substr(0, colon);
+		std::string	value = ft_trim(line.substr(colon + 1));
+		std::string	key = ft_to_lower(name);
+
+		if (key == "connection")
+			connection += (connection.empty() ? "" : ",") + ft_to_lower(value);
+		else if (key == "transfer-encoding")
+			chunked = (ft_to_lower(value).find("chunked") != std::string::npos);
+		else if (key == "content-length")
+		{
+			if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos)
+				return (-1);
+			length = std::strtol(value.c_str(), NULL, 10);
+		}
+		fields.push_back(std::make_pair(name, value));
+	}
+	if (block.compare(0, 8, "HTTP/1.0") == 0)
+		_keepAlive = ft_has_token(connection, "keep-alive");
+	else
+		_keepAlive = !ft_has_token(connection, "close");
+
+	_output += "Status: " + toString(code) + " " + reason + "\r\n";
+	for (size_t i = 0; i < fields.size(); i++)
+	{
+		std::string	key = ft_to_lower(fields[i].first);
+
+		// With both, `Transfer-Encoding` wins and the length is wrong
+		if (ft_is_hop_by_hop(key, connection) || (key == "content-length" && chunked))
+			continue ;
+		_output += fields[i].first + ": " + fields[i].second + "\r\n";
+	}
+	_output += "\r\n";
+	if (_headRequest || code == 204 || code == 304)
+		_state = STATE_DONE;
+	else if (chunked)
+		_state = STATE_CHUNK_SIZE;
+	else if (length >= 0)
+	{
+		_remaining = length;
+		_state = (length == 0) ? STATE_DONE : STATE_LENGTH;
+	}
+	else
+	{
+		_keepAlive = false;
+		_state = STATE_CLOSE;
+	}
+	return (0);
+}
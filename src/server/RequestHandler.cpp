@@ -16,8 +16,10 @@
 #include "Location.hpp"
 #include "Config.hpp"
 #include "Context.hpp"
+#include "CgiProcess.hpp"
 
 RequestHandler:: RequestHandler()
+	: _cgiStats(NULL)
 {}
 
 RequestHandler::~RequestHandler()
@@ -46,6 +48,10 @@ HttpResponse	RequestHandler::handleRequest(const Context& context)
 	// std::cout << "\r" << request.getMethod() << " | " << request.getUri() << " | " <<
 	// 	request.getVersion() << std::endl;
 
+	if (context.getLocation().isCgiStatus())
+		return (_handleCgiStatus(context));
+	if (!context.getLocation().getProxyPass().empty())
+		return (_handleProxyRequest(context));
 	if (_isCGIReqeust(context))
 		return (_handleCGIRequest(context));
 	else if (_isAllowedMethod(context))
@@ -53,38 +59,136 @@ HttpResponse	RequestHandler::handleRequest(const Context& context)
 	return (HttpResponse::methodNotAllowed_405(context));
 }
 
+/// @brief Hands the event loop's file cache to the handlers that serve files.
+void	RequestHandler::setFileCache(FileCache* fileCache)
+{
+	_staticFileHandler.setFileCache(fileCache);
+}
+
+/// @brief The counters a `cgi_status` location answers with.
+void	RequestHandler::setCgiStats(const CgiStats* cgiStats)
+{
+	_cgiStats = cgiStats;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// Private Methods
 ////////////////////////////////////////////////////////////////////////////////
 
-/// @brief Checks if the request is a CGI request at the current location.
+/// @brief Finds the script a URI path names, i.e. the first path segment
+/// ending in one of the `cgi_ext` extensions of the location.
+/// @param ext set to the extension found.
+/// @return where the script name ends in `path`, `npos` if it names none.
+static size_t	ft_find_cgi_script(const std::string& path, const std::map<std::string, std::string>& cgiMap,
+					std::string& ext)
+{
+	for (size_t end = path.find('/', 1); ; end = path.find('/', end + 1))
+	{
+		size_t	segmentEnd = (end == std::string::npos) ? path.size() : end;
+		for (std::map<std::string, std::string>::const_iterator it = cgiMap.begin(); it != cgiMap.end(); ++it)
+		{
+			if (segmentEnd > it->first.size()
+				&& path.compare(segmentEnd - it->first.size(), it->first.size(), it->first) == 0)
+			{
+				ext = it->first;
+				return (segmentEnd);
+			}
+		}
+		if (end == std::string::npos)
+			return (std::string::npos);
+	}
+}
+
+/// @brief Checks if the request is a CGI request at the current location:
+/// whether its path names a script with one of the location's `cgi_ext`.
+/// With `fastcgi_pass` and no `cgi_ext`, every request of the location is.
 /// @param context 
 /// @return bool
 bool	RequestHandler::_isCGIReqeust(const Context& context) const
 {
+	const std::map<std::string, std::string>&	cgiMap = context.getLocation().getCgi();
+	std::string									uri = context.getRequest().getUri();
+	std::string									ext;
 
-
-	std::map<std::string, std::string> cgiMap = context.getLocation().getCgi();
-	std::cout << YELLOW << "TEST | location.getCgi()\n" << RESET << std::endl;
-	for (std::map<std::string, std::string>::const_iterator it = cgiMap.begin(); it != cgiMap.end(); ++it)
-	{
-    	std::cout << YELLOW << "       key: " << it->first << " -> value: " << it->second << RESET << std::endl;
-	}
-	std::cout << YELLOW << "     --- cgi map end" << RESET << std::endl;
-	
-
-	if (context.getLocation().getCgi().empty())
-		return (false);
-	return (true);
+	if (cgiMap.empty())
+		return (!context.getLocation().getFastCgiPass().empty());
+	return (ft_find_cgi_script(uri.substr(0, uri.find('?')), cgiMap, ext) != std::string::npos);
 }
 
-/// @brief Not implemented.
+/// @brief Resolves the script of a CGI request. The script runs in the
+/// server's event loop, which answers with its output (see `HttpResponse::cgi`),
+/// or the request goes to the location's FastCGI application, which finds
+/// the script itself.
 /// @param context 
-/// @return 
+/// @return a CGI response, or 405 / 404 if the method or the script is refused.
 HttpResponse	RequestHandler::_handleCGIRequest(const Context& context)
 {
-	// env, fork...
-	return (HttpResponse::notImplemented_501(context));
+	const std::map<std::string, std::string>&	cgiMap = context.getLocation().getCgi();
+	const std::string&							pass = context.getLocation().getFastCgiPass();
+	std::string									uri = context.getRequest().getUri();
+	std::string									path = uri.substr(0, uri.find('?'));
+	std::string									ext;
+	char										cwd[4096];
+
+	if (!_isAllowedMethod(context))
+		return (HttpResponse::methodNotAllowed_405(context));
+	size_t	scriptEnd = cgiMap.empty() ? path.size() : ft_find_cgi_script(path, cgiMap, ext);
+	std::string	script = context.getServer().root + context.getLocation().getRootPath() + path.substr(0, scriptEnd);
+	if (getcwd(cwd, sizeof(cwd)) == NULL)
+		return (HttpResponse::internalServerError_500(context));
+	// The script runs from its own directory, so its path is made absolute
+	script = std::string(cwd) + script;
+	if (pass.empty() && !isFile(script))
+		return (HttpResponse::notFound_404(context));
+	return (HttpResponse::cgi(context, script, cgiMap.empty() ? "" : cgiMap.find(ext)->second,
+		path.substr(scriptEnd), pass));
+}
+
+/// @brief Answers a `cgi_status` location with the CGI counters of the event
+/// loop, one `name value` per line.
+HttpResponse	RequestHandler::_handleCgiStatus(const Context& context) const
+{
+	HttpResponse		response(context);
+	std::ostringstream	body;
+
+	if (_cgiStats == NULL)
+		return (HttpResponse::notFound_404(context));
+	body << "cgi_spawned " << _cgiStats->spawned << "\n"
+		<< "cgi_timed_out " << _cgiStats->timedOut << "\n"
+		<< "cgi_queued " << _cgiStats->queued << "\n"
+		<< "cgi_rejected " << _cgiStats->rejected << "\n"
+		<< "cgi_running " << _cgiStats->running << "\n"
+		<< "cgi_waiting " << _cgiStats->waiting << "\n"
+		<< "cgi_cache_hits " << _cgiStats->cacheHits << "\n"
+		<< "cgi_cache_misses " << _cgiStats->cacheMisses << "\n"
+		<< "cgi_cache_coalesced " << _cgiStats->cacheCoalesced << "\n"
+		<< "cgi_cache_bytes " << _cgiStats->cacheBytes << "\n"
+		<< "cgi_cache_disk_hits " << _cgiStats->cacheDiskHits << "\n"
+		<< "cgi_cache_revalidated " << _cgiStats->cacheRevalidated << "\n"
+		<< "cgi_cache_disk_bytes " << _cgiStats->cacheDiskBytes << "\n"
+		<< "cgi_cache_stale " << _cgiStats->cacheStale << "\n"
+		<< "cgi_cache_refreshes " << _cgiStats->cacheRefreshes << "\n";
+	response.setBody(body.str());
+	response.setHeader("Content-Type", "text/plain");
+	response.setHeader("Cache-Control", "no-store");
+	return (response);
+}
+
+/// @brief Forwards a request of a `proxy_pass` location, see
+/// `HttpResponse::proxy`. With a URI in `proxy_pass`, it replaces the
+/// location path at the start of the request URI; without, the URI is sent
+/// as it came.
+/// @return a proxy response, or 405 if the method is refused.
+HttpResponse	RequestHandler::_handleProxyRequest(const Context& context) const
+{
+	const Location&	location = context.getLocation();
+	std::string		uri = context.getRequest().getUri();
+
+	if (!_isAllowedMethod(context))
+		return (HttpResponse::methodNotAllowed_405(context));
+	if (!location.getProxyUri().empty() && uri.compare(0, location.getPath().size(), location.getPath()) == 0)
+		uri = location.getProxyUri() + uri.substr(location.getPath().size());
+	return (HttpResponse::proxy(context, location.getProxyPass(), uri));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
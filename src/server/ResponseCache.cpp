@@ -0,0 +1,294 @@
+#include "ResponseCache.hpp"
+#include "Context.hpp"
+#include "HttpRequest.hpp"
+#include "HttpResponse.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+
+/// Defaults, overridden by the `cgi_cache_*` directives
+#define RESPONSE_CACHE_DEFAULT_BUDGET		(16 * 1024 * 1024)
+#define RESPONSE_CACHE_DEFAULT_MAX_ENTRY	(1024 * 1024)
+
+static std::string	ft_to_lower(std::string value)
+{
+	for (size_t i = 0; i < value.size(); i++)
+		value[i] = std::tolower(value[i]);
+	return (value);
+}
+
+/// @brief The value of header `name` of a request, whatever its case.
+static std::string	ft_header(const std::map<std::string, std::string>& headers, const std::string& name)
+{
+	std::string	key = ft_to_lower(name);
+
+	for (std::map<std::string, std::string>::const_iterator it = headers.begin(); it != headers.end(); ++it)
+	{
+		if (ft_to_lower(it->first) == key)
+			return (it->second);
+	}
+	return ("");
+}
+
+/// @brief The seconds of a `max-age=N`-like directive in `value`, -1 if absent.
+static long	ft_directive_seconds(const std::string& value, const std::string& directive)
+{
+	size_t	at = value.find(directive);
+
+	// Not the tail of another directive, e.g. an extension `x-max-age`
+	while (at != std::string::npos && at > 0 && value[at - 1] != ' ' && value[at - 1] != ',')
+		at = value.find(directive, at + 1);
+	if (at == std::string::npos)
+		return (-1);
+	return (std::strtol(value.c_str() + at + directive.size(), NULL, 10));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// CachedResponse
+////////////////////////////////////////////////////////////////////////////////
+
+CachedResponse::CachedResponse()
+	: status(200), storedAt(0), expires(0), staleUntil(0), errorUntil(0), pass(false)
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Constructor & Destructor
+////////////////////////////////////////////////////////////////////////////////
+
+ResponseCache::ResponseCache()
+	: _bytes(0), _budget(RESPONSE_CACHE_DEFAULT_BUDGET), _maxEntry(RESPONSE_CACHE_DEFAULT_MAX_ENTRY)
+{}
+
+ResponseCache::~ResponseCache()
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Public Methods
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Returns the response cached under `key`, fresh or still within a
+/// stale window, which the caller tells apart by its times; one past them
+/// all is dropped.
+/// @return `NULL` on a miss; the pointer stays valid until the next `insert()`.
+const CachedResponse*	ResponseCache::lookup(const std::string& key, uint64_t now)
+{
+	std::map<std::string, Entry>::iterator it = _entries.find(key);
+
+	if (it == _entries.end())
+		return (NULL);
+	const CachedResponse&	response = it->second.response;
+	if (now >= std::max(response.expires, std::max(response.staleUntil, response.errorUntil)))
+	{
+		_erase(it);
+		return (NULL);
+	}
+	_lru.splice(_lru.begin(), _lru, it->second.lru);
+	return (&it->second.response);
+}
+
+/// @brief Stores (or replaces) the response of `key`, then evicts least
+/// recently used entries until the budget fits again. Responses larger than
+/// `cgi_cache_max_entry` are not stored.
+void	ResponseCache::insert(const std::string& key, const CachedResponse& response)
+{
+	std::map<std::string, Entry>::iterator it = _entries.find(key);
+
+	if (it != _entries.end())
+		_erase(it);
+	if (response.body.size() > _maxEntry)
+		return ;
+	_lru.push_front(key);
+	Entry&	entry = _entries[key];
+	entry.response = response;
+	entry.lru = _lru.begin();
+	_bytes += _footprint(key, response);
+	_evict(key);
+}
+
+/// @brief Remembers until `expires` that the responses of `key` are not
+/// cacheable.
+void	ResponseCache::insertPass(const std::string& key, uint64_t expires)
+{
+	CachedResponse	pass;
+
+	pass.expires = expires;
+	pass.pass = true;
+	insert(key, pass);
+}
+
+void	ResponseCache::setBudget(size_t bytes)
+{
+	_budget = bytes;
+}
+
+/// @brief Largest body a cached response may have.
+void	ResponseCache::setMaxEntry(size_t bytes)
+{
+	_maxEntry = bytes;
+}
+
+size_t	ResponseCache::getMaxEntry() const
+{
+	return (_maxEntry);
+}
+
+size_t	ResponseCache::getBytes() const
+{
+	return (_bytes);
+}
+
+/// @brief Whether a request may be answered from the cache: a GET without
+/// credentials.
+bool	ResponseCache::acceptsRequest(const HttpRequest& request)
+{
+	return (request.getMethod() == "GET" && ft_header(request.getHeaders(), "Authorization").empty());
+}
+
+/// @brief The cache key of a request: method, listen address, host and
+/// normalized URI, then the request headers named by `headers`.
+std::string	ResponseCache::buildKey(const Context& context, const std::vector<std::string>& headers)
+{
+	const HttpRequest&					request = context.getRequest();
+	std::map<std::string, std::string>	fields = request.getHeaders();
+	std::string							key;
+
+	key = request.getMethod() + " " + context.getServer().listen + " "
+		+ ft_to_lower(ft_header(fields, "Host")) + " " + normalizeUri(request.getUri());
+	for (size_t i = 0; i < headers.size(); i++)
+		key += "\n" + ft_to_lower(headers[i]) + ": " + ft_header(fields, headers[i]);
+	return (key);
+}
+
+/// @brief Spells the path of `uri` one way: unreserved characters decoded,
+/// other escapes in uppercase, empty and dot segments resolved. The query is
+/// kept as it is.
+std::string	ResponseCache::normalizeUri(const std::string& uri)
+{
+	size_t		query = uri.find('?');
+	std::string	path = uri.substr(0, query);
+	std::string	decoded;
+	std::string	normalized;
+
+	for (size_t i = 0; i < path.size(); i++)
+	{
+		if (path[i] != '%' || i + 2 >= path.size()
+			|| !std::isxdigit(path[i + 1]) || !std::isxdigit(path[i + 2]))
+		{
+			decoded += path[i];
+			continue ;
+		}
+		char	value = static_cast<char>(std::strtol(path.substr(i + 1, 2).c_str(), NULL, 16));
+		if (std::isalnum(value) || (value != '\0' && std::strchr("-._~", value) != NULL))
+			decoded += value;
+		else
+		{
+			decoded += '%';
+			decoded += static_cast<char>(std::toupper(path[i + 1]));
+			decoded += static_cast<char>(std::toupper(path[i + 2]));
+		}
+		i += 2;
+	}
+	std::vector<std::string>	segments;
+	for (size_t start = 0; start <= decoded.size(); )
+	{
+		size_t	end = decoded.find('/', start);
+		if (end == std::string::npos)
+			end = decoded.size();
+		std::string	segment = decoded.substr(start, end - start);
+		if (segment == ".." && !segments.empty())
+			segments.pop_back();
+		else if (!segment.empty() && segment != "." && segment != "..")
+			segments.push_back(segment);
+		start = end + 1;
+	}
+	for (size_t i = 0; i < segments.size(); i++)
+		normalized += "/" + segments[i];
+	if (normalized.empty() || (!decoded.empty() && decoded[decoded.size() - 1] == '/'))
+		normalized += "/";
+	if (query != std::string::npos)
+		normalized += uri.substr(query);
+	return (normalized);
+}
+
+/// @brief How long `response` may be cached, in ms: `s-maxage` or `max-age`
+/// from its `Cache-Control`, else `defaultTtl`.
+/// @return 0 if it may not be cached: an uncacheable status, `no-store`,
+/// `no-cache` or `private`, `Vary: *`, or a `Set-Cookie`.
+size_t	ResponseCache::freshness(const HttpResponse& response, size_t defaultTtl)
+{
+	const std::map<std::string, std::string>&	headers = response.getHeaders();
+	int											code = response.getStatusCode();
+	long										seconds = -1;
+
+	if (code != 200 && code != 203 && code != 300 && code != 301 && code != 404 && code != 410)
+		return (0);
+	for (std::map<std::string, std::string>::const_iterator it = headers.begin(); it != headers.end(); ++it)
+	{
+		std::string	name = ft_to_lower(it->first);
+		std::string	value = ft_to_lower(it->second);
+
+		if (name == "set-cookie" || (name == "vary" && value.find('*') != std::string::npos))
+			return (0);
+		if (name != "cache-control")
+			continue ;
+		if (value.find("no-store") != std::string::npos || value.find("no-cache") != std::string::npos
+			|| value.find("private") != std::string::npos)
+			return (0);
+		seconds = ft_directive_seconds(value, "s-maxage=");
+		if (seconds < 0)
+			seconds = ft_directive_seconds(value, "max-age=");
+	}
+	if (seconds < 0)
+		return (defaultTtl);
+	return (static_cast<size_t>(seconds) * 1000);
+}
+
+/// @brief How long past its expiry `response` may still be served, in ms:
+/// `directive` of its `Cache-Control`, `stale-while-revalidate=` or
+/// `stale-if-error=`, else `defaultWindow`.
+/// @return 0 if it says `must-revalidate` or `proxy-revalidate` instead.
+size_t	ResponseCache::staleness(const HttpResponse& response, const std::string& directive,
+			size_t defaultWindow)
+{
+	std::string	value = ft_to_lower(ft_header(response.getHeaders(), "Cache-Control"));
+	long		seconds = ft_directive_seconds(value, directive);
+
+	if (seconds >= 0)
+		return (static_cast<size_t>(seconds) * 1000);
+	if (value.find("must-revalidate") != std::string::npos || value.find("proxy-revalidate") != std::string::npos)
+		return (0);
+	return (defaultWindow);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Private Methods
+////////////////////////////////////////////////////////////////////////////////
+
+void	ResponseCache::_erase(std::map<std::string, Entry>::iterator it)
+{
+	_bytes -= _footprint(it->first, it->second.response);
+	_lru.erase(it->second.lru);
+	_entries.erase(it);
+}
+
+void	ResponseCache::_evict(const std::string& keep)
+{
+	while (_bytes > _budget && !_lru.empty())
+	{
+		std::string victim = _lru.back();
+		if (victim == keep)
+			break ;
+		_erase(_entries.find(victim));
+	}
+}
+
+size_t	ResponseCache::_footprint(const std::string& key, const CachedResponse& response)
+{
+	size_t	bytes = key.size() + response.message.size() + response.body.size();
+
+	for (std::map<std::string, std::string>::const_iterator it = response.headers.begin();
+		it != response.headers.end(); ++it)
+		bytes += it->first.size() + it->second.size();
+	return (bytes);
+}
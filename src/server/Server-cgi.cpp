@@ -0,0 +1,1528 @@
+#include "webserv.hpp"
+#include "Server.hpp"
+#include "Context.hpp"
+#include "CgiWorker.hpp"
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <algorithm>
+#include <sys/socket.h>
+
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL			0
+#endif
+
+/// Read at once from the socket a background refresh is answered over
+#define REFRESH_READ_BUFFER_SIZE	16384
+
+/// @brief Sets the stale windows of the response of `fill`: its
+/// `Cache-Control`, else those of the location.
+static void	ft_set_windows(CacheFill& fill, const HttpResponse& response)
+{
+	fill.staleWhileRevalidate = ResponseCache::staleness(response, "stale-while-revalidate=",
+		fill.staleWhileRevalidate);
+	fill.staleIfError = ResponseCache::staleness(response, "stale-if-error=", fill.staleIfError);
+}
+
+/// @brief Dates the response of `fill` as stored at `now`: fresh for its
+/// freshness, then served stale for its windows.
+static void	ft_date_response(CachedResponse& response, const CacheFill& fill, uint64_t now)
+{
+	response.storedAt = now;
+	response.expires = now + fill.ttl;
+	response.staleUntil = response.expires + fill.staleWhileRevalidate;
+	response.errorUntil = response.expires + fill.staleIfError;
+}
+
+/// @brief Whether an upstream pool is of `proxy_pass`, named by its URL.
+static bool	ft_is_proxy(const std::string& name)
+{
+	return (name.compare(0, 7, "http://") == 0);
+}
+
+/// @brief The address an upstream pool connects to: `host:port` of a
+/// `proxy_pass` URL, else the `fastcgi_pass` address itself.
+static std::string	ft_upstream_address(const std::string& name)
+{
+	if (ft_is_proxy(name))
+		return (name.substr(7));
+	return (name);
+}
+
+/// @brief The upstream pool of a `proxy_pass` URL not naming an `upstream`
+/// block: the URL, with port 80 if it has none.
+static std::string	ft_proxy_pool(const std::string& pass)
+{
+	if (pass.find(':', 7) == std::string::npos)
+		return (pass + ":80");
+	return (pass);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// CGI
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Starts the script of a CGI response. Its pipes join the poll set and
+/// the client waits in `PHASE_CGI`, polled for errors only, until the header
+/// of the script's output is complete (see `_relayCgiOutput`).
+void	Server::_startCgi(int target, const Context& context, const HttpResponse& response,
+			const std::string& requestData, bool keepAlive)
+{
+	std::map<std::string, std::string>	headers = context.getRequest().getHeaders();
+	std::map<std::string, std::string>::const_iterator it = headers.find("Transfer-Encoding");
+	std::string							body = CgiProcess::requestBody(requestData,
+											it != headers.end() && it->second == "chunked");
+	CgiProcess*							cgi = new CgiProcess(target, _connections[target].generation);
+	std::vector<std::string>			env = CgiProcess::buildEnvironment(context, response.getCgiScript(),
+											response.getCgiPathInfo(), body.size(), _connections[target].clientAddr);
+
+	cgi->setRlimits(context.getLocation().getCgiRlimits());
+	if (!cgi->start(response.getCgiInterpreter(), response.getCgiScript(), env, body))
+	{
+		std::cerr << "Error: failed to run " << response.getCgiScript() << ": " << strerror(errno) << std::endl;
+		delete cgi;
+		_leaveCgiLimit(target);
+		_respondWithError(target, 500);
+		return ;
+	}
+	_cgiStats.spawned++;
+	_registerFd(cgi->getStdoutFd(), FD_CGI, POLLIN).cgi = cgi;
+	if (cgi->getStdinFd() != -1)
+		_registerFd(cgi->getStdinFd(), FD_CGI, POLLOUT).cgi = cgi;
+	Connection&	conn = _connections[target];
+	conn.cgi = cgi;
+	conn.keepAlive = keepAlive;
+	conn.phase = PHASE_CGI;
+	conn.stream.reset(context.getRequest().getVersion() == "HTTP/1.1",
+		context.getRequest().getMethod() == "HEAD");
+	_setPollEvents(target, POLL_PEER_CLOSED);
+}
+
+/// @brief Feeds the request body to a script, collects its output, or reaps it
+/// once its pidfd reports the exit.
+void	Server::_handleCgiEvent(int fd)
+{
+	CgiProcess*	cgi = _connections[fd].cgi;
+
+	if (fd == cgi->getPidFd())
+		_reapCgi(cgi);
+	else if (fd == cgi->getStdinFd())
+	{
+		// A script may not read its whole body; that is not an error
+		if (cgi->writeInput() < 0 || cgi->inputDone())
+		{
+			_unregisterFd(fd);
+			cgi->closeInput();
+		}
+	}
+	else if (!_spliceCgiOutput(cgi))
+	{
+		std::string	data;
+		int			status = cgi->readOutput();
+
+		cgi->takeOutput(data);
+		_relayCgiOutput(cgi->getClientFd(), data, status);
+	}
+}
+
+/// @brief Relays output of the script or FastCGI application of a client as
+/// it comes: the header block once complete, then each piece of the body,
+/// queued on the connection and sent right away. The output stops being read
+/// while the client is behind (see `_pauseCgiOutput`).
+/// @param status 1 while more may come, 0 at the end of the output, -1 if it
+/// failed; the response is then 502, or cut short if already started.
+void	Server::_relayCgiOutput(int target, std::string& data, int status)
+{
+	if (!_connections[target].stream.isStarted() && !_startCgiResponse(target, data, status))
+		return ;
+	Connection&	conn = _connections[target];
+
+	conn.stream.relay(data, conn.output);
+	if (status <= 0)
+	{
+		bool	complete = (status == 0 && conn.stream.finish(conn.output));
+
+		// What was relayed is still sent; closing tells the client it is short
+		if (!complete)
+		{
+			std::cerr << "Error: CGI response cut short" << std::endl;
+			conn.keepAlive = false;
+		}
+		_endCacheFill(target, complete);
+		_endCgi(target, status < 0);
+	}
+	_flushOutput(target);
+}
+
+/// @brief Moves body bytes waiting in the script's pipe straight to the
+/// client with `splice()`, once the header is sent and nothing else is queued.
+/// A socket that is full stops the pipe from being polled until it drains.
+/// @return false if the output must be read and relayed instead: before the
+/// body, at its end, or without `splice()`.
+bool	Server::_spliceCgiOutput(CgiProcess* cgi)
+{
+	int			target = cgi->getClientFd();
+	Connection&	conn = _connections[target];
+	size_t		available = cgi->outputAvailable();
+
+	if (available == 0 || !conn.stream.canSplice() || !conn.output.empty())
+		return (false);
+	size_t	length = conn.stream.beginSplice(available, conn.output);
+	if (!conn.output.empty())
+	{
+		// The size line of a chunk goes first
+		_flushOutput(target);
+		if (_connections[target].cgi != cgi || !_connections[target].output.empty())
+			return (true);
+	}
+	ssize_t	moved = cgi->spliceOutput(target, length);
+	Connection&	sending = _connections[target];
+	if (moved < 0 && (errno == EINVAL || errno == ENOSYS))
+	{
+		sending.stream.disableSplice();
+		return (false);
+	}
+	if (moved < 0)
+	{
+		_closeClient(target);
+		return (true);
+	}
+	if (moved == 0)
+	{
+		_pauseCgiOutput(target, true);
+		_setPollEvents(target, POLLOUT);
+		_timers.arm(target, _sendTimeout);
+		return (true);
+	}
+	sending.stream.spliced(moved, sending.output);
+	_flushOutput(target);
+	return (true);
+}
+
+/// @brief Parses the header block of the output as it arrives. Once complete,
+/// queues the response header, framed for a body relayed as it comes (see
+/// `CgiStream::start`), leaving in `data` the body bytes that came with it.
+/// An invalid header, or output ending before it, is answered 502, or from
+/// a stale `cgi_cache` entry (see `_failCacheFill`).
+/// @return true once the body can be relayed.
+bool	Server::_startCgiResponse(int target, std::string& data, int status)
+{
+	Connection&		conn = _connections[target];
+	HttpRequest		request;
+
+	request.setUri("/");
+	Context			context(_fetchConfig(target), request);
+	HttpResponse	response(context);
+	int				parsed = conn.stream.parseHeader(data, response);
+	if (parsed == 0 && status > 0)
+		return (false);
+	if (parsed <= 0)
+	{
+		std::cerr << "Error: invalid CGI response" << std::endl;
+		response = HttpResponse::badGateway_502(context);
+		bool			keepAlive = conn.keepAlive;
+		CachedResponse	stale;
+		DiskCacheEntry	entry;
+		bool			useStale = _failCacheFill(target, stale, entry);
+		_endCgi(target, true);
+		if (useStale)
+			_sendStaleOnError(target, stale, entry, keepAlive);
+		else
+			_sendResponse(target, response, keepAlive);
+		return (false);
+	}
+	if (!conn.cacheKey.empty() && _keepCgiResponse(target, context, response, status))
+		return (false);
+	// May have run the requests waiting for it, and moved the table
+	Connection&	sending = _connections[target];
+	sending.stream.start(response, sending.keepAlive);
+	std::string	header = response.generateHeaderString();
+	sending.output.pushMemory(header);
+	sending.phase = PHASE_SENDING;
+	return (true);
+}
+
+/// @brief The output of a client's CGI request ended: detaches the script or
+/// FastCGI request, killing it or closing its connection on `abort`, and
+/// gives up its slot.
+void	Server::_endCgi(int target, bool abort)
+{
+	if (_connections[target].cgi != NULL)
+		_releaseCgi(target, abort);
+	if (_connections[target].upstream != NULL)
+		_releaseUpstream(target, abort);
+	_leaveCgiLimit(target);
+	_endCacheFill(target, false);
+}
+
+/// @brief The script or FastCGI application of a client failed.
+void	Server::_failCgi(int target)
+{
+	std::string	none;
+
+	_relayCgiOutput(target, none, -1);
+}
+
+/// @brief Stops or resumes reading the output of a client's CGI request, so
+/// that no more than `CGI_STREAM_BUFFER` bytes wait for a slow client: the
+/// pipe or socket fills up and the script blocks on its writes.
+void	Server::_pauseCgiOutput(int target, bool pause)
+{
+	Connection&	conn = _connections[target];
+
+	if (conn.stream.isPaused() == pause)
+		return ;
+	conn.stream.setPaused(pause);
+	if (conn.cgi != NULL && conn.cgi->getStdoutFd() != -1)
+		_setPollEvents(conn.cgi->getStdoutFd(), pause ? 0 : POLLIN);
+	else if (conn.upstream != NULL && conn.upstream->getSocketFd() != -1)
+		_setPollEvents(conn.upstream->getSocketFd(),
+			(pause ? 0 : POLLIN) | (conn.upstream->isSent() ? 0 : POLLOUT));
+}
+
+/// @brief Detaches the script from its client: closes the pipes, kills it on
+/// `abort`, and leaves it to be reaped.
+void	Server::_releaseCgi(int target, bool abort)
+{
+	CgiProcess*	cgi = _connections[target].cgi;
+
+	_connections[target].cgi = NULL;
+	if (cgi->getStdinFd() != -1)
+	{
+		_unregisterFd(cgi->getStdinFd());
+		cgi->closeInput();
+	}
+	if (cgi->getStdoutFd() != -1)
+	{
+		_unregisterFd(cgi->getStdoutFd());
+		cgi->closeOutput();
+	}
+	cgi->detach();
+	if (abort)
+		cgi->kill();
+	_reapCgi(cgi);
+}
+
+/// @brief Reaps a detached script, or waits for its exit: on its pidfd, or by
+/// polling where there is none. Each event loop only waits for its own
+/// children, so SIGCHLD and `waitpid(-1)` are not used. When the server stops,
+/// scripts still running are killed.
+void	Server::_reapCgi(CgiProcess* cgi)
+{
+	if (!_running)
+		cgi->kill();
+	if (cgi->reap(!_running))
+	{
+		if (cgi->getPidFd() != -1)
+		{
+			_unregisterFd(cgi->getPidFd());
+			cgi->closePidFd();
+		}
+		delete cgi;
+		return ;
+	}
+	if (cgi->getPidFd() != -1)
+		return ;
+	if (cgi->openPidFd() != -1)
+		_registerFd(cgi->getPidFd(), FD_CGI, POLLIN).cgi = cgi;
+	else
+		_cgiOrphans.push_back(cgi);
+}
+
+void	Server::_reapCgiOrphans()
+{
+	for (size_t i = 0; i < _cgiOrphans.size(); )
+	{
+		if (!_cgiOrphans[i]->reap(false))
+		{
+			i++;
+			continue ;
+		}
+		delete _cgiOrphans[i];
+		_cgiOrphans[i] = _cgiOrphans.back();
+		_cgiOrphans.pop_back();
+	}
+}
+
+/// @brief Kills and reaps every script and CGI worker, and drops the FastCGI
+/// requests, once the loop has stopped.
+void	Server::_stopCgi()
+{
+	for (size_t fd = 0; fd < _connections.size(); fd++)
+	{
+		if (_connections[fd].type == FD_CLIENT && _connections[fd].cgi != NULL)
+			_releaseCgi(fd, true);
+		if (_connections[fd].type == FD_CLIENT && _connections[fd].upstream != NULL)
+			_releaseUpstream(fd, true);
+	}
+	while (!_cgiWorkers.empty())
+		_closeUpstreamConnection(_cgiWorkers.begin()->first);
+	for (size_t fd = 0; fd < _connections.size(); fd++)
+	{
+		if (_connections[fd].type == FD_CGI)
+			_reapCgi(_connections[fd].cgi);
+	}
+	for (size_t i = 0; i < _cgiOrphans.size(); i++)
+	{
+		_cgiOrphans[i]->kill();
+		_cgiOrphans[i]->reap(true);
+		delete _cgiOrphans[i];
+	}
+	_cgiOrphans.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// CGI limits
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Admits a CGI request against the `cgi_max_concurrency` of its
+/// location. Past the cap the request is parked in the location's queue
+/// until a slot frees up (see `_leaveCgiLimit`), and shed with a 503 once the
+/// queue is full: slow scripts hold their own clients, not the event loop
+/// nor the connections serving static files. `cgi_timeout` runs from here,
+/// the wait included.
+/// @return true if the request may start now.
+bool	Server::_admitCgi(int target, const Context& context, const std::string& requestData)
+{
+	const Location&	location = context.getLocation();
+	std::string		name = context.getServer().listen + location.getPath();
+	std::map<std::string, CgiLimit>::iterator it = _cgiLimits.find(name);
+
+	if (it == _cgiLimits.end())
+	{
+		CgiLimit	limit;
+		limit.maxRunning = location.getCgiMaxConcurrency();
+		limit.maxWaiting = location.getCgiQueue();
+		limit.timeout = location.getProxyPass().empty() ? location.getCgiTimeout()
+			: location.getProxyTimeout();
+		limit.running = 0;
+		it = _cgiLimits.insert(std::make_pair(name, limit)).first;
+	}
+	CgiLimit&	limit = it->second;
+	Connection&	conn = _connections[target];
+	// Run again with the slot it waited for
+	if (conn.cgiLimit == &limit)
+		return (true);
+	if (limit.maxRunning != 0 && limit.running >= limit.maxRunning
+		&& limit.waiting.size() >= limit.maxWaiting)
+	{
+		_cgiStats.rejected++;
+		_shedRequest(target);
+		return (false);
+	}
+	conn.cgiLimit = &limit;
+	if (limit.timeout > 0)
+		_timers.arm(target, limit.timeout);
+	if (limit.maxRunning == 0 || limit.running < limit.maxRunning)
+	{
+		limit.running++;
+		_cgiStats.running++;
+		return (true);
+	}
+	ConnectionRef	ref = {target, conn.generation};
+	limit.waiting.push_back(ref);
+	_cgiStats.queued++;
+	_cgiStats.waiting++;
+	conn.parkedRequest = requestData;
+	conn.phase = PHASE_PARKED;
+	_setPollEvents(target, POLL_PEER_CLOSED);
+	return (false);
+}
+
+/// @brief Gives up the slot, or the place in the queue, of a CGI request and
+/// its `cgi_timeout`. A freed slot goes to the first request waiting, which
+/// is run again from the start.
+void	Server::_leaveCgiLimit(int target)
+{
+	CgiLimit*	limit = _connections[target].cgiLimit;
+
+	if (limit == NULL)
+		return ;
+	_connections[target].cgiLimit = NULL;
+	_timers.cancel(target);
+	if (_connections[target].phase == PHASE_PARKED)
+	{
+		for (std::deque<ConnectionRef>::iterator it = limit->waiting.begin(); it != limit->waiting.end(); ++it)
+		{
+			if (it->fd == target)
+			{
+				limit->waiting.erase(it);
+				_cgiStats.waiting--;
+				break ;
+			}
+		}
+		std::string().swap(_connections[target].parkedRequest);
+		return ;
+	}
+	while (!limit->waiting.empty())
+	{
+		ConnectionRef	next = limit->waiting.front();
+		limit->waiting.pop_front();
+		_cgiStats.waiting--;
+		if (!_isCurrent(next.fd, next.generation))
+			continue ;
+		std::string	requestData;
+		requestData.swap(_connections[next.fd].parkedRequest);
+		_connections[next.fd].phase = PHASE_CGI;
+		_processRequest(next.fd, requestData, 1);
+		return ;
+	}
+	limit->running--;
+	_cgiStats.running--;
+}
+
+/// @brief The `cgi_timeout` of a request expired: kills its script, or drops
+/// its FastCGI request (killing the CGI worker running it), and answers 504,
+/// or from a stale `cgi_cache` entry. Once the response has started, the
+/// connection is closed instead.
+void	Server::_timeoutCgi(int target)
+{
+	CachedResponse	stale;
+	DiskCacheEntry	entry;
+
+	std::cerr << "Error: CGI request timed out" << std::endl;
+	_cgiStats.timedOut++;
+	if (_connections[target].stream.isStarted())
+	{
+		_closeClient(target);
+		return ;
+	}
+	bool	useStale = _failCacheFill(target, stale, entry);
+	if (_connections[target].cgi != NULL)
+		_releaseCgi(target, true);
+	if (_connections[target].upstream != NULL)
+	{
+		_failPeer(_connections[target].upstream);
+		_releaseUpstream(target, true);
+	}
+	_leaveCgiLimit(target);
+	_endCacheFill(target, false);
+	if (useStale)
+		_sendStaleOnError(target, stale, entry, _connections[target].keepAlive);
+	else
+		_respondWithError(target, 504);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// CGI cache
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Answers a GET of a `cgi_cache` location from the cache, in memory
+/// then on disk. On a miss the request goes on to run, filling the cache;
+/// requests for the same key meanwhile wait for its response, parked,
+/// instead of running too. An expired entry within its
+/// `cgi_cache_stale_while_revalidate` window is still served, while a
+/// background request refreshes it. A stale disk entry that can be
+/// revalidated makes the request conditional (see `_addCacheValidators`).
+/// @return true if the request was answered or parked.
+bool	Server::_serveCgiCache(int target, const Context& context, const std::string& requestData, bool keepAlive)
+{
+	const Location&	location = context.getLocation();
+	Connection&		conn = _connections[target];
+	bool			background = conn.background;
+
+	// Run again with the CGI slot it waited for: the cache was looked up then
+	if (location.getCgiCache() == 0 || conn.cgiLimit != NULL
+		|| !ResponseCache::acceptsRequest(context.getRequest()))
+		return (false);
+	std::string				key = ResponseCache::buildKey(context, location.getCgiCacheKey());
+	uint64_t				now = TimerWheel::now();
+	const CachedResponse*	cached = _cgiCache.lookup(key, now);
+	_cgiStats.cacheBytes = _cgiCache.getBytes();
+	if (cached != NULL && cached->pass)
+		return (false);
+	if (cached != NULL && now < cached->expires)
+	{
+		_cgiStats.cacheHits++;
+		_sendCachedResponse(target, context, *cached, keepAlive, false);
+		return (true);
+	}
+	DiskCacheEntry	entry;
+	uint64_t		wall = DiskCache::now();
+	e_disk_lookup	found = _diskCache.lookup(key, wall, entry);
+	if (found == DISK_HIT && wall < entry.response.expires)
+	{
+		_cgiStats.cacheHits++;
+		_cgiStats.cacheDiskHits++;
+		_sendDiskCached(target, context, entry, keepAlive, false);
+		return (true);
+	}
+	// The refresh itself goes on to run
+	if (!background && ((cached != NULL && now < cached->staleUntil)
+		|| (found == DISK_HIT && wall < entry.response.staleUntil)))
+	{
+		// Opened first, as the client may be gone once answered
+		int	refresh = _openRefresh(target, key);
+
+		_cgiStats.cacheStale++;
+		if (cached != NULL && now < cached->staleUntil)
+		{
+			if (found == DISK_HIT)
+				close(entry.fd);
+			_sendCachedResponse(target, context, *cached, keepAlive, true);
+		}
+		else
+			_sendDiskCached(target, context, entry, keepAlive, true);
+		if (refresh != -1)
+			_processRequest(refresh, requestData, 1);
+		return (true);
+	}
+	if (found == DISK_HIT)
+		close(entry.fd);
+	conn.keepAlive = keepAlive;
+	std::map<std::string, CacheFill>::iterator it = _cacheFills.find(key);
+	if (it == _cacheFills.end())
+	{
+		CacheFill&	fill = _cacheFills[key];
+		fill.ttl = location.getCgiCache();
+		fill.staleWhileRevalidate = location.getCgiCacheStaleWhileRevalidate();
+		fill.staleIfError = location.getCgiCacheStaleIfError();
+		fill.diskFd = -1;
+		fill.revalidate = (found != DISK_MISS && (!entry.etag.empty() || !entry.lastModified.empty()));
+		fill.etag = entry.etag;
+		fill.lastModified = entry.lastModified;
+		fill.failed = false;
+		conn.cacheKey = key;
+		_cgiStats.cacheMisses++;
+		return (false);
+	}
+	ConnectionRef	ref = {target, conn.generation};
+	it->second.waiting.push_back(ref);
+	_cgiStats.cacheCoalesced++;
+	conn.parkedRequest = requestData;
+	conn.phase = PHASE_PARKED;
+	_setPollEvents(target, POLL_PEER_CLOSED);
+	return (true);
+}
+
+/// @brief Answers with a cached response, its `Age` in seconds.
+/// @param stale whether it is served past its expiry.
+void	Server::_sendCachedResponse(int target, const Context& context, const CachedResponse& cached,
+			bool keepAlive, bool stale)
+{
+	HttpResponse	response(context);
+
+	response.setStatusCode(cached.status, cached.message);
+	for (std::map<std::string, std::string>::const_iterator it = cached.headers.begin();
+		it != cached.headers.end(); ++it)
+		response.setHeader(it->first, it->second);
+	response.setHeader("Age", toString(static_cast<size_t>((TimerWheel::now() - cached.storedAt) / 1000)));
+	response.setHeader("X-Cache", stale ? "STALE" : "HIT");
+	response.setBody(cached.body);
+	_sendResponse(target, response, keepAlive);
+}
+
+/// @brief Answers with a response of the disk cache, its body sent from the
+/// file with `sendfile()`, which then closes it.
+void	Server::_sendDiskCached(int target, const Context& context, DiskCacheEntry& entry, bool keepAlive,
+			bool stale)
+{
+	HttpResponse	response(context);
+	uint64_t		now = DiskCache::now();
+
+	response.setStatusCode(entry.response.status, entry.response.message);
+	for (std::map<std::string, std::string>::const_iterator it = entry.response.headers.begin();
+		it != entry.response.headers.end(); ++it)
+		response.setHeader(it->first, it->second);
+	response.setHeader("Age", toString(static_cast<size_t>(
+		now > entry.response.storedAt ? (now - entry.response.storedAt) / 1000 : 0)));
+	response.setHeader("X-Cache", stale ? "STALE" : "HIT");
+	response.setFileBody("", entry.length);
+	_queueResponse(target, response, entry.fd, entry.offset, keepAlive);
+}
+
+/// @brief Opens the connection a background refresh of `key` runs on: one
+/// end of a socket pair, as a client of the same server as `target`, whose
+/// response the other end reads and drops. It counts as a client of the
+/// same address, so none is opened past the connection limits, nor while a
+/// request for `key` is already running.
+/// @return the fd to run the request on, -1 if none.
+int	Server::_openRefresh(int target, const std::string& key)
+{
+	int				fds[2];
+	size_t			listenIndex = _connections[target].listenIndex;
+	ServerConfig*	serverConfig = _connections[target].serverConfig;
+	uint32_t		clientAddr = _connections[target].clientAddr;
+
+	if (_cacheFills.find(key) != _cacheFills.end() || !_admitConnection(listenIndex, clientAddr))
+		return (-1);
+#ifdef __linux__
+	int	result = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds);
+#else
+	int	result = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	if (result == 0)
+	{
+		fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+		fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	}
+#endif
+	if (result == -1)
+	{
+		std::cerr << "Error: failed to refresh a cgi_cache entry: " << strerror(errno) << std::endl;
+		return (-1);
+	}
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	_registerFd(fds[1], FD_SINK, POLLIN);
+	Connection&		conn = _registerFd(fds[0], FD_CLIENT, 0);
+	conn.listenIndex = listenIndex;
+	conn.serverConfig = serverConfig;
+	conn.clientAddr = clientAddr;
+	conn.background = true;
+	_listenInfos[listenIndex].clients++;
+	_clientsPerIp[clientAddr]++;
+	_clientCount++;
+	_cgiStats.cacheRefreshes++;
+	return (fds[0]);
+}
+
+/// @brief Drops what a background refresh was answered, and closes its end
+/// of the socket pair once the refresh is over.
+void	Server::_drainRefresh(int fd)
+{
+	char	buffer[REFRESH_READ_BUFFER_SIZE];
+	ssize_t	count;
+
+	while ((count = read(fd, buffer, sizeof(buffer))) > 0)
+		;
+	if (count == 0 || (errno != EAGAIN && errno != EINTR))
+	{
+		_unregisterFd(fd);
+		close(fd);
+	}
+}
+
+/// @brief Finds what to answer with in place of a failed CGI request for
+/// `key`: an entry within its `cgi_cache_stale_if_error` window, in memory,
+/// copied into `cached`, else on disk, its file opened into `entry`.
+bool	Server::_findStaleOnError(const std::string& key, CachedResponse& cached, DiskCacheEntry& entry)
+{
+	uint64_t				now = TimerWheel::now();
+	const CachedResponse*	found = _cgiCache.lookup(key, now);
+
+	if (found != NULL && !found->pass && now < std::max(found->expires, found->errorUntil))
+	{
+		cached = *found;
+		return (true);
+	}
+	uint64_t	wall = DiskCache::now();
+	if (_diskCache.lookup(key, wall, entry) != DISK_HIT)
+		return (false);
+	if (wall < std::max(entry.response.expires, entry.response.errorUntil))
+		return (true);
+	close(entry.fd);
+	entry.fd = -1;
+	return (false);
+}
+
+/// @brief Answers with what `_findStaleOnError` found.
+void	Server::_sendStaleOnError(int target, const CachedResponse& cached, DiskCacheEntry& entry,
+			bool keepAlive)
+{
+	HttpRequest		request;
+
+	request.setUri("/");
+	Context			context(_fetchConfig(target), request);
+	_timers.cancel(target);
+	_cgiStats.cacheStale++;
+	if (entry.fd != -1)
+		_sendDiskCached(target, context, entry, keepAlive, true);
+	else
+		_sendCachedResponse(target, context, cached, keepAlive, true);
+}
+
+/// @brief The CGI request of a client failed, or timed out. If it was
+/// filling the cache and a stale entry can answer in its place (see
+/// `_findStaleOnError`), the requests waiting for it are answered from that
+/// too instead of running in turn.
+/// @return whether the client is to be answered from `cached` or `entry`.
+bool	Server::_failCacheFill(int target, CachedResponse& cached, DiskCacheEntry& entry)
+{
+	std::map<std::string, CacheFill>::iterator it = _cacheFills.find(_connections[target].cacheKey);
+
+	if (it == _cacheFills.end() || !_findStaleOnError(it->first, cached, entry))
+		return (false);
+	it->second.failed = true;
+	return (true);
+}
+
+/// @brief Makes the request of a `cgi_cache` miss conditional on the
+/// validators of the stale disk entry it revalidates, in place of the
+/// client's own: a 304 then means the entry can be served again. Without
+/// one, the client's validators are dropped, so that the response can be
+/// cached.
+void	Server::_addCacheValidators(int target, HttpRequest& request)
+{
+	std::map<std::string, CacheFill>::iterator it = _cacheFills.find(_connections[target].cacheKey);
+
+	if (it == _cacheFills.end())
+		return ;
+	std::map<std::string, std::string>	headers = request.getHeaders();
+	std::map<std::string, std::string>	conditional;
+
+	for (std::map<std::string, std::string>::const_iterator header = headers.begin();
+		header != headers.end(); ++header)
+	{
+		std::string	name = header->first;
+
+		for (size_t i = 0; i < name.size(); i++)
+			name[i] = std::tolower(name[i]);
+		if (name != "if-none-match" && name != "if-modified-since")
+			conditional.insert(*header);
+	}
+	if (it->second.revalidate && !it->second.etag.empty())
+		conditional["If-None-Match"] = it->second.etag;
+	if (it->second.revalidate && !it->second.lastModified.empty())
+		conditional["If-Modified-Since"] = it->second.lastModified;
+	request.setHeaders(conditional);
+}
+
+/// @brief The header of a `cgi_cache` miss arrived. If the response may be
+/// cached, keeps its status and headers and has its body copied as it is
+/// relayed, to memory and to the disk cache; if not, remembers the key as
+/// such for the location's `cgi_cache`, unless it is a server error, and
+/// lets the requests waiting for it run. A 304 to a revalidation makes the stale disk entry fresh again, and
+/// the client is answered from it. A server error is answered from a stale
+/// entry within its `cgi_cache_stale_if_error` window, if any.
+/// @param status of the output, see `_relayCgiOutput`.
+/// @return true if the client was answered from the cache instead.
+bool	Server::_keepCgiResponse(int target, const Context& context, HttpResponse& response, int status)
+{
+	std::map<std::string, CacheFill>::iterator it = _cacheFills.find(_connections[target].cacheKey);
+	CachedResponse	stale;
+	DiskCacheEntry	entry;
+
+	if (it == _cacheFills.end())
+		return (false);
+	CacheFill&	fill = it->second;
+	if (fill.revalidate && response.getStatusCode() == 304)
+		return (_revalidateCgiCache(target, context, response, status));
+	if (response.getStatusCode() >= 500 && _failCacheFill(target, stale, entry))
+	{
+		bool	keepAlive = _connections[target].keepAlive;
+
+		_endCgi(target, status != 0);
+		_sendStaleOnError(target, stale, entry, keepAlive);
+		return (true);
+	}
+	size_t		ttl = ResponseCache::freshness(response, fill.ttl);
+	if (ttl == 0)
+	{
+		// A server error says nothing of the key, and leaves a stale entry be
+		if (response.getStatusCode() < 500)
+			_cgiCache.insertPass(it->first, TimerWheel::now() + fill.ttl);
+		_endCacheFill(target, false);
+		return (false);
+	}
+	fill.ttl = ttl;
+	ft_set_windows(fill, response);
+	fill.response.status = response.getStatusCode();
+	fill.response.message = response.getStatusMessage();
+	fill.response.headers = response.getHeaders();
+	_connections[target].stream.capture(_cgiCache.getMaxEntry());
+	fill.diskFd = _diskCache.create(it->first, fill.response);
+	if (fill.diskFd != -1)
+		_connections[target].stream.captureToFile(fill.diskFd, _diskCache.getBudget());
+	response.setHeader("X-Cache", "MISS");
+	return (false);
+}
+
+/// @brief The stale disk entry of a `cgi_cache` miss was found unchanged:
+/// it is fresh again for the freshness of the 304, and answers the client.
+/// The requests waiting for it then find it too.
+bool	Server::_revalidateCgiCache(int target, const Context& context, HttpResponse& response, int status)
+{
+	std::string		key = _connections[target].cacheKey;
+	CacheFill&		fill = _cacheFills[key];
+	bool			keepAlive = _connections[target].keepAlive;
+	DiskCacheEntry	entry;
+	CachedResponse	times;
+	uint64_t		now = DiskCache::now();
+
+	// Its cache headers are those of the entry, but for the status
+	response.setStatusCode(200, "OK");
+	fill.ttl = ResponseCache::freshness(response, fill.ttl);
+	ft_set_windows(fill, response);
+	ft_date_response(times, fill, now);
+	_diskCache.refresh(key, times);
+	_cgiStats.cacheRevalidated++;
+	_endCgi(target, status != 0);
+	if (_diskCache.lookup(key, now, entry) != DISK_HIT)
+	{
+		_respondWithError(target, 502);
+		return (true);
+	}
+	_cgiStats.cacheHits++;
+	_cgiStats.cacheDiskHits++;
+	_sendDiskCached(target, context, entry, keepAlive, false);
+	return (true);
+}
+
+/// @brief The response of a `cgi_cache` miss is over: if `complete`, caches
+/// it, or remembers it was too large to. The requests waiting for it are
+/// then run again, answered from the cache or running in turn; if it failed
+/// with a stale entry to fall back on, they are answered from that.
+void	Server::_endCacheFill(int target, bool complete)
+{
+	std::string	key;
+
+	key.swap(_connections[target].cacheKey);
+	std::map<std::string, CacheFill>::iterator it = _cacheFills.find(key);
+	if (it == _cacheFills.end())
+		return ;
+	CacheFill&					fill = it->second;
+	std::vector<ConnectionRef>	waiting;
+	bool						failed = fill.failed;
+
+	waiting.swap(fill.waiting);
+	bool	onDisk = (fill.diskFd != -1 && _connections[target].stream.takeCapturedFile() && complete);
+	if (onDisk)
+	{
+		CachedResponse	stored = fill.response;
+
+		ft_date_response(stored, fill, DiskCache::now());
+		_diskCache.commit(key, fill.diskFd, stored);
+	}
+	else if (fill.diskFd != -1)
+		_diskCache.discard(fill.diskFd);
+	if (complete && _connections[target].stream.takeCaptured(fill.response.body))
+	{
+		ft_date_response(fill.response, fill, TimerWheel::now());
+		_cgiCache.insert(key, fill.response);
+	}
+	else if (complete && !onDisk)
+		_cgiCache.insertPass(key, TimerWheel::now() + fill.ttl);
+	_cgiStats.cacheBytes = _cgiCache.getBytes();
+	_cgiStats.cacheDiskBytes = _diskCache.getBytes();
+	_cacheFills.erase(it);
+	for (size_t i = 0; i < waiting.size(); i++)
+	{
+		CachedResponse	stale;
+		DiskCacheEntry	entry;
+
+		// The client may have gone away while its request was parked
+		if (!_isCurrent(waiting[i].fd, waiting[i].generation))
+			continue ;
+		std::string	requestData;
+		requestData.swap(_connections[waiting[i].fd].parkedRequest);
+		if (failed && _findStaleOnError(key, stale, entry))
+			_sendStaleOnError(waiting[i].fd, stale, entry, _connections[waiting[i].fd].keepAlive);
+		else
+			_processRequest(waiting[i].fd, requestData, 1);
+	}
+}
+
+/// @brief Forgets the misses being run, once the loop has stopped, and the
+/// disk cache files they were writing.
+void	Server::_dropCacheFills()
+{
+	for (std::map<std::string, CacheFill>::iterator it = _cacheFills.begin(); it != _cacheFills.end(); ++it)
+	{
+		if (it->second.diskFd != -1)
+			_diskCache.discard(it->second.diskFd);
+	}
+	_cacheFills.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// FastCGI, CGI workers and proxy_pass
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Sends a CGI request to the FastCGI application of its location, or
+/// to one of the location's `cgi_workers`, instead of forking the script.
+/// The client waits in `PHASE_CGI`, as for a script, until the header of the
+/// output is complete (see `_relayCgiOutput`).
+void	Server::_startFastCgi(int target, const Context& context, const HttpResponse& response,
+			const std::string& requestData, bool keepAlive)
+{
+	std::map<std::string, std::string>	headers = context.getRequest().getHeaders();
+	std::map<std::string, std::string>::const_iterator it = headers.find("Transfer-Encoding");
+	std::string							body = CgiProcess::requestBody(requestData,
+											it != headers.end() && it->second == "chunked");
+	std::vector<std::string>			env = CgiProcess::buildEnvironment(context, response.getCgiScript(),
+											response.getCgiPathInfo(), body.size(), _connections[target].clientAddr);
+	std::string							name = response.getCgiPass();
+
+	if (name.empty())
+	{
+		const Location&	location = context.getLocation();
+
+		name = _cgiWorkerPool(context.getServer(), location);
+		const CgiRlimits&	limits = location.getCgiRlimits();
+		env.push_back(CGI_WORKER_INTERPRETER "=" + response.getCgiInterpreter());
+		env.push_back(CGI_WORKER_RLIMITS "=" + toString(limits.cpu) + " " + toString(limits.memory)
+			+ " " + toString(limits.files));
+	}
+	FastCgiRequest*	request = new FastCgiRequest(target, _connections[target].generation, name);
+	request->encode(env, body);
+	Connection&	conn = _connections[target];
+	conn.upstream = request;
+	conn.keepAlive = keepAlive;
+	conn.phase = PHASE_CGI;
+	conn.stream.reset(context.getRequest().getVersion() == "HTTP/1.1",
+		context.getRequest().getMethod() == "HEAD");
+	_setPollEvents(target, POLL_PEER_CLOSED);
+	if (!_connectUpstream(request))
+		_failCgi(target);
+}
+
+/// @brief Forwards the request of a `proxy_pass` location to its server, on
+/// a pooled keep-alive connection when there is one. The response is relayed
+/// as it comes, like the output of a FastCGI request.
+void	Server::_startProxy(int target, const Context& context, const HttpResponse& response,
+			const std::string& requestData, bool keepAlive)
+{
+	const HttpRequest&					request = context.getRequest();
+	std::map<std::string, std::string>	headers = request.getHeaders();
+	std::map<std::string, std::string>::const_iterator it = headers.find("Transfer-Encoding");
+	std::string							body = CgiProcess::requestBody(requestData,
+											it != headers.end() && it->second == "chunked");
+	std::string							pass = response.getCgiPass();
+	std::map<std::string, UpstreamGroup>::iterator group = _upstreamGroups.find(pass);
+	ProxyRequest*						proxy;
+
+	if (group == _upstreamGroups.end())
+		pass = ft_proxy_pool(pass);
+	proxy = new ProxyRequest(target, _connections[target].generation, pass);
+	if (group != _upstreamGroups.end())
+		proxy->balance(&group->second, group->second.balanceKey(response.getProxyUri(),
+			_connections[target].clientAddr));
+	// Before a server is picked: without a `Host`, the block's name is sent
+	proxy->encode(request, response.getProxyUri(), body, _connections[target].clientAddr);
+	Connection&	conn = _connections[target];
+	conn.upstream = proxy;
+	conn.keepAlive = keepAlive;
+	conn.phase = PHASE_CGI;
+	conn.stream.reset(request.getVersion() == "HTTP/1.1", request.getMethod() == "HEAD");
+	_setPollEvents(target, POLL_PEER_CLOSED);
+	if (group != _upstreamGroups.end() ? !_connectPeer(proxy, -1) : !_connectUpstream(proxy))
+		_failCgi(target);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Upstream groups
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Builds the `upstream` blocks, for `proxy_pass http://name`.
+void	Server::_setupUpstreamGroups()
+{
+	const std::map<std::string, UpstreamConfig>&	upstreams = _config.getUpstreams();
+
+	for (std::map<std::string, UpstreamConfig>::const_iterator it = upstreams.begin(); it != upstreams.end(); ++it)
+		_upstreamGroups.insert(std::make_pair("http://" + it->first, UpstreamGroup(it->second)));
+}
+
+/// @brief Resolves every `fastcgi_pass`, `proxy_pass` and `upstream` server
+/// once, as the server starts: `getaddrinfo()` blocks, and would hold up the
+/// whole event loop. The requests of an address that does not resolve get a
+/// 502.
+void	Server::_setupUpstreams()
+{
+	std::vector<std::string>	names;
+
+	for (std::map<std::string, UpstreamGroup>::iterator it = _upstreamGroups.begin();
+		it != _upstreamGroups.end(); ++it)
+	{
+		for (size_t peer = 0; peer < it->second.size(); peer++)
+			names.push_back(it->second.getPool(peer));
+	}
+	for (size_t i = 0; i < _serverConfigs.size(); i++)
+	{
+		std::map<std::string, Location*>&	locations = _serverConfigs[i]->map_locationObjs;
+
+		for (std::map<std::string, Location*>::iterator it = locations.begin(); it != locations.end(); ++it)
+		{
+			const std::string&	pass = it->second->getProxyPass();
+
+			if (!it->second->getFastCgiPass().empty())
+				names.push_back(it->second->getFastCgiPass());
+			if (!pass.empty() && _upstreamGroups.find(pass) == _upstreamGroups.end())
+				names.push_back(ft_proxy_pool(pass));
+		}
+	}
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		UpstreamAddress	address;
+
+		if (_upstreams.find(names[i]) != _upstreams.end())
+			continue ;
+		if (resolveUpstream(ft_upstream_address(names[i]), address))
+			_upstreams.insert(std::make_pair(names[i], address));
+		else
+			std::cerr << "Error: invalid upstream address " << names[i] << std::endl;
+	}
+}
+
+/// @brief Gives a request of an `upstream` block a server and a connection
+/// to it. A server that cannot be connected to counts as failed, and the
+/// next one is tried, each at most once.
+/// @param avoid the server that just refused the request, -1 if none.
+/// @return false if no server could be connected to.
+bool	Server::_connectPeer(UpstreamRequest* request, int avoid)
+{
+	UpstreamGroup*	group = request->getGroup();
+	uint64_t		now = TimerWheel::now();
+
+	if (avoid != -1)
+	{
+		group->fail(avoid, now);
+		group->release(avoid);
+		request->setPeer(-1);
+	}
+	for (size_t attempt = 0; attempt < group->size(); attempt++)
+	{
+		int	peer = group->select(request->getBalanceKey(), now, avoid);
+		if (peer == -1)
+			return (false);
+		request->setPeer(peer);
+		if (_connectUpstream(request))
+			return (true);
+		group->fail(peer, now);
+		group->release(peer);
+		request->setPeer(-1);
+		avoid = peer;
+	}
+	return (false);
+}
+
+/// @brief The server of a request failed it: passive failure detection of
+/// its `upstream` block, see `UpstreamGroup::fail`.
+void	Server::_failPeer(UpstreamRequest* request)
+{
+	if (request->getGroup() != NULL && request->getPeer() != -1)
+		request->getGroup()->fail(request->getPeer(), TimerWheel::now());
+}
+
+/// @brief Starts the health checks that are due, and sets when the event
+/// loop runs the next ones.
+void	Server::_runHealthChecks()
+{
+	uint64_t	now = TimerWheel::now();
+	uint64_t	next = 0;
+
+	_nextHealthCheck = 0;
+	if (!_running)
+		return ;
+	for (std::map<std::string, UpstreamGroup>::iterator it = _upstreamGroups.begin();
+		it != _upstreamGroups.end(); ++it)
+	{
+		UpstreamGroup&	group = it->second;
+
+		if (group.getHealthInterval() == 0)
+			continue ;
+		if (group.isHealthCheckDue(now))
+		{
+			for (size_t peer = 0; peer < group.size(); peer++)
+				_startHealthProbe(group, peer);
+		}
+		if (next == 0 || group.getNextHealthCheck() < next)
+			next = group.getNextHealthCheck();
+	}
+	_nextHealthCheck = next;
+}
+
+/// @brief Connects to a server and, with a `uri`, asks for it. The check
+/// passes once connected, or on a 2xx or 3xx status, and fails on an error
+/// or after `timeout`. A server still being checked is left alone.
+void	Server::_startHealthProbe(UpstreamGroup& group, size_t peer)
+{
+	for (std::map<int, HealthProbe>::iterator it = _healthProbes.begin(); it != _healthProbes.end(); ++it)
+	{
+		if (it->second.group == &group && it->second.peer == peer)
+			return ;
+	}
+	const UpstreamAddress*	address = _resolveUpstream(group.getPool(peer));
+	int						fd = (address == NULL) ? -1 : connectUpstream(*address);
+	if (fd == -1)
+	{
+		if (group.setHealthy(peer, false))
+			std::cerr << "Error: upstream " << group.getPool(peer) << " is down" << std::endl;
+		return ;
+	}
+	HealthProbe	probe;
+	probe.group = &group;
+	probe.peer = peer;
+	probe.connecting = true;
+	probe.offset = 0;
+	if (!group.getHealthUri().empty())
+		probe.request = "GET " + group.getHealthUri() + " HTTP/1.1\r\nHost: "
+			+ ft_upstream_address(group.getPool(peer)) + "\r\nConnection: close\r\n\r\n";
+	_healthProbes[fd] = probe;
+	_registerFd(fd, FD_HEALTH, POLLOUT);
+	_timers.arm(fd, group.getHealthTimeout());
+}
+
+/// @brief Drives a health check: the connection, the request, then the
+/// status line of the answer.
+void	Server::_handleHealthEvent(int fd, short revents)
+{
+	HealthProbe&	probe = _healthProbes[fd];
+
+	if (probe.connecting)
+	{
+		if (!finishConnect(fd))
+			return (_endHealthProbe(fd, false));
+		probe.connecting = false;
+		if (probe.request.empty())
+			return (_endHealthProbe(fd, true));
+	}
+	if (probe.offset < probe.request.size())
+	{
+		ssize_t	written = ::send(fd, probe.request.data() + probe.offset,
+							probe.request.size() - probe.offset, MSG_NOSIGNAL);
+		if (written < 0 && errno != EAGAIN && errno != EINTR)
+			return (_endHealthProbe(fd, false));
+		if (written > 0)
+			probe.offset += written;
+		if (probe.offset == probe.request.size())
+			_setPollEvents(fd, POLLIN);
+		return ;
+	}
+	if (!(revents & (POLLIN | POLLHUP | POLLERR)))
+		return ;
+	char	buffer[512];
+	ssize_t	count = read(fd, buffer, sizeof(buffer));
+	if (count < 0 && (errno == EAGAIN || errno == EINTR))
+		return ;
+	if (count > 0)
+		probe.response.append(buffer, count);
+	// `HTTP/1.1 200`
+	if (probe.response.size() >= 12)
+	{
+		int	code = std::atoi(probe.response.c_str() + 9);
+		return (_endHealthProbe(fd, probe.response.compare(0, 5, "HTTP/") == 0 && code >= 200 && code < 400));
+	}
+	if (count <= 0)
+		_endHealthProbe(fd, false);
+}
+
+/// @brief Ends a health check, taking the server out of rotation or putting
+/// it back, and logs the change.
+void	Server::_endHealthProbe(int fd, bool healthy)
+{
+	std::map<int, HealthProbe>::iterator it = _healthProbes.find(fd);
+
+	if (it != _healthProbes.end())
+	{
+		UpstreamGroup&	group = *it->second.group;
+		size_t			peer = it->second.peer;
+
+		if (group.setHealthy(peer, healthy))
+			std::cerr << (healthy ? "Upstream " : "Error: upstream ") << group.getPool(peer)
+				<< (healthy ? " is up" : " is down") << std::endl;
+		_healthProbes.erase(it);
+	}
+	_unregisterFd(fd);
+	close(fd);
+}
+
+/// @brief Gives the request a connection: an idle one from the pool, else a
+/// new one, or a new worker while the pool has room and a place in its queue
+/// otherwise. Addresses are resolved once per `fastcgi_pass` or `proxy_pass`.
+/// @return false if no connection could be started.
+bool	Server::_connectUpstream(UpstreamRequest* request)
+{
+	const std::string&	name = request->getUpstream();
+	std::vector<int>&	idle = _upstreamIdle[name];
+
+	if (!idle.empty())
+	{
+		int	fd = idle.back();
+		idle.pop_back();
+		request->attach(fd, true);
+		_connections[fd].upstream = request;
+		_setPollEvents(fd, POLLIN | POLLOUT);
+		return (true);
+	}
+	std::map<std::string, CgiWorkerPool>::iterator pool = _cgiWorkerPools.find(name);
+	if (pool != _cgiWorkerPools.end())
+	{
+		if (pool->second.running < pool->second.size)
+			return (_spawnCgiWorker(name, request));
+		pool->second.waiting.push_back(request);
+		return (true);
+	}
+	const UpstreamAddress*	address = _resolveUpstream(name);
+	if (address == NULL)
+		return (false);
+	int	fd = connectUpstream(*address);
+	if (fd == -1)
+	{
+		std::cerr << "Error: failed to connect to " << name << ": " << strerror(errno) << std::endl;
+		return (false);
+	}
+	// The application may answer before it has read the whole request
+	_registerFd(fd, FD_UPSTREAM, POLLIN | POLLOUT).upstream = request;
+	request->attach(fd, false);
+	return (true);
+}
+
+/// @brief The address of an upstream pool, resolved at startup (see
+/// `_setupUpstreams`).
+/// @return NULL if it did not resolve.
+const UpstreamAddress*	Server::_resolveUpstream(const std::string& name) const
+{
+	std::map<std::string, UpstreamAddress>::const_iterator it = _upstreams.find(name);
+
+	if (it == _upstreams.end())
+		return (NULL);
+	return (&it->second);
+}
+
+/// @brief Writes the request and reads the answer. A pooled connection only
+/// becomes readable when the backend closes it, or the worker exits.
+void	Server::_handleUpstreamEvent(int fd, short revents)
+{
+	UpstreamRequest*	request = _connections[fd].upstream;
+
+	if (request == NULL)
+	{
+		_closeUpstreamConnection(fd);
+		return ;
+	}
+	if (!request->isSent())
+	{
+		if (request->send() < 0)
+		{
+			_retryUpstream(request);
+			return ;
+		}
+		if (request->isSent())
+			_setPollEvents(fd, POLLIN);
+	}
+	if (!(revents & (POLLIN | POLLHUP | POLLERR)))
+		return ;
+	int	status = request->receive();
+	if (status < 0 && request->canRetry())
+	{
+		_retryUpstream(request);
+		return ;
+	}
+	if (status < 0)
+		_failPeer(request);
+	std::string	data;
+	request->takeOutput(data);
+	_relayCgiOutput(request->getClientFd(), data, status);
+}
+
+/// @brief The connection failed: sends the request again on a new one if it
+/// was a pooled connection the backend had closed, or to another server of
+/// its `upstream` block if this one refused it; else answers 502.
+void	Server::_retryUpstream(UpstreamRequest* request)
+{
+	int		fd = request->getSocketFd();
+	bool	retry = request->canRetry();
+	bool	failover = !retry && request->getGroup() != NULL && !request->hasStarted();
+
+	request->detach();
+	_closeUpstreamConnection(fd);
+	if (retry)
+	{
+		request->rewind();
+		if (_connectUpstream(request))
+			return ;
+	}
+	else if (failover)
+	{
+		request->rewind();
+		if (_connectPeer(request, request->getPeer()))
+			return ;
+	}
+	_failPeer(request);
+	_failCgi(request->getClientFd());
+}
+
+/// @brief Detaches the request from its client, and takes it out of the queue
+/// of its workers if it was waiting. Its connection is kept if it can carry
+/// another request, and closed otherwise or on `abort`.
+void	Server::_releaseUpstream(int target, bool abort)
+{
+	UpstreamRequest*	request = _connections[target].upstream;
+	int					fd = request->getSocketFd();
+	UpstreamGroup*		group = request->getGroup();
+
+	_connections[target].upstream = NULL;
+	if (group != NULL && request->getPeer() != -1)
+	{
+		group->release(request->getPeer());
+		if (!abort)
+			group->succeed(request->getPeer());
+	}
+	if (fd == -1)
+	{
+		std::map<std::string, CgiWorkerPool>::iterator pool = _cgiWorkerPools.find(request->getUpstream());
+		if (pool != _cgiWorkerPools.end())
+		{
+			std::deque<UpstreamRequest*>&	waiting = pool->second.waiting;
+			std::deque<UpstreamRequest*>::iterator it = std::find(waiting.begin(), waiting.end(), request);
+			if (it != waiting.end())
+				waiting.erase(it);
+		}
+	}
+	else if (abort || !_running || !request->isReusable()
+		|| !_keepUpstreamConnection(fd, request->getUpstream()))
+		_closeUpstreamConnection(fd);
+	delete request;
+}
+
+/// @brief Keeps a connection whose request ended: a worker goes to the next
+/// request waiting for one, else the connection goes back to the pool.
+/// @return false if it is to be closed instead: the pool is full, or the
+/// worker served its `max_requests`.
+bool	Server::_keepUpstreamConnection(int fd, const std::string& name)
+{
+	std::vector<int>&	idle = _upstreamIdle[name];
+
+	_connections[fd].upstream = NULL;
+	std::map<int, CgiWorkerProcess>::iterator worker = _cgiWorkers.find(fd);
+	if (worker != _cgiWorkers.end())
+	{
+		CgiWorkerPool&	pool = _cgiWorkerPools[name];
+		if (pool.maxRequests != 0 && ++worker->second.requests >= pool.maxRequests)
+			return (false);
+		if (!pool.waiting.empty())
+		{
+			UpstreamRequest*	next = pool.waiting.front();
+			pool.waiting.pop_front();
+			next->attach(fd, true);
+			_connections[fd].upstream = next;
+			_setPollEvents(fd, POLLIN | POLLOUT);
+			return (true);
+		}
+	}
+	else if (idle.size() >= (ft_is_proxy(name) ? _proxyKeepalive : _fastcgiKeepalive))
+		return (false);
+	_setPollEvents(fd, POLLIN);
+	idle.push_back(fd);
+	return (true);
+}
+
+/// @brief Closes a connection, idle or not. Closing a worker's socket ends the
+/// worker, which is replaced for the next request waiting, or to keep the
+/// pool full. A worker that exited while idle is only replaced on demand,
+/// so one that cannot start does not respawn in a loop.
+void	Server::_closeUpstreamConnection(int fd)
+{
+	std::map<std::string, std::vector<int> >::iterator it;
+	bool	idle = false;
+
+	for (it = _upstreamIdle.begin(); it != _upstreamIdle.end() && !idle; ++it)
+	{
+		std::vector<int>::iterator found = std::find(it->second.begin(), it->second.end(), fd);
+		if (found != it->second.end())
+		{
+			it->second.erase(found);
+			idle = true;
+		}
+	}
+	_unregisterFd(fd);
+	close(fd);
+
+	std::map<int, CgiWorkerProcess>::iterator worker = _cgiWorkers.find(fd);
+	if (worker == _cgiWorkers.end())
+		return ;
+	CgiProcess*		process = worker->second.process;
+	std::string		name = worker->second.pool;
+	CgiWorkerPool&	pool = _cgiWorkerPools[name];
+	_cgiWorkers.erase(worker);
+	pool.running--;
+	// It may be in the middle of a script whose output is no longer wanted
+	process->kill();
+	_reapCgi(process);
+	if (!_running)
+		return ;
+	if (pool.waiting.empty())
+	{
+		if (!idle)
+			_spawnCgiWorker(name, NULL);
+		return ;
+	}
+	UpstreamRequest*	next = pool.waiting.front();
+	pool.waiting.pop_front();
+	if (!_spawnCgiWorker(next->getUpstream(), next))
+		_failCgi(next->getClientFd());
+}
+
+/// @brief The pool of the `cgi_workers` of a location, created on first use.
+/// @return its name, that of its connections in `_upstreamIdle`.
+std::string	Server::_cgiWorkerPool(const ServerConfig& server, const Location& location)
+{
+	std::string	name = "cgi_workers " + server.listen + location.getPath();
+
+	if (_cgiWorkerPools.find(name) == _cgiWorkerPools.end())
+	{
+		CgiWorkerPool&	pool = _cgiWorkerPools[name];
+		pool.size = location.getCgiWorkers();
+		pool.maxRequests = location.getCgiWorkerRequests();
+		pool.running = 0;
+	}
+	return (name);
+}
+
+/// @brief Starts the `cgi_workers` of every location with the event loop, so
+/// that no request waits for a worker to start. Each event loop has its own.
+void	Server::_setupCgiWorkers()
+{
+	for (size_t i = 0; i < _serverConfigs.size(); i++)
+	{
+		std::map<std::string, Location*>&	locations = _serverConfigs[i]->map_locationObjs;
+
+		for (std::map<std::string, Location*>::iterator it = locations.begin(); it != locations.end(); ++it)
+		{
+			if (it->second->getCgiWorkers() == 0)
+				continue ;
+			std::string		name = _cgiWorkerPool(*_serverConfigs[i], *it->second);
+			CgiWorkerPool&	pool = _cgiWorkerPools[name];
+			while (pool.running < pool.size && _spawnCgiWorker(name, NULL))
+				;
+		}
+	}
+}
+
+/// @brief Starts a worker of pool `name`, over a socketpair, and sends it
+/// `request`; without one, the worker waits idle in the pool.
+/// @return false if the worker could not be started.
+bool	Server::_spawnCgiWorker(const std::string& name, UpstreamRequest* request)
+{
+	int			fds[2];
+#ifdef __linux__
+	int			result = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds);
+#else
+	int			result = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	if (result == 0)
+	{
+		fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+		fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	}
+#endif
+	if (result == -1)
+	{
+		std::cerr << "Error: failed to start a CGI worker: " << strerror(errno) << std::endl;
+		return (false);
+	}
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	CgiProcess*	process = new CgiProcess(-1, 0);
+	bool		started = process->startWorker(fds[1]);
+	close(fds[1]);
+	if (!started)
+	{
+		std::cerr << "Error: failed to start a CGI worker: " << strerror(errno) << std::endl;
+		close(fds[0]);
+		delete process;
+		return (false);
+	}
+	CgiWorkerProcess	worker = {process, name, 0};
+	_cgiWorkers[fds[0]] = worker;
+	_cgiWorkerPools[name].running++;
+	_cgiStats.spawned++;
+	if (request == NULL)
+	{
+		_registerFd(fds[0], FD_UPSTREAM, POLLIN);
+		_upstreamIdle[name].push_back(fds[0]);
+		return (true);
+	}
+	_registerFd(fds[0], FD_UPSTREAM, POLLIN | POLLOUT).upstream = request;
+	request->attach(fds[0], false);
+	return (true);
+}
@@ -13,17 +13,100 @@
 #include "webserv.hpp"
 #include "Server.hpp"
 #include "Context.hpp"
+#include <cerrno>
+#include <cstring>
+#include <cctype>
+#include <cstdlib>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/tcp.h>
+
+/// A request whose file loads keep missing the cache is given up on
+#define MAX_REQUEST_DEFERRALS	8
+/// Largest file body kept in memory by default, see `_setupFileCache`
+#define DEFAULT_FILE_CACHE_MAX_BODY	(256 * 1024)
+/// Defaults of the `aio_*` directives
+#define DEFAULT_AIO_QUEUE_SIZE	1024
+/// Default of `accept_budget`, connections accepted per listener event
+#define DEFAULT_ACCEPT_BUDGET	64
+/// Bytes read from a client per readiness event
+#define CLIENT_READ_BUFFER_SIZE	16384
+/// Longest chunk-size line of a chunked request body
+#define MAX_CHUNK_LINE			4096
+/// Defaults of the `*_timeout` directives, in milliseconds
+#define DEFAULT_HEADER_TIMEOUT		60000
+#define DEFAULT_BODY_TIMEOUT		60000
+#define DEFAULT_KEEPALIVE_TIMEOUT	75000
+#define DEFAULT_SEND_TIMEOUT		60000
+/// Defaults of the `shed_*` directives
+#define DEFAULT_SHED_LOOP_LAG		500
+#define DEFAULT_SHED_RETRY_AFTER	1
+/// Longest wait of the event loop while CGI scripts are reaped by polling
+#define CGI_REAP_INTERVAL			100
+/// Default of `fastcgi_keepalive`, idle connections kept per FastCGI application
+#define DEFAULT_FASTCGI_KEEPALIVE	16
+/// Default of `proxy_keepalive`, idle connections kept per proxied server
+#define DEFAULT_PROXY_KEEPALIVE		16
+/// CGI output waiting for a slow client before the script's output is paused
+#define CGI_STREAM_BUFFER			(256 * 1024)
+
+/// @brief Whether the client lets the connection stay open after the response:
+/// by default from HTTP/1.1 on, on request with HTTP/1.0.
+static bool	ft_wants_keep_alive(const HttpRequest& request)
+{
+	std::map<std::string, std::string>	headers = request.getHeaders();
+	std::map<std::string, std::string>::const_iterator it = headers.find("Connection");
+
+	if (request.getVersion() == "HTTP/1.1")
+		return (!request.isConnectionClose());
+	return (request.getVersion() == "HTTP/1.0" && it != headers.end() && it->second == "keep-alive");
+}
 
 Server::Server(Config& config)
-	: _config(config)
+	: _poller(NULL), _ioPool(NULL), _config(config)
 {
+	_poller = Poller::create(config.get("event_backend"));
 	_running = false;
+	_reusePort = false;
+	_acceptBudget = DEFAULT_ACCEPT_BUDGET;
+	if (config.getInt("accept_budget") > 0)
+		_acceptBudget = config.getInt("accept_budget");
+	_fastcgiKeepalive = DEFAULT_FASTCGI_KEEPALIVE;
+	if (!config.get("fastcgi_keepalive").empty())
+		_fastcgiKeepalive = toSizeT(config.get("fastcgi_keepalive"));
+	_proxyKeepalive = DEFAULT_PROXY_KEEPALIVE;
+	if (!config.get("proxy_keepalive").empty())
+		_proxyKeepalive = toSizeT(config.get("proxy_keepalive"));
 	_serverConfigs = config.getServers();
+	_nextHealthCheck = 0;
+	std::memset(&_cgiStats, 0, sizeof(_cgiStats));
+	_requestHandler.setCgiStats(&_cgiStats);
+	_setupFileCache();
+	_setupCgiCache();
+	_setupTimeouts();
+	_setupLimits();
+	_setupUpstreamGroups();
+	_setupUpstreams();
+	if (pipe(_wakeFds) == -1)
+		throw std::runtime_error("Failed to create wakeup pipe");
+	for (int i = 0; i < 2; i++)
+	{
+		fcntl(_wakeFds[i], F_SETFL, O_NONBLOCK);
+		fcntl(_wakeFds[i], F_SETFD, FD_CLOEXEC);
+	}
+	// Spare descriptor, given up to shed connections when out of fds
+	_reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
 }
 
 Server::~Server()
 {
 	stop();
+	delete _ioPool;
+	delete _poller;
+	close(_wakeFds[0]);
+	close(_wakeFds[1]);
+	if (_reserveFd != -1)
+		close(_reserveFd);
 }
 
 void	Server::start()
@@ -41,6 +124,9 @@ void	Server::start()
 		stop();
 		return ;
 	}
+	_setupIOPool();
+	_setupCgiWorkers();
+	_runHealthChecks();
 
 	try
 	{
@@ -48,31 +134,47 @@ void	Server::start()
 		{
 			if (g_sigint == true)
 				break;
-			int pollcount = poll(_pollfds.data(), _pollfds.size(), -1);
-			if (pollcount <= 0) 
+			int timeout = _timers.pollTimeout();
+			if (!_cgiOrphans.empty() && (timeout < 0 || timeout > CGI_REAP_INTERVAL))
+				timeout = CGI_REAP_INTERVAL;
+			if (_nextHealthCheck != 0)
+			{
+				uint64_t	now = TimerWheel::now();
+				int			due = (_nextHealthCheck > now) ? static_cast<int>(_nextHealthCheck - now) : 0;
+				if (timeout < 0 || timeout > due)
+					timeout = due;
+			}
+			int pollcount = _poller->wait(_events, timeout);
+			if (pollcount < 0) 
 			{
 				// std::cerr << "Error: poll failed" << std::endl;
 				// Logger::Error("Server error: poll failed");
 				// break;
 				continue ;
 			}
-			for (size_t i = 0; i < _pollfds.size(); i++)
+			uint64_t	busySince = TimerWheel::now();
+
+			// Handlers close and reuse fds, so each event keeps its generation
+			_ready.clear();
+			for (size_t i = 0; i < _events.size(); i++)
 			{
-				int target = _pollfds[i].fd;
-				if (_pollfds[i].revents & POLLIN)
-				{
-					if ((_clients.find(target) != _clients.end()) && (_clients[target].fd == target))
-					{
-						if (_acceptNewConnection(target) != 1)
-							break ;
-					}
-					else
-					{
-						if (_handleClientData(target, i) != 1)
-							continue ;
-					}
-				}
+				int fd = _events[i].fd;
+				ReadyEvent event = {fd, _connections[fd].generation, _events[i].revents};
+				_ready.push_back(event);
 			}
+			for (size_t i = 0; i < _ready.size() && _running; i++)
+				_dispatchEvent(_ready[i]);
+
+			// Timers are cancelled when their fd is released, so none are stale
+			std::vector<int>	expired;
+			_timers.expire(expired);
+			for (size_t i = 0; i < expired.size() && _running; i++)
+				_handleTimeout(expired[i]);
+			if (!_cgiOrphans.empty())
+				_reapCgiOrphans();
+			if (_nextHealthCheck != 0 && TimerWheel::now() >= _nextHealthCheck)
+				_runHealthChecks();
+			_loopLag = TimerWheel::now() - busySince;
 		}
 		stop();
 	} 
@@ -85,12 +187,27 @@ void	Server::start()
 	}
 }
 
+/// @brief Stops the event loop and closes every listener and client socket.
 void	Server::stop()
 {
 	if (_running)
 	{
 		_running = false;
-		_pollfds.clear();
+		_stopCgi();
+		for (size_t fd = 0; fd < _connections.size(); fd++)
+		{
+			e_fd_type type = _connections[fd].type;
+			if (type != FD_FREE)
+				_unregisterFd(fd);
+			if (type == FD_LISTENER || type == FD_CLIENT || type == FD_UPSTREAM || type == FD_HEALTH
+				|| type == FD_SINK)
+				close(fd);
+		}
+		_pendingLoads.clear();
+		_healthProbes.clear();
+		_upstreamIdle.clear();
+		_cgiLimits.clear();
+		_dropCacheFills();
 		// Logger::info("Server stopped");
 		std::cout << "\rServer stopped" << std::endl;
 	}
@@ -101,10 +218,40 @@ bool	Server::isRunning() const
 	return (_running);
 }
 
+/// @brief Lets several workers bind the same `host:port` with `SO_REUSEPORT`.
+/// Must be set before `start()`.
+void	Server::setReusePort(bool reusePort)
+{
+	_reusePort = reusePort;
+}
+
+/// @brief The write end of the wakeup pipe, polled by the event loop.
+/// Writing to it is async-signal-safe and interrupts a blocked `poll()`.
+int	Server::getWakeupFd() const
+{
+	return (_wakeFds[1]);
+}
+
+/// @brief Interrupts `poll()` from another thread, e.g. to notice `g_sigint`.
+void	Server::wakeup()
+{
+	char	byte = 1;
+
+	if (write(_wakeFds[1], &byte, 1) < 0)
+		return ;
+}
+
+void	Server::_drainWakeup()
+{
+	char	buffer[64];
+
+	while (read(_wakeFds[0], buffer, sizeof(buffer)) > 0)
+		;
+}
+
 ServerConfig& Server::_fetchConfig(int target)
 {
-	ServerConfig& serverConfig = *_config.getServerByListen(_clients[target].listen);	
-	return (serverConfig);
+	return (*_connections[target].serverConfig);
 }
 
 int Server::_setupListenInfos()
@@ -116,7 +263,8 @@ int Server::_setupListenInfos()
 			_serverConfigs[i]->listen,
 			_serverConfigs[i]->host,
 			_serverConfigs[i]->port,
-			-1
+			-1,
+			0
 		};
 		_listenInfos.push_back(info);
 	}
@@ -130,14 +278,18 @@ int Server::_setupListenSockets()
 		// Setup listen sockets
 		for (size_t i = 0; i < _listenInfos.size(); i++)
 		{
-			int listen_socket = _setupListeningSocket(_listenInfos[i].host, _listenInfos[i].port);
+			ServerConfig* serverConfig = _config.getServerByListen(_listenInfos[i].listen);
+			int listen_socket = _setupListeningSocket(_listenInfos[i].host, _listenInfos[i].port, serverConfig->listen_options);
 			_listenInfos[i].fd = listen_socket;
-			_pollfds.push_back((struct pollfd){listen_socket, POLLIN, 0});
 
 			// Track listening sockets
-			_clients[listen_socket] = _listenInfos[i];
+			Connection& conn = _registerFd(listen_socket, FD_LISTENER, POLLIN);
+			conn.listenIndex = i;
+			conn.serverConfig = serverConfig;
 			std::cout << "Listening on " << _listenInfos[i].host << ":" << _listenInfos[i].port << std::endl;
 		}
+		_registerFd(_wakeFds[0], FD_INTERNAL, POLLIN);
+		std::cout << "Event backend: " << _poller->name() << std::endl;
 		return (1);
 	}
 	catch (const std::exception& e)
@@ -150,64 +302,328 @@ int Server::_setupListenSockets()
 	}
 }
 
-int	Server::_acceptNewConnection(int target)
+/// @brief Routes one readiness event. Events for an fd that was closed, or
+/// closed and reused, since `poll()` returned are dropped.
+void	Server::_dispatchEvent(const ReadyEvent& event)
 {
-	// New connection on a listening socket
-	sockaddr_in client_addr;
-	socklen_t client_addr_len = sizeof(client_addr);
-	int client_socket = accept(target, (sockaddr*)&client_addr, &client_addr_len);
-	if (client_socket < 0)
-	{
-		std::cerr << "Error: accept failed" << std::endl;
-		// Logger::Error("Server error: accept failed");
-		// break ;
-		// continue;
-		return (0);
-	}
+	int	target = event.fd;
 
-	int flags = fcntl(client_socket, F_GETFL, 0);
-	if (flags == -1)
+	if (!_isCurrent(target, event.generation))
+		return ;
+	switch (_connections[target].type)
 	{
-		throw std::runtime_error("Failed to get file descriptor flags");
+		case FD_LISTENER:
+			if (event.revents & POLLIN)
+				_acceptNewConnection(target);
+			break ;
+		case FD_INTERNAL:
+			if (target == _wakeFds[0])
+				_drainWakeup();
+			else if (_ioPool != NULL && target == _ioPool->getEventFd())
+				_handleIOCompletions();
+			break ;
+		case FD_CGI:
+			_handleCgiEvent(target);
+			break ;
+		case FD_UPSTREAM:
+			_handleUpstreamEvent(target, event.revents);
+			break ;
+		case FD_HEALTH:
+			_handleHealthEvent(target, event.revents);
+			break ;
+		case FD_SINK:
+			_drainRefresh(target);
+			break ;
+		case FD_CLIENT:
+			// A parked client is not polled for input, only for going away
+			if (_connections[target].phase == PHASE_PARKED || _connections[target].phase == PHASE_CGI)
+				_closeClient(target);
+			// Nor one whose CGI output is all sent while more is to come
+			else if (_connections[target].phase == PHASE_SENDING && _connections[target].output.empty()
+				&& (event.revents & (POLLERR | POLLHUP | POLL_PEER_CLOSED)))
+				_closeClient(target);
+			else if (_connections[target].phase == PHASE_SENDING)
+				_flushOutput(target);
+			else if (event.revents & (POLLIN | POLLHUP | POLLERR))
+				_handleClientData(target);
+			break ;
+		default:
+			break ;
 	}
-	flags |= O_NONBLOCK;
-	if (fcntl(client_socket, F_SETFL, flags) < 0)
+}
+
+/// @brief Accepts the connections waiting on a listener, at most
+/// `accept_budget` per event so an accept storm cannot starve the clients
+/// already connected; the rest are picked up on the next loop iteration.
+/// @return the number of connections accepted.
+int	Server::_acceptNewConnection(int target)
+{
+	int	accepted = 0;
+
+	while (accepted < _acceptBudget)
 	{
-		throw std::runtime_error("Failed to set file descriptor flags to non-blocking");
+		// New connection on a listening socket
+		sockaddr_in client_addr;
+		socklen_t client_addr_len = sizeof(client_addr);
+		int client_socket = _poller->accept(target, (sockaddr*)&client_addr, &client_addr_len);
+		if (client_socket < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue ;
+			if (errno == EMFILE || errno == ENFILE)
+				_shedWithReserveFd(target);
+			else if (errno != EAGAIN && errno != EWOULDBLOCK)
+				std::cerr << "Error: accept failed: " << strerror(errno) << std::endl;
+			// Logger::Error("Server error: accept failed");
+			break ;
+		}
+
+		size_t	listenIndex = _connections[target].listenIndex;
+		if (!_admitConnection(listenIndex, client_addr.sin_addr.s_addr))
+		{
+			// Best effort, the socket buffer of a new connection is empty
+			const std::string& response = _overloadResponse(_connections[target].serverConfig);
+			if (write(client_socket, response.data(), response.size()) < 0)
+				std::cerr << "Error: connection refused over limits" << std::endl;
+			close(client_socket);
+			accepted++;
+			continue ;
+		}
+
+		// Responses are written whole, there is nothing to gain from Nagle
+		int optval = 1;
+		if (_connections[target].serverConfig->listen_options.noDelay
+			&& setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval)) == -1)
+			std::cerr << "Error: failed to set TCP_NODELAY" << std::endl;
+
+		// Track new client connection
+		Connection& conn = _registerFd(client_socket, FD_CLIENT, POLLIN);
+		conn.listenIndex = listenIndex;
+		conn.serverConfig = _connections[target].serverConfig;
+		conn.clientAddr = client_addr.sin_addr.s_addr;
+		_listenInfos[listenIndex].clients++;
+		_clientsPerIp[conn.clientAddr]++;
+		_clientCount++;
+		_timers.arm(client_socket, _headerTimeout);
+		// Logger::info("Client connected from %s:%d", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+		accepted++;
 	}
+	return (accepted);
+}
 
-	// Track new client connection
-	_pollfds.push_back((struct pollfd){client_socket, POLLIN | POLLOUT, 0});
-	_clients[client_socket] = _clients[target];
-	std::cout << "Client connected from " << _clients[client_socket].host << ":" << _clients[client_socket].port << std::endl;
-	// Logger::info("Client connected from %s:%d", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
-	return (1);
+/// @brief Out of file descriptors: the pending connection would keep the
+/// listener readable and `poll()` spinning. Gives up the reserve fd to accept
+/// it, closes it right away, then takes the reserve back.
+void	Server::_shedWithReserveFd(int target)
+{
+	std::cerr << "Error: accept failed: " << strerror(errno) << ", dropping connection" << std::endl;
+	if (_reserveFd == -1)
+		return ;
+	close(_reserveFd);
+	int client_socket = accept(target, NULL, NULL);
+	if (client_socket >= 0)
+		close(client_socket);
+	_reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
 }
 
-int	Server::_handleClientData(int target, size_t i)
+/// @brief Reads what the client sent and runs the request once complete.
+/// The header timeout covers the whole header, the body timeout the gap
+/// between two reads of the body.
+int	Server::_handleClientData(int target)
 {
-	ServerConfig&    serverConfig = _fetchConfig(target);
+	Connection&	conn = _connections[target];
+	char		buffer[CLIENT_READ_BUFFER_SIZE];
 
 	// Data received on an existing client connection
-	char buffer[serverConfig.max_body_size + 1];    
 	ssize_t	count = read(target, buffer, sizeof(buffer));
 	if (count <= 0)
 	{
-		close(target);
-		_clients.erase(target);
-		_pollfds.erase(_pollfds.begin() + i);
-		// --i;
-		// continue ;
+		_closeClient(target);
 		return (0);
 	}
-	// buffer[count] = '\0';
+	conn.inBuffer.append(buffer, count);
+	if (conn.phase == PHASE_BODY)
+		_timers.arm(target, _bodyTimeout);
+	_parseBufferedRequest(target);
+	return (1);
+}
 
-	std::string	requestData(buffer, count);
+/// @brief Hands the request at the front of the input buffer to
+/// `_processRequest` once it is complete. Requests pipelined behind it stay
+/// buffered until its response is sent.
+void	Server::_parseBufferedRequest(int target)
+{
+	Connection&		conn = _connections[target];
 
-	std::cout << YELLOW << "TEST | requestData (server.cpp, buffer to std::string)" << std::endl;
-	std::cout << "buffer: " << count << ", string size: "<< requestData.size() << std::endl;
-	std::cout << RESET << "\nrequestData\n\n" << YELLOW << requestData << "\n\n" << RESET << std::endl;
+	if (conn.phase == PHASE_IDLE)
+	{
+		if (conn.inBuffer.empty())
+			return ;
+		conn.phase = PHASE_HEADER;
+		_timers.arm(target, _headerTimeout);
+	}
+	if (conn.phase != PHASE_HEADER && conn.phase != PHASE_BODY)
+		return ;
 
+	e_conn_phase	phase = conn.phase;
+	int				status = 0;
+	size_t			length = _measureRequest(target, status);
+	if (status != 0)
+	{
+		_respondWithError(target, status);
+		return ;
+	}
+	if (length == 0)
+	{
+		if (phase == PHASE_HEADER && conn.phase == PHASE_BODY)
+			_timers.arm(target, _bodyTimeout);
+		return ;
+	}
+	_timers.cancel(target);
+	std::string	requestData = conn.inBuffer.substr(0, length);
+	conn.inBuffer.erase(0, length);
+	conn.requestLength = 0;
+	conn.chunkOffset = 0;
+	conn.chunkedBody = 0;
+	conn.phase = PHASE_HEADER;
+	if (_isOverloaded())
+	{
+		_shedRequest(target);
+		return ;
+	}
+	_processRequest(target, requestData, 0);
+}
+
+/// @brief Finds where the request at the front of the input buffer ends, from
+/// its `Content-Length`, or the chunks of a chunked body. Moves the
+/// connection to `PHASE_BODY` once the header is complete.
+/// @param status set to 431 if the header exceeds `max_header`, 413 if the
+/// body exceeds `max_body_size`, 400 if the body cannot be framed: both
+/// `Content-Length` and `Transfer-Encoding`, a coding other than chunked
+/// last, or malformed chunks.
+/// @return the request length, 0 while incomplete or on error.
+size_t	Server::_measureRequest(int target, int& status)
+{
+	Connection&	conn = _connections[target];
+	size_t		maxBody = _fetchConfig(target).max_body_size;
+	size_t		maxHeader = _fetchConfig(target).max_header;
+
+	if (conn.requestLength != 0)
+		return (conn.inBuffer.size() >= conn.requestLength ? conn.requestLength : 0);
+	if (conn.chunkOffset != 0)
+		return (_measureChunks(conn, maxBody, maxHeader, status));
+
+	size_t		headerEnd = conn.inBuffer.find("\r\n\r\n");
+	if (headerEnd == std::string::npos || headerEnd + 4 > maxHeader)
+	{
+		if (conn.inBuffer.size() > maxHeader)
+			status = 431;
+		return (0);
+	}
+	headerEnd += 4;
+	conn.phase = PHASE_BODY;
+
+	std::string	header = conn.inBuffer.substr(0, headerEnd);
+	for (size_t i = 0; i < header.size(); i++)
+		header[i] = std::tolower(header[i]);
+	size_t		field = header.find("\ntransfer-encoding:");
+	if (field != std::string::npos)
+	{
+		// Framed by both, a request could be read one way here and another
+		// way by a proxy in front: the smuggling of a second request
+		std::string	codings = header.substr(field + 19, header.find("\r\n", field + 1) - field - 19);
+		size_t		last = codings.find_last_not_of(" \t");
+		size_t		first = codings.find_last_of(", \t", last);
+
+		codings = (last == std::string::npos) ? "" : codings.substr(first + 1, last - first);
+		if (header.find("\ncontent-length:") != std::string::npos || codings != "chunked")
+		{
+			status = 400;
+			return (0);
+		}
+		conn.chunkOffset = headerEnd;
+		conn.chunkedBody = 0;
+		return (_measureChunks(conn, maxBody, maxHeader, status));
+	}
+
+	size_t		contentLength = 0;
+	field = header.find("\ncontent-length:");
+	if (field != std::string::npos)
+		contentLength = toSizeT(header.substr(field + 16, header.find("\r\n", field + 1) - field - 16));
+	if (contentLength > maxBody)
+	{
+		status = 413;
+		return (0);
+	}
+	conn.requestLength = headerEnd + contentLength;
+	return (conn.inBuffer.size() >= conn.requestLength ? conn.requestLength : 0);
+}
+
+/// @brief Frames a chunked body chunk by chunk from `chunkOffset`, where the
+/// last call stopped: the data of each chunk is skipped by its size, so it
+/// may hold anything. Chunk extensions are ignored; the trailer section,
+/// up to `maxTrailer` bytes, ends the request at its empty line.
+/// @return the request length, 0 while incomplete or on error.
+size_t	Server::_measureChunks(Connection& conn, size_t maxBody, size_t maxTrailer, int& status)
+{
+	const std::string&	buffer = conn.inBuffer;
+
+	while (true)
+	{
+		size_t	lineEnd = buffer.find("\r\n", conn.chunkOffset);
+		if (lineEnd == std::string::npos)
+		{
+			if (buffer.size() - conn.chunkOffset > MAX_CHUNK_LINE)
+				status = 400;
+			return (0);
+		}
+		const char*	line = buffer.c_str() + conn.chunkOffset;
+		size_t		digits = 0;
+		while (std::isxdigit(line[digits]))
+			digits++;
+		if (digits == 0 || digits > 15 || (line + digits != buffer.c_str() + lineEnd
+			&& line[digits] != ';' && line[digits] != ' ' && line[digits] != '\t'))
+		{
+			status = 400;
+			return (0);
+		}
+		size_t	size = std::strtoul(line, NULL, 16);
+		if (size == 0)
+		{
+			// The last chunk, then trailer fields up to an empty line
+			size_t	trailerEnd = buffer.find("\r\n\r\n", lineEnd);
+			if (trailerEnd == std::string::npos || trailerEnd - lineEnd > maxTrailer)
+			{
+				if (buffer.size() - lineEnd > maxTrailer)
+					status = 431;
+				return (0);
+			}
+			return (trailerEnd + 4);
+		}
+		if (conn.chunkedBody + size > maxBody)
+		{
+			status = 413;
+			return (0);
+		}
+		if (buffer.size() < lineEnd + 2 + size + 2)
+			return (0);
+		if (buffer.compare(lineEnd + 2 + size, 2, "\r\n") != 0)
+		{
+			status = 400;
+			return (0);
+		}
+		conn.chunkedBody += size;
+		conn.chunkOffset = lineEnd + 2 + size + 2;
+	}
+}
+
+/// @brief Runs a request through the `RequestHandler` and sends the response.
+/// If the handler first needs a file loaded, the request is parked until the
+/// load completes (see `_deferRequest`), and is then run again from scratch.
+/// @param attempt how many times this request was already deferred.
+int	Server::_processRequest(int target, std::string requestData, int attempt)
+{
+	ServerConfig&    serverConfig = _fetchConfig(target);
 	HttpRequest		request(requestData);
 
 	// test line: POST, bad request
@@ -216,15 +632,520 @@ int	Server::_handleClientData(int target, size_t i)
 	
 	Context			contextFromTarget(serverConfig, request);
 	HttpResponse	response = _requestHandler.handleRequest(contextFromTarget);
-	std::string		responseData = response.generateResponseToString();
-	// std::string	responseData = handle_request(requestData);
+	// Given a CGI slot, but no longer a CGI request, e.g. the script is gone
+	if (!response.isCgi() && _connections[target].cgiLimit != NULL)
+		_leaveCgiLimit(target);
+	if (!response.isCgi() && !_connections[target].cacheKey.empty())
+		_endCacheFill(target, false);
+	if (response.isDeferred())
+	{
+		if (attempt < MAX_REQUEST_DEFERRALS)
+			return (_deferRequest(target, requestData, response, attempt));
+		response = HttpResponse::internalServerError_500(contextFromTarget);
+	}
 	////////////////////////////////////////////////////////////////////////////////////////
 	
+	bool	keepAlive = _keepaliveTimeout > 0 && ft_wants_keep_alive(request)
+		&& !_connections[target].background;
+	if (response.isCgi() && _serveCgiCache(target, contextFromTarget, requestData, keepAlive))
+		return (1);
+	if (response.isCgi() && !_admitCgi(target, contextFromTarget, requestData))
+		return (1);
+	if (response.isCgi())
+		_addCacheValidators(target, request);
+	if (response.isProxy())
+	{
+		_startProxy(target, contextFromTarget, response, requestData, keepAlive);
+		return (1);
+	}
+	if (response.isCgi() && (!response.getCgiPass().empty()
+		|| contextFromTarget.getLocation().getCgiWorkers() > 0))
+	{
+		_startFastCgi(target, contextFromTarget, response, requestData, keepAlive);
+		return (1);
+	}
+	if (response.isCgi())
+	{
+		_startCgi(target, contextFromTarget, response, requestData, keepAlive);
+		return (1);
+	}
 	// Send the response
-	write(target, responseData.c_str(), responseData.size());
-	close(target);
-	_clients.erase(target);
-	_pollfds.erase(_pollfds.begin() + i); 
-	// --i;
+	_sendResponse(target, response, keepAlive);
 	return (1);
 }
+
+/// @brief Queues `response` on the connection and starts sending it. The
+/// header and body are queued as separate segments, a file body as a region
+/// of the opened file, so none of them is copied.
+void	Server::_sendResponse(int target, HttpResponse& response, bool keepAlive)
+{
+	int			fileFd = -1;
+	struct stat	st;
+
+	if (response.hasFileBody())
+	{
+		// Announce the size of what is actually opened, not of the cached stat
+		fileFd = open(response.getFilePath().c_str(), O_RDONLY | O_CLOEXEC);
+		if (fileFd < 0 || fstat(fileFd, &st) != 0 || !S_ISREG(st.st_mode))
+		{
+			int code = (errno == ENOENT || fileFd >= 0) ? 404 : 500;
+			if (fileFd >= 0)
+				close(fileFd);
+			_respondWithError(target, code);
+			return ;
+		}
+		if (response.getFileRanges().empty())
+			response.setFileBody(response.getFilePath(), st.st_size);
+	}
+	_queueResponse(target, response, fileFd, 0, keepAlive);
+}
+
+/// @brief Queues `response` with its file body, if any, read from `offset`
+/// of the already opened `fileFd`, and starts sending it. The ranges of a
+/// 206 are each queued as a region of the same file.
+void	Server::_queueResponse(int target, HttpResponse& response, int fileFd, off_t offset, bool keepAlive)
+{
+	Connection&						conn = _connections[target];
+	const std::vector<FileRange>&	ranges = response.getFileRanges();
+
+	response.setConnectionHeaders(keepAlive);
+
+	std::string	header = response.generateHeaderString();
+	std::string	body;
+	response.takeBody(body);
+	conn.output.pushMemory(header);
+	conn.output.pushMemory(body);
+	if (fileFd >= 0 && ranges.empty())
+		conn.output.pushFile(fileFd, offset, response.getBodyLength());
+	for (size_t i = 0; fileFd >= 0 && i < ranges.size(); i++)
+	{
+		std::string	head = ranges[i].head;
+
+		conn.output.pushMemory(head);
+		conn.output.pushFile(fileFd, offset + ranges[i].offset, ranges[i].length, i + 1 == ranges.size());
+	}
+	std::string	tail = response.getFileTail();
+	conn.output.pushMemory(tail);
+	conn.keepAlive = keepAlive;
+	conn.phase = PHASE_SENDING;
+	_flushOutput(target);
+}
+
+/// @brief Answers with an error page outside of the `RequestHandler`, e.g. on a
+/// timeout, and closes the connection once it is sent.
+void	Server::_respondWithError(int target, int code)
+{
+	HttpRequest		request;
+
+	request.setUri("/");
+	Context			context(_fetchConfig(target), request);
+	HttpResponse	response = HttpResponse::createErrorResponse(code, context);
+	_timers.cancel(target);
+	_sendResponse(target, response, false);
+}
+
+/// @brief Writes as much of the pending response as the socket takes. The send
+/// timeout runs while the client is not reading, and restarts on progress.
+/// Once done, the connection is closed or waits for the next request; while
+/// CGI output is still coming, it waits for that under `cgi_timeout`.
+void	Server::_flushOutput(int target)
+{
+	Connection&	conn = _connections[target];
+	ssize_t		sent = conn.output.send(target);
+	bool		relaying = (conn.cgi != NULL || conn.upstream != NULL);
+
+	if (sent < 0)
+	{
+		_closeClient(target);
+		return ;
+	}
+	// Spliced bytes must not overtake what is queued
+	if (relaying)
+		_pauseCgiOutput(target, conn.output.pending()
+			>= (conn.stream.canSplice() ? 1 : CGI_STREAM_BUFFER));
+	if (!conn.output.empty())
+	{
+		if (sent > 0 || !_timers.isArmed(target))
+			_timers.arm(target, _sendTimeout);
+		_setPollEvents(target, POLLOUT);
+		return ;
+	}
+	if (relaying)
+	{
+		_setPollEvents(target, POLL_PEER_CLOSED);
+		if (conn.cgiLimit != NULL && conn.cgiLimit->timeout > 0)
+			_timers.arm(target, conn.cgiLimit->timeout);
+		else
+			_timers.cancel(target);
+		return ;
+	}
+	if (!conn.keepAlive || !_running)
+	{
+		_closeClient(target);
+		return ;
+	}
+	conn.phase = PHASE_IDLE;
+	_setPollEvents(target, POLLIN);
+	_timers.arm(target, _keepaliveTimeout);
+	_parseBufferedRequest(target);
+}
+
+/// @brief Answers a complete request with the prebuilt 503 instead of running
+/// it, and closes the connection.
+void	Server::_shedRequest(int target)
+{
+	Connection&	conn = _connections[target];
+
+	std::string	response = _overloadResponse(conn.serverConfig);
+
+	conn.output.pushMemory(response);
+	conn.keepAlive = false;
+	conn.phase = PHASE_SENDING;
+	_flushOutput(target);
+}
+
+/// @brief A connection's timer fired: a client that started a request gets a
+/// 408, a CGI request a 504, idle or stalled connections are closed.
+void	Server::_handleTimeout(int target)
+{
+	if (_connections[target].type == FD_HEALTH)
+		_endHealthProbe(target, false);
+	Connection&	conn = _connections[target];
+
+	if (conn.type != FD_CLIENT)
+		return ;
+	if (conn.cgiLimit != NULL)
+		_timeoutCgi(target);
+	else if ((conn.phase == PHASE_HEADER && !conn.inBuffer.empty()) || conn.phase == PHASE_BODY)
+		_respondWithError(target, 408);
+	else
+		_closeClient(target);
+}
+
+/// @brief Loads the path a deferred response asks for, then resumes the request.
+///
+/// With an I/O pool the load runs on a pool thread while the connection stops
+/// being polled; concurrent requests for the same path share one load. Without
+/// a pool, or when its queue is full, the load runs here on the event loop.
+int	Server::_deferRequest(int target, const std::string& requestData, const HttpResponse& response, int attempt)
+{
+	std::pair<std::string, bool>	key(response.getDeferredPath(), response.isDeferredListing());
+
+	if (_ioPool != NULL)
+	{
+		std::map<std::pair<std::string, bool>, std::vector<ConnectionRef> >::iterator it = _pendingLoads.find(key);
+		if (it == _pendingLoads.end())
+		{
+			FileLoadJob* job = new FileLoadJob(key.first, _fileCache.getBodyLimit(), key.second);
+			if (!_ioPool->submit(job))
+				delete job;
+			else
+				it = _pendingLoads.insert(std::make_pair(key, std::vector<ConnectionRef>())).first;
+		}
+		if (it != _pendingLoads.end())
+		{
+			ConnectionRef ref = {target, _connections[target].generation};
+			it->second.push_back(ref);
+			_connections[target].parkedRequest = requestData;
+			_connections[target].phase = PHASE_PARKED;
+			_setPollEvents(target, POLL_PEER_CLOSED);
+			return (1);
+		}
+	}
+	_fileCache.insert(key.first, FileCache::load(key.first, _fileCache.getBodyLimit(), key.second));
+	return (_processRequest(target, requestData, attempt + 1));
+}
+
+/// @brief Picks up the loads finished by the I/O pool, caches their result and
+/// resumes every request that was waiting for them.
+void	Server::_handleIOCompletions()
+{
+	_ioPool->drainEventFd();
+	IOJob* job = _ioPool->takeCompleted();
+	while (job != NULL)
+	{
+		IOJob*							next = job->next;
+		FileLoadJob*					load = static_cast<FileLoadJob*>(job);
+		std::pair<std::string, bool>	key(load->path, load->withListing);
+		std::vector<ConnectionRef>		waiting;
+
+		_fileCache.insert(load->path, load->result);
+		std::map<std::pair<std::string, bool>, std::vector<ConnectionRef> >::iterator it = _pendingLoads.find(key);
+		if (it != _pendingLoads.end())
+		{
+			waiting.swap(it->second);
+			_pendingLoads.erase(it);
+		}
+		delete job;
+		for (size_t i = 0; i < waiting.size(); i++)
+		{
+			// The client may have gone away while its request was parked
+			if (!_isCurrent(waiting[i].fd, waiting[i].generation))
+				continue ;
+			std::string requestData;
+			requestData.swap(_connections[waiting[i].fd].parkedRequest);
+			_processRequest(waiting[i].fd, requestData, 1);
+		}
+		job = next;
+	}
+}
+
+/// @brief Sizes the file cache from the `file_cache_*` directives. Bodies are
+/// cached up to `file_cache_max_body`; larger files are sent from disk.
+void	Server::_setupFileCache()
+{
+	size_t	bodyLimit = 0;
+
+	for (size_t i = 0; i < _serverConfigs.size(); i++)
+		bodyLimit = std::max(bodyLimit, _serverConfigs[i]->max_body_size);
+	if (!_config.get("file_cache_max_body").empty())
+		bodyLimit = std::min(bodyLimit, parseSize(_config.get("file_cache_max_body")));
+	else
+		bodyLimit = std::min(bodyLimit, static_cast<size_t>(DEFAULT_FILE_CACHE_MAX_BODY));
+	_fileCache.setBodyLimit(bodyLimit);
+	if (!_config.get("file_cache_valid").empty())
+		_fileCache.setValidity(_config.getInt("file_cache_valid"));
+	if (!_config.get("file_cache_size").empty())
+		_fileCache.setBudget(parseSize(_config.get("file_cache_size")));
+	_requestHandler.setFileCache(&_fileCache);
+}
+
+/// @brief Sizes the cache of `cgi_cache` locations from the `cgi_cache_size`
+/// and `cgi_cache_max_entry` directives, per event loop, and opens its disk
+/// tier under `cgi_cache_path`, `cgi_cache_disk_size` and `cgi_cache_keys`.
+/// A disk tier that cannot be opened is left out.
+void	Server::_setupCgiCache()
+{
+	if (!_config.get("cgi_cache_size").empty())
+		_cgiCache.setBudget(parseSize(_config.get("cgi_cache_size")));
+	if (!_config.get("cgi_cache_max_entry").empty())
+		_cgiCache.setMaxEntry(parseSize(_config.get("cgi_cache_max_entry")));
+	if (_config.get("cgi_cache_path").empty())
+		return ;
+	if (!_config.get("cgi_cache_disk_size").empty())
+		_diskCache.setBudget(parseSize(_config.get("cgi_cache_disk_size")));
+	if (!_config.get("cgi_cache_keys").empty())
+		_diskCache.setKeys(toSizeT(_config.get("cgi_cache_keys")));
+	_diskCache.open(_config.get("cgi_cache_path"));
+	_cgiStats.cacheDiskBytes = _diskCache.getBytes();
+}
+
+/// @brief Reads the `client_header_timeout`, `client_body_timeout`,
+/// `keepalive_timeout` and `send_timeout` directives. A `keepalive_timeout`
+/// of 0 closes every connection after its response.
+void	Server::_setupTimeouts()
+{
+	_headerTimeout = DEFAULT_HEADER_TIMEOUT;
+	_bodyTimeout = DEFAULT_BODY_TIMEOUT;
+	_keepaliveTimeout = DEFAULT_KEEPALIVE_TIMEOUT;
+	_sendTimeout = DEFAULT_SEND_TIMEOUT;
+	if (!_config.get("client_header_timeout").empty())
+		_headerTimeout = parseDuration(_config.get("client_header_timeout"));
+	if (!_config.get("client_body_timeout").empty())
+		_bodyTimeout = parseDuration(_config.get("client_body_timeout"));
+	if (!_config.get("keepalive_timeout").empty())
+		_keepaliveTimeout = parseDuration(_config.get("keepalive_timeout"));
+	if (!_config.get("send_timeout").empty())
+		_sendTimeout = parseDuration(_config.get("send_timeout"));
+}
+
+/// @brief Reads the admission control directives:
+/// - `max_connect` (per server), `max_connections` and `max_connections_per_ip`
+///   cap the client connections of this event loop; 0 is no limit.
+/// - `shed_loop_lag` and `shed_queue_depth` are the event loop lag (time spent
+///   on one batch of events) and I/O pool backlog from which new requests are
+///   shed with a 503 carrying `Retry-After: shed_retry_after`; 0 disables each.
+void	Server::_setupLimits()
+{
+	_clientCount = 0;
+	_loopLag = 0;
+	_maxConnections = toSizeT(_config.get("max_connections"));
+	_maxConnectionsPerIp = toSizeT(_config.get("max_connections_per_ip"));
+	_shedLoopLag = DEFAULT_SHED_LOOP_LAG;
+	if (!_config.get("shed_loop_lag").empty())
+		_shedLoopLag = parseDuration(_config.get("shed_loop_lag"));
+	// Without the directive, shed once the I/O pool queue is full (see `_setupIOPool`)
+	_shedQueueDepth = toSizeT(_config.get("shed_queue_depth"));
+	_retryAfter = DEFAULT_SHED_RETRY_AFTER;
+	if (!_config.get("shed_retry_after").empty())
+		_retryAfter = parseDuration(_config.get("shed_retry_after")) / 1000;
+}
+
+/// @brief Whether a new client of listener `listenIndex` fits the limits.
+bool	Server::_admitConnection(size_t listenIndex, uint32_t clientAddr) const
+{
+	size_t	maxConnect = _connections[_listenInfos[listenIndex].fd].serverConfig->max_connect;
+
+	if (_maxConnections > 0 && _clientCount >= _maxConnections)
+		return (false);
+	if (maxConnect > 0 && _listenInfos[listenIndex].clients >= maxConnect)
+		return (false);
+	if (_maxConnectionsPerIp > 0)
+	{
+		std::map<uint32_t, size_t>::const_iterator it = _clientsPerIp.find(clientAddr);
+		if (it != _clientsPerIp.end() && it->second >= _maxConnectionsPerIp)
+			return (false);
+	}
+	return (true);
+}
+
+/// @brief Whether the loop is too far behind to take on new requests.
+bool	Server::_isOverloaded() const
+{
+	if (_shedLoopLag > 0 && _loopLag >= _shedLoopLag)
+		return (true);
+	return (_ioPool != NULL && _shedQueueDepth > 0 && _ioPool->pending() >= _shedQueueDepth);
+}
+
+/// @brief The 503 sent when shedding load, built once per server so refusing
+/// work costs no more than a write.
+const std::string&	Server::_overloadResponse(ServerConfig* serverConfig)
+{
+	std::map<ServerConfig*, std::string>::iterator it = _overloadResponses.find(serverConfig);
+
+	if (it == _overloadResponses.end())
+	{
+		HttpRequest		request;
+
+		request.setUri("/");
+		Context			context(*serverConfig, request);
+		HttpResponse	response = HttpResponse::serviceUnavailable_503(context);
+		response.setHeader("Retry-After", toString(static_cast<size_t>(_retryAfter)));
+		response.setConnectionHeaders(false);
+		it = _overloadResponses.insert(std::make_pair(serverConfig, response.generateResponseToString())).first;
+	}
+	return (it->second);
+}
+
+/// @brief Starts `aio_threads` threads for blocking filesystem work, if configured.
+void	Server::_setupIOPool()
+{
+	int		threads = _config.getInt("aio_threads");
+	size_t	queueSize = DEFAULT_AIO_QUEUE_SIZE;
+
+	if (threads <= 0 || _ioPool != NULL)
+		return ;
+	if (!_config.get("aio_queue_size").empty())
+		queueSize = toSizeT(_config.get("aio_queue_size"));
+	try
+	{
+		_ioPool = new IOThreadPool(threads, queueSize);
+		if (_config.get("shed_queue_depth").empty())
+			_shedQueueDepth = queueSize;
+		_registerFd(_ioPool->getEventFd(), FD_INTERNAL, POLLIN);
+	}
+	catch (const std::exception& e)
+	{
+		// Keep serving, with file operations on the event loop
+		std::cerr << "Error: " << e.what() << std::endl;
+		_ioPool = NULL;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Connection table
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Claims the table slot of `fd` and adds it to the poll set.
+/// The slot gets a new generation, invalidating anything still referring to
+/// a previous user of the same fd number.
+Connection&	Server::_registerFd(int fd, e_fd_type type, short events)
+{
+	if ((size_t)fd >= _connections.size())
+	{
+		Connection	freeSlot;
+
+		freeSlot.type = FD_FREE;
+		freeSlot.generation = 0;
+		freeSlot.listenIndex = 0;
+		freeSlot.serverConfig = NULL;
+		freeSlot.clientAddr = 0;
+		freeSlot.phase = PHASE_HEADER;
+		freeSlot.requestLength = 0;
+		freeSlot.chunkOffset = 0;
+		freeSlot.chunkedBody = 0;
+		freeSlot.keepAlive = false;
+		freeSlot.cgi = NULL;
+		freeSlot.upstream = NULL;
+		freeSlot.cgiLimit = NULL;
+		freeSlot.background = false;
+		_connections.resize(std::max((size_t)fd + 1, _connections.size() * 2), freeSlot);
+	}
+	Connection& conn = _connections[fd];
+	conn.type = type;
+	conn.generation++;
+	conn.listenIndex = 0;
+	conn.serverConfig = NULL;
+	conn.clientAddr = 0;
+	conn.phase = PHASE_HEADER;
+	conn.inBuffer.clear();
+	conn.requestLength = 0;
+	conn.chunkOffset = 0;
+	conn.chunkedBody = 0;
+	conn.parkedRequest.clear();
+	conn.output.clear();
+	conn.keepAlive = false;
+	conn.cgi = NULL;
+	conn.upstream = NULL;
+	conn.cgiLimit = NULL;
+	conn.stream.reset(false, false);
+	conn.cacheKey.clear();
+	conn.background = false;
+	if (!(type == FD_LISTENER ? _poller->addListener(fd) : _poller->add(fd, events)))
+		std::cerr << "Error: failed to add fd " << fd << " to " << _poller->name() << std::endl;
+	return (conn);
+}
+
+/// @brief Releases the slot of `fd` and removes it from the poll set.
+/// Does not close the fd, and must be called before it is closed.
+void	Server::_unregisterFd(int fd)
+{
+	Connection& conn = _connections[fd];
+
+	_poller->remove(fd);
+	conn.type = FD_FREE;
+	conn.generation++;
+	conn.serverConfig = NULL;
+	conn.cgi = NULL;
+	conn.upstream = NULL;
+	conn.cgiLimit = NULL;
+	_timers.cancel(fd);
+	std::string().swap(conn.inBuffer);
+	std::string().swap(conn.cacheKey);
+	std::string().swap(conn.parkedRequest);
+	conn.output.clear();
+}
+
+/// @brief Whether `fd` is still the connection a saved `generation` refers to.
+bool	Server::_isCurrent(int fd, unsigned int generation) const
+{
+	return (fd >= 0 && (size_t)fd < _connections.size()
+		&& _connections[fd].type != FD_FREE
+		&& _connections[fd].generation == generation);
+}
+
+void	Server::_setPollEvents(int fd, short events)
+{
+	_poller->modify(fd, events);
+}
+
+void	Server::_closeClient(int fd)
+{
+	// May register a pidfd, and move the connection table
+	if (_connections[fd].cgi != NULL)
+		_releaseCgi(fd, true);
+	if (_connections[fd].upstream != NULL)
+		_releaseUpstream(fd, true);
+	// May run the next request waiting for the slot, or for the response
+	_leaveCgiLimit(fd);
+	_endCacheFill(fd, false);
+	Connection&	conn = _connections[fd];
+
+	_listenInfos[conn.listenIndex].clients--;
+	std::map<uint32_t, size_t>::iterator it = _clientsPerIp.find(conn.clientAddr);
+	if (it != _clientsPerIp.end() && --it->second == 0)
+		_clientsPerIp.erase(it);
+	_clientCount--;
+	_unregisterFd(fd);
+	close(fd);
+}
@@ -15,24 +15,233 @@
 #include "HttpRequest.hpp"
 #include "Location.hpp"
 #include "Context.hpp"
+#include "FileCache.hpp"
+#include <cerrno>
+#include <cctype>
+#include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <strings.h>
+
+/// Most ranges served in one multipart response, once merged; a request for
+/// more gets the whole file
+#define MAX_RANGES	64
+
+/// @brief The value of request header `name`, whatever its case.
+static std::string	ft_request_header(const std::map<std::string, std::string>& headers, const std::string& name)
+{
+	for (std::map<std::string, std::string>::const_iterator it = headers.begin(); it != headers.end(); ++it)
+	{
+		if (it->first.size() != name.size())
+			continue ;
+		size_t	i = 0;
+		while (i < name.size() && std::tolower(it->first[i]) == std::tolower(name[i]))
+			i++;
+		if (i == name.size())
+			return (it->second);
+	}
+	return ("");
+}
+
+/// @brief The entity tag of a file, from its inode, size and modification
+/// time. Weak while the file is being modified this very second, when another
+/// change could keep all three.
+static std::string	ft_etag(const FileInfo& info)
+{
+	char	tag[64];
+
+	std::snprintf(tag, sizeof(tag), "\"%lx-%llx-%lx\"", static_cast<unsigned long>(info.inode),
+		static_cast<unsigned long long>(info.size), static_cast<unsigned long>(info.mtime));
+	if (info.mtime >= std::time(NULL) - 1)
+		return (std::string("W/") + tag);
+	return (tag);
+}
+
+/// @brief `time` as an HTTP date, e.g. `Sun, 06 Nov 1994 08:49:37 GMT`.
+static std::string	ft_http_date(time_t time)
+{
+	char		date[64];
+	struct tm	tm;
+
+	gmtime_r(&time, &tm);
+	strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	return (date);
+}
+
+/// @brief Parses an HTTP date in its preferred format.
+/// @return false if `value` is not one, e.g. an obsolete format.
+static bool	ft_parse_http_date(const std::string& value, time_t& time)
+{
+	struct tm	tm;
+
+	std::memset(&tm, 0, sizeof(tm));
+	const char*	end = strptime(value.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	if (end == NULL || *end != '\0')
+		return (false);
+	time = timegm(&tm);
+	return (time != -1);
+}
+
+/// @brief `bytes first-last/size`, of a `Content-Range`.
+static std::string	ft_content_range(const FileRange& range, off_t size)
+{
+	return ("bytes " + toString(static_cast<size_t>(range.offset)) + "-"
+		+ toString(static_cast<size_t>(range.offset + range.length - 1)) + "/" + toString(static_cast<size_t>(size)));
+}
+
+/// @brief A multipart boundary for the ranges of a file, unlikely to be in it.
+static std::string	ft_boundary(const FileInfo& info)
+{
+	char				boundary[32];
+	unsigned long long	seed = static_cast<unsigned long long>(info.inode) * 2654435761ULL
+		^ static_cast<unsigned long long>(std::time(NULL)) ^ static_cast<unsigned long long>(info.size) << 20;
+
+	std::snprintf(boundary, sizeof(boundary), "%016llx", seed);
+	return (boundary);
+}
+
+static bool	ft_range_before(const FileRange& a, const FileRange& b)
+{
+	return (a.offset < b.offset);
+}
+
+/// @brief The weight `Accept-Encoding` gives `coding`, in thousandths: its
+/// own `q`, else that of `*`, 0 if neither is listed.
+static int	ft_accepted_weight(const std::string& list, const std::string& coding)
+{
+	int		wildcard = 0;
+
+	for (size_t start = 0; start < list.size(); )
+	{
+		size_t		end = list.find(',', start);
+		if (end == std::string::npos)
+			end = list.size();
+		std::string	item = list.substr(start, end - start);
+		size_t		semicolon = item.find(';');
+		size_t		first = item.find_first_not_of(" \t");
+		size_t		last = item.find_last_not_of(" \t", (semicolon == std::string::npos) ? semicolon : semicolon - 1);
+		std::string	name = (first == std::string::npos || last == std::string::npos || last < first)
+			? "" : item.substr(first, last - first + 1);
+		int			weight = 1000;
+		size_t		q = (semicolon == std::string::npos) ? semicolon : item.find("q=", semicolon);
+
+		start = end + 1;
+		if (q != std::string::npos)
+			weight = static_cast<int>(std::strtod(item.c_str() + q + 2, NULL) * 1000 + 0.5);
+		if (strcasecmp(name.c_str(), coding.c_str()) == 0
+			|| (coding == "gzip" && strcasecmp(name.c_str(), "x-gzip") == 0))
+			return (weight);
+		if (name == "*")
+			wildcard = weight;
+	}
+	return (wildcard);
+}
+
+/// @brief Parses the `Range` header `value` against a file of `size` bytes
+/// into the ranges it can be served, in order, overlapping or adjacent ones
+/// merged.
+/// @return -1 if it is not a valid byte range set, to be ignored.
+static int	ft_parse_ranges(const std::string& value, off_t size, std::vector<FileRange>& ranges)
+{
+	if (value.size() < 6 || strncasecmp(value.c_str(), "bytes=", 6) != 0)
+		return (-1);
+	for (size_t start = 6; start <= value.size(); )
+	{
+		size_t		end = value.find(',', start);
+		if (end == std::string::npos)
+			end = value.size();
+		size_t		first = value.find_first_not_of(" \t", start);
+		size_t		last = value.find_last_not_of(" \t", end - 1);
+		if (first >= end || last < first)
+			return (-1);
+		std::string	spec = value.substr(first, last - first + 1);
+		size_t		dash = spec.find('-');
+		if (dash == std::string::npos || spec.find_first_not_of("0123456789-") != std::string::npos
+			|| spec.find('-', dash + 1) != std::string::npos || (dash == 0 && spec.size() == 1))
+			return (-1);
+		char*		tail;
+		off_t		from = std::strtoll(spec.c_str(), &tail, 10);
+		off_t		to = std::strtoll(spec.c_str() + dash + 1, &tail, 10);
+		FileRange	range;
+		if (dash == 0)
+		{
+			// `-N`: the last N bytes
+			range.offset = (to >= size) ? 0 : size - to;
+			range.length = size - range.offset;
+		}
+		else
+		{
+			if (dash + 1 < spec.size() && to < from)
+				return (-1);
+			if (dash + 1 == spec.size() || to >= size)
+				to = size - 1;
+			range.offset = from;
+			range.length = (to >= from) ? to - from + 1 : 0;
+		}
+		if (range.offset < size && range.length > 0)
+			ranges.push_back(range);
+		start = end + 1;
+	}
+	std::vector<FileRange>	merged;
+	merged.swap(ranges);
+	std::sort(merged.begin(), merged.end(), ft_range_before);
+	for (size_t i = 0; i < merged.size(); i++)
+	{
+		off_t	end = merged[i].offset + merged[i].length;
+		if (!ranges.empty() && merged[i].offset <= ranges.back().offset + (off_t)ranges.back().length)
+			ranges.back().length = std::max(end, ranges.back().offset + (off_t)ranges.back().length)
+				- ranges.back().offset;
+		else
+			ranges.push_back(merged[i]);
+	}
+	return (0);
+}
+
+/// @brief Whether entity tag `tag` is in the `If-None-Match` list `list`,
+/// compared weakly: `W/` prefixes aside.
+static bool	ft_etag_listed(const std::string& list, std::string tag)
+{
+	if (tag.compare(0, 2, "W/") == 0)
+		tag.erase(0, 2);
+	for (size_t start = 0; start < list.size(); )
+	{
+		size_t		end = list.find(',', start);
+		if (end == std::string::npos)
+			end = list.size();
+		size_t		first = list.find_first_not_of(" \t", start);
+		size_t		last = list.find_last_not_of(" \t", end - 1);
+		std::string	item = (first < end && last >= first) ? list.substr(first, last - first + 1) : "";
+		if (item.compare(0, 2, "W/") == 0)
+			item.erase(0, 2);
+		if (item == "*" || item == tag)
+			return (true);
+		start = end + 1;
+	}
+	return (false);
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 
 StaticFileHandler::StaticFileHandler()
-	: _handledPath("")
+	: _fileCache(NULL)
 {
+	_initMimeTypes();
 }
 
 StaticFileHandler::StaticFileHandler(const StaticFileHandler& other)
 {
-	_handledPath = other._handledPath;
+	_mimeTypes = other._mimeTypes;
+	_fileCache = other._fileCache;
 }
 
 StaticFileHandler& StaticFileHandler::operator=(const StaticFileHandler& other)
 {
 	if (this != &other)
 	{
-		_handledPath = other._handledPath;
+		_mimeTypes = other._mimeTypes;
+		_fileCache = other._fileCache;
 	}
 	return (*this);
 }
@@ -48,26 +257,42 @@ StaticFileHandler::~StaticFileHandler()
 /// This method is called by the handleget to handle the request.
 /// It checks if the requested URI is a directory or a file and calls the
 /// appropriate method to handle the request.
+/// Paths are looked up in the `FileCache`; on a miss a deferred response is
+/// returned, and the server runs the request again once the path is loaded.
+/// In a `precompressed` location every response, errors included, carries
+/// `Vary: Accept-Encoding`, as a cache could not tell them apart otherwise.
 /// @param request HttpRequest object as reference
 /// @param location Location object as reference
 HttpResponse StaticFileHandler::handleget(const Context& context)
 {
-	_initMimeTypes();
+	HttpResponse	resp = _handleGet(context);
+
+	if (context.getLocation().isPrecompressed() && !resp.isDeferred())
+		resp.setHeader("Vary", "Accept-Encoding");
+	return (resp);
+}
+
+HttpResponse StaticFileHandler::_handleGet(const Context& context)
+{
 	int status = _verifyHeaders(context);
 	if (HttpResponse::checkStatusRange(status) != STATUS_SUCCESS)
 		return (HttpResponse::createErrorResponse(status, context));
 
 	if (context.getRequest().getUri() == "/")
 		return (_handleRoot(context));
-	_setHandledPath(_buildPathWithUri(context));
-	if (isDir(_handledPath))
+	std::string		path = _buildPathWithUri(context);
+	bool			listing = context.getLocation().isListdir();
+	const FileInfo*	info = _lookup(path, listing);
+	if (info == NULL)
+		return (HttpResponse::deferred(context, path, listing));
+	if (info->isDir())
 	{
-		if (context.getLocation().isListdir())
-			return (_handleDirListing(context));
-		return (_handleDirRequest(context));
+		if (listing)
+			return (_handleDirListing(context, path, *info));
+		return (_handleDirRequest(context, path));
 	}
-	else if (isFile(_handledPath))
-		return (_handleFileRequest(context));
+	else if (info->isFile())
+		return (_handleFileRequest(context, path, *info));
 	return (_handleNotFound(context));
 }
 
@@ -77,7 +302,6 @@ HttpResponse StaticFileHandler::handleget(const Context& context)
 
 HttpResponse StaticFileHandler::handlepost(const Context& context)
 {
-	_initMimeTypes();
 	int status = _verifyHeaders(context);
 	if (HttpResponse::checkStatusRange(status) != STATUS_SUCCESS)
 		return (HttpResponse::createErrorResponse(status, context));
@@ -145,27 +369,29 @@ bool	StaticFileHandler::_hasTargetHeader(const std::string& target, const std::m
 /// but the `uri` in the request is a directory.
 /// the method modifies the request to append the default file name.
 /// @warning this method depends on `_handleFileRequest` method
-HttpResponse StaticFileHandler::_handleDirRequest(const Context& context)
+HttpResponse StaticFileHandler::_handleDirRequest(const Context& context, const std::string& path)
 {
 	HttpRequest	modifiedRequest = context.getRequest();
 	Context&	moditiedContext = const_cast<Context&>(context);
-	
-	_setHandledPath(_buildAbsolutePathWithIndex(context));
-	std::cout << " absolute path that with index is built: " << _handledPath << std::endl;
-	if (!isFile(_handledPath))
+	std::string	indexPath = _buildAbsolutePathWithIndex(context, path);
+
+	const FileInfo*	info = _lookup(indexPath, false);
+	if (info == NULL)
+		return (HttpResponse::deferred(context, indexPath, false));
+	if (!info->isFile())
 		return (_handleNotFound(context));
-	modifiedRequest.setUri(getFullPath());
+	modifiedRequest.setUri(indexPath);
 	moditiedContext.setRequest(modifiedRequest);
-	return (_handleFileRequest(moditiedContext));
+	return (_handleFileRequest(moditiedContext, indexPath, *info));
 }
 
-std::string StaticFileHandler::_buildAbsolutePathWithIndex(const Context& context) const
+std::string StaticFileHandler::_buildAbsolutePathWithIndex(const Context& context, const std::string& dirPath) const
 {
 	std::string index		= INDEX_HTML;
 	std::string readedIndex = context.getLocation().getIndex();
 	if (!readedIndex.empty())
 		index = readedIndex;
-	return (_handledPath + index);
+	return (dirPath + index);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -173,17 +399,17 @@ std::string StaticFileHandler::_buildAbsolutePathWithIndex(const Context& contex
 /// This method is called when the directory listing is `true`,
 /// and the `uri` in the request is a directory.
 /// @warning not implemented yet
-HttpResponse StaticFileHandler::_handleDirListing(const Context& context)
+HttpResponse StaticFileHandler::_handleDirListing(const Context& context, const std::string& path, const FileInfo& info)
 {
-	return (_createDirListingResponse(context));
+	return (_createDirListingResponse(context, path, info));
 }
 
 /// @brief Create a `response` object for a directory listing.
 /// @return `HttpResponse`
-HttpResponse StaticFileHandler::_createDirListingResponse(const Context& context) const
+HttpResponse StaticFileHandler::_createDirListingResponse(const Context& context, const std::string& path, const FileInfo& info) const
 {
 	HttpResponse		resp(context);
-	resp.setBody(_genDirListingHtml(getFullPath()));
+	resp.setBody(_genDirListingHtml(path, info));
 
 	if (resp.getBody().empty() || resp.getBodyLength() <= 0)
 		return (HttpResponse::internalServerError_500(context));
@@ -193,8 +419,9 @@ HttpResponse StaticFileHandler::_createDirListingResponse(const Context& context
 
 /// @brief Generates an HTML page with a directory listing.
 /// @param path 
+/// @param info The directory, loaded with its entries.
 /// @return Create a list of directories and files in HTML and export it to `std::string`.
-std::string	StaticFileHandler::_genDirListingHtml(const std::string& path) const
+std::string	StaticFileHandler::_genDirListingHtml(const std::string& path, const FileInfo& info) const
 {
 	std::stringstream	html;
 	std::string			body;
@@ -203,63 +430,215 @@ std::string	StaticFileHandler::_genDirListingHtml(const std::string& path) const
     html << "<html><head><title>Directory Listing</title></head><body>";
     html << "<h2>Directory Listing for " << path << "</h2><ul>";
     
-    html << _genListing(path);
+    html << _genListing(info);
 
     html << "</ul></body></html>";
 	body = html.str();
 	return (body);
 }
 
-std::string StaticFileHandler::_genListing(const std::string& path) const
+std::string StaticFileHandler::_genListing(const FileInfo& info) const
 {
-	DIR*			dir = opendir(path.c_str());
-    struct dirent*	entry;
 	std::string		listing;
 
-	if (dir == NULL)
+	if (!info.hasListing)
 		return ("<li>Error opening directory</li>");
-	else
+	// TODO: implement: sort the list
+	for (size_t i = 0; i < info.listing.size(); i++)
+	{
+		const std::string& name = info.listing[i].first;
+		if (info.listing[i].second)
+			listing += "<li><a href=\"" + name + "/\">" + name + "</a></li>";
+		else
+			listing += "<li><a href=\"" + name + "\">" + name + "</a></li>";
+	}
+	return (listing);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+HttpResponse StaticFileHandler::_handleFileRequest(const Context& context, const std::string& path, const FileInfo& info)
+{
+	return (_createResponseForFile(context, path, info));
+}
+
+/// @brief Builds the response from the cached file, with the same outcomes as
+/// reading it directly: 404 if it could not be opened. Files too large for
+/// the cache are sent from disk by the server, whatever their size.
+/// Responses carry `ETag` and `Last-Modified`; a request still holding the
+/// current version is answered 304 from the cached stat alone, without a body.
+/// A `Range` request is answered 206 with the ranges sent from the file (see
+/// `_selectRanges`).
+/// In a `precompressed` location, the file may be sent as its sidecar (see
+/// `_selectSidecar`): validators and ranges are then those of the sidecar.
+HttpResponse StaticFileHandler::_createResponseForFile(const Context& context, const std::string& path, const FileInfo& info) const
+{
+	std::vector<FileRange>	ranges;
+	const FileInfo*			variant = &info;
+	std::string				variantPath = path;
+	std::string				encoding;
+
+	if (!info.hasBody && info.error == EIO)
+		return (HttpResponse::internalServerError_500(context));
+	if (!info.hasBody && (info.error != 0 || !info.isFile()))
+		return (HttpResponse::notFound_404(context));
+	if (context.getLocation().isPrecompressed() && !_selectSidecar(context, path, info, variantPath, variant, encoding))
+		return (HttpResponse::deferred(context, variantPath, false));
+	std::string	etag = ft_etag(*variant);
+	std::string	lastModified = ft_http_date(variant->mtime);
+	if (_isNotModified(context, etag, variant->mtime))
+	{
+		HttpResponse	notModified(context);
+
+		notModified.setStatusCode(304);
+		notModified.setHeader("ETag", etag);
+		notModified.setHeader("Last-Modified", lastModified);
+		return (notModified);
+	}
+	int	status = _selectRanges(context, *variant, etag, ranges);
+	if (status == 416)
+	{
+		HttpResponse	unsatisfiable = HttpResponse::rangeNotSatisfiable_416(context);
+
+		unsatisfiable.setHeader("Content-Range", "bytes */" + toString(static_cast<size_t>(variant->size)));
+		return (unsatisfiable);
+	}
+	std::string		type = resolveMimeType(path);
+	HttpResponse	resp = (status == 206)
+		? _createRangeResponse(context, variantPath, type, *variant, ranges) : HttpResponse(context);
+	if (status != 206 && variant->hasBody)
+		resp.initializeFromContent(variant->body);
+	else if (status != 206)
+	{
+		resp.setFileBody(variantPath, variant->size);
+		resp.setDefaultHeaders();
+	}
+	if (status != 206)
+		resp.setHeader("Content-Type", type);
+	if (!encoding.empty())
+		resp.setHeader("Content-Encoding", encoding);
+	resp.setHeader("Accept-Ranges", "bytes");
+	resp.setHeader("ETag", etag);
+	resp.setHeader("Last-Modified", lastModified);
+	return (resp);
+}
+
+/// @brief The precompressed sidecar of `path` to send instead, if any:
+/// `path.br` or `path.gz`, whichever encoding the client weighs most, `br` on
+/// a tie. A sidecar counts only as a regular file at least as recent as
+/// `path`. Whether it exists is kept in the `FileCache` like any other path,
+/// so once cached the choice takes no syscall.
+/// @return false if `variantPath` has to be loaded into the cache first.
+bool	StaticFileHandler::_selectSidecar(const Context& context, const std::string& path, const FileInfo& info,
+			std::string& variantPath, const FileInfo*& variant, std::string& encoding) const
+{
+	static const char*	codings[][2] = {{"br", ".br"}, {"gzip", ".gz"}};
+	std::string			accepted = ft_request_header(context.getRequest().getHeaders(), "Accept-Encoding");
+	int					best = 0;
+
+	for (size_t i = 0; i < sizeof(codings) / sizeof(codings[0]) && !accepted.empty(); i++)
 	{
-		while ((entry = readdir(dir)) != NULL)
+		int				weight = ft_accepted_weight(accepted, codings[i][0]);
+		std::string		sidecarPath = path + codings[i][1];
+
+		if (weight <= best)
+			continue ;
+		const FileInfo*	sidecar = _lookup(sidecarPath, false);
+		if (sidecar == NULL)
 		{
-			// TODO: implement: sort the list
-			std::string name = entry->d_name;
-			if (name != "." && name != "..")
-			{
-				if (entry->d_type == DT_DIR)
-					listing += "<li><a href=\"" + name + "/\">" + name + "</a></li>";
-				else
-					listing += "<li><a href=\"" + name + "\">" + name + "</a></li>";
-			}
+			variantPath = sidecarPath;
+			return (false);
 		}
-		closedir(dir);
-		return (listing);
+		if (!sidecar->isFile() || (!sidecar->hasBody && sidecar->error != 0) || sidecar->mtime < info.mtime)
+			continue ;
+		best = weight;
+		variantPath = sidecarPath;
+		variant = sidecar;
+		encoding = codings[i][0];
 	}
+	return (true);
 }
 
-////////////////////////////////////////////////////////////////////////////////
-HttpResponse StaticFileHandler::_handleFileRequest(const Context& context)
+/// @brief Which ranges of the file a GET asks for with `Range`, provided its
+/// `If-Range`, if any, still names the current version: the strong `ETag`,
+/// or the `Last-Modified` date of a file that has a strong one.
+/// @return 206 with `ranges` set, 416 if none of them is in the file, 200 to
+/// send the whole file: no `Range`, an invalid one, or too many ranges.
+int	StaticFileHandler::_selectRanges(const Context& context, const FileInfo& info, const std::string& etag,
+		std::vector<FileRange>& ranges) const
 {
-	return (_createResponseForFile(context));
+	std::map<std::string, std::string>	headers = context.getRequest().getHeaders();
+	std::string							range = ft_request_header(headers, "Range");
+	std::string							ifRange = ft_request_header(headers, "If-Range");
+	time_t								date;
+
+	if (range.empty())
+		return (200);
+	if (!ifRange.empty() && (etag.compare(0, 2, "W/") == 0
+		|| (ifRange != etag && (!ft_parse_http_date(ifRange, date) || date != info.mtime))))
+		return (200);
+	if (ft_parse_ranges(range, info.size, ranges) == -1 || ranges.size() > MAX_RANGES)
+		return (200);
+	return (ranges.empty() ? 416 : 206);
 }
 
-HttpResponse StaticFileHandler::_createResponseForFile(const Context& context) const
+/// @brief A 206 of `ranges` of the file: a single one as the body, several
+/// as the parts of a `multipart/byteranges` body, each headed by its range.
+HttpResponse	StaticFileHandler::_createRangeResponse(const Context& context, const std::string& path,
+					const std::string& type, const FileInfo& info, std::vector<FileRange>& ranges) const
 {
-	HttpResponse resp(context, _handledPath);
-	resp.setHeader("Content-Type", resolveMimeType(_handledPath));
+	HttpResponse	resp(context);
+	std::string		tail;
+
+	resp.setStatusCode(206);
+	if (ranges.size() == 1)
+	{
+		resp.setHeader("Content-Type", type);
+		resp.setHeader("Content-Range", ft_content_range(ranges[0], info.size));
+	}
+	else
+	{
+		std::string	boundary = ft_boundary(info);
+
+		for (size_t i = 0; i < ranges.size(); i++)
+			ranges[i].head = "\r\n--" + boundary + "\r\nContent-Type: " + type
+				+ "\r\nContent-Range: " + ft_content_range(ranges[i], info.size) + "\r\n\r\n";
+		tail = "\r\n--" + boundary + "--\r\n";
+		resp.setHeader("Content-Type", "multipart/byteranges; boundary=" + boundary);
+	}
+	resp.setFileRanges(path, ranges, tail);
 	return (resp);
 }
 
+/// @brief Evaluates the validators of a GET against the current version of
+/// the file: `If-None-Match` if sent, else `If-Modified-Since`.
+/// @return true if the client's copy is current, to be answered 304.
+bool	StaticFileHandler::_isNotModified(const Context& context, const std::string& etag, time_t mtime) const
+{
+	std::map<std::string, std::string>	headers = context.getRequest().getHeaders();
+	std::string							ifNoneMatch = ft_request_header(headers, "If-None-Match");
+	std::string							ifModifiedSince = ft_request_header(headers, "If-Modified-Since");
+	time_t								since;
+
+	if (!ifNoneMatch.empty())
+		return (ft_etag_listed(ifNoneMatch, etag));
+	if (ifModifiedSince.empty() || !ft_parse_http_date(ifModifiedSince, since))
+		return (false);
+	return (mtime <= since);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// @brief _handleRoot, private method to handle the root request
 /// This method is called when the requested URI is the root directory.
 /// It builds the full path of the default file and checks if the file exists.
 HttpResponse StaticFileHandler::_handleRoot(const Context& context)
 {
-	_setHandledPath(_buildAbsolutePathWithRoot(context));
-	if (!isFile(_handledPath))
+	std::string		path = _buildAbsolutePathWithRoot(context);
+	const FileInfo*	info = _lookup(path, false);
+	if (info == NULL)
+		return (HttpResponse::deferred(context, path, false));
+	if (!info->isFile())
 		return (_handleNotFound(context));
-	return (_createResponseForFile(context));
+	return (_createResponseForFile(context, path, *info));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -286,8 +665,6 @@ std::string StaticFileHandler::_buildPathWithUri(const Context& context) const
 		throw std::runtime_error("Root path is empty");
 	std::string fullPath = "." + serverRoot + locationRoot + context.getRequest().getUri();
 
-	std::cout << "TEST | absolute path that is built: " << fullPath << std::endl;
-
 	return(fullPath);
 }
 
@@ -296,29 +673,29 @@ HttpResponse StaticFileHandler::_handleNotFound(const Context& context)
 	return (HttpResponse::notFound_404(context));
 }
 
-
 ////////////////////////////////////////////////////////////////////////////////
-/// Setters
+/// File cache
 ////////////////////////////////////////////////////////////////////////////////
 
-void	StaticFileHandler::_setHandledPath(const std::string& fullPath)
+void	StaticFileHandler::setFileCache(FileCache* fileCache)
 {
-	_handledPath = fullPath;
+	_fileCache = fileCache;
 }
 
-////////////////////////////////////////////////////////////////////////////////
-/// Getters
-////////////////////////////////////////////////////////////////////////////////
-
-std::string	StaticFileHandler::getFullPath() const
+/// @brief Looks `path` up in the event loop's `FileCache`, without any syscall.
+/// @return `NULL` if the path has to be loaded first.
+const FileInfo*	StaticFileHandler::_lookup(const std::string& path, bool listing) const
 {
-	return (_handledPath);
+	if (_fileCache == NULL)
+		throw std::runtime_error("StaticFileHandler has no file cache");
+	return (_fileCache->lookup(path, listing));
 }
 
+
 ////////////////////////////////////////////////////////////////////////////////
 /// Mime types
 ////////////////////////////////////////////////////////////////////////////////
-/// @brief Initializes the MIME types map from the configuration.
+/// @brief Initializes the MIME types map from the configuration, once per handler.
 /// If the configuration does not provide MIME types, default values are used.
 void	StaticFileHandler::_initMimeTypes()
 {
@@ -0,0 +1,135 @@
+#include "webserv.hpp"
+#include "ThreadGroup.hpp"
+#include "Config.hpp"
+#include "Server.hpp"
+#include <cerrno>
+#include <cstring>
+
+static int						s_wakeFds[MAX_WORKER_THREADS];
+static volatile sig_atomic_t	s_wakeCount = 0;
+
+/// @brief Only the main thread receives signals; it stops every event loop
+/// by raising `g_sigint` and poking each loop's wakeup pipe.
+static void	ft_thread_group_signal_handler(int sig)
+{
+	char	byte = 1;
+
+	(void)sig;
+	g_sigint = true;
+	for (int i = 0; i < s_wakeCount; i++)
+	{
+		if (write(s_wakeFds[i], &byte, 1) < 0)
+			continue ;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Constructor & Destructor
+////////////////////////////////////////////////////////////////////////////////
+
+ThreadGroup::ThreadGroup(Config& config, int threadCount)
+	: _config(config), _threadCount(threadCount)
+{
+	if (_threadCount < 1)
+		_threadCount = 1;
+	if (_threadCount > MAX_WORKER_THREADS)
+		_threadCount = MAX_WORKER_THREADS;
+}
+
+ThreadGroup::~ThreadGroup()
+{
+	for (size_t i = 0; i < _servers.size(); i++)
+		delete _servers[i];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Public Methods
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Reads `worker_threads` from the top level of the config file.
+/// @return 1 (threading disabled) if absent, the CPU count for `auto`.
+int	ThreadGroup::resolveThreadCount(const Config& config)
+{
+	std::string	value = config.get("worker_threads");
+	long		count;
+
+	if (value.empty())
+		return (1);
+	if (value == "auto")
+		count = sysconf(_SC_NPROCESSORS_ONLN);
+	else
+		count = atol(value.c_str());
+	if (count < 1)
+		count = 1;
+	if (count > MAX_WORKER_THREADS)
+		count = MAX_WORKER_THREADS;
+	return (static_cast<int>(count));
+}
+
+/// @brief Starts one `Server` per thread and waits for all of them to stop.
+///
+/// Termination signals are blocked before the threads are created, so they
+/// inherit the mask and only the main thread (waiting in `pthread_join`) runs
+/// the handler.
+void	ThreadGroup::run()
+{
+	sigset_t	blocked;
+	sigset_t	previous;
+
+	for (int i = 0; i < _threadCount; i++)
+	{
+		Server* server = new Server(_config);
+		server->setReusePort(true);
+		_servers.push_back(server);
+		s_wakeFds[i] = server->getWakeupFd();
+	}
+	s_wakeCount = _threadCount;
+
+	sigemptyset(&blocked);
+	sigaddset(&blocked, SIGINT);
+	sigaddset(&blocked, SIGTERM);
+	sigaddset(&blocked, SIGQUIT);
+	pthread_sigmask(SIG_BLOCK, &blocked, &previous);
+	for (size_t i = 0; i < _servers.size(); i++)
+	{
+		pthread_t	thread;
+		int			error = pthread_create(&thread, NULL, _threadMain, _servers[i]);
+		if (error != 0)
+		{
+			std::cerr << "Error: failed to create event loop thread: " << std::strerror(error) << std::endl;
+			continue ;
+		}
+		_threads.push_back(thread);
+	}
+	_installSignalHandlers();
+	pthread_sigmask(SIG_SETMASK, &previous, NULL);
+	std::cout << "Started " << _threads.size() << " event loop threads" << std::endl;
+
+	for (size_t i = 0; i < _threads.size(); i++)
+		pthread_join(_threads[i], NULL);
+	s_wakeCount = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Private Methods
+////////////////////////////////////////////////////////////////////////////////
+
+void	ThreadGroup::_installSignalHandlers()
+{
+	struct sigaction	sa;
+
+	std::memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	sa.sa_handler = ft_thread_group_signal_handler;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGQUIT, &sa, NULL);
+}
+
+void*	ThreadGroup::_threadMain(void* arg)
+{
+	Server*	server = static_cast<Server*>(arg);
+
+	server->start();
+	return (NULL);
+}
@@ -0,0 +1,138 @@
+#include "TimerWheel.hpp"
+#include <ctime>
+
+////////////////////////////////////////////////////////////////////////////////
+/// Constructor & Destructor
+////////////////////////////////////////////////////////////////////////////////
+
+TimerWheel::TimerWheel(unsigned int tickMs, size_t slots)
+	: _heads(slots, -1), _current(0), _lastTick(now()), _tickMs(tickMs), _armed(0)
+{}
+
+TimerWheel::~TimerWheel()
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Public Methods
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief (Re)starts the timer of `id` to fire in `timeoutMs`, rounded up to
+/// whole ticks. A timer already running for `id` is replaced.
+void	TimerWheel::arm(int id, unsigned int timeoutMs)
+{
+	size_t	ticks = (timeoutMs + _tickMs - 1) / _tickMs;
+
+	if ((size_t)id >= _nodes.size())
+	{
+		Node	unarmed = {-1, -1, -1, 0};
+		_nodes.resize(id + 1, unarmed);
+	}
+	if (_nodes[id].slot != -1)
+		_unlink(id);
+	// An empty wheel is not advanced, catch up so the slot is counted from now
+	if (_armed == 0)
+		_lastTick += (now() - _lastTick) / _tickMs * _tickMs;
+	if (ticks == 0)
+		ticks = 1;
+	_nodes[id].rounds = (ticks - 1) / _heads.size();
+	_link(id, (_current + ticks) % _heads.size());
+}
+
+void	TimerWheel::cancel(int id)
+{
+	if (isArmed(id))
+		_unlink(id);
+}
+
+bool	TimerWheel::isArmed(int id) const
+{
+	return (id >= 0 && (size_t)id < _nodes.size() && _nodes[id].slot != -1);
+}
+
+/// @brief Timeout for `poll()`: until the next tick while timers are armed,
+/// forever otherwise.
+int	TimerWheel::pollTimeout() const
+{
+	uint64_t	nextTick = _lastTick + _tickMs;
+	uint64_t	current = now();
+
+	if (_armed == 0)
+		return (-1);
+	if (current >= nextTick)
+		return (0);
+	return (static_cast<int>(nextTick - current));
+}
+
+/// @brief Advances the wheel to the current time and appends the ids of the
+/// timers that fired to `expired`. Fired timers are disarmed.
+void	TimerWheel::expire(std::vector<int>& expired)
+{
+	uint64_t	current = now();
+	uint64_t	ticks = (current - _lastTick) / _tickMs;
+
+	if (_armed == 0)
+	{
+		_lastTick += ticks * _tickMs;
+		return ;
+	}
+	for (uint64_t t = 0; t < ticks; t++)
+	{
+		_current = (_current + 1) % _heads.size();
+		int id = _heads[_current];
+		while (id != -1)
+		{
+			int next = _nodes[id].next;
+			if (_nodes[id].rounds == 0)
+			{
+				_unlink(id);
+				expired.push_back(id);
+			}
+			else
+				_nodes[id].rounds--;
+			id = next;
+		}
+	}
+	_lastTick += ticks * _tickMs;
+}
+
+/// @brief Monotonic clock in milliseconds.
+uint64_t	TimerWheel::now()
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Private Methods
+////////////////////////////////////////////////////////////////////////////////
+
+void	TimerWheel::_link(int id, size_t slot)
+{
+	Node&	node = _nodes[id];
+
+	node.slot = slot;
+	node.prev = -1;
+	node.next = _heads[slot];
+	if (node.next != -1)
+		_nodes[node.next].prev = id;
+	_heads[slot] = id;
+	_armed++;
+}
+
+void	TimerWheel::_unlink(int id)
+{
+	Node&	node = _nodes[id];
+
+	if (node.prev != -1)
+		_nodes[node.prev].next = node.next;
+	else
+		_heads[node.slot] = node.next;
+	if (node.next != -1)
+		_nodes[node.next].prev = node.prev;
+	node.prev = -1;
+	node.next = -1;
+	node.slot = -1;
+	_armed--;
+}
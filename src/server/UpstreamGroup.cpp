@@ -0,0 +1,291 @@
+#include "UpstreamGroup.hpp"
+#include "Config.hpp"
+#include "Util.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+
+/// Points of each server on the hash ring, per unit of weight
+#define UPSTREAM_HASH_POINTS	160
+/// Longest a failing server is taken out of rotation, ms
+#define UPSTREAM_MAX_BACKOFF	(5 * 60 * 1000)
+
+////////////////////////////////////////////////////////////////////////////////
+/// Constructor & Destructor
+////////////////////////////////////////////////////////////////////////////////
+
+UpstreamGroup::UpstreamGroup()
+	: _balance(BALANCE_ROUND_ROBIN), _next(0), _healthInterval(0), _healthTimeout(0), _nextHealthCheck(0)
+{}
+
+UpstreamGroup::UpstreamGroup(const UpstreamConfig& config)
+	: _name(config.name), _balance(BALANCE_ROUND_ROBIN), _next(0),
+	_healthInterval(config.healthInterval), _healthTimeout(config.healthTimeout),
+	_healthUri(config.healthUri), _nextHealthCheck(0)
+{
+	if (config.balance == "least_conn")
+		_balance = BALANCE_LEAST_CONN;
+	else if (config.balance == "hash_uri")
+		_balance = BALANCE_HASH_URI;
+	else if (config.balance == "hash_ip")
+		_balance = BALANCE_HASH_IP;
+	for (size_t i = 0; i < config.servers.size(); i++)
+	{
+		Peer	peer;
+
+		peer.pool = "http://" + config.servers[i].address;
+		peer.weight = config.servers[i].weight;
+		peer.maxFails = config.servers[i].maxFails;
+		peer.failTimeout = config.servers[i].failTimeout;
+		peer.currentWeight = 0;
+		peer.active = 0;
+		peer.fails = 0;
+		peer.lastFail = 0;
+		peer.downUntil = 0;
+		peer.backoff = 0;
+		peer.healthy = true;
+		_peers.push_back(peer);
+		// Points from the address, so a server keeps its keys across reloads
+		for (size_t point = 0; point < peer.weight * UPSTREAM_HASH_POINTS; point++)
+			_ring.push_back(std::make_pair(_hash(peer.pool + "#" + toString(point)), i));
+	}
+	std::sort(_ring.begin(), _ring.end());
+}
+
+UpstreamGroup::~UpstreamGroup()
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Public Methods
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief What a request is hashed on: its URI with `hash_uri`, its client's
+/// address with `hash_ip`, nothing otherwise.
+std::string	UpstreamGroup::balanceKey(const std::string& uri, uint32_t clientAddr) const
+{
+	char	address[INET_ADDRSTRLEN] = "";
+
+	if (_balance == BALANCE_HASH_URI)
+		return (uri);
+	if (_balance != BALANCE_HASH_IP)
+		return ("");
+	inet_ntop(AF_INET, &clientAddr, address, sizeof(address));
+	return (address);
+}
+
+/// @brief Picks the server of a request and counts it as outstanding there,
+/// until `release()`.
+/// @param key see `balanceKey`.
+/// @param avoid a server that just failed the request, -1 if none.
+/// @return the server, -1 if there is none to try.
+int	UpstreamGroup::select(const std::string& key, uint64_t now, int avoid)
+{
+	int	peer;
+
+	if (_balance == BALANCE_LEAST_CONN)
+		peer = _selectLeastConn(now, avoid);
+	else if (_balance == BALANCE_HASH_URI || _balance == BALANCE_HASH_IP)
+		peer = _selectHash(key, now, avoid);
+	else
+		peer = _selectRoundRobin(now, avoid);
+	if (peer == -1)
+		peer = _selectAnyway(avoid);
+	if (peer != -1)
+		_peers[peer].active++;
+	return (peer);
+}
+
+/// @brief The request sent to `peer` ended, whatever its outcome.
+void	UpstreamGroup::release(size_t peer)
+{
+	if (_peers[peer].active > 0)
+		_peers[peer].active--;
+}
+
+/// @brief `peer` answered a request: its failures are forgotten.
+void	UpstreamGroup::succeed(size_t peer)
+{
+	_peers[peer].fails = 0;
+	_peers[peer].backoff = 0;
+}
+
+/// @brief `peer` could not be reached, broke off its response or timed out.
+/// At `max_fails` failures within `fail_timeout`, it is taken out of rotation.
+void	UpstreamGroup::fail(size_t peer, uint64_t now)
+{
+	Peer&	p = _peers[peer];
+
+	if (p.maxFails == 0)
+		return ;
+	// Failures too old are forgotten, unless it is just back from being out
+	if (p.backoff == 0 && p.fails > 0 && now - p.lastFail > p.failTimeout)
+		p.fails = 0;
+	p.lastFail = now;
+	if (++p.fails < p.maxFails)
+		return ;
+	p.backoff = (p.backoff == 0) ? p.failTimeout : std::min(p.backoff * 2, (size_t)UPSTREAM_MAX_BACKOFF);
+	p.downUntil = now + p.backoff;
+	// Back in rotation, one more failure takes it out again
+	p.fails = p.maxFails - 1;
+}
+
+/// @brief Records the result of an active health check of `peer`.
+/// @return whether that changed its state.
+bool	UpstreamGroup::setHealthy(size_t peer, bool healthy)
+{
+	if (_peers[peer].healthy == healthy)
+		return (false);
+	_peers[peer].healthy = healthy;
+	return (true);
+}
+
+/// @brief Whether the servers are to be checked now, with `health_check`;
+/// if so, the next checks are due an interval later.
+bool	UpstreamGroup::isHealthCheckDue(uint64_t now)
+{
+	if (_healthInterval == 0 || now < _nextHealthCheck)
+		return (false);
+	_nextHealthCheck = now + _healthInterval;
+	return (true);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Getters
+////////////////////////////////////////////////////////////////////////////////
+
+size_t	UpstreamGroup::size() const
+{
+	return (_peers.size());
+}
+
+const std::string&	UpstreamGroup::getName() const
+{
+	return (_name);
+}
+
+const std::string&	UpstreamGroup::getPool(size_t peer) const
+{
+	return (_peers[peer].pool);
+}
+
+uint64_t	UpstreamGroup::getNextHealthCheck() const
+{
+	return (_nextHealthCheck);
+}
+
+size_t	UpstreamGroup::getHealthInterval() const
+{
+	return (_healthInterval);
+}
+
+size_t	UpstreamGroup::getHealthTimeout() const
+{
+	return (_healthTimeout);
+}
+
+const std::string&	UpstreamGroup::getHealthUri() const
+{
+	return (_healthUri);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Private Methods
+////////////////////////////////////////////////////////////////////////////////
+
+bool	UpstreamGroup::_isAvailable(size_t peer, uint64_t now, int avoid) const
+{
+	return ((int)peer != avoid && _peers[peer].healthy && now >= _peers[peer].downUntil);
+}
+
+/// @brief Smooth weighted round-robin: each pick adds every server's weight
+/// to its current weight, takes the highest, and lowers it by the total, so
+/// a server of weight 2 out of 3 comes up two times in three, interleaved.
+int	UpstreamGroup::_selectRoundRobin(uint64_t now, int avoid)
+{
+	long	total = 0;
+	int		best = -1;
+
+	for (size_t i = 0; i < _peers.size(); i++)
+	{
+		if (!_isAvailable(i, now, avoid))
+			continue ;
+		_peers[i].currentWeight += _peers[i].weight;
+		total += _peers[i].weight;
+		if (best == -1 || _peers[i].currentWeight > _peers[best].currentWeight)
+			best = i;
+	}
+	if (best != -1)
+		_peers[best].currentWeight -= total;
+	return (best);
+}
+
+/// @brief The server with the fewest outstanding requests for its weight.
+/// Ties go round, so an idle group still spreads its requests.
+int	UpstreamGroup::_selectLeastConn(uint64_t now, int avoid)
+{
+	int	best = -1;
+
+	for (size_t n = 0; n < _peers.size(); n++)
+	{
+		size_t	i = (_next + n) % _peers.size();
+
+		if (!_isAvailable(i, now, avoid))
+			continue ;
+		// active / weight < best active / best weight, without division
+		if (best == -1 || _peers[i].active * _peers[best].weight < _peers[best].active * _peers[i].weight)
+			best = i;
+	}
+	if (best != -1)
+		_next = best + 1;
+	return (best);
+}
+
+/// @brief The server owning the first point of the ring at or after the
+/// key's hash, skipping those out of rotation: when a server goes, only its
+/// own keys move.
+int	UpstreamGroup::_selectHash(const std::string& key, uint64_t now, int avoid) const
+{
+	if (_ring.empty())
+		return (-1);
+	std::vector<std::pair<uint32_t, size_t> >::const_iterator it;
+	it = std::lower_bound(_ring.begin(), _ring.end(), std::make_pair(_hash(key), (size_t)0));
+	for (size_t n = 0; n < _ring.size(); n++, ++it)
+	{
+		if (it == _ring.end())
+			it = _ring.begin();
+		if (_isAvailable(it->second, now, avoid))
+			return (it->second);
+	}
+	return (-1);
+}
+
+/// @brief Every server is out: the one due back first, other than `avoid`.
+int	UpstreamGroup::_selectAnyway(int avoid) const
+{
+	int	best = -1;
+
+	for (size_t i = 0; i < _peers.size(); i++)
+	{
+		if ((int)i != avoid && (best == -1 || _peers[i].downUntil < _peers[best].downUntil))
+			best = i;
+	}
+	return (best);
+}
+
+/// @brief FNV-1a, then the MurmurHash3 finalizer to spread similar keys,
+/// e.g. consecutive ring points of a server, over the whole ring.
+uint32_t	UpstreamGroup::_hash(const std::string& value)
+{
+	uint32_t	hash = 2166136261u;
+
+	for (size_t i = 0; i < value.size(); i++)
+	{
+		hash ^= (unsigned char)value[i];
+		hash *= 16777619u;
+	}
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+	return (hash);
+}
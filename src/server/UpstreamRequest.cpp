@@ -0,0 +1,150 @@
+#include "UpstreamRequest.hpp"
+#include "Upstream.hpp"
+#include "UpstreamGroup.hpp"
+#include <cerrno>
+#include <sys/socket.h>
+
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL			0
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+/// Constructor & Destructor
+////////////////////////////////////////////////////////////////////////////////
+
+UpstreamRequest::UpstreamRequest(int clientFd, unsigned int clientGeneration, const std::string& upstream)
+	: _clientFd(clientFd), _clientGeneration(clientGeneration), _upstream(upstream),
+	_socketFd(-1), _reused(false), _connecting(false), _requestOffset(0), _received(0),
+	_group(NULL), _peer(-1)
+{}
+
+/// @brief The socket is not closed: it belongs to the `Server`'s pool.
+UpstreamRequest::~UpstreamRequest()
+{}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Public Methods
+////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Sends the request over `socketFd`: a pooled connection if `reused`,
+/// else one `connectUpstream` just started.
+void	UpstreamRequest::attach(int socketFd, bool reused)
+{
+	_socketFd = socketFd;
+	_reused = reused;
+	_connecting = !reused;
+}
+
+void	UpstreamRequest::detach()
+{
+	_socketFd = -1;
+}
+
+/// @brief Starts over, to send the request again on another connection.
+void	UpstreamRequest::rewind()
+{
+	_requestOffset = 0;
+	_input.clear();
+	_received = 0;
+	_output.clear();
+}
+
+/// @brief Spreads the request over the servers of `group`, by `key` when it
+/// hashes (see `UpstreamGroup::balanceKey`). The server is set by `setPeer`.
+void	UpstreamRequest::balance(UpstreamGroup* group, const std::string& key)
+{
+	_group = group;
+	_balanceKey = key;
+}
+
+/// @brief Sends the request to server `peer` of its group, -1 for none yet:
+/// the connection pool changes with it.
+void	UpstreamRequest::setPeer(int peer)
+{
+	_peer = peer;
+	if (peer != -1)
+		_upstream = _group->getPool(peer);
+}
+
+/// @brief Writes as much of the request as the socket takes, once connected.
+/// @return the bytes written, 0 if the socket is full, -1 on error.
+int	UpstreamRequest::send()
+{
+	if (_connecting)
+	{
+		if (!finishConnect(_socketFd))
+			return (-1);
+		_connecting = false;
+	}
+	ssize_t	written = ::send(_socketFd, _request.data() + _requestOffset,
+						_request.size() - _requestOffset, MSG_NOSIGNAL);
+	if (written < 0)
+		return ((errno == EAGAIN || errno == EINTR) ? 0 : -1);
+	_requestOffset += written;
+	return (written);
+}
+
+/// @brief Whether any of the request was written: until then a server that
+/// refused it can be replaced by another.
+bool	UpstreamRequest::hasStarted() const
+{
+	return (_requestOffset > 0);
+}
+
+bool	UpstreamRequest::isSent() const
+{
+	return (!_connecting && _requestOffset >= _request.size());
+}
+
+/// @brief Whether a failure may be a pooled connection the backend had
+/// already closed, so the request can be sent again on a new one.
+bool	UpstreamRequest::canRetry() const
+{
+	return (_reused && _received == 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Getters
+////////////////////////////////////////////////////////////////////////////////
+
+int	UpstreamRequest::getClientFd() const
+{
+	return (_clientFd);
+}
+
+unsigned int	UpstreamRequest::getClientGeneration() const
+{
+	return (_clientGeneration);
+}
+
+const std::string&	UpstreamRequest::getUpstream() const
+{
+	return (_upstream);
+}
+
+int	UpstreamRequest::getSocketFd() const
+{
+	return (_socketFd);
+}
+
+UpstreamGroup*	UpstreamRequest::getGroup() const
+{
+	return (_group);
+}
+
+const std::string&	UpstreamRequest::getBalanceKey() const
+{
+	return (_balanceKey);
+}
+
+int	UpstreamRequest::getPeer() const
+{
+	return (_peer);
+}
+
+/// @brief Moves out the CGI output received so far.
+void	UpstreamRequest::takeOutput(std::string& output)
+{
+	output.clear();
+	output.swap(_output);
+}
@@ -12,11 +12,17 @@
 
 #include "webserv.hpp"
 #include "Config.hpp"
+#include "Util.hpp"
 #include <fstream>
 #include <sstream>
 #include <stdexcept>
 #include <algorithm>
 
+/// Defaults of an `upstream` block
+#define DEFAULT_UPSTREAM_FAIL_TIMEOUT	10000
+#define DEFAULT_HEALTH_INTERVAL			5000
+#define DEFAULT_HEALTH_TIMEOUT			2000
+
 LocationConfig*	new_locationConfig()
 {
 	LocationConfig*	_this = new LocationConfig();
@@ -26,7 +32,26 @@ LocationConfig*	new_locationConfig()
 	_this->allowed_methods = std::vector<std::string>();
 	_this->upload_dir = "";
 	_this->lsdir = false;
-	_this->cgi_ext = ".py";
+	_this->cgi_ext = std::map<std::string, std::string>();
+	_this->fastcgi_pass = "";
+	_this->cgi_workers = 0;
+	_this->cgi_worker_requests = 0;
+	_this->cgi_params = std::vector<std::string>();
+	_this->cgi_timeout = 0;
+	_this->cgi_max_concurrency = 0;
+	_this->cgi_queue = 0;
+	_this->cgi_rlimits.cpu = 0;
+	_this->cgi_rlimits.memory = 0;
+	_this->cgi_rlimits.files = 0;
+	_this->cgi_status = false;
+	_this->cgi_cache = 0;
+	_this->cgi_cache_key = std::vector<std::string>();
+	_this->cgi_cache_stale_while_revalidate = 0;
+	_this->cgi_cache_stale_if_error = 0;
+	_this->proxy_pass = "";
+	_this->proxy_uri = "";
+	_this->proxy_timeout = DEFAULT_PROXY_TIMEOUT;
+	_this->precompressed = false;
 	_this->redirection = "";
 	_this->default_file = "index.html";
 
@@ -41,7 +66,15 @@ ServerConfig*	new_serverConfig()
 	_this->listen = "localhost:80";
 	_this->host = "localhost";
 	_this->port = 80;
+	_this->listen_options.backlog = 0;
+	_this->listen_options.deferAccept = 0;
+	_this->listen_options.fastOpen = 0;
+	_this->listen_options.rcvbuf = 0;
+	_this->listen_options.sndbuf = 0;
+	_this->listen_options.noDelay = true;
 	_this->max_body_size = 1024;
+	_this->max_connect = 0;
+	_this->max_header = 8192;
 	_this->root = "/www";
 	_this->default_file = "index.html";
 	_this->upload_dir = "/www/data/uploads";
@@ -106,6 +139,8 @@ void	Config::_parseConfigFile(const std::string& filename)
 	bool inServerBlock = false;
 	bool inLocationBlock = false;
 	bool inErrorPagesBlock = false;
+	bool inUpstreamBlock = false;
+	UpstreamConfig currentUpstream;
 
 	while (std::getline(file, line))
 	{
@@ -126,7 +161,29 @@ void	Config::_parseConfigFile(const std::string& filename)
 		std::string key;
 		iss >> key;
 
-		if (key == "types")
+		if (inUpstreamBlock)
+		{
+			if (key == "}")
+			{
+				inUpstreamBlock = false;
+				if (currentUpstream.servers.empty())
+					throw std::runtime_error("No server in upstream " + currentUpstream.name);
+				_upstreams[currentUpstream.name] = currentUpstream;
+			}
+			else
+				_parseUpstream(currentUpstream, key, iss);
+		}
+		else if (key == "upstream")
+		{
+			// `upstream backend {`, at the top level
+			inUpstreamBlock = true;
+			currentUpstream = UpstreamConfig();
+			iss >> currentUpstream.name;
+			currentUpstream.balance = "round_robin";
+			currentUpstream.healthInterval = 0;
+			currentUpstream.healthTimeout = DEFAULT_HEALTH_TIMEOUT;
+		}
+		else if (key == "types")
 		{
 			inTypesBlock = true;
 		}
@@ -178,6 +235,9 @@ void	Config::_parseConfigFile(const std::string& filename)
 			else if (inServerBlock)
 			{
 				inServerBlock = false;
+				std::map<std::string, Location*>::iterator it;
+				for (it = currentServer->map_locationObjs.begin(); it != currentServer->map_locationObjs.end(); ++it)
+					it->second->buildCgiEnvironment();
 				_servers.push_back(currentServer);
 				currentServer = new_serverConfig();
 			}
@@ -235,10 +295,128 @@ void	Config::_parseConfigFile(const std::string& filename)
 				currentLocation->lsdir = true;
 			}
 			else if (key == "cgi_ext")
+			{
+				// `cgi_ext .py [/usr/bin/python3];`, once per extension
+				std::string interpreter;
+				iss >> val >> interpreter;
+				if (!interpreter.empty())
+					interpreter.erase(interpreter.length() - 1);
+				else
+					val.erase(val.length() - 1);
+				currentLocation->cgi_ext[val] = interpreter;
+			}
+			else if (key == "fastcgi_pass")
+			{
+				iss >> val;
+				val.erase(val.length() - 1);
+				currentLocation->fastcgi_pass = val;
+			}
+			else if (key == "cgi_param")
+			{
+				// `cgi_param NAME value;`, the value may be empty
+				std::string value;
+				iss >> val;
+				std::getline(iss, value);
+				value.erase(0, value.find_first_not_of(" \t"));
+				if (!value.empty())
+					value.erase(value.length() - 1);
+				else
+					val.erase(val.length() - 1);
+				currentLocation->cgi_params.push_back(val + "=" + value);
+			}
+			else if (key == "cgi_workers")
+			{
+				// `cgi_workers 4 [max_requests=1000];`
+				std::string option;
+				iss >> val >> option;
+				if (!option.empty())
+					option.erase(option.length() - 1);
+				else
+					val.erase(val.length() - 1);
+				currentLocation->cgi_workers = toSizeT(val);
+				if (option.compare(0, 13, "max_requests=") == 0)
+					currentLocation->cgi_worker_requests = toSizeT(option.substr(13));
+			}
+			else if (key == "cgi_timeout")
+			{
+				iss >> val;
+				val.erase(val.length() - 1);
+				currentLocation->cgi_timeout = parseDuration(val);
+			}
+			else if (key == "cgi_max_concurrency")
+			{
+				// `cgi_max_concurrency 8 [queue=32];`, the queue as long as the cap by default
+				std::string option;
+				iss >> val >> option;
+				if (!option.empty())
+					option.erase(option.length() - 1);
+				else
+					val.erase(val.length() - 1);
+				currentLocation->cgi_max_concurrency = toSizeT(val);
+				currentLocation->cgi_queue = currentLocation->cgi_max_concurrency;
+				if (option.compare(0, 6, "queue=") == 0)
+					currentLocation->cgi_queue = toSizeT(option.substr(6));
+			}
+			else if (key == "cgi_rlimit")
+			{
+				// `cgi_rlimit cpu=10 as=256m nofile=64;`
+				while (iss >> val)
+				{
+					if (val[val.length() - 1] == ';')
+						val.erase(val.length() - 1);
+					_parseCgiRlimit(currentLocation->cgi_rlimits, val);
+				}
+			}
+			else if (key == "cgi_status")
+			{
+				iss >> val;
+				currentLocation->cgi_status = (val == "on;");
+			}
+			else if (key == "precompressed")
+			{
+				iss >> val;
+				currentLocation->precompressed = (val == "on;");
+			}
+			else if (key == "cgi_cache")
+			{
+				iss >> val;
+				val.erase(val.length() - 1);
+				currentLocation->cgi_cache = parseDuration(val);
+			}
+			else if (key == "cgi_cache_key")
+			{
+				// `cgi_cache_key Accept-Language X-Device;`
+				while (iss >> val)
+				{
+					if (val[val.length() - 1] == ';')
+						val.erase(val.length() - 1);
+					if (!val.empty())
+						currentLocation->cgi_cache_key.push_back(val);
+				}
+			}
+			else if (key == "cgi_cache_stale_while_revalidate")
+			{
+				iss >> val;
+				val.erase(val.length() - 1);
+				currentLocation->cgi_cache_stale_while_revalidate = parseDuration(val);
+			}
+			else if (key == "cgi_cache_stale_if_error")
+			{
+				iss >> val;
+				val.erase(val.length() - 1);
+				currentLocation->cgi_cache_stale_if_error = parseDuration(val);
+			}
+			else if (key == "proxy_pass")
 			{
 				iss >> val;
 				val.erase(val.length() - 1);
-				currentLocation->cgi_ext = val;
+				_parseProxyPass(currentLocation, val);
+			}
+			else if (key == "proxy_timeout")
+			{
+				iss >> val;
+				val.erase(val.length() - 1);
+				currentLocation->proxy_timeout = parseDuration(val);
 			}
 			else if (key == "redirection")
 			{
@@ -265,17 +443,39 @@ void	Config::_parseConfigFile(const std::string& filename)
 			else if (key == "listen")
 			{
 				iss >> value;
-				value.erase(value.length() - 1);
+				if (value[value.length() - 1] == ';')
+					value.erase(value.length() - 1);
 				currentServer->listen = value;
 				std::string listen = currentServer->listen;
 				size_t delimPos = listen.find_first_of(":");
 				currentServer->port = atoi(listen.substr(delimPos + 1).c_str());
 				currentServer->host = listen.substr(0, delimPos);
+				// Socket options following the address
+				std::string option;
+				while (iss >> option)
+				{
+					if (option[option.length() - 1] == ';')
+						option.erase(option.length() - 1);
+					_parseListenOption(currentServer->listen_options, option);
+				}
+			}
+			else if (key == "tcp_nodelay")
+			{
+				iss >> value;
+				currentServer->listen_options.noDelay = (value != "off;");
 			}
 			else if (key == "max_body_size")
 			{
 				iss >> currentServer->max_body_size;
 			}
+			else if (key == "max_connect")
+			{
+				iss >> currentServer->max_connect;
+			}
+			else if (key == "max_header")
+			{
+				iss >> currentServer->max_header;
+			}
 			else if (key == "root")
 			{
 				iss >> value;
@@ -301,6 +501,15 @@ void	Config::_parseConfigFile(const std::string& filename)
 				currentServer->cgi_dir = value;
 			}
 		}
+		else
+		{
+			// Top-level directives, e.g. `worker_processes auto;`
+			std::string value = "";
+			iss >> value;
+			if (!value.empty() && value[value.length() - 1] == ';')
+				value.erase(value.length() - 1);
+			_configMap[key] = value;
+		}
 	}
 
 	if (currentServer->server_name.empty() == false)
@@ -310,6 +519,126 @@ void	Config::_parseConfigFile(const std::string& filename)
 	delete currentLocation;
 }
 
+/// @brief Parses one `name[=value]` option of a `listen` directive.
+void	Config::_parseListenOption(ListenOptions& options, const std::string& option)
+{
+	size_t		delimPos = option.find('=');
+	std::string	name = option.substr(0, delimPos);
+	std::string	value = (delimPos == std::string::npos) ? "" : option.substr(delimPos + 1);
+
+	if (name == "backlog")
+		options.backlog = atoi(value.c_str());
+	else if (name == "deferred")
+		options.deferAccept = value.empty() ? 1 : parseDuration(value) / 1000;
+	else if (name == "fastopen")
+		options.fastOpen = atoi(value.c_str());
+	else if (name == "rcvbuf")
+		options.rcvbuf = parseSize(value);
+	else if (name == "sndbuf")
+		options.sndbuf = parseSize(value);
+	else
+		throw std::runtime_error("Unknown listen option: " + option);
+}
+
+/// @brief Parses one `name=value` limit of a `cgi_rlimit` directive.
+void	Config::_parseCgiRlimit(CgiRlimits& limits, const std::string& option)
+{
+	size_t		delimPos = option.find('=');
+	std::string	name = option.substr(0, delimPos);
+	std::string	value = (delimPos == std::string::npos) ? "" : option.substr(delimPos + 1);
+
+	if (name == "cpu")
+		limits.cpu = parseDuration(value) / 1000;
+	else if (name == "as")
+		limits.memory = parseSize(value);
+	else if (name == "nofile")
+		limits.files = toSizeT(value);
+	else
+		throw std::runtime_error("Unknown cgi_rlimit: " + option);
+}
+
+/// @brief Parses the URL of a `proxy_pass` directive,
+/// `http://host[:port][/uri]`: the server, or the name of an `upstream`
+/// block, and the URI replacing the location path, if any.
+void	Config::_parseProxyPass(LocationConfig* location, const std::string& url)
+{
+	if (url.compare(0, 7, "http://") != 0 || url.size() == 7)
+		throw std::runtime_error("Invalid proxy_pass: " + url);
+	size_t	slash = url.find('/', 7);
+
+	location->proxy_pass = url.substr(0, slash);
+	location->proxy_uri = (slash == std::string::npos) ? "" : url.substr(slash);
+}
+
+/// @brief Parses one directive of an `upstream` block:
+/// `server host[:port] [weight=N] [max_fails=N] [fail_timeout=T];`,
+/// `balance round_robin|least_conn|hash_uri|hash_ip;` or
+/// `health_check [interval=T] [timeout=T] [uri=/path];`.
+void	Config::_parseUpstream(UpstreamConfig& upstream, const std::string& key, std::istringstream& iss)
+{
+	std::vector<std::string>	words;
+	std::string					word;
+
+	while (iss >> word)
+	{
+		if (word[word.length() - 1] == ';')
+			word.erase(word.length() - 1);
+		if (!word.empty())
+			words.push_back(word);
+	}
+	if (key == "server" && !words.empty())
+	{
+		UpstreamServerConfig	server;
+
+		server.address = words[0];
+		if (server.address.find(':') == std::string::npos)
+			server.address += ":80";
+		server.weight = 1;
+		server.maxFails = 1;
+		server.failTimeout = DEFAULT_UPSTREAM_FAIL_TIMEOUT;
+		for (size_t i = 1; i < words.size(); i++)
+		{
+			size_t		delimPos = words[i].find('=');
+			std::string	name = words[i].substr(0, delimPos);
+			std::string	value = (delimPos == std::string::npos) ? "" : words[i].substr(delimPos + 1);
+
+			if (name == "weight")
+				server.weight = std::max(toSizeT(value), (size_t)1);
+			else if (name == "max_fails")
+				server.maxFails = toSizeT(value);
+			else if (name == "fail_timeout")
+				server.failTimeout = parseDuration(value);
+			else
+				throw std::runtime_error("Unknown upstream server option: " + words[i]);
+		}
+		upstream.servers.push_back(server);
+	}
+	else if (key == "balance" && words.size() == 1 && (words[0] == "round_robin"
+		|| words[0] == "least_conn" || words[0] == "hash_uri" || words[0] == "hash_ip"))
+		upstream.balance = words[0];
+	else if (key == "health_check")
+	{
+		upstream.healthInterval = DEFAULT_HEALTH_INTERVAL;
+		for (size_t i = 0; i < words.size(); i++)
+		{
+			size_t		delimPos = words[i].find('=');
+			std::string	name = words[i].substr(0, delimPos);
+			std::string	value = (delimPos == std::string::npos) ? "" : words[i].substr(delimPos + 1);
+
+			if (name == "interval")
+				upstream.healthInterval = parseDuration(value);
+			else if (name == "timeout")
+				upstream.healthTimeout = parseDuration(value);
+			else if (name == "uri")
+				upstream.healthUri = value;
+			else
+				throw std::runtime_error("Unknown health_check option: " + words[i]);
+		}
+	}
+	else
+		throw std::runtime_error("Invalid upstream directive: " + key);
+}
+
 void	Config::load(const std::string& filename)
 {
 	_parseConfigFile(filename);
@@ -364,6 +693,12 @@ std::map<std::string, std::string>	Config::getConfigMap() const
 	return (_configMap);
 }
 
+/// @brief The `upstream` blocks, by name.
+const std::map<std::string, UpstreamConfig>&	Config::getUpstreams() const
+{
+	return (_upstreams);
+}
+
 std::map<std::string, std::string>	Config::getMimeTypeMap() const
 {
 	return (_mimeTypeMap);
@@ -12,6 +12,9 @@
 
 #include "webserv.hpp"
 #include "Location.hpp"
+#include "Config.hpp"
+#include "Util.hpp"
+#include <cstring>
 
 Location::Location()
 {
@@ -29,6 +32,18 @@ Location::Location()
 	_redirectPath = "";
 	_redirectCode = "";
 	_cgi = std::map<std::string, std::string>();
+	_cgiWorkers = 0;
+	_cgiWorkerRequests = 0;
+	_cgiTimeout = 0;
+	_cgiMaxConcurrency = 0;
+	_cgiQueue = 0;
+	std::memset(&_cgiRlimits, 0, sizeof(_cgiRlimits));
+	_cgiStatus = false;
+	_cgiCache = 0;
+	_cgiCacheStaleWhileRevalidate = 0;
+	_cgiCacheStaleIfError = 0;
+	_proxyTimeout = DEFAULT_PROXY_TIMEOUT;
+	_precompressed = false;
 }
 
 Location::Location(LocationConfig* location)
@@ -57,7 +72,24 @@ Location::Location(LocationConfig* location)
 		_redirectPath = "";
 		_redirectCode = "";
 	}
-	_cgi = std::map<std::string, std::string>();
+	_cgi = location->cgi_ext;
+	_fastCgiPass = location->fastcgi_pass;
+	_cgiWorkers = location->cgi_workers;
+	_cgiWorkerRequests = location->cgi_worker_requests;
+	_cgiParams = location->cgi_params;
+	_cgiTimeout = location->cgi_timeout;
+	_cgiMaxConcurrency = location->cgi_max_concurrency;
+	_cgiQueue = location->cgi_queue;
+	_cgiRlimits = location->cgi_rlimits;
+	_cgiStatus = location->cgi_status;
+	_cgiCache = location->cgi_cache;
+	_cgiCacheKey = location->cgi_cache_key;
+	_cgiCacheStaleWhileRevalidate = location->cgi_cache_stale_while_revalidate;
+	_cgiCacheStaleIfError = location->cgi_cache_stale_if_error;
+	_proxyPass = location->proxy_pass;
+	_proxyUri = location->proxy_uri;
+	_proxyTimeout = location->proxy_timeout;
+	_precompressed = location->precompressed;
 }
 
 Location::Location(std::string path)
@@ -75,6 +107,18 @@ Location::Location(std::string path)
 	_redirectPath = "";
 	_redirectCode = "";
 	_cgi = std::map<std::string, std::string>();
+	_cgiWorkers = 0;
+	_cgiWorkerRequests = 0;
+	_cgiTimeout = 0;
+	_cgiMaxConcurrency = 0;
+	_cgiQueue = 0;
+	std::memset(&_cgiRlimits, 0, sizeof(_cgiRlimits));
+	_cgiStatus = false;
+	_cgiCache = 0;
+	_cgiCacheStaleWhileRevalidate = 0;
+	_cgiCacheStaleIfError = 0;
+	_proxyTimeout = DEFAULT_PROXY_TIMEOUT;
+	_precompressed = false;
 }
 
 Location::Location(ServerConfig* server, std::string path)
@@ -92,6 +136,18 @@ Location::Location(ServerConfig* server, std::string path)
 	_redirectPath = "";
 	_redirectCode = "";
 	_cgi = std::map<std::string, std::string>();
+	_cgiWorkers = 0;
+	_cgiWorkerRequests = 0;
+	_cgiTimeout = 0;
+	_cgiMaxConcurrency = 0;
+	_cgiQueue = 0;
+	std::memset(&_cgiRlimits, 0, sizeof(_cgiRlimits));
+	_cgiStatus = false;
+	_cgiCache = 0;
+	_cgiCacheStaleWhileRevalidate = 0;
+	_cgiCacheStaleIfError = 0;
+	_proxyTimeout = DEFAULT_PROXY_TIMEOUT;
+	_precompressed = false;
 }
 
 Location::~Location()
@@ -147,11 +203,120 @@ std::string	Location::getRedirectCode() const
 	return (_redirectCode);
 }
 
-std::map<std::string, std::string>	Location::getCgi() const
+/// @brief The CGI extensions of the location, each with the interpreter running
+/// its scripts (empty to execute the script itself).
+const std::map<std::string, std::string>&	Location::getCgi() const
 {
 	return (_cgi);
 }
 
+/// @brief The FastCGI application CGI requests of the location are sent to,
+/// empty to run the scripts.
+const std::string&	Location::getFastCgiPass() const
+{
+	return (_fastCgiPass);
+}
+
+/// @brief The size of the location's pool of CGI workers, which caps its
+/// scripts running at once; 0 to spawn each script from the server.
+size_t	Location::getCgiWorkers() const
+{
+	return (_cgiWorkers);
+}
+
+/// @brief Requests a CGI worker serves before it is replaced, 0 for no limit.
+size_t	Location::getCgiWorkerRequests() const
+{
+	return (_cgiWorkerRequests);
+}
+
+const std::vector<std::string>&	Location::getCgiEnvironment() const
+{
+	return (_cgiEnvironment);
+}
+
+/// @brief Milliseconds a CGI request may wait for its response header, queue
+/// included, then for each piece of its body; 0 for no limit.
+size_t	Location::getCgiTimeout() const
+{
+	return (_cgiTimeout);
+}
+
+/// @brief CGI requests of the location running at once, 0 for no limit.
+size_t	Location::getCgiMaxConcurrency() const
+{
+	return (_cgiMaxConcurrency);
+}
+
+/// @brief CGI requests waiting for one of those, beyond which they get a 503.
+size_t	Location::getCgiQueue() const
+{
+	return (_cgiQueue);
+}
+
+const CgiRlimits&	Location::getCgiRlimits() const
+{
+	return (_cgiRlimits);
+}
+
+bool	Location::isCgiStatus() const
+{
+	return (_cgiStatus);
+}
+
+/// @brief Milliseconds CGI responses of the location are cached for when
+/// they say nothing of it, 0 not to cache them.
+size_t	Location::getCgiCache() const
+{
+	return (_cgiCache);
+}
+
+/// @brief Request headers the cached responses vary on.
+const std::vector<std::string>&	Location::getCgiCacheKey() const
+{
+	return (_cgiCacheKey);
+}
+
+/// @brief Milliseconds past its expiry a cached response is still served,
+/// while one request refreshes it in the background.
+size_t	Location::getCgiCacheStaleWhileRevalidate() const
+{
+	return (_cgiCacheStaleWhileRevalidate);
+}
+
+/// @brief Milliseconds past its expiry a cached response is still served in
+/// place of a failed or timed out CGI request.
+size_t	Location::getCgiCacheStaleIfError() const
+{
+	return (_cgiCacheStaleIfError);
+}
+
+/// @brief The server requests are forwarded to, `http://host:port`, empty if
+/// the location is not proxied.
+const std::string&	Location::getProxyPass() const
+{
+	return (_proxyPass);
+}
+
+/// @brief What the location path is replaced with in a proxied URI, empty to
+/// pass the URI as is.
+const std::string&	Location::getProxyUri() const
+{
+	return (_proxyUri);
+}
+
+size_t	Location::getProxyTimeout() const
+{
+	return (_proxyTimeout);
+}
+
+/// @brief Whether static files are sent as their precompressed `.br` or
+/// `.gz` sidecar to clients accepting that encoding.
+bool	Location::isPrecompressed() const
+{
+	return (_precompressed);
+}
+
 void	Location::setServer(ServerConfig* server)
 {
 	_server = server;
@@ -199,3 +364,21 @@ void	Location::setCgi(std::string cgi)
 {
 	_cgi["cgi"] = cgi;
 }
+
+/// @brief Prebuilds the part of the CGI environment that is the same for every
+/// request of the location, once the server block is complete: the server's
+/// meta-variables and the `cgi_param` of the location.
+void	Location::buildCgiEnvironment()
+{
+	_cgiEnvironment.clear();
+	_cgiEnvironment.push_back("GATEWAY_INTERFACE=CGI/1.1");
+	_cgiEnvironment.push_back("SERVER_SOFTWARE=webserv");
+	if (_server != NULL)
+	{
+		_cgiEnvironment.push_back("SERVER_NAME=" + _server->server_name);
+		_cgiEnvironment.push_back("SERVER_PORT=" + toString(_server->port));
+	}
+	// For php-cgi, which refuses to run scripts not reached through a server
+	_cgiEnvironment.push_back("REDIRECT_STATUS=200");
+	_cgiEnvironment.insert(_cgiEnvironment.end(), _cgiParams.begin(), _cgiParams.end());
+}
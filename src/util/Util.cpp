@@ -36,7 +36,48 @@ std::string toString(const std::vector<std::string>& values)
 size_t		toSizeT(const std::string& value)
 {
 	std::istringstream	iss(value);
-	size_t				result;
+	size_t				result = 0;
 	iss >> result;
 	return (result);
-}
\ No newline at end of file
+}
+
+/// @brief Parses a size with an optional `k`, `m` or `g` suffix, e.g. `16m`.
+/// @return the size in bytes, 0 if `value` does not start with a number.
+size_t		parseSize(const std::string& value)
+{
+	std::istringstream	iss(value);
+	size_t				result = 0;
+	char				unit = 0;
+
+	if (!(iss >> result))
+		return (0);
+	if (iss >> unit)
+	{
+		if (unit == 'k' || unit == 'K')
+			result *= 1024;
+		else if (unit == 'm' || unit == 'M')
+			result *= 1024 * 1024;
+		else if (unit == 'g' || unit == 'G')
+			result *= 1024 * 1024 * 1024;
+	}
+	return (result);
+}
+
+/// @brief Parses a duration in seconds, or with an `ms`, `s` or `m` suffix,
+/// e.g. `60`, `500ms`, `2m`.
+/// @return the duration in milliseconds, 0 if `value` does not start with a number.
+size_t		parseDuration(const std::string& value)
+{
+	std::istringstream	iss(value);
+	size_t				result = 0;
+	std::string			unit;
+
+	if (!(iss >> result))
+		return (0);
+	iss >> unit;
+	if (unit == "ms")
+		return (result);
+	if (unit == "m")
+		return (result * 60 * 1000);
+	return (result * 1000);
+}
@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+"""Minimal FastCGI responder, a local stand-in for `fastcgi_pass`.
+
+    python3 tests/fastcgi_responder.py unix:/tmp/fcgi.sock
+    python3 tests/fastcgi_responder.py 127.0.0.1:9009
+
+Each connection is served by its own thread and kept open while the server
+sends FCGI_KEEP_CONN. The response echoes the request, with the number of
+the connection (X-Conn) and of the request on it (X-Nreq), so pooled reuse
+can be seen from the client. The script name picks the behaviour:
+  .../big    3 MB of body, over many STDOUT records
+  .../slow   answers after one second
+  .../close  closes the connection instead of answering
+Every response also sends a STDERR record, "stderr line".
+"""
+import os
+import socket
+import struct
+import sys
+import threading
+import time
+
+FCGI_BEGIN_REQUEST = 1
+FCGI_END_REQUEST = 3
+FCGI_PARAMS = 4
+FCGI_STDIN = 5
+FCGI_STDOUT = 6
+FCGI_STDERR = 7
+FCGI_KEEP_CONN = 1
+FCGI_MAX_CONTENT = 65535
+
+
+def read_exactly(conn, length):
+    data = b""
+    while len(data) < length:
+        chunk = conn.recv(length - len(data))
+        if not chunk:
+            return None
+        data += chunk
+    return data
+
+
+def decode_params(data):
+    params = {}
+    i = 0
+
+    def length():
+        nonlocal i
+        if data[i] < 128:
+            i += 1
+            return data[i - 1]
+        value = struct.unpack(">I", data[i:i + 4])[0] & 0x7FFFFFFF
+        i += 4
+        return value
+
+    while i < len(data):
+        name_length = length()
+        value_length = length()
+        name = data[i:i + name_length].decode()
+        params[name] = data[i + name_length:i + name_length + value_length].decode()
+        i += name_length + value_length
+    return params
+
+
+def record(kind, request_id, content):
+    return struct.pack(">BBHHBB", 1, kind, request_id, len(content), 0, 0) + content
+
+
+def read_request(conn):
+    """Reads records up to the empty STDIN one: (id, keep, params, stdin)."""
+    params = b""
+    stdin = b""
+    keep = False
+    while True:
+        header = read_exactly(conn, 8)
+        if header is None:
+            return None
+        _, kind, request_id, length, padding, _ = struct.unpack(">BBHHBB", header)
+        content = read_exactly(conn, length) if length else b""
+        if padding:
+            read_exactly(conn, padding)
+        if content is None:
+            return None
+        if kind == FCGI_BEGIN_REQUEST:
+            keep = bool(content[2] & FCGI_KEEP_CONN)
+        elif kind == FCGI_PARAMS:
+            params += content
+        elif kind == FCGI_STDIN:
+            if length == 0:
+                return request_id, keep, decode_params(params), stdin
+            stdin += content
+
+
+def serve(conn, number):
+    served = 0
+    while True:
+        request = read_request(conn)
+        if request is None:
+            conn.close()
+            return
+        request_id, keep, env, stdin = request
+        served += 1
+        script = env.get("SCRIPT_NAME", "")
+        if script.endswith("close"):
+            conn.close()
+            return
+        if script.endswith("slow"):
+            time.sleep(1)
+        out = ("Content-Type: text/plain\r\nX-Conn: %d\r\nX-Nreq: %d\r\n\r\n" % (number, served)).encode()
+        out += ("%s %s %s\n" % (env.get("REQUEST_METHOD"), script, env.get("QUERY_STRING"))).encode()
+        out += ("body=%d\n" % len(stdin)).encode()
+        if script.endswith("big"):
+            out += b"x" * 3000000
+        for i in range(0, len(out), FCGI_MAX_CONTENT):
+            conn.sendall(record(FCGI_STDOUT, request_id, out[i:i + FCGI_MAX_CONTENT]))
+        conn.sendall(record(FCGI_STDERR, request_id, b"stderr line"))
+        conn.sendall(record(FCGI_STDOUT, request_id, b"")
+                     + record(FCGI_END_REQUEST, request_id, struct.pack(">IB3x", 0, 0)))
+        if not keep:
+            conn.close()
+            return
+
+
+def main():
+    address = sys.argv[1]
+    if address.startswith("unix:"):
+        path = address[5:]
+        if os.path.exists(path):
+            os.unlink(path)
+        listener = socket.socket(socket.AF_UNIX)
+        listener.bind(path)
+    else:
+        host, port = address.rsplit(":", 1)
+        listener = socket.socket()
+        listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        listener.bind((host, int(port)))
+    listener.listen(128)
+    accepted = 0
+    while True:
+        conn, _ = listener.accept()
+        accepted += 1
+        threading.Thread(target=serve, args=(conn, accepted), daemon=True).start()
+
+
+if __name__ == "__main__":
+    main()
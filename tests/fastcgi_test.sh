@@ -0,0 +1,58 @@
+#!/bin/sh
+# `fastcgi_pass` against tests/fastcgi_responder.py: responses, pooled
+# connections, STDERR records, END_REQUEST framing and failures.
+. tests/lib.sh
+
+SOCK="$TMP/fcgi.sock"
+background python3 tests/fastcgi_responder.py "unix:$SOCK"
+write_config "$TMP/webserv.conf" <<CONF
+	location / {
+		root /static;
+	}
+	location /app/ {
+		root /static;
+		fastcgi_pass unix:$SOCK;
+		allowed_methods GET POST;
+	}
+	location /down/ {
+		root /static;
+		fastcgi_pass unix:$TMP/none.sock;
+	}
+CONF
+for _ in 1 2 3 4 5 6 7 8 9 10; do [ -S "$SOCK" ] && break; sleep 0.1; done
+start_webserv "$TMP/webserv.conf"
+URL="http://127.0.0.1:$PORT"
+
+check "response" "200 GET /app/hello x=1" \
+	"$(curl -s -o "$TMP/body" -w '%{http_code}' "$URL/app/hello?x=1") $(head -1 "$TMP/body")"
+
+# Sequential requests, each from a new client connection, share one pooled connection
+for i in 1 2 3 4 5; do
+	curl -s -D - -o /dev/null "$URL/app/hello" | tr -d '\r' | grep -i '^x-conn:'
+done > "$TMP/conns"
+check "pooled connection reused" "1 X-Conn: 1" "$(sort -u "$TMP/conns" | wc -l | tr -d ' ') $(sort -u "$TMP/conns")"
+
+# Concurrent requests each get a connection of their own
+jobs=""
+for i in 1 2 3; do
+	curl -s -D "$TMP/slow$i" -o /dev/null "$URL/app/slow" &
+	jobs="$jobs $!"
+done
+wait $jobs
+check "concurrent requests on separate connections" 3 \
+	"$(cat "$TMP"/slow* | tr -d '\r' | grep -i '^x-conn:' | sort -u | wc -l | tr -d ' ')"
+
+check "STDERR records logged" yes "$(grep -q 'stderr line' "$TMP/webserv.log" && echo yes)"
+
+curl -s -o "$TMP/big" "$URL/app/big"
+check "multi-record STDOUT up to END_REQUEST" 3000000 "$(tail -c 3000000 "$TMP/big" | tr -d -c x | wc -c | tr -d ' ')"
+
+head -c 100000 /dev/zero | tr '\0' a > "$TMP/post"
+check "request body as STDIN" "body=100000" \
+	"$(curl -s -H 'Content-Type: text/plain' --data-binary @"$TMP/post" "$URL/app/echo" | sed -n 2p)"
+
+check "connection closed before END_REQUEST" 502 "$(curl -s -o /dev/null -w '%{http_code}' "$URL/app/close")"
+check "next request on a new connection" 200 "$(curl -s -o /dev/null -w '%{http_code}' "$URL/app/hello")"
+check "application down" 502 "$(curl -s -o /dev/null -w '%{http_code}' "$URL/down/x")"
+
+finish
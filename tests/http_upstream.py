@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+"""Minimal HTTP/1.1 server, a local stand-in for `proxy_pass`.
+
+    python3 tests/http_upstream.py 127.0.0.1:9080
+
+Each connection is served by its own thread and kept open between requests
+unless a response is close-delimited. Responses carry the number of the
+connection (X-Conn) and of the request on it (X-Nreq), so pooled reuse can
+be seen from the client, and their body starts with the request line and
+the request headers as received. The last path segment picks the framing:
+  .../chunked  chunked, with a chunk extension and a trailer
+  .../big      1 MB chunked in 4 KB chunks, spread over many reads
+  .../close    no length, the body ends when the connection closes
+  .../interim  100 Continue and 103 Early Hints before the response
+  .../hop      hop-by-hop headers, and one named by `Connection`
+  .../lf       bare LF line endings in the header block
+  .../bad      a malformed status line
+  anything else, Content-Length.
+"""
+import socket
+import sys
+import threading
+
+
+def read_request(conn, pending):
+    """Reads one request: (request line, headers, body, rest) or None."""
+    while b"\r\n\r\n" not in pending:
+        data = conn.recv(65536)
+        if not data:
+            return None
+        pending += data
+    head, pending = pending.split(b"\r\n\r\n", 1)
+    lines = head.decode("latin-1").split("\r\n")
+    headers = []
+    length = 0
+    for line in lines[1:]:
+        name, value = line.split(":", 1)
+        headers.append((name, value.strip()))
+        if name.lower() == "content-length":
+            length = int(value)
+    while len(pending) < length:
+        data = conn.recv(65536)
+        if not data:
+            return None
+        pending += data
+    return lines[0], headers, pending[:length], pending[length:]
+
+
+def serve(conn, number):
+    pending = b""
+    served = 0
+    while True:
+        request = read_request(conn, pending)
+        if request is None:
+            conn.close()
+            return
+        line, headers, body, pending = request
+        served += 1
+        kind = line.split(" ")[1].split("?")[0].rsplit("/", 1)[-1]
+        echo = line + "\n" + "".join("%s: %s\n" % h for h in headers)
+        echo += "body=%d\n" % len(body)
+        echo = echo.encode()
+        ids = "X-Conn: %d\r\nX-Nreq: %d\r\n" % (number, served)
+        if kind == "chunked":
+            out = "HTTP/1.1 200 OK\r\n" + ids + "Transfer-Encoding: chunked\r\nTrailer: X-Checksum\r\n\r\n"
+            out = out.encode()
+            out += b"%x;name=value\r\n%s\r\n" % (len(echo), echo)
+            out += b"6\r\nchunks\r\n0\r\nX-Checksum: 1\r\n\r\n"
+        elif kind == "big":
+            out = ("HTTP/1.1 200 OK\r\n" + ids + "Transfer-Encoding: chunked\r\n\r\n").encode()
+            out += b"%x\r\n%s\r\n" % (len(echo), echo)
+            out += (b"1000\r\n" + b"x" * 4096 + b"\r\n") * 256 + b"0\r\n\r\n"
+        elif kind == "close":
+            conn.sendall(("HTTP/1.1 200 OK\r\n" + ids + "Connection: close\r\n\r\n").encode() + echo)
+            conn.sendall(b"until close")
+            conn.close()
+            return
+        elif kind == "interim":
+            out = b"HTTP/1.1 100 Continue\r\n\r\n"
+            out += b"HTTP/1.1 103 Early Hints\r\nLink: </style.css>; rel=preload\r\n\r\n"
+            out += ("HTTP/1.1 200 OK\r\n" + ids + "Content-Length: %d\r\n\r\n" % len(echo)).encode() + echo
+        elif kind == "hop":
+            out = ("HTTP/1.1 200 OK\r\n" + ids + "Connection: keep-alive, X-Secret\r\n"
+                   "Keep-Alive: timeout=5\r\nX-Secret: 1\r\nUpgrade: h2c\r\nX-Kept: yes\r\n"
+                   "Content-Length: %d\r\n\r\n" % len(echo)).encode() + echo
+        elif kind == "lf":
+            out = ("HTTP/1.1 200 OK\n" + ids.replace("\r\n", "\n")
+                   + "Content-Length: %d\n\n" % len(echo)).encode() + echo
+        elif kind == "bad":
+            out = b"HTTP/1.1 OK\r\nContent-Length: 0\r\n\r\n"
+        else:
+            out = ("HTTP/1.1 200 OK\r\n" + ids + "Content-Length: %d\r\n\r\n" % len(echo)).encode() + echo
+        conn.sendall(out)
+
+
+def main():
+    host, port = sys.argv[1].rsplit(":", 1)
+    listener = socket.socket()
+    listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    listener.bind((host, int(port)))
+    listener.listen(128)
+    accepted = 0
+    while True:
+        conn, _ = listener.accept()
+        accepted += 1
+        threading.Thread(target=serve, args=(conn, accepted), daemon=True).start()
+
+
+if __name__ == "__main__":
+    main()
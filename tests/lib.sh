@@ -0,0 +1,77 @@
+# Helpers of the tests, sourced by each `tests/*_test.sh`. Run the tests from
+# the repository root once built, e.g. `make test` or `sh tests/proxy_test.sh`.
+
+WEBSERV=${WEBSERV:-./webserv}
+PORT=${PORT:-18080}
+TMP=$(mktemp -d)
+PIDS=""
+FAILED=0
+
+cleanup()
+{
+	[ -n "$PIDS" ] && kill $PIDS 2>/dev/null
+	wait 2>/dev/null
+	rm -rf "$TMP"
+}
+trap cleanup EXIT
+
+# check NAME EXPECTED ACTUAL
+check()
+{
+	if [ "$2" = "$3" ]; then
+		echo "ok   $1"
+	else
+		echo "FAIL $1: expected '$2', got '$3'"
+		FAILED=1
+	fi
+}
+
+# background COMMAND...: runs a stand-in for the length of the test
+background()
+{
+	"$@" > "$TMP/$(basename "$2").log" 2>&1 &
+	PIDS="$PIDS $!"
+}
+
+# wait_for HOST PORT: until something listens there, 5 seconds at most
+wait_for()
+{
+	python3 - "$1" "$2" <<'PY'
+import socket, sys, time
+for _ in range(50):
+    try:
+        socket.create_connection((sys.argv[1], int(sys.argv[2])), 0.1).close()
+        sys.exit(0)
+    except OSError:
+        time.sleep(0.1)
+sys.exit(1)
+PY
+}
+
+# start_webserv CONFIG: its output goes to `$TMP/webserv.log`
+start_webserv()
+{
+	"$WEBSERV" "$1" > "$TMP/webserv.log" 2>&1 &
+	PIDS="$PIDS $!"
+	wait_for 127.0.0.1 "$PORT" || { echo "FAIL webserv did not start:"; cat "$TMP/webserv.log"; exit 1; }
+}
+
+# A config serving `www` on `$PORT`, with the locations given on stdin, on the
+# event backend named by `$EVENT_BACKEND` if set
+write_config()
+{
+	{
+		[ -n "$EVENT_BACKEND" ] && printf 'event_backend %s;\n\n' "$EVENT_BACKEND"
+		printf 'types {\n\ttext/html\thtml;\n\ttext/plain\ttxt;\n}\n\n'
+		printf 'server {\n\tserver_name\ttest;\n\tlisten\t\t127.0.0.1:%s;\n' "$PORT"
+		printf '\tmax_body_size\t10000000;\n\troot\t\t/www;\n\tdefault_file\tindex.html;\n\n'
+		cat
+		printf '}\n'
+	} > "$1"
+}
+
+finish()
+{
+	[ "$FAILED" = 0 ] && echo "all passed"
+	exit "$FAILED"
+}
@@ -0,0 +1,74 @@
+#!/bin/sh
+# `proxy_pass` against tests/http_upstream.py: the framings of the response
+# (length, chunked, close-delimited), interim responses, hop-by-hop headers
+# both ways, pooled connections and failures.
+. tests/lib.sh
+
+UPSTREAM_PORT=$((PORT + 1))
+background python3 tests/http_upstream.py "127.0.0.1:$UPSTREAM_PORT"
+write_config "$TMP/webserv.conf" <<CONF
+	location / {
+		root /static;
+	}
+	location /api/ {
+		proxy_pass http://127.0.0.1:$UPSTREAM_PORT;
+		allowed_methods GET POST;
+	}
+	location /down/ {
+		proxy_pass http://127.0.0.1:$((PORT + 2));
+	}
+CONF
+wait_for 127.0.0.1 "$UPSTREAM_PORT" || { echo "FAIL upstream did not start"; exit 1; }
+start_webserv "$TMP/webserv.conf"
+URL="http://127.0.0.1:$PORT"
+
+# get NAME PATH [CURL OPTION...]: the response headers in `$TMP/NAME.h`, the body in `$TMP/NAME`
+get()
+{
+	name=$1
+	path=$2
+	shift 2
+	curl -s -D "$TMP/$name.h" -o "$TMP/$name" "$@" "$URL$path"
+	tr -d '\r' < "$TMP/$name.h" > "$TMP/$name.headers"
+}
+header()
+{
+	sed -n "s/^$2: //Ip" "$TMP/$1.headers"
+}
+
+get length /api/x -H 'Connection: X-Drop' -H 'X-Drop: 1'
+check "Content-Length response" "GET /api/x HTTP/1.1" "$(head -1 "$TMP/length")"
+check "client hop-by-hop headers dropped" "" "$(grep -i '^x-drop' "$TMP/length")"
+check "X-Forwarded-For added" "127.0.0.1" "$(sed -n 's/^X-Forwarded-For: //p' "$TMP/length")"
+
+get chunked /api/chunked
+check "chunked response decoded" "body=0 chunks" "$(tail -2 "$TMP/chunked" | tr '\n' ' ' | sed 's/ $//')"
+# The stand-in numbers its connections, the first one being the probe of wait_for
+first=$(header length x-conn)
+check "connection reused after a chunked response" "${first:-?} ${first:-?}" \
+	"$(header length x-conn) $(header chunked x-conn)"
+
+get big /api/big
+check "chunks over many reads" 1048576 "$(tr -d -c x < "$TMP/big" | wc -c | tr -d ' ')"
+
+get close /api/close
+check "close-delimited response" "until close" "$(tail -1 "$TMP/close")"
+get after /api/x
+check "new connection after a close-delimited response" "${first:-?} $((first + 1))" \
+	"$(header close x-conn) $(header after x-conn)"
+
+get interim /api/interim
+check "interim responses skipped" "200 1" \
+	"$(head -1 "$TMP/interim.headers" | cut -d' ' -f2) $(grep -c '^HTTP/' "$TMP/interim.headers")"
+check "body after interim responses" "GET /api/interim HTTP/1.1" "$(head -1 "$TMP/interim")"
+
+get hop /api/hop
+check "server hop-by-hop headers dropped" "" \
+	"$(grep -i -e '^x-secret' -e '^keep-alive' -e '^upgrade' "$TMP/hop.headers")"
+check "end-to-end headers kept" yes "$(header hop x-kept)"
+
+check "bare LF header block" 200 "$(curl -s -o /dev/null -w '%{http_code}' "$URL/api/lf")"
+check "malformed status line" 502 "$(curl -s -o /dev/null -w '%{http_code}' "$URL/api/bad")"
+check "server down" 502 "$(curl -s -o /dev/null -w '%{http_code}' "$URL/down/x")"
+
+finish
@@ -0,0 +1,14 @@
+#!/usr/bin/env python3
+# Sample CGI script: echoes the request it was run for.
+import os
+import sys
+
+body = sys.stdin.read(int(os.environ.get("CONTENT_LENGTH") or 0))
+
+print("Content-Type: text/plain")
+print()
+print("Hello from CGI")
+for name in ("REQUEST_METHOD", "SCRIPT_NAME", "PATH_INFO", "QUERY_STRING", "CONTENT_LENGTH"):
+    print(f"{name}={os.environ.get(name, '')}")
+if body:
+    print(f"body={body}")